@@ -0,0 +1,54 @@
+/*
+ * no allocation from the global heap in steady state: every mode logs
+ * messages of up to CPPLOG_POOL_MAX_BLOCK bytes for a while (so all
+ * queue slots, thread buffers and pooled blocks exist), then any call
+ * to operator new during the timed loop is reported as an error
+ * (the ctest cpplog-allocations runs these)
+ */
+
+#include <string>
+
+#include "bench_util.h"
+
+enum class Mode { SYNC, ASYNC, DEFERRED, THREAD_BUFFERED };
+
+// long enough to touch every slot of the async queue twice
+static constexpr size_t WARMUP_RECORDS =
+  2 * cpplog::CPPLOG_ASYNC_QUEUE_CAPACITY;
+
+template<Mode M>
+static void BM_SteadyStateAllocations(benchmark::State &state) {
+  auto logger = bench::create_bench_log(bench::null_sink());
+  if (M == Mode::ASYNC || M == Mode::DEFERRED) logger->set_async();
+  if (M == Mode::DEFERRED) logger->set_deferred_formatting(true);
+  if (M == Mode::THREAD_BUFFERED) logger->set_thread_buffered();
+
+  std::string text(static_cast<size_t>(state.range(0)), 'x');
+  auto log = [&logger, &text](int i) {
+    logger->info("request {0>8d} from {s} took {.3f} ms", i, text, 1.5);
+    logger->warn(CPPLOG_FMT("{d} {s}"), i, text);
+  };
+
+  for (size_t i = 0; i < WARMUP_RECORDS; ++i) log(static_cast<int>(i));
+  logger->flush();
+  uint64_t allocations_before = bench::allocation_count();
+
+  int i = 0;
+  for (auto _ : state) {
+    log(++i);
+  }
+  logger->flush();
+
+  uint64_t allocs = bench::allocation_count() - allocations_before;
+  state.counters["allocs/op"] = benchmark::Counter(
+    static_cast<double>(allocs), benchmark::Counter::kAvgIterations);
+  if (allocs) state.SkipWithError("allocated from the global heap");
+}
+BENCHMARK_TEMPLATE(BM_SteadyStateAllocations, Mode::SYNC)
+  ->Arg(16)->Arg(4096)->Arg(cpplog::CPPLOG_POOL_MAX_BLOCK / 2);
+BENCHMARK_TEMPLATE(BM_SteadyStateAllocations, Mode::ASYNC)
+  ->Arg(16)->Arg(4096)->Arg(cpplog::CPPLOG_POOL_MAX_BLOCK / 2);
+BENCHMARK_TEMPLATE(BM_SteadyStateAllocations, Mode::DEFERRED)
+  ->Arg(16)->Arg(4096)->Arg(cpplog::CPPLOG_POOL_MAX_BLOCK / 2);
+BENCHMARK_TEMPLATE(BM_SteadyStateAllocations, Mode::THREAD_BUFFERED)
+  ->Arg(16)->Arg(4096)->Arg(cpplog::CPPLOG_POOL_MAX_BLOCK / 2);
@@ -0,0 +1,170 @@
+/*
+ * format strings with 1 ... 8 "{_>10.2f}" specifiers, parsed at runtime
+ * and at compile time (CPPLOG_FMT), and formatted on the calling thread
+ * or by the writer thread of an async Logger (deferred formatting);
+ * suppressed records and spans
+ */
+
+#include <string>
+#include <utility>
+
+#include "bench_util.h"
+
+template<size_t ...I>
+static void log_format_args(benchmark::State &state,
+                            std::index_sequence<I...>) {
+  std::string fmt_str;
+  for (size_t i = 0; i < sizeof...(I); ++i) fmt_str += "{_>10.2f} ";
+
+  bench::run_log_loop(state, bench::null_sink(),
+                      [&fmt_str](cpplog::Logger<> &logger) {
+    logger.info(fmt_str.c_str(), (static_cast<double>(I) + 0.125)...);
+  });
+}
+
+template<size_t N>
+static void BM_FormatArgs(benchmark::State &state) {
+  log_format_args(state, std::make_index_sequence<N>());
+}
+BENCHMARK_TEMPLATE(BM_FormatArgs, 1);
+BENCHMARK_TEMPLATE(BM_FormatArgs, 2);
+BENCHMARK_TEMPLATE(BM_FormatArgs, 4);
+BENCHMARK_TEMPLATE(BM_FormatArgs, 8);
+
+static void BM_CompiledFormatArgs1(benchmark::State &state) {
+  bench::run_log_loop(state, bench::null_sink(), [](cpplog::Logger<> &logger) {
+    logger.info(CPPLOG_FMT("{_>10.2f} "), 0.125);
+  });
+}
+BENCHMARK(BM_CompiledFormatArgs1);
+
+static void BM_CompiledFormatArgs8(benchmark::State &state) {
+  bench::run_log_loop(state, bench::null_sink(), [](cpplog::Logger<> &logger) {
+    logger.info(CPPLOG_FMT("{_>10.2f} {_>10.2f} {_>10.2f} {_>10.2f} "
+                           "{_>10.2f} {_>10.2f} {_>10.2f} {_>10.2f} "),
+                0.125, 1.125, 2.125, 3.125, 4.125, 5.125, 6.125, 7.125);
+  });
+}
+BENCHMARK(BM_CompiledFormatArgs8);
+
+static void BM_FormatMixed(benchmark::State &state) {
+  bench::run_log_loop(state, bench::null_sink(), [](cpplog::Logger<> &logger) {
+    logger.info("request {0>8d} from {s} took {.3f} ms", 4711, "client", 1.5);
+  });
+}
+BENCHMARK(BM_FormatMixed);
+
+// cost of measuring the formatting time of every record
+static void BM_FormatMixedTimed(benchmark::State &state) {
+  bench::run_log_loop(state, bench::null_sink(), [](cpplog::Logger<> &logger) {
+    logger.info("request {0>8d} from {s} took {.3f} ms", 4711, "client", 1.5);
+  }, [](cpplog::Logger<> &logger) {
+    logger.set_timing_metrics(true);
+  });
+}
+BENCHMARK(BM_FormatMixedTimed);
+
+// ### structured records ###
+
+static void log_structured(benchmark::State &state,
+                           cpplog::StructuredFormat format) {
+  bench::run_log_loop(state, bench::null_sink(), [](cpplog::Logger<> &logger) {
+    logger.info("request done", cpplog::kv("status", 200),
+                cpplog::kv("path", "/api/v1/users"),
+                cpplog::kv("latency_ms", 1.5));
+  }, [format](cpplog::Logger<> &logger) {
+    logger.set_structured_format(format);
+  });
+}
+
+static void BM_StructuredText(benchmark::State &state) {
+  log_structured(state, cpplog::StructuredFormat::TEXT);
+}
+BENCHMARK(BM_StructuredText);
+
+static void BM_StructuredLogfmt(benchmark::State &state) {
+  log_structured(state, cpplog::StructuredFormat::LOGFMT);
+}
+BENCHMARK(BM_StructuredLogfmt);
+
+static void BM_StructuredJson(benchmark::State &state) {
+  log_structured(state, cpplog::StructuredFormat::JSON);
+}
+BENCHMARK(BM_StructuredJson);
+
+// ### async Loggers ###
+
+// measures the cost on the calling thread (records the writer thread
+// can't keep up with are dropped, so bytes/op may be lower)
+static void log_async(benchmark::State &state, bool deferred) {
+  bench::run_log_loop(state, bench::null_sink(), [](cpplog::Logger<> &logger) {
+    logger.info(CPPLOG_FMT("request {0>8d} from {s} took {_>10.2f} ms"),
+                4711, cpplog::string_ref("client"), 1.5);
+  }, [deferred](cpplog::Logger<> &logger) {
+    logger.set_async(1 << 16, cpplog::OverflowPolicy::DROP_NEWEST);
+    logger.set_deferred_formatting(deferred);
+  });
+}
+
+static void BM_AsyncFormatted(benchmark::State &state) {
+  log_async(state, false);
+}
+BENCHMARK(BM_AsyncFormatted);
+
+static void BM_AsyncDeferred(benchmark::State &state) {
+  log_async(state, true);
+}
+BENCHMARK(BM_AsyncDeferred);
+
+// ##########################################################
+
+// ### suppressed records ###
+
+static void BM_RateLimited(benchmark::State &state) {
+  bench::run_log_loop(state, bench::null_sink(), [](cpplog::Logger<> &logger) {
+    logger.info("request {0>8d} from {s} took {.3f} ms", 4711, "client", 1.5);
+  }, [](cpplog::Logger<> &logger) {
+    logger.set_rate_limit(1);
+  });
+}
+BENCHMARK(BM_RateLimited);
+
+static void BM_CollapsedRepeats(benchmark::State &state) {
+  bench::run_log_loop(state, bench::null_sink(), [](cpplog::Logger<> &logger) {
+    logger.info("request {0>8d} from {s} took {.3f} ms", 4711, "client", 1.5);
+  }, [](cpplog::Logger<> &logger) {
+    logger.set_collapse_repeats(true);
+  });
+}
+BENCHMARK(BM_CollapsedRepeats);
+
+// ##########################################################
+
+// ### spans ###
+
+static void BM_Span(benchmark::State &state) {
+  bench::run_log_loop(state, bench::null_sink(), [](cpplog::Logger<> &logger) {
+    auto span = logger.span("request");
+  });
+}
+BENCHMARK(BM_Span);
+
+static void BM_SpanBelowThreshold(benchmark::State &state) {
+  bench::run_log_loop(state, bench::null_sink(), [](cpplog::Logger<> &logger) {
+    auto span = logger.span("request");
+  }, [](cpplog::Logger<> &logger) {
+    logger.set_span_threshold(std::chrono::milliseconds(1));
+  });
+}
+BENCHMARK(BM_SpanBelowThreshold);
+
+static void BM_SpanAggregated(benchmark::State &state) {
+  bench::run_log_loop(state, bench::null_sink(), [](cpplog::Logger<> &logger) {
+    auto span = logger.span("request");
+  }, [](cpplog::Logger<> &logger) {
+    logger.set_span_aggregation(std::chrono::seconds(1));
+  });
+}
+BENCHMARK(BM_SpanAggregated);
+
+// ##########################################################
@@ -0,0 +1,27 @@
+/*
+ * entry point of cpplog-bench; also replaces the global operator new
+ * to count allocations (see bench::allocation_count)
+ */
+
+#include <cstdlib>
+#include <new>
+
+#include "bench_util.h"
+
+std::atomic<uint64_t> bench::allocations{0};
+
+void *operator new(size_t size) {
+  bench::allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *ptr = std::malloc(size ? size : 1)) return ptr;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+  std::free(ptr);
+}
+
+BENCHMARK_MAIN();
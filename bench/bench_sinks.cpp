@@ -0,0 +1,74 @@
+/*
+ * the same record written through the different sinks (to /dev/null
+ * and to files in the temp directory)
+ */
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "bench_util.h"
+
+static std::string temp_path(const char *name) {
+  return (std::filesystem::temp_directory_path() / name).string();
+}
+
+static void log_to(benchmark::State &state,
+                   std::shared_ptr<cpplog::Sink> sink) {
+  bench::run_log_loop(state, std::move(sink), [](cpplog::Logger<> &logger) {
+    logger.info("request {0>8d} from {s} took {.3f} ms", 4711, "client", 1.5);
+  });
+}
+
+static void BM_SinkFdDevNull(benchmark::State &state) {
+  log_to(state, bench::null_sink());
+}
+BENCHMARK(BM_SinkFdDevNull);
+
+// (as if /dev/null was a terminal)
+static void BM_SinkFdDevNullColors(benchmark::State &state) {
+  std::shared_ptr<cpplog::Sink> sink = bench::null_sink();
+  sink->set_color_mode(cpplog::ColorMode::ALWAYS);
+  log_to(state, std::move(sink));
+}
+BENCHMARK(BM_SinkFdDevNullColors);
+
+// (range = max_bytes of the flush policy, 0 = a write(2) per record)
+static void BM_SinkBatchingDevNull(benchmark::State &state) {
+  cpplog::FlushPolicy policy;
+  policy.max_bytes = static_cast<size_t>(state.range(0));
+  int fd = cpplog::open_log_file("/dev/null", false);
+  log_to(state, std::make_shared<cpplog::BatchingSink>(fd, policy, true));
+}
+BENCHMARK(BM_SinkBatchingDevNull)->Arg(0)->Arg(cpplog::CPPLOG_BATCH_SIZE);
+
+static void BM_SinkOStreamDevNull(benchmark::State &state) {
+  std::ofstream stream("/dev/null");
+  log_to(state, std::make_shared<cpplog::OStreamSink>(stream));
+}
+BENCHMARK(BM_SinkOStreamDevNull);
+
+static void BM_SinkFile(benchmark::State &state) {
+  std::string path = temp_path("cpplog_bench_file.log");
+  log_to(state, std::make_shared<cpplog::FileSink>(
+    path, static_cast<size_t>(state.range(0)), true));
+  std::filesystem::remove(path);
+}
+BENCHMARK(BM_SinkFile)->Arg(0)->Arg(cpplog::CPPLOG_FILE_BUFFER_SIZE);
+
+static void BM_SinkRotatingFile(benchmark::State &state) {
+  std::string path = temp_path("cpplog_bench_rotating.log");
+  log_to(state, std::make_shared<cpplog::RotatingFileSink>(
+    path, 16 * 1024 * 1024, 1));
+  std::filesystem::remove(path);
+  std::filesystem::remove(path + ".1");
+}
+BENCHMARK(BM_SinkRotatingFile);
+
+static void BM_SinkMappedRing(benchmark::State &state) {
+  std::string path = temp_path("cpplog_bench.ring");
+  log_to(state, std::make_shared<cpplog::MappedRingSink>(
+    path, 16 * 1024 * 1024));
+  std::filesystem::remove(path);
+}
+BENCHMARK(BM_SinkMappedRing);
@@ -0,0 +1,64 @@
+/*
+ * throughput of a single Logger shared by 1 ... 64 threads: the default
+ * path (one mutex per record), thread-local batches (set_thread_buffered),
+ * the async queue, 4 async queues the threads are spread over and the
+ * async queue with try_info (records are dropped instead of waiting); all
+ * records are written to /dev/null
+ */
+
+#include "bench_util.h"
+
+enum class Mode { MUTEX, THREAD_BUFFERED, ASYNC, ASYNC_SHARDED, ASYNC_TRY };
+
+static cpplog::Logger<> *create_shared_log(Mode mode) {
+  cpplog::Logger<> *logger = bench::create_bench_log(
+    bench::null_sink()).release();
+
+  switch (mode) {
+    case Mode::MUTEX:
+      break;
+    case Mode::THREAD_BUFFERED:
+      logger->set_thread_buffered();
+      break;
+    case Mode::ASYNC:
+    case Mode::ASYNC_TRY:
+      logger->set_async();
+      break;
+    case Mode::ASYNC_SHARDED: {
+      cpplog::WriterOptions options;
+      options.shards = 4;
+      logger->set_async(options);
+      break;
+    }
+  }
+  return logger;
+}
+
+template<Mode mode>
+static void BM_SharedLogger(benchmark::State &state) {
+  static cpplog::Logger<> *logger = create_shared_log(mode);
+
+  int thread = state.thread_index();
+  int i = 0;
+  for (auto _ : state) {
+    if constexpr (mode == Mode::ASYNC_TRY) {
+      logger->try_info("thread {d} record {0>6d}: {s}", thread, i++, "done");
+    } else {
+      logger->info("thread {d} record {0>6d}: {s}", thread, i++, "done");
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  if (thread == 0) logger->flush();
+}
+
+BENCHMARK_TEMPLATE(BM_SharedLogger, Mode::MUTEX)
+  ->Name("SharedLogger/mutex")->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_SharedLogger, Mode::THREAD_BUFFERED)
+  ->Name("SharedLogger/thread_buffered")->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_SharedLogger, Mode::ASYNC)
+  ->Name("SharedLogger/async")->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_SharedLogger, Mode::ASYNC_SHARDED)
+  ->Name("SharedLogger/async_sharded")->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_SharedLogger, Mode::ASYNC_TRY)
+  ->Name("SharedLogger/async_try")->ThreadRange(1, 64)->UseRealTime();
@@ -0,0 +1,123 @@
+/*
+ * helpers shared by all cpplog benchmarks: allocation counting (see
+ * bench_main.cpp), a sink that counts the written bytes and a loop that
+ * reports ns/op, allocations/op and bytes/op for a logging call
+ */
+
+#ifndef CPPLOG_BENCH_UTIL_H_
+#define CPPLOG_BENCH_UTIL_H_
+
+#include <benchmark/benchmark.h>
+
+#include <fcntl.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "cpplog.h"
+
+namespace bench {
+
+// number of calls to the global operator new (of all threads)
+extern std::atomic<uint64_t> allocations;
+
+inline uint64_t allocation_count() {
+  return allocations.load(std::memory_order_relaxed);
+}
+
+// forwards all records to another sink and counts their bytes
+class CountingSink : public cpplog::Sink {
+ private:
+  std::shared_ptr<cpplog::Sink> _sink;
+  std::atomic<uint64_t> _bytes;
+
+ public:
+  explicit CountingSink(std::shared_ptr<cpplog::Sink> sink) :
+    _sink(std::move(sink)), _bytes(0) {
+    set_color_mode(_sink->colors() ? cpplog::ColorMode::ALWAYS :
+                                     cpplog::ColorMode::NEVER);
+  }
+
+  void write(const char *data, size_t size) override {
+    _bytes.fetch_add(size, std::memory_order_relaxed);
+    _sink->write(data, size);
+  }
+
+  void write_record(const char *data, size_t size,
+                    cpplog::Severity severity) override {
+    _bytes.fetch_add(size, std::memory_order_relaxed);
+    _sink->write_record(data, size, severity);
+  }
+
+  void flush() override {
+    _sink->flush();
+  }
+
+  void idle() override {
+    _sink->idle();
+  }
+
+  cpplog::Severity flush_severity() const override {
+    return _sink->flush_severity();
+  }
+
+  uint64_t bytes() const {
+    return _bytes.load(std::memory_order_relaxed);
+  }
+};
+
+// raw write(2) calls to /dev/null
+inline std::shared_ptr<cpplog::Sink> null_sink() {
+  return std::make_shared<cpplog::FdSink>(
+    ::open("/dev/null", O_WRONLY | O_CLOEXEC), true);
+}
+
+// a Logger with the default formats that writes into sink
+inline std::unique_ptr<cpplog::Logger<>> create_bench_log(
+    std::shared_ptr<cpplog::Sink> sink) {
+  std::unique_ptr<cpplog::Logger<>> logger(cpplog::create_log("bench"));
+  logger->set_sink(std::move(sink));
+  return logger;
+}
+
+// leaves the Logger of run_log_loop as it is
+inline void default_setup(cpplog::Logger<> &) {}
+
+/*
+ * call log(logger) once per iteration (single-threaded) and report
+ * allocations and bytes written per call next to the timings;
+ * setup(logger) can switch the Logger into another mode first
+ */
+template<typename Fn, typename Setup = void (*)(cpplog::Logger<> &)>
+void run_log_loop(benchmark::State &state,
+                  std::shared_ptr<cpplog::Sink> sink, Fn &&log,
+                  Setup &&setup = default_setup) {
+  auto counter = std::make_shared<CountingSink>(std::move(sink));
+  auto logger = create_bench_log(counter);
+  setup(*logger);
+
+  // the first call registers the thread's buffers, don't count it
+  log(*logger);
+  logger->flush();
+  uint64_t bytes_before = counter->bytes();
+  uint64_t allocations_before = allocation_count();
+
+  for (auto _ : state) {
+    log(*logger);
+  }
+  logger->flush();
+
+  uint64_t bytes = counter->bytes() - bytes_before;
+  uint64_t allocs = allocation_count() - allocations_before;
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(static_cast<int64_t>(bytes));
+  state.counters["allocs/op"] = benchmark::Counter(
+    static_cast<double>(allocs), benchmark::Counter::kAvgIterations);
+  state.counters["bytes/op"] = benchmark::Counter(
+    static_cast<double>(bytes), benchmark::Counter::kAvgIterations);
+}
+
+}  // namespace bench
+
+#endif  // CPPLOG_BENCH_UTIL_H_
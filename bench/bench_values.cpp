@@ -0,0 +1,130 @@
+/*
+ * single-threaded info(const T&) for the types cpplog can log (most of
+ * them through their cpplog::formatter),
+ * including the truncation of long strings (CPPLOG_MX_STR_LEN) and of
+ * containers with more than CPPLOG_MX_ELS elements, and the escaping
+ * of control chars in string arguments
+ */
+
+#include <chrono>
+#include <map>
+#include <optional>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "bench_util.h"
+
+template<typename T>
+static void log_value(benchmark::State &state, const T &value) {
+  bench::run_log_loop(state, bench::null_sink(),
+                      [&value](cpplog::Logger<> &logger) {
+    logger.info(value);
+  });
+}
+
+static void BM_InfoInt(benchmark::State &state) {
+  log_value(state, 123456789);
+}
+BENCHMARK(BM_InfoInt);
+
+static void BM_InfoDouble(benchmark::State &state) {
+  log_value(state, 3.14159265358979);
+}
+BENCHMARK(BM_InfoDouble);
+
+static void BM_InfoUint64(benchmark::State &state) {
+  log_value(state, uint64_t(18446744073709551615ull));
+}
+BENCHMARK(BM_InfoUint64);
+
+static void BM_InfoFloat(benchmark::State &state) {
+  log_value(state, 2.71828f);
+}
+BENCHMARK(BM_InfoFloat);
+
+static void BM_InfoPointer(benchmark::State &state) {
+  log_value(state, static_cast<const void *>(&state));
+}
+BENCHMARK(BM_InfoPointer);
+
+static void BM_InfoDuration(benchmark::State &state) {
+  log_value(state, std::chrono::microseconds(1500));
+}
+BENCHMARK(BM_InfoDuration);
+
+static void BM_InfoOptional(benchmark::State &state) {
+  log_value(state, std::optional<long>(42));
+}
+BENCHMARK(BM_InfoOptional);
+
+static void BM_InfoVariant(benchmark::State &state) {
+  log_value(state, std::variant<int, double>(0.5));
+}
+BENCHMARK(BM_InfoVariant);
+
+static void BM_InfoString(benchmark::State &state) {
+  log_value(state, std::string("a short log message"));
+}
+BENCHMARK(BM_InfoString);
+
+static void BM_InfoVector(benchmark::State &state) {
+  log_value(state, std::vector<int>{1, 2, 3, 4, 5});
+}
+BENCHMARK(BM_InfoVector);
+
+static void BM_InfoMap(benchmark::State &state) {
+  log_value(state, std::map<int, int>{{1, 2}, {3, 4}, {5, 6}});
+}
+BENCHMARK(BM_InfoMap);
+
+// ### truncated values ###
+
+static void BM_InfoLongString(benchmark::State &state) {
+  log_value(state, std::string(static_cast<size_t>(state.range(0)), 'x'));
+}
+BENCHMARK(BM_InfoLongString)->Arg(cpplog::CPPLOG_MX_STR_LEN * 2)->Arg(4096);
+
+static void BM_InfoLongVector(benchmark::State &state) {
+  log_value(state, std::vector<int>(static_cast<size_t>(state.range(0)), 7));
+}
+BENCHMARK(BM_InfoLongVector)->Arg(cpplog::CPPLOG_MX_ELS * 2)->Arg(10000);
+
+static void BM_InfoLongMap(benchmark::State &state) {
+  std::map<int, int> map;
+  for (int i = 0; i < state.range(0); ++i) map[i] = i;
+  log_value(state, map);
+}
+BENCHMARK(BM_InfoLongMap)->Arg(cpplog::CPPLOG_MX_ELS * 2)->Arg(10000);
+
+// ### escaped strings ###
+
+// a line of text with (every 64 chars) or without control chars
+static std::string escape_input(size_t size, bool with_controls) {
+  std::string str(size, 'x');
+  if (with_controls) {
+    for (size_t i = 63; i < size; i += 64) str[i] = '\n';
+  }
+  return str;
+}
+
+static void log_escaped(benchmark::State &state, bool with_controls) {
+  std::string str = escape_input(static_cast<size_t>(state.range(0)),
+                                 with_controls);
+  bench::run_log_loop(state, bench::null_sink(),
+                      [&str](cpplog::Logger<> &logger) {
+    logger.info("payload: {s}", str.c_str());
+  });
+}
+
+static void BM_FormatCleanString(benchmark::State &state) {
+  log_escaped(state, false);
+}
+BENCHMARK(BM_FormatCleanString)->Arg(64)->Arg(4096);
+
+static void BM_FormatControlString(benchmark::State &state) {
+  log_escaped(state, true);
+}
+BENCHMARK(BM_FormatControlString)->Arg(64)->Arg(4096);
+
+// ##########################################################
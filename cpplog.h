@@ -25,13 +25,102 @@
 
 #include <memory>
 #include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include <cstdint>
 #include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <cstdio>
+#include <cerrno>
+#include <climits>
+#include <limits>
 #include <ctime>
+#include <time.h>
 #include <cassert>
+#include <stdexcept>
+#include <type_traits>
+#include <string_view>
+#include <charconv>
+#include <new>
+#include <algorithm>
+#include <csignal>
+#include <exception>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <poll.h>
+#endif
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+// SIMD kernels for scanning strings (see find_escape)
+#ifndef CPPLOG_NO_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CPPLOG_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define CPPLOG_AVX2
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#define CPPLOG_NEON
+#include <arm_neon.h>
+#endif
+#endif  // CPPLOG_NO_SIMD
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// cycle counter of x86 CPUs (see span_ticks)
+#if !defined(CPPLOG_NO_TSC) && (defined(__x86_64__) || defined(_M_X64))
+#define CPPLOG_TSC
+#ifndef _MSC_VER
+#include <x86intrin.h>
+#endif
+#endif
+
+// backtraces of crashing threads (see install_crash_handler)
+#if defined(__has_include)
+#if __has_include(<execinfo.h>)
+#define CPPLOG_BACKTRACE
+#include <execinfo.h>
+#endif
+#endif
+
+// codecs of compressed FileSinks (see FileSink::set_compression)
+#if defined(__has_include)
+#if !defined(CPPLOG_NO_LZ4) && __has_include(<lz4frame.h>)
+#define CPPLOG_LZ4
+#include <lz4frame.h>
+#endif
+#if !defined(CPPLOG_NO_ZSTD) && __has_include(<zstd.h>)
+#define CPPLOG_ZSTD
+#include <zstd.h>
+#endif
+#endif
+
+// reads that are known to be safe, but not within the bounds of an object
+#if defined(__clang__) || defined(__GNUC__)
+#define CPPLOG_NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#else
+#define CPPLOG_NO_SANITIZE_ADDRESS
+#endif
 
 // ### types that can be logged by default: ###
 // all primitive types
@@ -41,10 +130,61 @@
 #include <map>
 #include <utility>  // for std::pair
 #include <unordered_map>
+// ranges of any kind, e.g.
+#include <deque>
+#include <list>
+#include <forward_list>
+#include <set>
+#include <unordered_set>
+#include <optional>
+#include <variant>
+#if __cplusplus >= 202002L && __has_include(<span>)
+#include <span>
+#endif
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine) && \
+    __has_include(<coroutine>)
+#define CPPLOG_COROUTINES
+#include <coroutine>
+#include <tuple>
+#endif
 // ############################################
 
+// severities as plain numbers (for CPPLOG_ACTIVE_LEVEL)
+#define CPPLOG_LEVEL_TRACE 0
+#define CPPLOG_LEVEL_DEBUG 1
+#define CPPLOG_LEVEL_INFO  2
+#define CPPLOG_LEVEL_WARN  3
+#define CPPLOG_LEVEL_ERROR 4
+#define CPPLOG_LEVEL_FATAL 5
+#define CPPLOG_LEVEL_OFF   6
+
+/*
+ * records below this severity are removed at compile time (including the
+ * evaluation of their arguments if the CPPLOG_<LEVEL> macros are used);
+ * has to be defined the same way in every translation unit
+ */
+#ifndef CPPLOG_ACTIVE_LEVEL
+#define CPPLOG_ACTIVE_LEVEL CPPLOG_LEVEL_TRACE
+#endif
+
 namespace cpplog {
 
+// severity of a log record
+enum class Severity : uint8_t {
+  TRACE = CPPLOG_LEVEL_TRACE,
+  DEBUG = CPPLOG_LEVEL_DEBUG,
+  INFO  = CPPLOG_LEVEL_INFO,
+  WARN  = CPPLOG_LEVEL_WARN,
+  ERROR = CPPLOG_LEVEL_ERROR,
+  FATAL = CPPLOG_LEVEL_FATAL,
+  OFF   = CPPLOG_LEVEL_OFF,
+};
+
+// check if records of a severity are compiled in (see CPPLOG_ACTIVE_LEVEL)
+constexpr bool is_active_level(int level) {
+  return level >= CPPLOG_ACTIVE_LEVEL;
+}
+
 // available format flags for a log message
 enum LogFmt {
   NEWLINE          = 1 << 0,  // append newline at the end of the log msg
@@ -72,12 +212,61 @@ static const char *__ansi_green   = "\033[32m";
 static const char *__ansi_yellow  = "\033[33m";
 static const char *__ansi_default = "\033[39m";
 
-// limit number of chars of logged string
+// default limit of the number of chars of a logged string
+// (see Logger::set_max_string_length)
 static constexpr int CPPLOG_MX_STR_LEN = 50;
 
-// limit number of elements of logged container
+// default limit of the number of elements of a logged container
+// (see Logger::set_max_elements)
 static constexpr int CPPLOG_MX_ELS     = 10;
 
+// default number of records the async queue can hold (rounded up to pow2)
+static constexpr size_t CPPLOG_ASYNC_QUEUE_CAPACITY = 8192;
+
+// number of bytes a FormatBuffer can hold before it spills to the heap
+static constexpr size_t CPPLOG_FORMAT_BUFFER_SIZE   = 512;
+
+// max size of a queued record that can be stored without any allocation
+static constexpr size_t CPPLOG_RECORD_INLINE_SIZE   = 200;
+
+// default size of the write buffer of a FileSink
+static constexpr size_t CPPLOG_FILE_BUFFER_SIZE     = 64 * 1024;
+
+// default number of bytes a BatchingSink collects before writing them
+static constexpr size_t CPPLOG_BATCH_SIZE           = 64 * 1024;
+
+// largest block the default allocator (BlockPool) recycles; buffers that
+// are larger come from the global heap every time
+static constexpr size_t CPPLOG_POOL_MAX_BLOCK       = 64 * 1024;
+
+// number of bytes of free blocks (per block size) a thread keeps for
+// itself before it hands them to the shared pool
+static constexpr size_t CPPLOG_POOL_THREAD_CACHE    = 256 * 1024;
+
+// default number of bytes of records a NetworkSink keeps while they wait
+// to be sent, and sends at once
+static constexpr size_t CPPLOG_NETWORK_BACKLOG      = 4 * 1024 * 1024;
+static constexpr size_t CPPLOG_NETWORK_BATCH        = 64 * 1024;
+
+// default number of (uncompressed) bytes per frame of a compressed FileSink
+static constexpr size_t CPPLOG_COMPRESSION_FRAME_SIZE = 1024 * 1024;
+
+// default number of bytes per block of the index of a FileSink
+static constexpr size_t CPPLOG_INDEX_INTERVAL = 64 * 1024;
+
+// what an async Logger should do if its queue is full
+enum class OverflowPolicy {
+  BLOCK,        // wait until the writer thread has freed a slot
+  DROP_NEWEST,  // discard the record that should be logged
+  DROP_OLDEST,  // discard the oldest queued record to make room
+};
+
+// which of the queues of an async writer a record goes into
+enum class ShardPolicy {
+  THREAD,  // every thread always uses the same queue
+  NAME,    // all records of a Logger (name) go into the same queue
+};
+
 // ### operator<< overloads for most std library types ###
 
 template<typename T>
@@ -167,709 +356,9324 @@ static std::ostream &operator<<(std::ostream &stream,
 
 // ##########################################################
 
+// ### timestamps ###
+
+// sub-second precision of logged timestamps
+enum class TimestampPrecision : uint8_t {
+  SECONDS,       // hh:mm:ss
+  MILLISECONDS,  // hh:mm:ss.mmm
+  MICROSECONDS,  // hh:mm:ss.uuuuuu
+};
+
+// max length of a rendered timestamp (w/o '\0')
+static constexpr size_t CPPLOG_MX_TIMESTAMP_LEN = sizeof("hh:mm:ss.uuuuuu") - 1;
+
+// max length of a timestamp rendered as seconds since the epoch
+static constexpr size_t CPPLOG_MX_EPOCH_TIMESTAMP_LEN =
+  sizeof("18446744073.uuuuuu") - 1;
+
 /*
- * specifies how a certain datatype should be logged;
- * defines a "void log(std::ostream &stream, CustomType t, LogFormat fmt)"
- * method for every loggable type;
- * this class should be extened if you wish to add log definitions
- * for you own custom types as the main "Logger" class will always
- * call a "log" method of whatever LogImpl object it owns
+ * current time in nanoseconds since the epoch;
+ * if only seconds are logged, the (much cheaper) coarse clock is used
  */
-class LoggerImpl {
- private:
-  // buffer for current time
-  char time_str[sizeof("hh:mm:ss")];
+inline uint64_t timestamp_now(TimestampPrecision precision) {
+#if defined(__linux__)
+  timespec ts;
+  clock_gettime(precision == TimestampPrecision::SECONDS ?
+                  CLOCK_REALTIME_COARSE : CLOCK_REALTIME, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull +
+         static_cast<uint64_t>(ts.tv_nsec);
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+#endif
+}
 
-  // start time of program
-  // (will be used to calculate current time whenever a timestamp is logged)
-  std::time_t start_time;
+/*
+ * renders timestamps as local time; the "hh:mm:ss" part is cached and
+ * only rendered again (via localtime_r) once the second changes,
+ * milli-/microseconds are patched in with plain integer formatting;
+ * every thread uses its own cache, so rendering needs no locking
+ */
+class TimestampCache {
+ private:
+  std::time_t _second;
+  char _hms[sizeof("hh:mm:ss")];
 
-  // name of Logger (for easier differentiation when using multiple Loggers)
-  std::string name;
+  static void _write_digits(char *out, uint32_t value, int n_digits) {
+    for (int i = n_digits - 1; i >= 0; --i) {
+      out[i] = static_cast<char>('0' + value % 10);
+      value /= 10;
+    }
+  }
 
  public:
-  LoggerImpl() :
-    start_time(std::time(nullptr)), name("") {}
+  TimestampCache() : _second(-1), _hms() {}
 
-  void set_name(const std::string &_name) {
-    name = _name;
+  static TimestampCache &local() {
+    static thread_local TimestampCache cache;
+    return cache;
   }
 
   /*
-   * initialize the log msg based on the log format options;
-   * the passed type needs to have an operator<< overload and
-   * will be passed directly into the stream
+   * render ticks (ns since the epoch) into out, which has to have room
+   * for CPPLOG_MX_TIMESTAMP_LEN characters; returns the rendered length
    */
-  template<typename T>
-  void parse_fmt_opts(std::ostream &stream, const T &t,
-                      LogFormat fmt, size_t type_size = 0) {
-    // set color of text
-    if (fmt & LogFmt::HIGHLIGHT_GREEN) {
-      stream << __ansi_green;
-    } else if (fmt & LogFmt::HIGHLIGHT_YELLOW) {
-      stream << __ansi_yellow;
-    } else if (fmt & LogFmt::HIGHLIGHT_RED) {
-      stream << __ansi_red;
-    } else if (fmt & LogFmt::HIGHLIGHT_DEF) {
-      stream << __ansi_default;
-    }
-
-    bool log_name      = fmt & LogFmt::NAME;
-    bool log_timestamp = fmt & LogFmt::TIMESTAMP;
+  size_t render(uint64_t ticks, TimestampPrecision precision, char *out) {
+    std::time_t second = static_cast<std::time_t>(ticks / 1000000000ull);
+
+    if (second != _second) {
+      std::tm local_time;
+#ifdef _WIN32
+      localtime_s(&local_time, &second);
+#else
+      localtime_r(&second, &local_time);
+#endif
+      std::strftime(_hms, sizeof(_hms), "%T", &local_time);
+      _second = second;
+    }
 
-    std::strftime(time_str, sizeof(time_str),
-                  "%T", std::localtime(&start_time));
+    std::memcpy(out, _hms, sizeof(_hms) - 1);
+    size_t len = sizeof(_hms) - 1;
+    uint32_t ns = static_cast<uint32_t>(ticks % 1000000000ull);
+
+    switch (precision) {
+      case TimestampPrecision::MILLISECONDS:
+        out[len++] = '.';
+        _write_digits(out + len, ns / 1000000, 3);
+        return len + 3;
+      case TimestampPrecision::MICROSECONDS:
+        out[len++] = '.';
+        _write_digits(out + len, ns / 1000, 6);
+        return len + 6;
+      default:
+        return len;
+    }
+  }
 
-    if (log_name && log_timestamp) {
-      stream << "[" << name << ", " << time_str << "] ";
-    } else {
-      if (fmt & LogFmt::NAME) {
-        stream << "[" << name << "] ";
-      }
-      if (fmt & LogFmt::TIMESTAMP) {
-        stream << "[" << time_str << "] ";
-      }
+  /*
+   * render ticks as seconds since the epoch ("1760486400.123" with
+   * MILLISECONDS) into out, which has to have room for
+   * CPPLOG_MX_EPOCH_TIMESTAMP_LEN characters; unlike render, this
+   * doesn't touch the cache or call localtime_r, so the crash handler
+   * can use it
+   */
+  static size_t render_epoch(uint64_t ticks, TimestampPrecision precision,
+                             char *out) {
+    std::to_chars_result res = std::to_chars(
+      out, out + CPPLOG_MX_EPOCH_TIMESTAMP_LEN, ticks / 1000000000ull);
+    size_t len = static_cast<size_t>(res.ptr - out);
+    uint32_t ns = static_cast<uint32_t>(ticks % 1000000000ull);
+
+    switch (precision) {
+      case TimestampPrecision::MILLISECONDS:
+        out[len++] = '.';
+        _write_digits(out + len, ns / 1000000, 3);
+        return len + 3;
+      case TimestampPrecision::MICROSECONDS:
+        out[len++] = '.';
+        _write_digits(out + len, ns / 1000, 6);
+        return len + 6;
+      default:
+        return len;
     }
+  }
+};
 
-    // add type to stream (without any special formatting)
-    stream << t;
+// ##########################################################
 
-    // print estimtated size of type (in bytes)
-    if (fmt & LogFmt::TYPE_SIZE) {
-      stream << " (SIZE ~= ";
-      if (type_size) {
-        stream << type_size;
-      } else {
-        stream << sizeof(t);
-      }
-      stream << " bytes)";
-    }
+// ### records ###
 
-    // reset to default colors again
-    stream << __ansi_default;
+/*
+ * growable character buffer used as the target of a RecordStream;
+ * the put area points directly into the buffer, so the stream only
+ * calls back into this class if the buffer has to grow; the memory
+ * is kept between records, so a reused buffer doesn't allocate
+ */
+class RecordBuffer : public std::streambuf {
+ private:
+  std::string _buf;
 
-    if (fmt & LogFmt::NEWLINE) {
-      stream << '\n';
-    }
-  }
+ protected:
+  int_type overflow(int_type chr) override {
+    if (traits_type::eq_int_type(chr, traits_type::eof())) return 0;
 
-  // log (unsigned) integer types
-  void log(std::ostream &stream, int x, LogFormat fmt) {
-    parse_fmt_opts(stream, x, fmt);
-  }
+    size_t size = pptr() - pbase();
+    _buf.resize(_buf.size() * 2);
+    setp(&_buf[0], &_buf[0] + _buf.size());
+    pbump(static_cast<int>(size));
 
-  // log floating point types
-  void log(std::ostream &stream, double x, LogFormat fmt) {
-    parse_fmt_opts(stream, x, fmt);
+    *pptr() = traits_type::to_char_type(chr);
+    pbump(1);
+    return chr;
   }
 
-  // log characters
-  void log(std::ostream &stream, char c, LogFormat fmt) {
-    parse_fmt_opts(stream, c, fmt);
+ public:
+  RecordBuffer() : _buf(256, '\0') {
+    clear();
   }
 
-  // log booleans
-  void log(std::ostream &stream, bool b, LogFormat fmt) {
-    const char *bool_val = b ? "true" : "false";
-    parse_fmt_opts(stream, bool_val, fmt, 1);
+  // discard the current content (but keep the memory)
+  void clear() {
+    setp(&_buf[0], &_buf[0] + _buf.size());
   }
 
-  // log std::pair
-  template<typename T, typename U>
-  void log(std::ostream &stream, const std::pair<T, U> &p, LogFormat fmt) {
-    parse_fmt_opts(stream, p, fmt);
+  const char *data() const {
+    return pbase();
   }
 
-  // log C string
-  void log(std::ostream &stream, const char *str, LogFormat fmt) {
-    size_t str_len = std::strlen(str);
-
-    if (fmt & LogFmt::VERBOSE || str_len < CPPLOG_MX_STR_LEN) {
-      parse_fmt_opts(stream, str, fmt, str_len);
-    } else {
-      // if a string is longer than 20 characters,
-      // print shortened version of it
-      char formatted_str[64];
-      int pos = std::snprintf(formatted_str,
-                              sizeof(formatted_str), "String: \"");
-
-      int mx_border = 8;
-      for (int i = 0; i < mx_border; ++i, ++pos) {
-        formatted_str[pos] = str[i];
-      }
-
-      formatted_str[pos++] = '.';
-      formatted_str[pos++] = '.';
-      formatted_str[pos++] = '.';
-      formatted_str[pos++] = ' ';
+  size_t size() const {
+    return pptr() - pbase();
+  }
+};
 
-      for (size_t i = str_len - mx_border; i < str_len; ++i, ++pos) {
-        formatted_str[pos] = str[i];
-      }
+// marks a record that doesn't contain a deferred timestamp
+static constexpr uint32_t CPPLOG_NO_TIMESTAMP = UINT32_MAX;
 
-      formatted_str[pos++] = '"';
-      formatted_str[pos] = '\0';
+/*
+ * std::ostream that formats a single record into a RecordBuffer;
+ * instead of a rendered timestamp, a record may also just store the
+ * raw clock ticks and the position the timestamp belongs to
+ * (whoever writes the record renders the timestamp later on)
+ */
+class RecordStream : public std::ostream {
+ private:
+  RecordBuffer _buf;
+  uint64_t _timestamp;
+  uint32_t _timestamp_pos;
+  TimestampPrecision _timestamp_precision;
 
-      parse_fmt_opts(stream, formatted_str, fmt);
-    }
+ public:
+  RecordStream() :
+    std::ostream(nullptr), _timestamp(0),
+    _timestamp_pos(CPPLOG_NO_TIMESTAMP),
+    _timestamp_precision(TimestampPrecision::SECONDS) {
+    rdbuf(&_buf);
   }
 
-  // log std::string
-  void log(std::ostream &stream, const std::string &str, LogFormat fmt) {
-    log(stream, str.c_str(), fmt);
+  // prepare the stream for the next record
+  void reset() {
+    _buf.clear();
+    std::ostream::clear();
+    _timestamp_pos = CPPLOG_NO_TIMESTAMP;
   }
 
-  // log std::vector
-  template<typename T>
-  void log(std::ostream &stream, const std::vector<T> &vec, LogFormat fmt) {
-    size_t size = vec.size();
-    size_t size_in_bytes = size * sizeof(T);
+  // the timestamp ticks should be rendered at the current position
+  void defer_timestamp(uint64_t ticks, TimestampPrecision precision) {
+    _timestamp = ticks;
+    _timestamp_pos = static_cast<uint32_t>(_buf.size());
+    _timestamp_precision = precision;
+  }
 
-    if (fmt & LogFmt::VERBOSE || size < CPPLOG_MX_ELS) {
-      parse_fmt_opts(stream, vec, fmt, size_in_bytes);
-    } else {
-      // if a vector contains more than mx_size elements,
-      // print shortened version of it
-      std::stringstream formatted_vec;
-      formatted_vec << "vector: [";
-      formatted_vec << vec[0];
+  // replace the ticks of an already deferred timestamp
+  void set_timestamp(uint64_t ticks, TimestampPrecision precision) {
+    _timestamp = ticks;
+    _timestamp_precision = precision;
+  }
 
-      for (size_t i = 1; i < CPPLOG_MX_ELS / 2; ++i) {
-        formatted_vec << ", " << vec[i];
-      }
+  const char *data() const {
+    return _buf.data();
+  }
 
-      formatted_vec << " ... ";
-      size_t start = size - (CPPLOG_MX_ELS / 2);
-      formatted_vec << vec[start++];
+  size_t size() const {
+    return _buf.size();
+  }
 
-      for (size_t i = start; i < size; ++i) {
-        formatted_vec << ", " << vec[i];
-      }
-      formatted_vec << "] ";
+  uint64_t timestamp() const {
+    return _timestamp;
+  }
 
-      parse_fmt_opts(stream, formatted_vec.rdbuf(), fmt, size_in_bytes);
-    }
+  uint32_t timestamp_pos() const {
+    return _timestamp_pos;
   }
 
-  // log std::array
-  template<typename T, size_t SIZE>
-  void log(std::ostream &stream,
-           const std::array<T, SIZE> &arr, LogFormat fmt) {
-    size_t size = arr.size();
-    size_t size_in_bytes = size * sizeof(T);
+  TimestampPrecision timestamp_precision() const {
+    return _timestamp_precision;
+  }
+};
 
-    if (fmt & LogFmt::VERBOSE || size < CPPLOG_MX_ELS) {
-      parse_fmt_opts(stream, arr, fmt, size_in_bytes);
-    } else {
-      // if an array contains more than mx_size elements,
-      // print shortened version of it
-      std::stringstream formatted_arr;
-      formatted_arr << "array: [";
-      formatted_arr << arr[0];
+// every thread reuses one RecordStream for all the records it formats
+inline RecordStream &thread_record_stream() {
+  static thread_local RecordStream stream;
+  stream.reset();
+  return stream;
+}
 
-      for (size_t i = 1; i < CPPLOG_MX_ELS / 2; ++i) {
-        formatted_arr << ", " << arr[i];
-      }
+/*
+ * write a record to stream (rendering its deferred timestamp, if any);
+ * Record has to provide the same accessors as RecordStream
+ */
+template<typename Record>
+void write_record(std::ostream &stream, const Record &record) {
+  uint32_t pos = record.timestamp_pos();
+  if (pos == CPPLOG_NO_TIMESTAMP) {
+    stream.write(record.data(), record.size());
+    return;
+  }
 
-      formatted_arr << " ... ";
-      size_t start = size - (CPPLOG_MX_ELS / 2);
-      formatted_arr << arr[start++];
+  char time_str[CPPLOG_MX_TIMESTAMP_LEN];
+  size_t time_len = TimestampCache::local().render(
+    record.timestamp(), record.timestamp_precision(), time_str);
 
-      for (size_t i = start; i < size; ++i) {
-        formatted_arr << ", " << arr[i];
-      }
-      formatted_arr << "] ";
+  stream.write(record.data(), pos);
+  stream.write(time_str, time_len);
+  stream.write(record.data() + pos, record.size() - pos);
+}
 
-      parse_fmt_opts(stream, formatted_arr.rdbuf(), fmt, size_in_bytes);
-    }
-  }
+// ##########################################################
 
-  // log std::map
-  template<typename K, typename V>
-  void log(std::ostream &stream, const std::map<K, V> &map, LogFormat fmt) {
-    size_t size = map.size();
-    size_t size_in_bytes = size * sizeof(K) + size * sizeof(V);  // estimate
+// ### string scanning ###
 
-    if (fmt & LogFmt::VERBOSE || size < CPPLOG_MX_ELS) {
-      parse_fmt_opts(stream, map, fmt, size_in_bytes);
-    } else {
-      // if a map contains more than mx_size key-value pairs,
-      // print shortened version of it
-      std::stringstream formatted_map;
-      auto map_it = map.cbegin();
-      size_t left_start = 1;
-      formatted_map << "map: {";
-      formatted_map << map_it->first << ": " << map_it->second;
-      ++map_it;
+/*
+ * kernels that find the chars of a string that have to be escaped;
+ * SSE2/AVX2 on x86 and NEON on AArch64 test 16/32 chars at a time,
+ * all other targets (or CPPLOG_NO_SIMD) test 8 chars per step;
+ * the kernel is selected at compile time (e.g. -mavx2)
+ */
 
-      for (; left_start < CPPLOG_MX_ELS / 2; ++map_it, ++left_start) {
-        formatted_map << ", " << map_it->first << ": " << map_it->second;
-      }
+// control chars always have to be escaped (they would break records
+// into several lines or change the terminal), '"' and '\\' only
+// inside of quoted strings
+inline bool is_control_char(unsigned char chr) {
+  return chr < 0x20;
+}
 
-      formatted_map << " ... ";
-      size_t skip_c = (size - (CPPLOG_MX_ELS / 2)) - left_start;
-      std::advance(map_it, skip_c);
-      left_start += skip_c;
+inline bool needs_escape(unsigned char chr) {
+  return chr < 0x20 || chr == '"' || chr == '\\';
+}
 
-      formatted_map << map_it->first << ": " << map_it->second;
-      ++map_it;
-      ++left_start;
+// index of the lowest set bit (mask must not be 0)
+inline unsigned lowest_bit(uint32_t mask) {
+#ifdef _MSC_VER
+  unsigned long idx;
+  _BitScanForward(&idx, mask);
+  return static_cast<unsigned>(idx);
+#else
+  return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
 
-      for (; left_start < size; ++map_it, ++left_start) {
-        formatted_map << ", " << map_it->first << ": " << map_it->second;
-      }
-      formatted_map << "} ";
+// index of the highest set bit of value (value must not be 0)
+inline unsigned highest_bit(uint64_t value) {
+#ifdef _MSC_VER
+  unsigned long idx;
+  _BitScanReverse64(&idx, value);
+  return static_cast<unsigned>(idx);
+#else
+  return 63 - static_cast<unsigned>(__builtin_clzll(value));
+#endif
+}
 
-      parse_fmt_opts(stream, formatted_map.rdbuf(), fmt, size_in_bytes);
+/*
+ * index of the first char of data that needs escaping (or size);
+ * QUOTES also stops at '"' and '\\'
+ */
+template<bool QUOTES>
+size_t find_escape(const char *data, size_t size) {
+  size_t i = 0;
+
+#ifdef CPPLOG_AVX2
+  const __m256i max_control32 = _mm256_set1_epi8(0x1f);
+  const __m256i quote32       = _mm256_set1_epi8('"');
+  const __m256i backslash32   = _mm256_set1_epi8('\\');
+  for (; i + 32 <= size; i += 32) {
+    __m256i chars = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i *>(data + i));
+    __m256i found = _mm256_cmpeq_epi8(
+      _mm256_min_epu8(chars, max_control32), chars);
+    if constexpr (QUOTES) {
+      found = _mm256_or_si256(found, _mm256_or_si256(
+        _mm256_cmpeq_epi8(chars, quote32),
+        _mm256_cmpeq_epi8(chars, backslash32)));
     }
+    uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(found));
+    if (mask) return i + lowest_bit(mask);
   }
+#endif
+
+#if defined(CPPLOG_SSE2)
+  const __m128i max_control = _mm_set1_epi8(0x1f);
+  const __m128i quote       = _mm_set1_epi8('"');
+  const __m128i backslash   = _mm_set1_epi8('\\');
+  for (; i + 16 <= size; i += 16) {
+    __m128i chars = _mm_loadu_si128(
+      reinterpret_cast<const __m128i *>(data + i));
+    __m128i found = _mm_cmpeq_epi8(_mm_min_epu8(chars, max_control), chars);
+    if constexpr (QUOTES) {
+      found = _mm_or_si128(found, _mm_or_si128(
+        _mm_cmpeq_epi8(chars, quote), _mm_cmpeq_epi8(chars, backslash)));
+    }
+    uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(found));
+    if (mask) return i + lowest_bit(mask);
+  }
+#elif defined(CPPLOG_NEON)
+  const uint8x16_t control   = vdupq_n_u8(0x20);
+  const uint8x16_t quote     = vdupq_n_u8('"');
+  const uint8x16_t backslash = vdupq_n_u8('\\');
+  for (; i + 16 <= size; i += 16) {
+    uint8x16_t chars = vld1q_u8(reinterpret_cast<const uint8_t *>(data + i));
+    uint8x16_t found = vcltq_u8(chars, control);
+    if constexpr (QUOTES) {
+      found = vorrq_u8(found, vorrq_u8(vceqq_u8(chars, quote),
+                                       vceqq_u8(chars, backslash)));
+    }
+    if (vmaxvq_u8(found)) break;  // (the exact position is found below)
+  }
+#else
+  constexpr uint64_t ONES  = 0x0101010101010101ull;
+  constexpr uint64_t HIGHS = 0x8080808080808080ull;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, data + i, sizeof(word));
+
+    // high bit set for bytes < 0x20 (/ equal to '"' or '\\')
+    uint64_t found = word - ONES * 0x20;
+    if constexpr (QUOTES) {
+      found |= ((word ^ (ONES * '"')) - ONES) |
+               ((word ^ (ONES * '\\')) - ONES);
+    }
+    if (found & ~word & HIGHS) break;  // (the exact position is found below)
+  }
+#endif
 
-  // log std::unordered_map
-  template<typename K, typename V>
-  void log(std::ostream &stream,
-           const std::unordered_map<K, V> &map, LogFormat fmt) {
-    size_t size = map.size();
-    size_t size_in_bytes = size * sizeof(K) + size * sizeof(V);  // estimate
-
-    if (fmt & LogFmt::VERBOSE || size < CPPLOG_MX_ELS) {
-      parse_fmt_opts(stream, map, fmt, size_in_bytes);
-    } else {
-      // if an unordered map contains more than mx_size key-value pairs,
-      // print shortened version of it
-      std::stringstream formatted_map;
-      auto map_it = map.cbegin();
-      size_t left_start = 1;
-      formatted_map << "unordered_map: {";
-      formatted_map << map_it->first << ": " << map_it->second;
-      ++map_it;
-
-      for (; left_start < CPPLOG_MX_ELS / 2; ++map_it, ++left_start) {
-        formatted_map << ", " << map_it->first << ": " << map_it->second;
-      }
-
-      formatted_map << " ... ";
-      size_t skip_c = (size - (CPPLOG_MX_ELS / 2)) - left_start;
-      std::advance(map_it, skip_c);
-      left_start += skip_c;
+  for (; i < size; ++i) {
+    unsigned char chr = static_cast<unsigned char>(data[i]);
+    if (QUOTES ? needs_escape(chr) : is_control_char(chr)) return i;
+  }
+  return size;
+}
 
-      formatted_map << map_it->first << ": " << map_it->second;
-      ++map_it;
-      ++left_start;
+// length of a C string and the index of its first control char
+struct StringScan {
+  size_t size;
+  size_t first_control;  // (== size if there is none)
+};
 
-      for (; left_start < size; ++map_it, ++left_start) {
-        formatted_map << ", " << map_it->first << ": " << map_it->second;
-      }
-      formatted_map << "} ";
+/*
+ * scan a C string for its terminator and its control chars at once;
+ * the SSE2 version only uses aligned loads, which never cross a page
+ * boundary, so reading the rest of the last block is safe (those bytes
+ * are ignored, but address sanitizers would still report them)
+ */
+CPPLOG_NO_SANITIZE_ADDRESS
+inline StringScan scan_cstr(const char *str) {
+#ifdef CPPLOG_SSE2
+  const __m128i max_control = _mm_set1_epi8(0x1f);
+  const __m128i zero = _mm_setzero_si128();
+
+  size_t offset = reinterpret_cast<uintptr_t>(str) & 15;
+  const char *block = reinterpret_cast<const char *>(
+    reinterpret_cast<uintptr_t>(str) & ~static_cast<uintptr_t>(15));
+  size_t first_control = SIZE_MAX;
+
+  for (size_t pos = 0; ; pos += 16) {
+    __m128i chars = _mm_load_si128(
+      reinterpret_cast<const __m128i *>(block + pos));
+    uint32_t control = static_cast<uint32_t>(_mm_movemask_epi8(
+      _mm_cmpeq_epi8(_mm_min_epu8(chars, max_control), chars)));
+    uint32_t terminator = static_cast<uint32_t>(_mm_movemask_epi8(
+      _mm_cmpeq_epi8(chars, zero)));
+    if (!pos) {
+      // ignore the chars before the start of the string
+      control &= 0xffffu << offset;
+      terminator &= 0xffffu << offset;
+    }
 
-      parse_fmt_opts(stream, formatted_map.rdbuf(), fmt, size_in_bytes);
+    if (control && first_control == SIZE_MAX) {
+      first_control = pos + lowest_bit(control) - offset;
+    }
+    if (terminator) {
+      // (the terminator is a control char itself)
+      return StringScan{pos + lowest_bit(terminator) - offset,
+                        first_control};
     }
   }
-};
+#else
+  size_t size = std::strlen(str);
+  return StringScan{size, find_escape<false>(str, size)};
+#endif
+}
+
+// write chr as an escape sequence into dst ('\t' is kept); returns length
+inline size_t escape_control_char(char *dst, unsigned char chr) {
+  static constexpr char HEX[] = "0123456789abcdef";
+
+  switch (chr) {
+    case '\t': dst[0] = '\t'; return 1;
+    case '\n': dst[0] = '\\'; dst[1] = 'n'; return 2;
+    case '\r': dst[0] = '\\'; dst[1] = 'r'; return 2;
+    default:
+      dst[0] = '\\';
+      dst[1] = 'x';
+      dst[2] = HEX[chr >> 4];
+      dst[3] = HEX[chr & 0xf];
+      return 4;
+  }
+}
 
 /*
- * The Logger class contains a reference to std::cerr, which
- * is the output stream for all logged messages;
- * you can specify the log level and log format of the
- * to-be-logged messages using the set_log_level and
- * set_log_format methods; this class contains methods that
- * support the logging of all primitive and most std library types;
- * if you wish to log your own custom types, please extend the
- * "LoggerImpl" class and add your own
- * "void log(std::ostream &stream, YourCustomType t, LogFormat fmt)"
- * definitions that specify how your custom types should be logged
- * and provide your extension of the LoggerImpl class as the template
- * class for the Logger class;
- * the Logger class will take ownership of the LoggerImpl object,
- * so be aware that it will be deleted whenever the Logger class
- * get deleted
+ * pass str to append (chunk by chunk) with all control chars escaped;
+ * first_control has to be the index of the first control char of str
+ * (or its size), so clean strings are appended as a whole
  */
-template<class LogImpl = LoggerImpl>
-class Logger {
- private:
-  Level _log_lvl;
-  std::ostream &_stream;
-  std::string _name;
-  LogFormat _log_format;
-  LogImpl *_log_impl;
-  std::mutex _mutex;
-
-  // default log formats for error, warning and info messages
-  const LogFormat _default_err_fmt =
-    LogFmt::HIGHLIGHT_RED | LogFmt::TIMESTAMP | LogFmt::NEWLINE;
-  const LogFormat _default_warn_fmt =
-    LogFmt::HIGHLIGHT_YELLOW | LogFmt::TIMESTAMP | LogFmt::NEWLINE;
-  const LogFormat _default_info_fmt =
-    LogFmt::HIGHLIGHT_GREEN | LogFmt::TIMESTAMP | LogFmt::NEWLINE;
+template<typename Append>
+void sanitize_string(std::string_view str, size_t first_control,
+                     Append &&append) {
+  const char *data = str.data();
+  size_t size = str.size();
+
+  size_t pos = 0;
+  size_t n = first_control;
+  for (;;) {
+    append(data + pos, n);
+    pos += n;
+    if (pos >= size) return;
+
+    char esc[4];
+    append(esc, escape_control_char(
+      esc, static_cast<unsigned char>(data[pos++])));
+    n = find_escape<false>(data + pos, size - pos);
+  }
+}
 
-  /*
-   * contains data of a to-be-formatted object from the format string;
-   * the format string can parse decimal numbers, floating point numbers,
-   * strings, objects and characters. Formatting can be specified in curly
-   * brackets with Python/printf-like syntax:
-   *   {_>10.2f} -> left-padded w/ '_', 10 chars, 2 decimal place float
-   *   {0>8d< }   -> left-padded w/ '0, 8 chars, decimal, right-padded w/ ' '
-   * supported format specifiers (have to be inside {...}):
-   *   - '>' : any character put before '>' will be used to left-pad
-   *     the to-be-printed type (if a max character size was also specified);
-   *     '>' should be the 2nd character in the specified format
-   *   - max character size: limit the number of characters the to-be-printed
-   *     output can have; this number should be either the first number
-   *     of the format or put after the '>' specifier (for left-padding)
-   *   - '.' : specify the number of decimal places after a floating-point
-   *     number after this character
-   *   - 'd' | 'f' | 's' | 'o' | 'c' | 'b' : specify that the to-be-printed
-   *     parameter is a decimal number, floating-point number, string, object,
-   *     character or boolean
-   *   - '<' : any character put after '<' will be used to right-pad
-   *     the to-be-printed type (if a max character size was also specified);
-   *     '>' should be the 2nd to last character in the specified format
-   */
-  struct FormatStringObject {
-    enum FORMAT {
-     NONE           = '\0',
-     INT            = 'd',
-     FLOAT          = 'f',
-     STRING         = 's',
-     CHAR           = 'c',
-     BOOL           = 'b',
-     OBJECT         = 'o',
-     OPEN           = '{',
-     CLOSE          = '}',
-     DECIMAL_PLACES = '.',
-     PAD_LEFT       = '>',
-     PAD_RIGHT      = '<'
-    };
+// writes a string with all control chars escaped (see sanitize_string)
+struct SanitizedString {
+  std::string_view str;
+  size_t first_control;
+};
 
-    FORMAT type;
-    char left_pad_chr, right_pad_chr;
-    uint16_t mx_len, mx_decimal_places;
+inline SanitizedString sanitized(std::string_view str) {
+  return SanitizedString{str, find_escape<false>(str.data(), str.size())};
+}
 
-    // start and end idx of the format specifier in the format string
-    int start_idx, end_idx;
+inline std::ostream &operator<<(std::ostream &stream,
+                                const SanitizedString &str) {
+  sanitize_string(str.str, str.first_control,
+                  [&stream](const char *data, size_t n) {
+    stream.write(data, static_cast<std::streamsize>(n));
+  });
+  return stream;
+}
 
-    FormatStringObject() :
-      type(NONE), left_pad_chr('\0'), right_pad_chr('\0'),
-      mx_len(0), mx_decimal_places(0), start_idx(0), end_idx(0) {}
+// ##########################################################
 
-    static void pad(std::ostream &stream, int n, char pad_chr) {
-      if (n < 0) return;
+// ### ranges ###
 
-      for (int i = 0; i < n; ++i) {
-        stream << pad_chr;
-      }
-    }
+// check if T can be iterated with std::begin/std::end
+template<typename T, typename = void>
+struct is_range : std::false_type {};
 
-    static bool is_number(char chr) {
-      return !(chr < '0' || chr > '9');
-    }
+template<typename T>
+struct is_range<T, std::void_t<decltype(std::begin(std::declval<const T &>())),
+                               decltype(std::end(std::declval<const T &>()))>>
+  : std::true_type {};
 
-    static std::string get_type(FORMAT type) {
-      switch (type) {
-        case FORMAT::INT    : return std::string("Decimal number");
-        case FORMAT::FLOAT  : return std::string("Floating-point number");
-        case FORMAT::STRING : return std::string("String");
-        case FORMAT::OBJECT : return std::string("Object");
-        case FORMAT::CHAR   : return std::string("Character");
-        case FORMAT::BOOL   : return std::string("Boolean");
-        case FORMAT::NONE   : return std::string("None");
-      }
-    }
+// ranges that are logged element by element (strings are logged as text)
+template<typename T>
+struct is_loggable_range : std::integral_constant<bool,
+  is_range<T>::value &&
+  !std::is_convertible<const T &, std::string_view>::value> {};
 
-    // parse a (multi-digit) number from format string
-    static uint16_t get_number(const char *fmt_str, int &fmt_str_idx) {
-      constexpr uint8_t MX_DIGITS = 3;
-      char number[] = "0\0\0";
-      int number_i = 0;
+// check if the elements of T are key-value pairs (std::map & co.)
+template<typename T, typename = void>
+struct is_map_like : std::false_type {};
 
-      while (number_i < MX_DIGITS &&
-             FormatStringObject::is_number(fmt_str[fmt_str_idx])) {
-        number[number_i++] = fmt_str[fmt_str_idx++];
-      }
+template<typename T>
+struct is_map_like<T, std::void_t<typename T::key_type,
+                                  typename T::mapped_type>>
+  : std::true_type {};
 
-      return static_cast<uint16_t>(std::stoi(number));
-    }
+// check if T is a set or map (logged with braces instead of brackets)
+template<typename T, typename = void>
+struct is_associative : std::false_type {};
 
-    friend std::ostream &operator<<(std::ostream &stream,
-                                    const FormatStringObject &obj) {
-      stream << "Type: " << FormatStringObject::get_type(obj.type)
-             << ", Left pad: '" << obj.left_pad_chr
-             << "', Right pad: '" << obj.right_pad_chr << "', Mx Length: "
-             << obj.mx_len << ", Mx decimal places: " << obj.mx_decimal_places
-             << "\n";
-      return stream;
-    }
-  };
+template<typename T>
+struct is_associative<T, std::void_t<typename T::key_type>>
+  : std::true_type {};
 
-  std::vector<FormatStringObject> _parse_format_string(const char *fmt_str) {
-    std::vector<FormatStringObject> fmt_objs;
+// name of a range in the log message
+template<typename T>
+struct range_name { static constexpr const char *value = "range"; };
 
-    size_t str_len = std::strlen(fmt_str);
+template<typename T, size_t SIZE>
+struct range_name<T[SIZE]> { static constexpr const char *value = "array"; };
 
-    for (int i = 0; i < str_len;) {
-      if (fmt_str[i] == FormatStringObject::OPEN) {
-        FormatStringObject obj;
-        obj.start_idx = i;
-        ++i;
+#define CPPLOG_RANGE_NAME(type, name)                            \
+  template<typename ...T>                                        \
+  struct range_name<type<T...>> {                                \
+    static constexpr const char *value = name;                   \
+  };
 
-        // store left pad character (if specified, comes before '>')
-        if (fmt_str[i + 1] == FormatStringObject::PAD_LEFT) {
-          obj.left_pad_chr = fmt_str[i];
-          i += 2;
-        }
+CPPLOG_RANGE_NAME(std::vector, "vector")
+CPPLOG_RANGE_NAME(std::deque, "deque")
+CPPLOG_RANGE_NAME(std::list, "list")
+CPPLOG_RANGE_NAME(std::forward_list, "forward_list")
+CPPLOG_RANGE_NAME(std::set, "set")
+CPPLOG_RANGE_NAME(std::multiset, "multiset")
+CPPLOG_RANGE_NAME(std::unordered_set, "unordered_set")
+CPPLOG_RANGE_NAME(std::unordered_multiset, "unordered_multiset")
+CPPLOG_RANGE_NAME(std::map, "map")
+CPPLOG_RANGE_NAME(std::multimap, "multimap")
+CPPLOG_RANGE_NAME(std::unordered_map, "unordered_map")
+CPPLOG_RANGE_NAME(std::unordered_multimap, "unordered_multimap")
+
+#undef CPPLOG_RANGE_NAME
 
-        // store max number of characters of formatted argument
-        obj.mx_len = FormatStringObject::get_number(fmt_str, i);
+template<typename T, size_t SIZE>
+struct range_name<std::array<T, SIZE>> {
+  static constexpr const char *value = "array";
+};
 
-        // store max number of decimal places after floating point number
-        if (fmt_str[i] == FormatStringObject::DECIMAL_PLACES) {
-          ++i;
-          obj.mx_decimal_places = FormatStringObject::get_number(fmt_str, i);
-        }
+#ifdef __cpp_lib_span
+template<typename T, size_t EXTENT>
+struct range_name<std::span<T, EXTENT>> {
+  static constexpr const char *value = "span";
+};
+#endif
 
-        // store type specifier
-        switch (fmt_str[i]) {
-          case FormatStringObject::INT :
-            obj.type = FormatStringObject::INT;
-            break;
-          case FormatStringObject::FLOAT :
-            obj.type = FormatStringObject::FLOAT;
-            break;
-          case FormatStringObject::STRING :
-            obj.type = FormatStringObject::STRING;
-            break;
-          case FormatStringObject::OBJECT :
-            obj.type = FormatStringObject::OBJECT;
-            break;
-          case FormatStringObject::CHAR:
-            obj.type = FormatStringObject::CHAR;
-            break;
-          case FormatStringObject::BOOL:
-            obj.type = FormatStringObject::BOOL;
-            break;
-          default:
-            std::cerr << "Error: Unknown format specifier '"
-                      << fmt_str[i] << "'\n";
-            std::exit(1);
-        }
-        ++i;
+// check if T has a size() method
+template<typename T, typename = void>
+struct has_size : std::false_type {};
 
-        // store right-pad character (if it was specified, comes after '<')
-        if (fmt_str[i] == FormatStringObject::PAD_RIGHT) {
-          ++i;
-          obj.right_pad_chr = fmt_str[i++];
-        }
+template<typename T>
+struct has_size<T, std::void_t<decltype(std::declval<const T &>().size())>>
+  : std::true_type {};
+
+// number of elements of a range (only walks ranges without a size())
+template<typename Range>
+size_t range_size(const Range &range) {
+  if constexpr (std::is_array<Range>::value) {
+    return std::extent<Range>::value;
+  } else if constexpr (has_size<Range>::value) {
+    return static_cast<size_t>(range.size());
+  } else {
+    return static_cast<size_t>(std::distance(std::begin(range),
+                                             std::end(range)));
+  }
+}
 
-        assert(fmt_str[i] == FormatStringObject::CLOSE);
+template<typename Range>
+void write_range(std::ostream &stream, const Range &range,
+                 size_t max_elements, bool nested);
 
-        obj.end_idx = i + 1;
-        fmt_objs.push_back(obj);
+// write one element of a range (nested ranges are shortened as well)
+template<typename T>
+void write_range_element(std::ostream &stream, const T &value,
+                         size_t max_elements) {
+  if constexpr (is_loggable_range<T>::value) {
+    write_range(stream, value, max_elements, true);
+  } else {
+    stream << value;
+  }
+}
 
-        if (fmt_str[i] != FormatStringObject::CLOSE) {
-          std::cerr << "Error: Expected '" << FormatStringObject::CLOSE
-                    << "', found '" << fmt_str[i] << "'!\n";
-          std::exit(1);
-        }
-      } else {
-        ++i;
-      }
+template<typename Range, typename It>
+void write_range_elements(std::ostream &stream, It it, size_t n,
+                          size_t max_elements) {
+  for (size_t i = 0; i < n; ++i, ++it) {
+    if (i) stream << ", ";
+    if constexpr (is_map_like<Range>::value) {
+      write_range_element(stream, it->first, max_elements);
+      stream << ": ";
+      write_range_element(stream, it->second, max_elements);
+    } else {
+      write_range_element(stream, *it, max_elements);
     }
-
-    return fmt_objs;
   }
+}
 
-  // handle max length and padding of to-be-printed format argument
-  void _pad_fmt_arg(std::ostream &str, const std::string &arg,
-                    const FormatStringObject &fmt_obj) {
-    size_t str_len = arg.size();       // length of to-be-printed string arg
-    uint16_t mx_len = fmt_obj.mx_len;  // max length of to-be-printed arg
-    if (mx_len) {
-      if (mx_len < str_len) {
-        // no space for padding -> just print string until max is reached
-        for (uint16_t i = 0; i < mx_len; ++i) str << arg[i];
-      } else {
-        // if left- AND right-padding was specified in the format,
-        // distribute the padding equally between left and right
-        // (left will be preferred if the max padding number is uneven)
-        uint16_t mx_padding = mx_len - str_len;
-        uint16_t mx_right_padding = mx_padding / 2;
-        uint16_t mx_left_padding = mx_padding - mx_right_padding;
-
-        mx_left_padding = mx_padding > 0 && fmt_obj.right_pad_chr != '\0' ?
-                            mx_left_padding: mx_padding;
-        mx_right_padding = mx_padding > 0 && fmt_obj.left_pad_chr != '\0' ?
-                             mx_right_padding : mx_padding;
-
-        // left-pad (no-op if mx_left_padding<0 or no pad char was specified)
-        if (fmt_obj.left_pad_chr != '\0') {
-          FormatStringObject::pad(str, mx_left_padding, fmt_obj.left_pad_chr);
-        }
-
-        // print entire argument
-        str << arg;
-
-         // right-pad (no-op if mx_right_padding<0 or no pad char was specified)
-        if (fmt_obj.right_pad_chr != '\0') {
-          FormatStringObject::pad(str, mx_right_padding, fmt_obj.right_pad_chr);
-        }
-      }
+/*
+ * write a range as "name: [e1, e2, ...] " (sets and maps with braces);
+ * unless max_elements is 0, only the first and last max_elements / 2
+ * (at least 1) elements are written if that leaves some out; the tail
+ * is reached via random access or by walking backwards from the end,
+ * ranges that can only be walked forwards only log their head (and are
+ * shortened if they have more elements than that); nested ranges are
+ * written without name and trailing space
+ */
+template<typename Range>
+void write_range(std::ostream &stream, const Range &range,
+                 size_t max_elements, bool nested) {
+  const char open = is_associative<Range>::value ? '{' : '[';
+  const char close = is_associative<Range>::value ? '}' : ']';
+
+  using It = decltype(std::begin(range));
+  using Category = typename std::iterator_traits<It>::iterator_category;
+  constexpr bool has_tail =
+    std::is_base_of<std::bidirectional_iterator_tag, Category>::value;
+
+  if (!nested) stream << range_name<Range>::value << ": ";
+  stream << open;
+
+  size_t size = range_size(range);
+  size_t n_shown = max_elements / 2 ? max_elements / 2 : 1;
+  if (max_elements == 0 || size <= (has_tail ? 2 * n_shown : n_shown)) {
+    write_range_elements<Range>(stream, std::begin(range), size,
+                                max_elements);
+  } else {
+    write_range_elements<Range>(stream, std::begin(range), n_shown,
+                                max_elements);
+    stream << " ... ";
+
+    if constexpr (has_tail) {
+      It tail = std::end(range);
+      std::advance(tail, -static_cast<std::ptrdiff_t>(n_shown));
+      write_range_elements<Range>(stream, tail, n_shown, max_elements);
     } else {
-      str << arg;
+      stream << '(' << (size - n_shown) << " more)";
     }
   }
 
-  template<typename T>
-  void _log_fmt_arg(std::stringstream &fmt_arg, T &&_arg,
-                    const char *log_fmt, int start_idx, int end_idx,
-                    const FormatStringObject &fmt_obj) {
-    // log the regular string part before the current format specifier
-    for (int i = start_idx; i < end_idx; ++i) fmt_arg << log_fmt[i];
-
-    std::stringstream tmp;
-    tmp << _arg;
-    std::string arg = tmp.str();
-
-    switch (fmt_obj.type) {
-      case FormatStringObject::INT :
-        _pad_fmt_arg(fmt_arg, arg, fmt_obj);
-        break;
-      case FormatStringObject::FLOAT :
-      {
-        // convert floating-point number to string and check if the
-        // number of decimal places matches the max number of decimal
-        // places specified in the format; if not, cut the overflow off
-        size_t dot_idx = arg.find('.');
-        assert(dot_idx != arg.npos);
+  stream << close;
+  if (!nested) stream << ' ';
+}
 
-        size_t n_decimal_places = arg.size() - dot_idx - 1;
+// passes a range through parse_fmt_opts without copying it
+template<typename Range>
+struct RangeWriter {
+  const Range &range;
+  size_t max_elements;
+};
 
-        if (n_decimal_places > fmt_obj.mx_decimal_places) {
-          arg = arg.substr(0, dot_idx + 1 + fmt_obj.mx_decimal_places);
-        }
+template<typename Range>
+std::ostream &operator<<(std::ostream &stream,
+                         const RangeWriter<Range> &writer) {
+  write_range(stream, writer.range, writer.max_elements, false);
+  return stream;
+}
 
-        _pad_fmt_arg(fmt_arg, arg, fmt_obj);
+/*
+ * writes a long string as 'String: "<head>... <tail>"' (sanitized);
+ * only the head and the tail are scanned
+ */
+struct TruncatedStringWriter {
+  std::string_view str;
+  size_t border;
+};
+
+inline std::ostream &operator<<(std::ostream &stream,
+                                const TruncatedStringWriter &writer) {
+  std::string_view str = writer.str;
+  stream << "String: \"" << sanitized(str.substr(0, writer.border))
+         << "... " << sanitized(str.substr(str.size() - writer.border))
+         << '"';
+  return stream;
+}
+
+// ##########################################################
+
+// a value written with its formatter (see formatter, defined below)
+template<typename T>
+struct FormattedValue;
+
+/*
+ * specifies how a certain datatype should be logged;
+ * defines a "void log(std::ostream &stream, CustomType t, LogFormat fmt)"
+ * method for strings, ranges, pairs and booleans; all other values are
+ * written by their cpplog::formatter, which is also the way to log your
+ * own custom types; extending this class with "log" overloads for them
+ * still works, as the main "Logger" class will always call a "log"
+ * method of whatever LogImpl object it owns
+ */
+class LoggerImpl {
+ private:
+  // name of Logger (for easier differentiation when using multiple Loggers)
+  std::string name;
+
+  // sub-second precision of logged timestamps
+  TimestampPrecision timestamp_precision;
+
+  // only store the clock ticks in async records and let
+  // the writer thread render the timestamp
+  bool raw_timestamps;
+
+  // longer strings/containers are shortened (unless LogFmt::VERBOSE);
+  // 0 disables the limit
+  size_t max_string_length;
+  size_t max_elements;
+
+  // highlight records at all (off if no sink is a terminal)
+  bool colors;
+
+  /*
+   * everything around the timestamp and the value of a record; there is
+   * one template for every combination of color, LogFmt::NAME, TIMESTAMP
+   * and NEWLINE (all of them are built whenever the name or colors
+   * change, so logging threads only read them)
+   */
+  struct RecordTemplate {
+    std::string head;  // color + name + opening bracket of the timestamp
+    std::string tail;  // closing bracket of the timestamp
+    std::string end;   // color reset + newline
+  };
+
+  static constexpr size_t N_COLORS = 5;
+  RecordTemplate templates[N_COLORS * 8];
+
+  // 0 = no color, 1 ... 4 in the order of precedence of the LogFmt flags
+  static size_t color_index(LogFormat fmt) {
+    if (fmt & LogFmt::HIGHLIGHT_GREEN) return 1;
+    if (fmt & LogFmt::HIGHLIGHT_YELLOW) return 2;
+    if (fmt & LogFmt::HIGHLIGHT_RED) return 3;
+    if (fmt & LogFmt::HIGHLIGHT_DEF) return 4;
+    return 0;
+  }
+
+  const RecordTemplate &record_template(LogFormat fmt) const {
+    size_t color = colors ? color_index(fmt) : 0;
+    bool log_name = fmt & LogFmt::NAME;
+    bool log_timestamp = fmt & LogFmt::TIMESTAMP;
+    bool newline = fmt & LogFmt::NEWLINE;
+    return templates[color * 8 + log_name * 4 + log_timestamp * 2 + newline];
+  }
+
+  void build_templates() {
+    static const char *COLOR_CODES[N_COLORS] = {
+      "", __ansi_green, __ansi_yellow, __ansi_red, __ansi_default
+    };
+
+    for (size_t i = 0; i < N_COLORS * 8; ++i) {
+      size_t color = i / 8;
+      bool log_name = i & 4;
+      bool log_timestamp = i & 2;
+      bool newline = i & 1;
+
+      RecordTemplate &tpl = templates[i];
+      tpl.head = COLOR_CODES[color];
+      tpl.tail.clear();
+      if (log_name && log_timestamp) {
+        tpl.head += "[" + name + ", ";
+        tpl.tail = "] ";
+      } else {
+        if (log_name) tpl.head += "[" + name + "] ";
+        if (log_timestamp) {
+          tpl.head += "[";
+          tpl.tail = "] ";
+        }
+      }
+      tpl.end = color ? __ansi_default : "";
+      if (newline) tpl.end += '\n';
+    }
+  }
+
+ public:
+  LoggerImpl() :
+    name(""), timestamp_precision(TimestampPrecision::SECONDS),
+    raw_timestamps(false), max_string_length(CPPLOG_MX_STR_LEN),
+    max_elements(CPPLOG_MX_ELS), colors(true) {
+    build_templates();
+  }
+
+  void set_name(const std::string &_name) {
+    if (name == _name) return;
+    name = _name;
+    build_templates();
+  }
+
+  // highlight records according to the LogFmt::HIGHLIGHT_* options
+  // (the templates without colors are looked up instead)
+  void set_colors(bool _colors) {
+    colors = _colors;
+  }
+
+  void set_timestamp_precision(TimestampPrecision precision) {
+    timestamp_precision = precision;
+  }
+
+  void set_raw_timestamps(bool raw) {
+    raw_timestamps = raw;
+  }
+
+  void set_max_string_length(size_t length) {
+    max_string_length = length;
+  }
+
+  void set_max_elements(size_t n_elements) {
+    max_elements = n_elements;
+  }
+
+  // write the current time into the stream
+  void log_timestamp(std::ostream &stream) {
+    uint64_t ticks = timestamp_now(timestamp_precision);
+
+    if (raw_timestamps) {
+      RecordStream *record = dynamic_cast<RecordStream *>(&stream);
+      if (record) {
+        record->defer_timestamp(ticks, timestamp_precision);
+        return;
+      }
+    }
+
+    char time_str[CPPLOG_MX_TIMESTAMP_LEN];
+    size_t time_len = TimestampCache::local().render(
+      ticks, timestamp_precision, time_str);
+    stream.write(time_str, time_len);
+  }
+
+  /*
+   * initialize the log msg based on the log format options;
+   * the passed type needs to have an operator<< overload and
+   * will be passed directly into the stream
+   */
+  template<typename T>
+  void parse_fmt_opts(std::ostream &stream, const T &t,
+                      LogFormat fmt, size_t type_size = 0) {
+    // color, name and brackets are copied from the template of the format
+    const RecordTemplate &tpl = record_template(fmt);
+    stream.write(tpl.head.data(),
+                 static_cast<std::streamsize>(tpl.head.size()));
+    if (fmt & LogFmt::TIMESTAMP) {
+      this->log_timestamp(stream);
+      stream.write(tpl.tail.data(),
+                   static_cast<std::streamsize>(tpl.tail.size()));
+    }
+
+    // add type to stream (without any special formatting)
+    stream << t;
+
+    // print estimtated size of type (in bytes)
+    if (fmt & LogFmt::TYPE_SIZE) {
+      stream << " (SIZE ~= ";
+      if (type_size) {
+        stream << type_size;
+      } else {
+        stream << sizeof(t);
+      }
+      stream << " bytes)";
+    }
+
+    // reset to default colors again (if a color was set) + newline
+    stream.write(tpl.end.data(), static_cast<std::streamsize>(tpl.end.size()));
+  }
+
+  /*
+   * log all other values (numbers of every arithmetic type, characters,
+   * pointers, enums, durations, optionals, variants and custom types)
+   * with their formatter (see cpplog::formatter)
+   */
+  template<typename T,
+           typename std::enable_if<
+             !is_loggable_range<T>::value &&
+             !std::is_convertible<const T &, std::string_view>::value,
+             int>::type = 0>
+  void log(std::ostream &stream, const T &value, LogFormat fmt) {
+    parse_fmt_opts(stream, FormattedValue<T>{value}, fmt, sizeof(T));
+  }
+
+  // log booleans
+  void log(std::ostream &stream, bool b, LogFormat fmt) {
+    const char *bool_val = b ? "true" : "false";
+    parse_fmt_opts(stream, bool_val, fmt, 1);
+  }
+
+  // log std::pair
+  template<typename T, typename U>
+  void log(std::ostream &stream, const std::pair<T, U> &p, LogFormat fmt) {
+    parse_fmt_opts(stream, p, fmt);
+  }
+
+  /*
+   * log strings (shortened to 'String: "<head>... <tail>"' if too long);
+   * control chars are escaped, so the string can't break the record
+   */
+  void log(std::ostream &stream, std::string_view str, LogFormat fmt) {
+    size_t str_len = str.size();
+
+    if (fmt & LogFmt::VERBOSE || max_string_length == 0 ||
+        str_len < max_string_length) {
+      parse_fmt_opts(stream, sanitized(str), fmt, str_len);
+    } else {
+      size_t border = max_string_length / 2 < 8 ? max_string_length / 2 : 8;
+      parse_fmt_opts(stream, TruncatedStringWriter{str, border}, fmt,
+                     str_len);
+    }
+  }
+
+  // log C string (length and control chars are found in one scan)
+  void log(std::ostream &stream, const char *str, LogFormat fmt) {
+    StringScan scan = scan_cstr(str);
+    std::string_view view(str, scan.size);
+
+    if (fmt & LogFmt::VERBOSE || max_string_length == 0 ||
+        scan.size < max_string_length) {
+      parse_fmt_opts(stream, SanitizedString{view, scan.first_control}, fmt,
+                     scan.size);
+    } else {
+      log(stream, view, fmt);
+    }
+  }
+
+  // log std::string
+  void log(std::ostream &stream, const std::string &str, LogFormat fmt) {
+    log(stream, std::string_view(str), fmt);
+  }
+
+  /*
+   * log any range (std containers, arrays, spans, nested containers, ...);
+   * ranges with max_elements or more elements only log their first and
+   * last elements (see write_range), without copying anything
+   */
+  template<typename Range,
+           typename std::enable_if<is_loggable_range<Range>::value,
+                                   int>::type = 0>
+  void log(std::ostream &stream, const Range &range, LogFormat fmt) {
+    using Element = typename std::decay<
+      decltype(*std::begin(range))>::type;
+    size_t size_in_bytes = range_size(range) * sizeof(Element);  // estimate
+    if (!size_in_bytes) size_in_bytes = sizeof(range);
+
+    size_t limit = fmt & LogFmt::VERBOSE ? 0 : max_elements;
+    parse_fmt_opts(stream, RangeWriter<Range>{range, limit}, fmt,
+                   size_in_bytes);
+  }
+};
+
+// ### memory pools ###
+
+/*
+ * source of the memory of FormatBuffers that outgrow their inline storage
+ * and of parsed format strings; a Logger can be given its own (see
+ * Logger::set_allocator), size is always passed to deallocate again
+ */
+class Allocator {
+ public:
+  virtual ~Allocator() = default;
+
+  virtual void *allocate(size_t size) = 0;
+  virtual void deallocate(void *ptr, size_t size) = 0;
+};
+
+// plain operator new/delete
+class HeapAllocator : public Allocator {
+ public:
+  void *allocate(size_t size) override {
+    return ::operator new(size);
+  }
+
+  void deallocate(void *ptr, size_t) override {
+    ::operator delete(ptr);
+  }
+};
+
+/*
+ * recycles blocks of 2^n bytes (64 bytes up to CPPLOG_POOL_MAX_BLOCK);
+ * freed blocks go onto a free list of the freeing thread and once that
+ * one holds more than CPPLOG_POOL_THREAD_CACHE bytes, half of it moves to
+ * a shared list that threads with empty free lists refill from, so
+ * blocks allocated by producers and freed by the writer thread (or the
+ * other way round) are reused as well; in steady state no block is
+ * taken from the global heap
+ */
+class BlockPool {
+ private:
+  static constexpr unsigned MIN_BLOCK_BITS = 6;
+  static constexpr unsigned N_CLASSES = 11;  // 64 bytes to 64 KiB
+  static_assert((size_t(1) << (MIN_BLOCK_BITS + N_CLASSES - 1)) >=
+                CPPLOG_POOL_MAX_BLOCK, "too few block sizes");
+
+  struct Block {
+    Block *next;
+  };
+
+  struct FreeList {
+    Block *head = nullptr;
+    size_t count = 0;
+
+    void push(Block *block) {
+      block->next = head;
+      head = block;
+      ++count;
+    }
+
+    Block *pop() {
+      Block *block = head;
+      head = block->next;
+      --count;
+      return block;
+    }
+
+    // move up to n blocks to other
+    void move(FreeList &other, size_t n) {
+      for (; n && head; --n) other.push(pop());
+    }
+  };
+
+  struct ThreadCache {
+    FreeList lists[N_CLASSES];
+    bool *destroyed;
+
+    explicit ThreadCache(bool *destroyed_flag) : destroyed(destroyed_flag) {}
+
+    // the blocks of exiting threads are kept for the other threads
+    ~ThreadCache() {
+      *destroyed = true;
+      std::lock_guard<std::mutex> lock(_shared_mutex());
+      for (unsigned cls = 0; cls < N_CLASSES; ++cls) {
+        lists[cls].move(_shared()[cls], lists[cls].count);
+      }
+    }
+  };
+
+  static constexpr size_t _block_size(unsigned cls) {
+    return size_t(1) << (MIN_BLOCK_BITS + cls);
+  }
+
+  static unsigned _size_class(size_t size) {
+    if (size <= _block_size(0)) return 0;
+    return highest_bit(size - 1) + 1 - MIN_BLOCK_BITS;
+  }
+
+  static constexpr size_t _cache_limit(unsigned cls) {
+    return CPPLOG_POOL_THREAD_CACHE / _block_size(cls) > 4 ?
+      CPPLOG_POOL_THREAD_CACHE / _block_size(cls) : 4;
+  }
+
+  // never destroyed, threads might still free blocks during exit
+  static FreeList *_shared() {
+    static FreeList *lists = new FreeList[N_CLASSES];
+    return lists;
+  }
+
+  static std::mutex &_shared_mutex() {
+    static std::mutex *mutex = new std::mutex();
+    return *mutex;
+  }
+
+  // nullptr once the thread's cache was destroyed (during thread exit)
+  static ThreadCache *_cache() {
+    static thread_local bool destroyed = false;
+    if (destroyed) return nullptr;
+    _shared();
+    _shared_mutex();  // both have to outlive the cache
+    static thread_local ThreadCache cache(&destroyed);
+    return &cache;
+  }
+
+ public:
+  static void *allocate(size_t size) {
+    if (size > CPPLOG_POOL_MAX_BLOCK) return ::operator new(size);
+
+    unsigned cls = _size_class(size);
+    ThreadCache *cache = _cache();
+    if (cache) {
+      FreeList &list = cache->lists[cls];
+      if (!list.head) {
+        std::lock_guard<std::mutex> lock(_shared_mutex());
+        _shared()[cls].move(list, _cache_limit(cls) / 2);
+      }
+      if (list.head) return list.pop();
+    }
+    return ::operator new(_block_size(cls));
+  }
+
+  static void deallocate(void *ptr, size_t size) {
+    if (size > CPPLOG_POOL_MAX_BLOCK) {
+      ::operator delete(ptr);
+      return;
+    }
+
+    unsigned cls = _size_class(size);
+    Block *block = static_cast<Block *>(ptr);
+    ThreadCache *cache = _cache();
+    if (!cache) {
+      std::lock_guard<std::mutex> lock(_shared_mutex());
+      _shared()[cls].push(block);
+      return;
+    }
+
+    FreeList &list = cache->lists[cls];
+    list.push(block);
+    if (list.count > _cache_limit(cls)) {
+      std::lock_guard<std::mutex> lock(_shared_mutex());
+      list.move(_shared()[cls], list.count / 2);
+    }
+  }
+};
+
+// the default Allocator: blocks of the BlockPool
+class PoolAllocator : public Allocator {
+ public:
+  void *allocate(size_t size) override {
+    return BlockPool::allocate(size);
+  }
+
+  void deallocate(void *ptr, size_t size) override {
+    BlockPool::deallocate(ptr, size);
+  }
+};
+
+// never destroyed, static buffers might still be freed during exit
+inline Allocator &default_allocator() {
+  static Allocator *allocator = new PoolAllocator();
+  return *allocator;
+}
+
+// std allocator interface for containers that use an Allocator
+template<typename T>
+class StdAllocator {
+ private:
+  Allocator *_allocator;
+
+  template<typename U>
+  friend class StdAllocator;
+
+ public:
+  using value_type = T;
+
+  explicit StdAllocator(Allocator &allocator) : _allocator(&allocator) {}
+
+  template<typename U>
+  StdAllocator(const StdAllocator<U> &other) :
+    _allocator(other._allocator) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(_allocator->allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T *ptr, size_t n) {
+    _allocator->deallocate(ptr, n * sizeof(T));
+  }
+
+  template<typename U>
+  bool operator==(const StdAllocator<U> &other) const {
+    return _allocator == other._allocator;
+  }
+
+  template<typename U>
+  bool operator!=(const StdAllocator<U> &other) const {
+    return _allocator != other._allocator;
+  }
+};
+
+// ##########################################################
+
+// ### formatting buffers ###
+
+/*
+ * character buffer that formatted messages are written into;
+ * the first CPPLOG_FORMAT_BUFFER_SIZE bytes are stored inside of the
+ * object itself (so usually on the stack), only longer messages
+ * spill into memory of the Allocator (by default pooled blocks)
+ */
+class FormatBuffer {
+ private:
+  char _stack[CPPLOG_FORMAT_BUFFER_SIZE];
+  char *_data;
+  size_t _size;
+  size_t _capacity;
+  Allocator *_allocator;
+
+  void _grow(size_t min_capacity) {
+    // powers of 2, the sizes of the pooled blocks
+    size_t capacity = _capacity * 2;
+    while (capacity < min_capacity) capacity *= 2;
+
+    char *data = static_cast<char *>(_allocator->allocate(capacity));
+    std::memcpy(data, _data, _size);
+    if (_data != _stack) _allocator->deallocate(_data, _capacity);
+
+    _data = data;
+    _capacity = capacity;
+  }
+
+ public:
+  explicit FormatBuffer(Allocator &allocator = default_allocator()) :
+    _data(_stack), _size(0), _capacity(sizeof(_stack)),
+    _allocator(&allocator) {}
+
+  ~FormatBuffer() {
+    if (_data != _stack) _allocator->deallocate(_data, _capacity);
+  }
+
+  FormatBuffer(const FormatBuffer &) = delete;
+  FormatBuffer &operator=(const FormatBuffer &) = delete;
+
+  // make room for n more bytes and return a pointer to the first one
+  // (call commit afterwards with the number of bytes actually written)
+  char *reserve(size_t n) {
+    if (_size + n > _capacity) _grow(_size + n);
+    return _data + _size;
+  }
+
+  void commit(size_t n) {
+    _size += n;
+  }
+
+  void append(const char *str, size_t n) {
+    if (!n) return;
+    std::memcpy(reserve(n), str, n);
+    _size += n;
+  }
+
+  void append(std::string_view str) {
+    append(str.data(), str.size());
+  }
+
+  void push_back(char chr) {
+    *reserve(1) = chr;
+    ++_size;
+  }
+
+  // append n copies of chr
+  void fill(char chr, size_t n) {
+    if (!n) return;
+    std::memset(reserve(n), chr, n);
+    _size += n;
+  }
+
+  void clear() {
+    _size = 0;
+  }
+
+  char *data() {
+    return _data;
+  }
+
+  const char *data() const {
+    return _data;
+  }
+
+  size_t size() const {
+    return _size;
+  }
+
+  std::string_view view() const {
+    return std::string_view(_data, _size);
+  }
+};
+
+// std::streambuf that appends everything to a FormatBuffer
+class FormatBufferStreambuf : public std::streambuf {
+ private:
+  FormatBuffer *_target;
+
+ protected:
+  int_type overflow(int_type chr) override {
+    if (!traits_type::eq_int_type(chr, traits_type::eof())) {
+      _target->push_back(traits_type::to_char_type(chr));
+    }
+    return traits_type::not_eof(chr);
+  }
+
+  std::streamsize xsputn(const char *str, std::streamsize n) override {
+    _target->append(str, static_cast<size_t>(n));
+    return n;
+  }
+
+ public:
+  FormatBufferStreambuf() : _target(nullptr) {}
+
+  // redirect the output to target; returns the previous target
+  FormatBuffer *set_target(FormatBuffer *target) {
+    FormatBuffer *prev = _target;
+    _target = target;
+    return prev;
+  }
+};
+
+/*
+ * fallback for types that can only be written with operator<<;
+ * every thread reuses one std::ostream for this, so no stream
+ * has to be constructed per formatted argument
+ */
+template<typename T>
+void stream_into(FormatBuffer &out, const T &t) {
+  static thread_local FormatBufferStreambuf buf;
+  static thread_local std::ostream stream(&buf);
+
+  // restore the previous target afterwards, since operator<<
+  // of t might format something itself
+  FormatBuffer *prev = buf.set_target(&out);
+  stream.clear();
+  stream << t;
+  buf.set_target(prev);
+}
+
+// ##########################################################
+
+// ### format strings ###
+
+/*
+ * contains data of a to-be-formatted object from the format string;
+ * the format string can parse decimal numbers, floating point numbers,
+ * strings, objects and characters. Formatting can be specified in curly
+ * brackets with Python/printf-like syntax:
+ *   {_>10.2f} -> left-padded w/ '_', 10 chars, 2 decimal place float
+ *   {0>8d< }   -> left-padded w/ '0, 8 chars, decimal, right-padded w/ ' '
+ * supported format specifiers (have to be inside {...}):
+ *   - '>' : any character put before '>' will be used to left-pad
+ *     the to-be-printed type (if a max character size was also specified);
+ *     '>' should be the 2nd character in the specified format
+ *   - max character size: limit the number of characters the to-be-printed
+ *     output can have; this number should be either the first number
+ *     of the format or put after the '>' specifier (for left-padding)
+ *   - '.' : specify the number of decimal places after a floating-point
+ *     number after this character
+ *   - 'd' | 'f' | 's' | 'o' | 'c' | 'b' : specify that the to-be-printed
+ *     parameter is a decimal number, floating-point number, string, object,
+ *     character or boolean
+ *   - '<' : any character put after '<' will be used to right-pad
+ *     the to-be-printed type (if a max character size was also specified);
+ *     '>' should be the 2nd to last character in the specified format
+ */
+struct FormatStringObject {
+  enum FORMAT {
+   NONE           = '\0',
+   INT            = 'd',
+   FLOAT          = 'f',
+   STRING         = 's',
+   CHAR           = 'c',
+   BOOL           = 'b',
+   OBJECT         = 'o',
+   OPEN           = '{',
+   CLOSE          = '}',
+   DECIMAL_PLACES = '.',
+   PAD_LEFT       = '>',
+   PAD_RIGHT      = '<'
+  };
+
+  FORMAT type;
+  char left_pad_chr, right_pad_chr;
+
+  // a '.' was given (so "{.0f}" means 0 decimal places, not the default)
+  bool has_decimal_places;
+  uint16_t mx_len, mx_decimal_places;
+
+  // start and end idx of the format specifier in the format string
+  int start_idx, end_idx;
+
+  constexpr FormatStringObject() :
+    type(NONE), left_pad_chr('\0'), right_pad_chr('\0'),
+    has_decimal_places(false), mx_len(0), mx_decimal_places(0),
+    start_idx(0), end_idx(0) {}
+
+  static void pad(FormatBuffer &out, int n, char pad_chr) {
+    if (n <= 0) return;
+    out.fill(pad_chr, n);
+  }
+
+  static constexpr bool is_number(char chr) {
+    return !(chr < '0' || chr > '9');
+  }
+
+  static std::string get_type(FORMAT type) {
+    switch (type) {
+      case FORMAT::INT    : return std::string("Decimal number");
+      case FORMAT::FLOAT  : return std::string("Floating-point number");
+      case FORMAT::STRING : return std::string("String");
+      case FORMAT::OBJECT : return std::string("Object");
+      case FORMAT::CHAR   : return std::string("Character");
+      case FORMAT::BOOL   : return std::string("Boolean");
+      default             : return std::string("None");
+    }
+  }
+
+  // parse a (multi-digit) number from format string
+  static constexpr uint16_t get_number(const char *fmt_str, int &fmt_str_idx) {
+    constexpr uint8_t MX_DIGITS = 3;
+    uint16_t number = 0;
+
+    for (uint8_t n_digits = 0; n_digits < MX_DIGITS &&
+         FormatStringObject::is_number(fmt_str[fmt_str_idx]); ++n_digits) {
+      number = number * 10 + (fmt_str[fmt_str_idx++] - '0');
+    }
+
+    return number;
+  }
+
+  friend std::ostream &operator<<(std::ostream &stream,
+                                  const FormatStringObject &obj) {
+    stream << "Type: " << FormatStringObject::get_type(obj.type)
+           << ", Left pad: '" << obj.left_pad_chr
+           << "', Right pad: '" << obj.right_pad_chr << "', Mx Length: "
+           << obj.mx_len << ", Mx decimal places: " << obj.mx_decimal_places
+           << "\n";
+    return stream;
+  }
+};
+
+// errors that can occur while parsing a format specifier
+enum class FormatError {
+  NONE,
+  UNKNOWN_SPECIFIER,  // unknown type character (not one of d, f, s, o, c, b)
+  MISSING_CLOSE,      // format specifier wasn't closed with '}'
+};
+
+/*
+ * parse the format specifier starting at fmt_str[i] (the '{') into obj;
+ * afterwards, i points to the first character after the specifier
+ * (or to the offending character if an error occured);
+ * this is constexpr, so the same parser is used for runtime
+ * format strings and for format strings parsed at compile time
+ */
+constexpr FormatError parse_format_object(const char *fmt_str, int &i,
+                                          FormatStringObject &obj) {
+  obj.start_idx = i;
+  ++i;
+
+  // store left pad character (if specified, comes before '>')
+  if (fmt_str[i] != '\0' &&
+      fmt_str[i + 1] == FormatStringObject::PAD_LEFT) {
+    obj.left_pad_chr = fmt_str[i];
+    i += 2;
+  }
+
+  // store max number of characters of formatted argument
+  obj.mx_len = FormatStringObject::get_number(fmt_str, i);
+
+  // store max number of decimal places after floating point number
+  if (fmt_str[i] == FormatStringObject::DECIMAL_PLACES) {
+    ++i;
+    obj.has_decimal_places = true;
+    obj.mx_decimal_places = FormatStringObject::get_number(fmt_str, i);
+  }
+
+  // store type specifier
+  switch (fmt_str[i]) {
+    case FormatStringObject::INT :
+      obj.type = FormatStringObject::INT;
+      break;
+    case FormatStringObject::FLOAT :
+      obj.type = FormatStringObject::FLOAT;
+      break;
+    case FormatStringObject::STRING :
+      obj.type = FormatStringObject::STRING;
+      break;
+    case FormatStringObject::OBJECT :
+      obj.type = FormatStringObject::OBJECT;
+      break;
+    case FormatStringObject::CHAR:
+      obj.type = FormatStringObject::CHAR;
+      break;
+    case FormatStringObject::BOOL:
+      obj.type = FormatStringObject::BOOL;
+      break;
+    default:
+      return FormatError::UNKNOWN_SPECIFIER;
+  }
+  ++i;
+
+  // store right-pad character (if it was specified, comes after '<')
+  if (fmt_str[i] == FormatStringObject::PAD_RIGHT) {
+    ++i;
+    obj.right_pad_chr = fmt_str[i++];
+  }
+
+  if (fmt_str[i] != FormatStringObject::CLOSE) {
+    return FormatError::MISSING_CLOSE;
+  }
+
+  obj.end_idx = ++i;
+  return FormatError::NONE;
+}
+
+// format specifiers of a runtime format string (in pooled memory)
+using FormatObjects =
+  std::vector<FormatStringObject, StdAllocator<FormatStringObject>>;
+
+/*
+ * parse all format specifiers of a format string at runtime into
+ * fmt_objs; stops at the first malformed specifier and returns its
+ * error (error_idx is then set to the offending character)
+ */
+template<typename Objects>
+FormatError try_parse_format_string(const char *fmt_str, Objects &fmt_objs,
+                                    int *error_idx = nullptr) {
+  for (int i = 0; fmt_str[i] != '\0';) {
+    if (fmt_str[i] == FormatStringObject::OPEN) {
+      FormatStringObject obj;
+      FormatError error = parse_format_object(fmt_str, i, obj);
+      if (error != FormatError::NONE) {
+        if (error_idx) *error_idx = i;
+        return error;
+      }
+      fmt_objs.push_back(obj);
+    } else {
+      ++i;
+    }
+  }
+  return FormatError::NONE;
+}
+
+/*
+ * parse all format specifiers of a format string at runtime into
+ * fmt_objs; a malformed specifier is a programming error of the caller,
+ * which ends the process (see try_parse_format_string for strings that
+ * come from elsewhere)
+ */
+template<typename Objects>
+void parse_format_string(const char *fmt_str, Objects &fmt_objs) {
+  int i = 0;
+  switch (try_parse_format_string(fmt_str, fmt_objs, &i)) {
+    case FormatError::UNKNOWN_SPECIFIER:
+      std::cerr << "Error: Unknown format specifier '"
+                << fmt_str[i] << "'\n";
+      std::exit(1);
+    case FormatError::MISSING_CLOSE:
+      std::cerr << "Error: Expected '" << FormatStringObject::CLOSE
+                << "', found '" << fmt_str[i] << "'!\n";
+      std::exit(1);
+    case FormatError::NONE:
+      break;
+  }
+}
+
+inline std::vector<FormatStringObject> parse_format_string(
+    const char *fmt_str) {
+  std::vector<FormatStringObject> fmt_objs;
+  parse_format_string(fmt_str, fmt_objs);
+  return fmt_objs;
+}
+
+// ### compile-time format strings ###
+
+constexpr size_t format_string_length(const char *fmt_str) {
+  size_t len = 0;
+  while (fmt_str[len] != '\0') ++len;
+  return len;
+}
+
+/*
+ * parse all format specifiers of a format string during constant
+ * evaluation and store them in objs (if objs isn't nullptr);
+ * returns the number of format specifiers; an invalid format string
+ * hits one of the throw expressions, which turns it into a compile error
+ */
+constexpr size_t parse_format_string_static(const char *fmt_str,
+                                            FormatStringObject *objs) {
+  size_t count = 0;
+
+  for (int i = 0; fmt_str[i] != '\0';) {
+    if (fmt_str[i] == FormatStringObject::OPEN) {
+      FormatStringObject obj;
+
+      switch (parse_format_object(fmt_str, i, obj)) {
+        case FormatError::UNKNOWN_SPECIFIER:
+          throw std::invalid_argument("cpplog: unknown format specifier");
+        case FormatError::MISSING_CLOSE:
+          throw std::invalid_argument("cpplog: format specifier not closed");
+        case FormatError::NONE:
+          break;
+      }
+
+      if (objs) objs[count] = obj;
+      ++count;
+    } else {
+      ++i;
+    }
+  }
+
+  return count;
+}
+
+template<size_t N>
+constexpr std::array<FormatStringObject, N> parse_format_objects(
+    const char *fmt_str) {
+  std::array<FormatStringObject, N> objs{};
+  parse_format_string_static(fmt_str, objs.data());
+  return objs;
+}
+
+/*
+ * string argument that is only referenced by a deferred record instead of
+ * being copied (see Logger::set_deferred_formatting); the referenced
+ * characters have to stay valid until the record was written, i.e. until
+ * the next flush() of the Logger returns (e.g. string literals or strings
+ * owned by the program for its entire runtime); everywhere else it is
+ * logged like a std::string_view
+ */
+struct StringRef {
+  std::string_view str;
+
+  operator std::string_view() const {
+    return str;
+  }
+};
+
+inline std::ostream &operator<<(std::ostream &stream, StringRef ref) {
+  return stream << ref.str;
+}
+
+inline StringRef string_ref(std::string_view str) {
+  return StringRef{str};
+}
+
+// check if an argument of type T may be logged with a format specifier
+template<typename T>
+constexpr bool format_accepts(FormatStringObject::FORMAT type) {
+  using U = typename std::decay<T>::type;
+
+  constexpr bool is_char = std::is_same<U, char>::value ||
+                           std::is_same<U, signed char>::value ||
+                           std::is_same<U, unsigned char>::value;
+  constexpr bool is_bool = std::is_same<U, bool>::value;
+  constexpr bool is_string = std::is_same<U, const char *>::value ||
+                             std::is_same<U, char *>::value ||
+                             std::is_same<U, std::string>::value ||
+                             std::is_same<U, std::string_view>::value ||
+                             std::is_same<U, StringRef>::value;
+
+  switch (type) {
+    case FormatStringObject::INT:
+      return std::is_integral<U>::value && !is_char && !is_bool;
+    case FormatStringObject::FLOAT:
+      return std::is_floating_point<U>::value;
+    case FormatStringObject::STRING:
+      return is_string;
+    case FormatStringObject::CHAR:
+      return is_char;
+    case FormatStringObject::BOOL:
+      return is_bool;
+    case FormatStringObject::OBJECT:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/*
+ * format string that was parsed at compile time;
+ * Str has to provide a "static constexpr const char *value()" method
+ * returning the format string (use the CPPLOG_FMT macro or, with C++20,
+ * the cpplog::fmt<"..."> variable template to create one)
+ */
+template<class Str>
+struct CompiledFormat {
+  static constexpr const char *str = Str::value();
+  static constexpr size_t length = format_string_length(Str::value());
+  static constexpr size_t count =
+    parse_format_string_static(Str::value(), nullptr);
+  static constexpr std::array<FormatStringObject, count> objs =
+    parse_format_objects<count>(Str::value());
+
+  // turn a mismatch between format specifiers and arguments
+  // into a compile error
+  template<typename ...T>
+  static constexpr void check_args() {
+    static_assert(sizeof...(T) == count,
+                  "cpplog: number of arguments doesn't match the number "
+                  "of format specifiers");
+    _check_args<T...>(std::make_index_sequence<sizeof...(T)>());
+  }
+
+ private:
+  template<typename ...T, size_t ...I>
+  static constexpr void _check_args(std::index_sequence<I...>) {
+    static_assert((format_accepts<T>(objs[I].type) && ...),
+                  "cpplog: argument type doesn't match its format "
+                  "specifier (d: integer, f: floating-point, s: string, "
+                  "c: character, b: boolean, o: any object)");
+  }
+};
+
+// (C++17) create a CompiledFormat from a string literal
+#define CPPLOG_FMT(fmt_str)                                          \
+  ([]() {                                                            \
+    struct _cpplog_fmt_str {                                         \
+      static constexpr const char *value() { return fmt_str; }       \
+    };                                                               \
+    return ::cpplog::CompiledFormat<_cpplog_fmt_str>();              \
+  }())
+
+#if __cplusplus >= 202002L
+// string literal that can be used as a template argument
+template<size_t N>
+struct FixedString {
+  char data[N] = {};
+
+  constexpr FixedString(const char (&fmt_str)[N]) {
+    for (size_t i = 0; i < N; ++i) data[i] = fmt_str[i];
+  }
+};
+
+template<FixedString S>
+struct FixedStringValue {
+  static constexpr const char *value() { return S.data; }
+};
+
+// (C++20) compile-time format string, e.g. cpplog::fmt<"{0>4d}">
+template<FixedString S>
+inline constexpr CompiledFormat<FixedStringValue<S>> fmt{};
+#endif
+
+// ##########################################################
+
+// ### formatting engine ###
+
+// append an integer (w/o going through a std::ostream)
+template<typename T>
+void format_integer(FormatBuffer &out, T value) {
+  constexpr size_t MX_DIGITS = 24;
+  char *first = out.reserve(MX_DIGITS);
+  std::to_chars_result res = std::to_chars(first, first + MX_DIGITS, value);
+  out.commit(res.ptr - first);
+}
+
+/*
+ * print value into [first, last); returns the end of the printed number
+ * (nullptr if it doesn't fit)
+ */
+template<typename T>
+char *print_float(char *first, char *last, T value, int decimal_places) {
+#ifdef __cpp_lib_to_chars
+  std::to_chars_result res = decimal_places >= 0 ?
+    std::to_chars(first, last, value, std::chars_format::fixed,
+                  decimal_places) :
+    std::to_chars(first, last, value, std::chars_format::general, 6);
+  return res.ec == std::errc() ? res.ptr : nullptr;
+#else
+  size_t size = static_cast<size_t>(last - first);
+  int n;
+  if constexpr (std::is_same<T, long double>::value) {
+    n = decimal_places >= 0 ?
+      std::snprintf(first, size, "%.*Lf", decimal_places, value) :
+      std::snprintf(first, size, "%Lg", value);
+  } else {
+    n = decimal_places >= 0 ?
+      std::snprintf(first, size, "%.*f", decimal_places,
+                    static_cast<double>(value)) :
+      std::snprintf(first, size, "%g", static_cast<double>(value));
+  }
+  return n >= 0 && static_cast<size_t>(n) < size ? first + n : nullptr;
+#endif
+}
+
+/*
+ * append a floating-point number; with decimal_places >= 0 the number
+ * is rounded to exactly that many decimal places, otherwise it is
+ * printed like a std::ostream would (6 significant digits); only huge
+ * numbers in fixed notation reserve more than a few bytes of out
+ */
+template<typename T>
+void format_float(FormatBuffer &out, T value, int decimal_places = -1) {
+  constexpr size_t MX_CHARS = 64;
+  char *first = out.reserve(MX_CHARS);
+  char *last = print_float(first, first + MX_CHARS, value, decimal_places);
+  if (!last) {
+    // largest number of T in fixed notation + sign, point and decimals
+    size_t mx_chars = std::numeric_limits<T>::max_exponent10 + 3 +
+                      (decimal_places > 0 ? decimal_places : 0);
+    first = out.reserve(mx_chars);
+    last = print_float(first, first + mx_chars, value, decimal_places);
+    if (!last) last = first;
+  }
+  out.commit(last - first);
+}
+
+// append a string with all control chars escaped (see sanitize_string)
+inline void append_sanitized(FormatBuffer &out, std::string_view str,
+                             size_t first_control) {
+  sanitize_string(str, first_control, [&out](const char *data, size_t n) {
+    out.append(data, n);
+  });
+}
+
+/*
+ * writes values of type T into a FormatBuffer; everything that logs a
+ * value goes through it (single values, format string arguments,
+ * structured fields and arguments that binary or deferred records have
+ * to turn into text), so a specialization is all a type needs:
+ *   template<>
+ *   struct cpplog::formatter<Vec3> {
+ *     static void format(cpplog::FormatBuffer &out, const Vec3 &vec) {...}
+ *   };
+ * cpplog specializes it for all arithmetic types, strings, pointers,
+ * enums, std::chrono durations, std::optional and std::variant; all
+ * other types are written with their operator<<
+ */
+template<typename T, typename = void>
+struct formatter {
+  static void format(FormatBuffer &out, const T &value) {
+    stream_into(out, value);
+  }
+};
+
+template<typename T>
+void format_value(FormatBuffer &out, const T &arg);
+
+// types operator<< writes as characters (not as numbers)
+template<typename T>
+struct is_character : std::integral_constant<bool,
+  std::is_same<T, char>::value || std::is_same<T, signed char>::value ||
+  std::is_same<T, unsigned char>::value> {};
+
+// character types that are no numbers either (written by operator<<)
+template<typename T>
+struct is_wide_character : std::integral_constant<bool,
+  std::is_same<T, wchar_t>::value || std::is_same<T, char16_t>::value ||
+#ifdef __cpp_char8_t
+  std::is_same<T, char8_t>::value ||
+#endif
+  std::is_same<T, char32_t>::value> {};
+
+/*
+ * check if T has an operator<< of its own, besides the conversion of
+ * unscoped enums to int (which is ambiguous in this form)
+ */
+template<typename T, typename = void>
+struct has_stream_operator : std::false_type {};
+
+template<typename T>
+struct has_stream_operator<T, std::void_t<decltype(operator<<(
+  std::declval<std::ostream &>(), std::declval<const T &>()))>>
+  : std::true_type {};
+
+// (as digits, like operator<<)
+template<>
+struct formatter<bool> {
+  static void format(FormatBuffer &out, bool value) {
+    out.push_back(value ? '1' : '0');
+  }
+};
+
+template<typename T>
+struct formatter<T, typename std::enable_if<is_character<T>::value>::type> {
+  static void format(FormatBuffer &out, T value) {
+    out.push_back(static_cast<char>(value));
+  }
+};
+
+template<typename T>
+struct formatter<T, typename std::enable_if<
+    std::is_integral<T>::value && !std::is_same<T, bool>::value &&
+    !is_character<T>::value && !is_wide_character<T>::value>::type> {
+  static void format(FormatBuffer &out, T value) {
+    format_integer(out, value);
+  }
+};
+
+template<typename T>
+struct formatter<T, typename std::enable_if<
+    std::is_floating_point<T>::value>::type> {
+  static void format(FormatBuffer &out, T value) {
+    format_float(out, value);
+  }
+};
+
+// (control chars are escaped)
+template<>
+struct formatter<const char *> {
+  static void format(FormatBuffer &out, const char *str) {
+    if (!str) return;
+    StringScan scan = scan_cstr(str);
+    append_sanitized(out, std::string_view(str, scan.size),
+                     scan.first_control);
+  }
+};
+
+template<>
+struct formatter<char *> : formatter<const char *> {};
+
+template<typename T>
+struct formatter<T, typename std::enable_if<
+    !std::is_pointer<T>::value &&
+    std::is_convertible<const T &, std::string_view>::value>::type> {
+  static void format(FormatBuffer &out, const T &value) {
+    std::string_view str(value);
+    append_sanitized(out, str, find_escape<false>(str.data(), str.size()));
+  }
+};
+
+template<>
+struct formatter<std::nullptr_t> {
+  static void format(FormatBuffer &out, std::nullptr_t) {
+    out.append("nullptr", 7);
+  }
+};
+
+// object pointers as hex addresses ("0x7ffd5e8c", null as "nullptr")
+template<typename T>
+struct formatter<T *, typename std::enable_if<
+    !std::is_function<T>::value &&
+    !is_character<typename std::remove_cv<T>::type>::value>::type> {
+  static void format(FormatBuffer &out, const T *value) {
+    if (!value) {
+      out.append("nullptr", 7);
+      return;
+    }
+    constexpr size_t MX_CHARS = 2 + 2 * sizeof(uintptr_t);
+    char *first = out.reserve(MX_CHARS);
+    first[0] = '0';
+    first[1] = 'x';
+    std::to_chars_result res = std::to_chars(
+      first + 2, first + MX_CHARS, reinterpret_cast<uintptr_t>(value), 16);
+    out.commit(res.ptr - first);
+  }
+};
+
+// enums as their underlying number (unless they have an operator<<)
+template<typename T>
+struct formatter<T, typename std::enable_if<
+    std::is_enum<T>::value && !has_stream_operator<T>::value>::type> {
+  static void format(FormatBuffer &out, T value) {
+    format_integer(out, +static_cast<
+      typename std::underlying_type<T>::type>(value));
+  }
+};
+
+// the count and the unit ("15ms", "3[1/30]s"; "us" for microseconds)
+template<typename Rep, typename Period>
+struct formatter<std::chrono::duration<Rep, Period>> {
+  static void format(FormatBuffer &out,
+                     const std::chrono::duration<Rep, Period> &value) {
+    format_value(out, value.count());
+
+    if constexpr (std::is_same<Period, std::nano>::value) {
+      out.append("ns", 2);
+    } else if constexpr (std::is_same<Period, std::micro>::value) {
+      out.append("us", 2);
+    } else if constexpr (std::is_same<Period, std::milli>::value) {
+      out.append("ms", 2);
+    } else if constexpr (std::is_same<Period, std::ratio<1>>::value) {
+      out.push_back('s');
+    } else if constexpr (std::is_same<Period, std::ratio<60>>::value) {
+      out.append("min", 3);
+    } else if constexpr (std::is_same<Period, std::ratio<3600>>::value) {
+      out.push_back('h');
+    } else if constexpr (std::is_same<Period, std::ratio<86400>>::value) {
+      out.push_back('d');
+    } else {
+      out.push_back('[');
+      format_integer(out, Period::num);
+      if (Period::den != 1) {
+        out.push_back('/');
+        format_integer(out, Period::den);
+      }
+      out.append("]s", 2);
+    }
+  }
+};
+
+template<typename T>
+struct formatter<std::optional<T>> {
+  static void format(FormatBuffer &out, const std::optional<T> &value) {
+    if (value) {
+      format_value(out, *value);
+    } else {
+      out.append("nullopt", 7);
+    }
+  }
+};
+
+template<>
+struct formatter<std::monostate> {
+  static void format(FormatBuffer &out, std::monostate) {
+    out.append("monostate", 9);
+  }
+};
+
+// (the alternative the variant holds)
+template<typename ...T>
+struct formatter<std::variant<T...>> {
+  static void format(FormatBuffer &out, const std::variant<T...> &value) {
+    if (value.valueless_by_exception()) {
+      out.append("valueless", 9);
+      return;
+    }
+    std::visit([&out](const auto &alternative) {
+      format_value(out, alternative);
+    }, value);
+  }
+};
+
+/*
+ * append the plain value of an argument (with its formatter);
+ * control chars of strings are escaped
+ */
+template<typename T>
+void format_value(FormatBuffer &out, const T &arg) {
+  // (char arrays decay to pointers here)
+  formatter<typename std::decay<T>::type>::format(out, arg);
+}
+
+/*
+ * writes a value with its formatter into a std::ostream (see
+ * LoggerImpl::log)
+ */
+template<typename T>
+struct FormattedValue {
+  const T &value;
+};
+
+template<typename T>
+std::ostream &operator<<(std::ostream &stream,
+                         const FormattedValue<T> &value) {
+  FormatBuffer buf;
+  format_value(buf, value.value);
+  stream.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+  return stream;
+}
+
+// append a single argument as specified by its format specifier
+template<typename T>
+void format_arg_value(FormatBuffer &out, const T &arg,
+                      const FormatStringObject &fmt_obj) {
+  using U = typename std::decay<const T &>::type;
+
+  switch (fmt_obj.type) {
+    case FormatStringObject::FLOAT :
+      if constexpr (std::is_arithmetic<U>::value) {
+        // (integers are printed as doubles, floats keep their type)
+        using F = typename std::conditional<
+          std::is_floating_point<U>::value, U, double>::type;
+        format_float(out, static_cast<F>(arg),
+                     fmt_obj.has_decimal_places ?
+                       fmt_obj.mx_decimal_places : -1);
+        return;
+      }
+      break;
+    case FormatStringObject::BOOL :
+      if constexpr (std::is_arithmetic<U>::value ||
+                    std::is_pointer<U>::value) {
+        const U value = arg;  // (char arrays decay here)
+        out.append(value ? std::string_view("true") :
+                           std::string_view("false"));
+      } else {
+        FormatBuffer tmp;
+        format_value(tmp, arg);
+        out.append(tmp.view() == "1" ? std::string_view("true") :
+                                       std::string_view("false"));
+      }
+      return;
+    default:
+      break;
+  }
+
+  format_value(out, arg);
+}
+
+// handle max length and padding of to-be-printed format argument
+inline void pad_fmt_arg(FormatBuffer &out, std::string_view arg,
+                        const FormatStringObject &fmt_obj) {
+  size_t str_len = arg.size();       // length of to-be-printed string arg
+  uint16_t mx_len = fmt_obj.mx_len;  // max length of to-be-printed arg
+  if (mx_len) {
+    if (mx_len < str_len) {
+      // no space for padding -> just print string until max is reached
+      out.append(arg.data(), mx_len);
+    } else {
+      // if left- AND right-padding was specified in the format,
+      // distribute the padding equally between left and right
+      // (left will be preferred if the max padding number is uneven)
+      uint16_t mx_padding = mx_len - str_len;
+      uint16_t mx_right_padding = mx_padding / 2;
+      uint16_t mx_left_padding = mx_padding - mx_right_padding;
+
+      mx_left_padding = mx_padding > 0 && fmt_obj.right_pad_chr != '\0' ?
+                          mx_left_padding: mx_padding;
+      mx_right_padding = mx_padding > 0 && fmt_obj.left_pad_chr != '\0' ?
+                           mx_right_padding : mx_padding;
+
+      // left-pad (no-op if no pad char was specified)
+      if (fmt_obj.left_pad_chr != '\0') {
+        FormatStringObject::pad(out, mx_left_padding, fmt_obj.left_pad_chr);
+      }
+
+      // print entire argument
+      out.append(arg);
+
+       // right-pad (no-op if no pad char was specified)
+      if (fmt_obj.right_pad_chr != '\0') {
+        FormatStringObject::pad(out, mx_right_padding, fmt_obj.right_pad_chr);
+      }
+    }
+  } else {
+    out.append(arg);
+  }
+}
+
+// format a single argument (incl. max length and padding)
+template<typename T>
+void format_arg(FormatBuffer &out, const T &arg,
+                const FormatStringObject &fmt_obj) {
+  if (!fmt_obj.mx_len) {
+    format_arg_value(out, arg, fmt_obj);
+    return;
+  }
+
+  // padding depends on the length of the formatted argument
+  FormatBuffer tmp;
+  format_arg_value(tmp, arg, fmt_obj);
+  pad_fmt_arg(out, tmp.view(), fmt_obj);
+}
+
+// terminate the variadic argument recursion and print the rest of
+// the text in the format string after the last format specifier
+inline void format_string_args(FormatBuffer &out,
+                               const FormatStringObject *fmt_objs,
+                               size_t n_objs, const char *fmt_str,
+                               size_t fmt_len, int start_idx, int end_idx,
+                               int obj_idx) {
+  (void)fmt_objs;
+  (void)n_objs;
+  (void)fmt_len;
+  (void)obj_idx;
+  out.append(fmt_str + start_idx, end_idx - start_idx);
+}
+
+/*
+ * write the text of fmt_str with all format specifiers replaced by the
+ * formatted arguments into out; start_idx/end_idx delimit the plain text
+ * before the format specifier fmt_objs[obj_idx]
+ */
+template<typename T, typename ...Tr>
+void format_string_args(FormatBuffer &out,
+                        const FormatStringObject *fmt_objs,
+                        size_t n_objs, const char *fmt_str,
+                        size_t fmt_len, int start_idx, int end_idx,
+                        int obj_idx, T &&first, Tr &&...rest) {
+  // log the regular string part before the current format specifier
+  out.append(fmt_str + start_idx, end_idx - start_idx);
+  format_arg(out, first, fmt_objs[obj_idx]);
+
+  // case where recursion anchor is called
+  if (obj_idx + 1 >= static_cast<int>(n_objs)) {
+    format_string_args(out, fmt_objs, n_objs, fmt_str, fmt_len,
+                       fmt_objs[obj_idx].end_idx,
+                       static_cast<int>(fmt_len), obj_idx,
+                       std::forward<Tr>(rest)...);
+  } else {
+    format_string_args(out, fmt_objs, n_objs, fmt_str, fmt_len,
+                       fmt_objs[obj_idx].end_idx,
+                       fmt_objs[obj_idx + 1].start_idx, obj_idx + 1,
+                       std::forward<Tr>(rest)...);
+  }
+}
+
+// ##########################################################
+
+// ### structured logging ###
+
+// how structured records (see kv) are written
+enum class StructuredFormat {
+  TEXT,    // message + logfmt fields inside a regular record (default)
+  LOGFMT,  // one logfmt line per record: time=... level=... msg=... k=v
+  JSON,    // one JSON object per record: {"time":...,"msg":...,"k":v}
+};
+
+// a named field of a structured record (only refers to its value)
+template<typename T>
+struct KeyValue {
+  std::string_view key;
+  const T &value;
+};
+
+/*
+ * create a field of a structured record, e.g.
+ *   logger->info("request done", kv("latency_us", t), kv("path", path));
+ * the value isn't copied, so the field has to be logged within the
+ * expression it was created in
+ */
+template<typename T>
+KeyValue<T> kv(std::string_view key, const T &value) {
+  return KeyValue<T>{key, value};
+}
+
+template<typename T>
+struct is_key_value : std::false_type {};
+
+template<typename T>
+struct is_key_value<KeyValue<T>> : std::true_type {};
+
+// records whose arguments are all fields are structured records
+template<typename ...T>
+struct are_key_values : std::integral_constant<bool,
+  (sizeof...(T) > 0) &&
+  (is_key_value<typename std::decay<T>::type>::value && ...)> {};
+
+// name of a severity as written into structured records
+inline const char *severity_name(Severity severity) {
+  switch (severity) {
+    case Severity::TRACE: return "trace";
+    case Severity::DEBUG: return "debug";
+    case Severity::INFO:  return "info";
+    case Severity::WARN:  return "warn";
+    case Severity::ERROR: return "error";
+    case Severity::FATAL: return "fatal";
+    default:              return "off";
+  }
+}
+
+// append str with all special characters escaped (JSON rules)
+inline void append_escaped(FormatBuffer &out, std::string_view str) {
+  static constexpr char HEX[] = "0123456789abcdef";
+  const char *data = str.data();
+  size_t size = str.size();
+
+  size_t pos = 0;
+  while (pos < size) {
+    size_t n = find_escape<true>(data + pos, size - pos);
+    out.append(data + pos, n);
+    pos += n;
+    if (pos == size) break;
+
+    unsigned char chr = static_cast<unsigned char>(data[pos++]);
+    switch (chr) {
+      case '"':  out.append("\\\"", 2); break;
+      case '\\': out.append("\\\\", 2); break;
+      case '\n': out.append("\\n", 2);  break;
+      case '\r': out.append("\\r", 2);  break;
+      case '\t': out.append("\\t", 2);  break;
+      case '\b': out.append("\\b", 2);  break;
+      case '\f': out.append("\\f", 2);  break;
+      default: {
+        char esc[6] = {'\\', 'u', '0', '0', HEX[chr >> 4], HEX[chr & 0xf]};
+        out.append(esc, sizeof(esc));
+      }
+    }
+  }
+}
+
+// append str as a quoted and escaped JSON string
+inline void append_json_string(FormatBuffer &out, std::string_view str) {
+  out.push_back('"');
+  append_escaped(out, str);
+  out.push_back('"');
+}
+
+// append str as a logfmt value (only quoted if necessary)
+inline void append_logfmt_string(FormatBuffer &out, std::string_view str) {
+  bool quote = str.empty();
+  for (size_t i = 0; i < str.size() && !quote; ++i) {
+    unsigned char chr = static_cast<unsigned char>(str[i]);
+    quote = chr <= ' ' || chr == '=' || needs_escape(chr);
+  }
+
+  if (quote) {
+    append_json_string(out, str);
+  } else {
+    out.append(str);
+  }
+}
+
+/*
+ * append a floating-point number with the shortest representation
+ * that reads back as the same value
+ */
+template<typename T>
+void format_float_shortest(FormatBuffer &out, T value) {
+  constexpr size_t MX_CHARS = 32;
+  char *first = out.reserve(MX_CHARS);
+#ifdef __cpp_lib_to_chars
+  std::to_chars_result res = std::to_chars(first, first + MX_CHARS, value);
+  out.commit(res.ptr - first);
+#else
+  int n = std::snprintf(first, MX_CHARS, "%.17g",
+                        static_cast<double>(value));
+  out.commit(n > 0 ? static_cast<size_t>(n) : 0);
+#endif
+}
+
+template<typename T>
+void encode_json_value(FormatBuffer &out, const T &value);
+
+// object keys have to be strings, so other keys are encoded as text
+template<typename T>
+void encode_json_key(FormatBuffer &out, const T &key) {
+  using U = typename std::decay<const T &>::type;
+
+  if constexpr (std::is_convertible<const U &, std::string_view>::value) {
+    encode_json_value(out, key);
+  } else {
+    FormatBuffer tmp;
+    encode_json_value(tmp, key);
+    append_json_string(out, tmp.view());
+  }
+}
+
+/*
+ * append a value as JSON (straight into out, without building any
+ * document first): numbers as numbers, strings as escaped strings,
+ * maps as objects, all other ranges (see is_loggable_range) as arrays
+ * and everything else as the string its operator<< writes;
+ * unlike records, fields are never shortened
+ */
+template<typename T>
+void encode_json_value(FormatBuffer &out, const T &value) {
+  using U = typename std::decay<const T &>::type;
+
+  if constexpr (std::is_same<U, bool>::value) {
+    out.append(value ? std::string_view("true") : std::string_view("false"));
+  } else if constexpr (std::is_same<U, char>::value) {
+    append_json_string(out, std::string_view(&value, 1));
+  } else if constexpr (std::is_integral<U>::value) {
+    format_integer(out, +value);
+  } else if constexpr (std::is_floating_point<U>::value) {
+    if (std::isfinite(value)) {
+      format_float_shortest(out, value);
+    } else {
+      out.append("null", 4);
+    }
+  } else if constexpr (std::is_same<U, const char *>::value ||
+                       std::is_same<U, char *>::value) {
+    const char *str = value;  // (char arrays decay here)
+    if (str) {
+      append_json_string(out, str);
+    } else {
+      out.append("null", 4);
+    }
+  } else if constexpr (std::is_convertible<const U &,
+                                           std::string_view>::value) {
+    append_json_string(out, std::string_view(value));
+  } else if constexpr (is_loggable_range<U>::value) {
+    bool first = true;
+    out.push_back(is_map_like<U>::value ? '{' : '[');
+    for (const auto &element : value) {
+      if (!first) out.push_back(',');
+      first = false;
+      if constexpr (is_map_like<U>::value) {
+        encode_json_key(out, element.first);
+        out.push_back(':');
+        encode_json_value(out, element.second);
+      } else {
+        encode_json_value(out, element);
+      }
+    }
+    out.push_back(is_map_like<U>::value ? '}' : ']');
+  } else {
+    FormatBuffer tmp;
+    format_value(tmp, value);
+    append_json_string(out, tmp.view());
+  }
+}
+
+// append a value as logfmt (containers are written as JSON)
+template<typename T>
+void encode_logfmt_value(FormatBuffer &out, const T &value) {
+  using U = typename std::decay<const T &>::type;
+
+  if constexpr (std::is_same<U, const char *>::value ||
+                std::is_same<U, char *>::value) {
+    const char *str = value;  // (char arrays decay here)
+    append_logfmt_string(out, str ? std::string_view(str) :
+                                    std::string_view());
+  } else if constexpr (std::is_convertible<const U &,
+                                           std::string_view>::value) {
+    append_logfmt_string(out, std::string_view(value));
+  } else if constexpr (std::is_floating_point<U>::value) {
+    if (std::isfinite(value)) {
+      format_float_shortest(out, value);
+    } else {
+      format_float(out, value);
+    }
+  } else if constexpr (std::is_same<U, char>::value) {
+    append_logfmt_string(out, std::string_view(&value, 1));
+  } else if constexpr (std::is_arithmetic<U>::value) {
+    encode_json_value(out, value);
+  } else {
+    FormatBuffer tmp;
+    if constexpr (is_loggable_range<U>::value) {
+      encode_json_value(tmp, value);
+    } else {
+      format_value(tmp, value);
+    }
+    append_logfmt_string(out, tmp.view());
+  }
+}
+
+// append a logfmt key (chars that would end the key are replaced)
+inline void append_logfmt_key(FormatBuffer &out, std::string_view key) {
+  char *dst = out.reserve(key.size());
+  for (size_t i = 0; i < key.size(); ++i) {
+    unsigned char chr = static_cast<unsigned char>(key[i]);
+    dst[i] = chr <= ' ' || chr == '=' || chr == '"' ? '_' : key[i];
+  }
+  out.commit(key.size());
+}
+
+// append the fields of a structured record (",k:v" or " k=v")
+template<typename ...T>
+void encode_fields(FormatBuffer &out, StructuredFormat format,
+                   const KeyValue<T> &...fields) {
+  if (format == StructuredFormat::JSON) {
+    ((out.push_back(','), append_json_string(out, fields.key),
+      out.push_back(':'), encode_json_value(out, fields.value)), ...);
+  } else {
+    ((out.push_back(' '), append_logfmt_key(out, fields.key),
+      out.push_back('='), encode_logfmt_value(out, fields.value)), ...);
+  }
+}
+
+// ##########################################################
+
+// ### binary encoding ###
+
+// how a Logger encodes its records
+enum class Encoding {
+  TEXT,    // human-readable text (default)
+  BINARY,  // format string id + raw argument bytes (see cpplog-decode)
+};
+
+/*
+ * layout of binary log output (all integers in host byte order):
+ *   file header : CPPLOG_BINARY_MAGIC (8 bytes)
+ *   record      : u8 type, u32 size (of the entire record), payload
+ *     STRING    : u32 id, characters (defines a format string/logger name)
+ *     LOG       : u32 format id, u32 name id, u64 timestamp (ns since
+ *                 the epoch), u64 LogFormat, u8 Severity, u8 number of
+ *                 args, args
+ *   arg         : u8 BinaryArgType, value (u32 length + bytes for STRING,
+ *                 1 byte for BOOL/CHAR, 8 bytes otherwise)
+ * every string id is defined once per output before it is used
+ */
+static constexpr char CPPLOG_BINARY_MAGIC[8] = {
+  'C', 'P', 'P', 'L', 'O', 'G', 'B', '2'
+};
+
+enum class BinaryRecordType : uint8_t {
+  STRING = 1,
+  LOG    = 2,
+};
+
+enum class BinaryArgType : uint8_t {
+  INT    = 1,  // int64_t
+  UINT   = 2,  // uint64_t
+  DOUBLE = 3,
+  BOOL   = 4,
+  CHAR   = 5,
+  STRING = 6,
+
+  // only used by deferred records, which never leave the process:
+  CUSTOM     = 7,  // u64 DeferredFormatFn, u32 size, serialized value
+  STRING_REF = 8,  // u64 pointer, u32 length (see StringRef)
+};
+
+static constexpr size_t CPPLOG_BINARY_RECORD_HEADER_SIZE = 1 + 4;
+static constexpr size_t CPPLOG_BINARY_LOG_HEADER_SIZE =
+  CPPLOG_BINARY_RECORD_HEADER_SIZE + 4 + 4 + 8 + 8 + 1 + 1;
+
+// offset of the Severity byte inside of a LOG record
+static constexpr size_t CPPLOG_BINARY_LOG_SEVERITY_OFFSET =
+  CPPLOG_BINARY_RECORD_HEADER_SIZE + 4 + 4 + 8 + 8;
+
+// reserved string ids
+static constexpr uint32_t CPPLOG_BINARY_VALUE_FORMAT_ID   = 0;  // "{s}"
+static constexpr uint32_t CPPLOG_BINARY_DROPPED_FORMAT_ID = 1;
+
+// name id of records that weren't logged by a Logger (never a string id)
+static constexpr uint32_t CPPLOG_NO_NAME_ID = 0xffffffff;
+
+/*
+ * bit of a Logger name in the name bitmaps of a log index (see
+ * FileSink::set_index); FNV-1a, so every build agrees on it
+ */
+inline uint64_t name_bit(std::string_view name) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (char chr : name) {
+    hash ^= static_cast<unsigned char>(chr);
+    hash *= 0x100000001b3ull;
+  }
+  return 1ull << (hash >> 58);
+}
+
+/*
+ * process-wide table of all strings (format strings and Logger names)
+ * used in binary records; every distinct string gets its own id once,
+ * looking up the string of an id afterwards is lock-free
+ */
+class BinaryStringTable {
+ private:
+  static constexpr size_t CHUNK_SIZE = 1024;
+  static constexpr size_t MX_CHUNKS  = 1024;
+
+  struct Entry {
+    const char *str;
+    uint64_t name_bit;
+  };
+
+  std::unique_ptr<Entry[]> _chunks[MX_CHUNKS];
+  std::atomic<uint32_t> _count;
+
+  std::mutex _mutex;
+  std::unordered_map<std::string, uint32_t> _ids;
+
+  BinaryStringTable() : _count(0) {
+    add("{s}");
+    add("[cpplog] dropped {d} log record(s) (async queue full)");
+  }
+
+ public:
+  static BinaryStringTable &global() {
+    static BinaryStringTable table;
+    return table;
+  }
+
+  // get the id of str (the string gets copied on its first registration)
+  uint32_t add(const char *str) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto it = _ids.find(str);
+    if (it != _ids.end()) return it->second;
+
+    uint32_t id = _count.load(std::memory_order_relaxed);
+    assert(id < CHUNK_SIZE * MX_CHUNKS);
+
+    std::unique_ptr<Entry[]> &chunk = _chunks[id / CHUNK_SIZE];
+    if (!chunk) chunk.reset(new Entry[CHUNK_SIZE]);
+
+    it = _ids.emplace(str, id).first;
+    chunk[id % CHUNK_SIZE] = Entry{it->first.c_str(), cpplog::name_bit(str)};
+    _count.store(id + 1, std::memory_order_release);
+    return id;
+  }
+
+  // string with the given id (nullptr if no such string exists)
+  const char *get(uint32_t id) const {
+    if (id >= _count.load(std::memory_order_acquire)) return nullptr;
+    return _chunks[id / CHUNK_SIZE][id % CHUNK_SIZE].str;
+  }
+
+  // name_bit of the string with the given id (0 if it doesn't exist)
+  uint64_t name_bit(uint32_t id) const {
+    if (id >= _count.load(std::memory_order_acquire)) return 0;
+    return _chunks[id / CHUNK_SIZE][id % CHUNK_SIZE].name_bit;
+  }
+};
+
+/*
+ * id of a runtime format string; looked up by its content (not its
+ * address, a reused buffer may hold a different string), the per-thread
+ * cache points into the BinaryStringTable and so never outgrows it
+ */
+inline uint32_t binary_format_id(const char *fmt_str) {
+  static thread_local std::unordered_map<std::string_view, uint32_t> ids;
+
+  auto it = ids.find(fmt_str);
+  if (it != ids.end()) return it->second;
+
+  BinaryStringTable &table = BinaryStringTable::global();
+  uint32_t id = table.add(fmt_str);
+  ids.emplace(table.get(id), id);
+  return id;
+}
+
+// id of a compile-time format string (registered on its first use)
+template<class Str>
+uint32_t binary_format_id(CompiledFormat<Str>) {
+  static const uint32_t id = BinaryStringTable::global().add(Str::value());
+  return id;
+}
+
+template<typename T>
+void encode_binary_value(FormatBuffer &out, const T &value) {
+  std::memcpy(out.reserve(sizeof(T)), &value, sizeof(T));
+  out.commit(sizeof(T));
+}
+
+/*
+ * opt-in trait that lets deferred records (see
+ * Logger::set_deferred_formatting) capture a user type instead of
+ * formatting it on the logging thread; a specialization has to provide
+ *   static void serialize(FormatBuffer &out, const T &value);
+ *   static T deserialize(const char *data, size_t size);
+ * the deserialized value is then formatted (via its operator<<) by the
+ * writer thread; trivially copyable types don't need a serializer,
+ * they are simply copied
+ */
+template<typename T, typename = void>
+struct serializer {};
+
+template<typename T, typename = void>
+struct has_serializer : std::false_type {};
+
+template<typename T>
+struct has_serializer<T, std::void_t<decltype(serializer<T>::serialize(
+  std::declval<FormatBuffer &>(), std::declval<const T &>()))>>
+  : std::true_type {};
+
+// formats a captured argument of a deferred record into out
+using DeferredFormatFn = void (*)(FormatBuffer &out, const char *data,
+                                  size_t size, const FormatStringObject &obj);
+
+template<typename T>
+void format_deferred_arg(FormatBuffer &out, const char *data, size_t size,
+                         const FormatStringObject &obj) {
+  if constexpr (has_serializer<T>::value) {
+    format_arg(out, serializer<T>::deserialize(data, size), obj);
+  } else {
+    alignas(T) unsigned char storage[sizeof(T)];
+    std::memcpy(storage, data, sizeof(T));
+    format_arg(out, *std::launder(reinterpret_cast<const T *>(storage)),
+               obj);
+  }
+}
+
+template<typename T>
+void encode_deferred_arg(FormatBuffer &out, const T &arg) {
+  DeferredFormatFn fn = &format_deferred_arg<T>;
+  out.push_back(static_cast<char>(BinaryArgType::CUSTOM));
+  encode_binary_value(out, reinterpret_cast<uint64_t>(fn));
+
+  size_t size_pos = out.size();
+  encode_binary_value(out, static_cast<uint32_t>(0));  // size (patched)
+  if constexpr (has_serializer<T>::value) {
+    serializer<T>::serialize(out, arg);
+  } else {
+    encode_binary_value(out, arg);
+  }
+
+  uint32_t size = static_cast<uint32_t>(out.size() - size_pos - 4);
+  std::memcpy(out.data() + size_pos, &size, sizeof(size));
+}
+
+inline void encode_binary_string(FormatBuffer &out, std::string_view str) {
+  out.push_back(static_cast<char>(BinaryArgType::STRING));
+  encode_binary_value(out, static_cast<uint32_t>(str.size()));
+  out.append(str);
+}
+
+/*
+ * append a single argument (types w/o a raw encoding are sent as text);
+ * DEFERRED records also capture StringRefs, types with a serializer and
+ * trivially copyable types instead of formatting them
+ */
+template<bool DEFERRED = false, typename T>
+void encode_binary_arg(FormatBuffer &out, const T &arg) {
+  using U = typename std::decay<const T &>::type;
+
+  if constexpr (std::is_same<U, bool>::value) {
+    out.push_back(static_cast<char>(BinaryArgType::BOOL));
+    out.push_back(arg ? 1 : 0);
+  } else if constexpr (is_character<U>::value) {
+    out.push_back(static_cast<char>(BinaryArgType::CHAR));
+    out.push_back(static_cast<char>(arg));
+  } else if constexpr (std::is_integral<U>::value &&
+                       std::is_signed<U>::value) {
+    out.push_back(static_cast<char>(BinaryArgType::INT));
+    encode_binary_value(out, static_cast<int64_t>(arg));
+  } else if constexpr (std::is_integral<U>::value) {
+    out.push_back(static_cast<char>(BinaryArgType::UINT));
+    encode_binary_value(out, static_cast<uint64_t>(arg));
+  } else if constexpr (std::is_floating_point<U>::value &&
+                       !(DEFERRED && std::is_same<U, long double>::value)) {
+    // (binary logs store doubles, deferred records capture long doubles)
+    out.push_back(static_cast<char>(BinaryArgType::DOUBLE));
+    encode_binary_value(out, static_cast<double>(arg));
+  } else if constexpr (std::is_same<U, const char *>::value ||
+                       std::is_same<U, char *>::value) {
+    const char *str = arg;  // (char arrays decay here)
+    encode_binary_string(out, str ? std::string_view(str) : "");
+  } else if constexpr (DEFERRED && std::is_same<U, StringRef>::value) {
+    out.push_back(static_cast<char>(BinaryArgType::STRING_REF));
+    encode_binary_value(out, reinterpret_cast<uint64_t>(arg.str.data()));
+    encode_binary_value(out, static_cast<uint32_t>(arg.str.size()));
+  } else if constexpr (std::is_convertible<const U &,
+                                           std::string_view>::value) {
+    encode_binary_string(out, std::string_view(arg));
+  } else if constexpr (DEFERRED && (has_serializer<U>::value ||
+                                    std::is_trivially_copyable<U>::value)) {
+    encode_deferred_arg(out, arg);
+  } else {
+    FormatBuffer text;
+    format_value(text, arg);
+    encode_binary_string(out, text.view());
+  }
+}
+
+/*
+ * encode a complete LOG record into out; apart from that, the only work
+ * done on the logging thread is copying the raw argument values
+ */
+template<bool DEFERRED = false, typename ...T>
+void encode_binary_record(FormatBuffer &out, uint32_t format_id,
+                          uint32_t name_id, uint64_t timestamp,
+                          LogFormat fmt, Severity severity,
+                          const T &...args) {
+  size_t start = out.size();
+
+  out.push_back(static_cast<char>(BinaryRecordType::LOG));
+  encode_binary_value(out, static_cast<uint32_t>(0));  // size (patched)
+  encode_binary_value(out, format_id);
+  encode_binary_value(out, name_id);
+  encode_binary_value(out, timestamp);
+  encode_binary_value(out, static_cast<uint64_t>(fmt));
+  out.push_back(static_cast<char>(severity));
+  out.push_back(static_cast<char>(sizeof...(T)));
+  (encode_binary_arg<DEFERRED>(out, args), ...);
+
+  uint32_t size = static_cast<uint32_t>(out.size() - start);
+  std::memcpy(out.data() + start + 1, &size, sizeof(size));
+}
+
+// read a raw value from a binary record
+template<typename T>
+T decode_binary_value(const char *data) {
+  T value;
+  std::memcpy(&value, data, sizeof(T));
+  return value;
+}
+
+// ##########################################################
+
+// ### metrics ###
+
+// what the Metrics of a Logger / LoggerBackend count
+enum class Counter : uint8_t {
+  RECORDS_TRACE,       // records logged per severity (indexed by Severity)
+  RECORDS_DEBUG,
+  RECORDS_INFO,
+  RECORDS_WARN,
+  RECORDS_ERROR,
+  RECORDS_FATAL,
+  BYTES,               // size of all logged records (text or binary)
+  DROPPED_RATE_LIMIT,  // records suppressed by the rate limit
+  COLLAPSED,           // records collapsed into "last message repeated"
+  DROPPED_QUEUE,       // records dropped because the async queue was full
+  LOCK_WAIT_NS,        // time spent waiting for the lock of the sinks
+  QUEUE_WAIT_NS,       // time spent waiting for a free slot (BLOCK policy)
+  FLUSHES,             // flushes of the sinks
+  DROPPED_SINK,        // records dropped by sinks (e.g. a full backlog)
+  SINK_RECONNECTS,     // connections sinks had to establish again
+  DROPPED_NONBLOCKING, // records that found no slot and couldn't wait
+                       // (try_ calls and BudgetAction::BEST_EFFORT)
+  DROPPED_BUDGET,      // records dropped by a latency budget
+  BEST_EFFORT,         // records a latency budget queued best-effort
+  QUEUE_DEPTH,         // records in the async queues (a gauge, see
+                       // LoggerBackend::metrics)
+  N_COUNTERS
+};
+
+// the durations Metrics keep histograms of
+enum class Histogram : uint8_t {
+  FORMAT_NS,  // formatting/encoding of a record (see set_timing_metrics)
+  FLUSH_NS,   // flushing all sinks
+  N_HISTOGRAMS
+};
+
+static constexpr size_t CPPLOG_N_COUNTERS =
+  static_cast<size_t>(Counter::N_COUNTERS);
+static constexpr size_t CPPLOG_N_HISTOGRAMS =
+  static_cast<size_t>(Histogram::N_HISTOGRAMS);
+
+// histogram buckets: < 64ns, < 128ns, ..., < 1ms, everything else
+static constexpr size_t CPPLOG_HISTOGRAM_BUCKETS = 16;
+
+// number of cache lines the counters of a Metrics object are spread over
+static constexpr size_t CPPLOG_METRICS_STRIPES = 16;
+
+// nanoseconds of a monotonic clock (for measuring durations)
+inline uint64_t steady_now() {
+  return static_cast<uint64_t>(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// values of all counters/histograms of a Metrics object at some point
+struct MetricsSnapshot {
+  struct HistogramData {
+    uint64_t buckets[CPPLOG_HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t sum_ns;
+  };
+
+  uint64_t counters[CPPLOG_N_COUNTERS] = {};
+  HistogramData histograms[CPPLOG_N_HISTOGRAMS] = {};
+
+  uint64_t operator[](Counter counter) const {
+    return counters[static_cast<size_t>(counter)];
+  }
+
+  const HistogramData &operator[](Histogram histogram) const {
+    return histograms[static_cast<size_t>(histogram)];
+  }
+
+  // records of the given severity
+  uint64_t records(Severity severity) const {
+    return counters[static_cast<size_t>(severity)];
+  }
+
+  MetricsSnapshot &operator+=(const MetricsSnapshot &other) {
+    for (size_t i = 0; i < CPPLOG_N_COUNTERS; ++i) {
+      counters[i] += other.counters[i];
+    }
+    for (size_t i = 0; i < CPPLOG_N_HISTOGRAMS; ++i) {
+      for (size_t j = 0; j < CPPLOG_HISTOGRAM_BUCKETS; ++j) {
+        histograms[i].buckets[j] += other.histograms[i].buckets[j];
+      }
+      histograms[i].count += other.histograms[i].count;
+      histograms[i].sum_ns += other.histograms[i].sum_ns;
+    }
+    return *this;
+  }
+
+  // upper bound (in ns) of a histogram bucket (0 = no bound)
+  static uint64_t bucket_bound(size_t bucket) {
+    return bucket + 1 < CPPLOG_HISTOGRAM_BUCKETS ? 64ull << bucket : 0;
+  }
+};
+
+/*
+ * counters and histograms of a Logger or LoggerBackend; every thread
+ * updates one of CPPLOG_METRICS_STRIPES cache-line-aligned stripes
+ * (with relaxed atomics), so threads logging at the same time rarely
+ * touch the same cache line; snapshot() adds up all stripes
+ */
+class Metrics {
+ private:
+  struct alignas(64) Stripe {
+    std::atomic<uint64_t> counters[CPPLOG_N_COUNTERS];
+    std::atomic<uint64_t> buckets[CPPLOG_N_HISTOGRAMS]
+                                 [CPPLOG_HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> sums[CPPLOG_N_HISTOGRAMS];
+  };
+
+  std::unique_ptr<Stripe[]> _stripes;
+
+  // every thread gets its own stripe (round-robin)
+  Stripe &_stripe() {
+    static std::atomic<size_t> next_stripe{0};
+    static thread_local size_t stripe =
+      next_stripe.fetch_add(1, std::memory_order_relaxed) %
+      CPPLOG_METRICS_STRIPES;
+    return _stripes[stripe];
+  }
+
+  static size_t _bucket(uint64_t ns) {
+    size_t bucket = 0;
+    for (uint64_t bound = 64; ns >= bound &&
+         bucket + 1 < CPPLOG_HISTOGRAM_BUCKETS; bound <<= 1) {
+      ++bucket;
+    }
+    return bucket;
+  }
+
+ public:
+  Metrics() : _stripes(new Stripe[CPPLOG_METRICS_STRIPES]()) {}
+
+  void add(Counter counter, uint64_t n = 1) {
+    _stripe().counters[static_cast<size_t>(counter)].fetch_add(
+      n, std::memory_order_relaxed);
+  }
+
+  void record(Histogram histogram, uint64_t ns) {
+    Stripe &stripe = _stripe();
+    size_t idx = static_cast<size_t>(histogram);
+    stripe.buckets[idx][_bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    stripe.sums[idx].fetch_add(ns, std::memory_order_relaxed);
+  }
+
+  MetricsSnapshot snapshot() const {
+    MetricsSnapshot snapshot;
+    for (size_t s = 0; s < CPPLOG_METRICS_STRIPES; ++s) {
+      const Stripe &stripe = _stripes[s];
+      for (size_t i = 0; i < CPPLOG_N_COUNTERS; ++i) {
+        snapshot.counters[i] +=
+          stripe.counters[i].load(std::memory_order_relaxed);
+      }
+      for (size_t i = 0; i < CPPLOG_N_HISTOGRAMS; ++i) {
+        MetricsSnapshot::HistogramData &data = snapshot.histograms[i];
+        for (size_t j = 0; j < CPPLOG_HISTOGRAM_BUCKETS; ++j) {
+          uint64_t n = stripe.buckets[i][j].load(std::memory_order_relaxed);
+          data.buckets[j] += n;
+          data.count += n;
+        }
+        data.sum_ns += stripe.sums[i].load(std::memory_order_relaxed);
+      }
+    }
+    return snapshot;
+  }
+};
+
+// 'name="value"' (value escaped as a Prometheus label value)
+inline std::string prometheus_label(const char *name,
+                                    std::string_view value) {
+  std::string label = std::string(name) + "=\"";
+  for (char chr : value) {
+    if (chr == '\\' || chr == '"') {
+      label += '\\';
+      label += chr;
+    } else if (chr == '\n') {
+      label += "\\n";
+    } else {
+      label += chr;
+    }
+  }
+  label += '"';
+  return label;
+}
+
+// metrics of one Logger or backend as written by write_prometheus
+struct MetricsSource {
+  std::string labels;  // e.g. 'logger="db"' (may be empty)
+  MetricsSnapshot snapshot;
+};
+
+/*
+ * write metrics in the Prometheus text format (version 0.0.4); loggers
+ * are the snapshots of Loggers (records, bytes, rate limit, formatting
+ * times), backends the snapshots of LoggerBackends (queue, lock, flushes)
+ */
+inline void write_prometheus(std::ostream &out,
+                             const std::vector<MetricsSource> &loggers,
+                             const std::vector<MetricsSource> &backends) {
+  static const char *LEVELS[] = {
+    "trace", "debug", "info", "warn", "error", "fatal"
+  };
+
+  auto labels = [](const MetricsSource &source, const char *extra) {
+    std::string all = source.labels;
+    if (*extra) {
+      if (!all.empty()) all += ',';
+      all += extra;
+    }
+    return all.empty() ? all : '{' + all + '}';
+  };
+  auto seconds = [](uint64_t ns) {
+    char str[32];
+    std::snprintf(str, sizeof(str), "%.9g", static_cast<double>(ns) / 1e9);
+    return std::string(str);
+  };
+  auto family = [&out](const char *name, const char *type,
+                       const char *help) {
+    out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' '
+        << type << '\n';
+  };
+  auto counter = [&](const std::vector<MetricsSource> &sources,
+                     const char *name, const char *help, Counter id) {
+    family(name, "counter", help);
+    for (const MetricsSource &source : sources) {
+      out << name << labels(source, "") << ' ' << source.snapshot[id] << '\n';
+    }
+  };
+  auto histogram = [&](const std::vector<MetricsSource> &sources,
+                       const char *name, const char *help, Histogram id) {
+    family(name, "histogram", help);
+    for (const MetricsSource &source : sources) {
+      const MetricsSnapshot::HistogramData &data = source.snapshot[id];
+      uint64_t cumulative = 0;
+      for (size_t i = 0; i < CPPLOG_HISTOGRAM_BUCKETS; ++i) {
+        uint64_t bound = MetricsSnapshot::bucket_bound(i);
+        std::string le = "le=\"" + (bound ? seconds(bound) : "+Inf") + '"';
+        cumulative += data.buckets[i];
+        out << name << "_bucket" << labels(source, le.c_str()) << ' '
+            << cumulative << '\n';
+      }
+      out << name << "_sum" << labels(source, "") << ' '
+          << seconds(data.sum_ns) << '\n';
+      out << name << "_count" << labels(source, "") << ' ' << data.count
+          << '\n';
+    }
+  };
+
+  family("cpplog_records_total", "counter", "Records logged per severity.");
+  for (const MetricsSource &source : loggers) {
+    for (size_t i = 0; i < sizeof(LEVELS) / sizeof(LEVELS[0]); ++i) {
+      std::string level = std::string("level=\"") + LEVELS[i] + '"';
+      out << "cpplog_records_total" << labels(source, level.c_str()) << ' '
+          << source.snapshot.counters[i] << '\n';
+    }
+  }
+  counter(loggers, "cpplog_bytes_total", "Bytes of all logged records.",
+          Counter::BYTES);
+  counter(loggers, "cpplog_rate_limited_total",
+          "Records suppressed by the rate limit.",
+          Counter::DROPPED_RATE_LIMIT);
+  counter(loggers, "cpplog_collapsed_total",
+          "Repeated records that were collapsed.", Counter::COLLAPSED);
+  histogram(loggers, "cpplog_format_seconds",
+            "Time spent formatting a record.", Histogram::FORMAT_NS);
+
+  counter(backends, "cpplog_queue_dropped_total",
+          "Records dropped because the async queue was full.",
+          Counter::DROPPED_QUEUE);
+
+  family("cpplog_lock_wait_seconds_total", "counter",
+         "Time spent waiting for the lock of the sinks.");
+  for (const MetricsSource &source : backends) {
+    out << "cpplog_lock_wait_seconds_total" << labels(source, "") << ' '
+        << seconds(source.snapshot[Counter::LOCK_WAIT_NS]) << '\n';
+  }
+  family("cpplog_queue_wait_seconds_total", "counter",
+         "Time spent waiting for a free slot of the async queue.");
+  for (const MetricsSource &source : backends) {
+    out << "cpplog_queue_wait_seconds_total" << labels(source, "") << ' '
+        << seconds(source.snapshot[Counter::QUEUE_WAIT_NS]) << '\n';
+  }
+
+  counter(backends, "cpplog_flushes_total", "Flushes of the sinks.",
+          Counter::FLUSHES);
+  histogram(backends, "cpplog_flush_seconds",
+            "Time spent flushing the sinks.", Histogram::FLUSH_NS);
+
+  counter(backends, "cpplog_sink_dropped_total",
+          "Records dropped by the sinks.", Counter::DROPPED_SINK);
+  counter(backends, "cpplog_sink_reconnects_total",
+          "Connections the sinks had to establish again.",
+          Counter::SINK_RECONNECTS);
+
+  counter(backends, "cpplog_nonblocking_dropped_total",
+          "Records that found no free queue slot and could not wait.",
+          Counter::DROPPED_NONBLOCKING);
+  counter(backends, "cpplog_budget_dropped_total",
+          "Records dropped by the latency budget of their thread.",
+          Counter::DROPPED_BUDGET);
+  counter(backends, "cpplog_budget_best_effort_total",
+          "Records the latency budget of their thread queued best-effort.",
+          Counter::BEST_EFFORT);
+  family("cpplog_queue_depth", "gauge", "Records in the async queues.");
+  for (const MetricsSource &source : backends) {
+    out << "cpplog_queue_depth" << labels(source, "") << ' '
+        << source.snapshot[Counter::QUEUE_DEPTH] << '\n';
+  }
+}
+
+// ##########################################################
+
+// ### sinks ###
+
+// whether records written to a Sink are highlighted
+enum class ColorMode : uint8_t {
+  AUTO,    // only if the sink is a terminal (and NO_COLOR isn't set)
+  ALWAYS,
+  NEVER,
+};
+
+// check if fd refers to a terminal
+inline bool is_terminal_fd(int fd) {
+#ifdef _WIN32
+  return _isatty(fd) != 0;
+#else
+  return ::isatty(fd) != 0;
+#endif
+}
+
+/*
+ * what is known about the records a Sink gets in one piece (see
+ * Sink::write_records); sinks that index their output use it
+ */
+struct RecordInfo {
+  Severity severity = Severity::TRACE;  // highest severity of the records
+
+  // 1 << severity of every record
+  uint8_t levels = 0;
+
+  // earliest and latest timestamp (ns since the epoch; 0 = unknown)
+  uint64_t first_timestamp = 0;
+  uint64_t last_timestamp = 0;
+
+  // name_bit of the Loggers of the records (or-ed together)
+  uint64_t names = 0;
+
+  Encoding encoding = Encoding::TEXT;
+
+  // add a record (timestamp 0 = unknown)
+  void add(Severity record_severity, uint64_t timestamp,
+           uint64_t name_bits) {
+    severity = std::max(severity, record_severity);
+    levels = static_cast<uint8_t>(
+      levels | 1u << static_cast<unsigned>(record_severity));
+    if (timestamp) {
+      if (!first_timestamp || timestamp < first_timestamp) {
+        first_timestamp = timestamp;
+      }
+      last_timestamp = std::max(last_timestamp, timestamp);
+    }
+    names |= name_bits;
+  }
+};
+
+// end (offset in its batch) and severity of a record of a batch
+struct RecordBound {
+  uint32_t end;
+  Severity severity;
+};
+
+/*
+ * destination of complete log records; every record (or batch of records)
+ * is handed over as one contiguous chunk of bytes, so a Sink never sees
+ * partial records; a Sink can be shared by multiple Loggers, so all
+ * implementations have to be thread-safe
+ */
+class Sink {
+ private:
+  ColorMode _color_mode = ColorMode::AUTO;
+
+ public:
+  virtual ~Sink() = default;
+
+  // check if the sink writes to a terminal (see ColorMode::AUTO)
+  virtual bool is_terminal() const {
+    return false;
+  }
+
+  // this should be called before the sink is added to a Logger
+  void set_color_mode(ColorMode mode) {
+    _color_mode = mode;
+  }
+
+  ColorMode color_mode() const {
+    return _color_mode;
+  }
+
+  // check if records written to this sink should contain color codes
+  bool colors() const {
+    if (_color_mode != ColorMode::AUTO) {
+      return _color_mode == ColorMode::ALWAYS;
+    }
+    const char *no_color = std::getenv("NO_COLOR");
+    return (!no_color || !*no_color) && is_terminal();
+  }
+
+  // write size bytes of data (one or more complete records)
+  virtual void write(const char *data, size_t size) = 0;
+
+  /*
+   * same as write, severity is the highest severity of the records in
+   * data (sinks that batch records may flush on severe records)
+   */
+  virtual void write_record(const char *data, size_t size,
+                            Severity severity) {
+    (void)severity;
+    write(data, size);
+  }
+
+  // same as write_record, with everything known about the records
+  virtual void write_records(const char *data, size_t size,
+                             const RecordInfo &info) {
+    write_record(data, size, info.severity);
+  }
+
+  /*
+   * batches of records (see Logger::set_thread_buffered) have to be
+   * handed over record by record, so write_record gets the severity of
+   * each record instead of the highest one of the batch
+   */
+  virtual bool wants_single_records() const {
+    return false;
+  }
+
+  // hand everything buffered so far to the operating system
+  virtual void flush() {}
+
+  /*
+   * called by the writer thread of an async Logger whenever its queue ran
+   * dry (sinks with their own flush policy may ignore it)
+   */
+  virtual void idle() {
+    flush();
+  }
+
+  // records of this severity (or above) are flushed right away
+  virtual Severity flush_severity() const {
+    return Severity::OFF;
+  }
+
+  /*
+   * called by the crash handler (see install_crash_handler): write data
+   * right away, without blocking on a lock (see emergency_lock) or
+   * allocating memory; buffers the sink shares with other threads may
+   * only be touched if emergency_lock got the lock, otherwise data is
+   * written on its own (with write(2)) or dropped; sinks that can't do
+   * that drop it
+   */
+  virtual void emergency_write(const char *data, size_t size) {
+    (void)data;
+    (void)size;
+  }
+
+  // write everything buffered so far (same rules as emergency_write)
+  virtual void emergency_flush() {}
+
+  /*
+   * add the counters of this sink (e.g. Counter::DROPPED_SINK) to
+   * snapshot (see LoggerBackend::metrics)
+   */
+  virtual void add_metrics(MetricsSnapshot &snapshot) const {
+    (void)snapshot;
+  }
+};
+
+/*
+ * try to take the lock of a sink for an emergency write for a while; if
+ * its owner doesn't let go (e.g. because it is the crashing thread), the
+ * returned lock doesn't own the mutex and the caller must not touch what
+ * the mutex protects; this is best effort: try_lock and yield aren't on
+ * the list of async-signal-safe functions, but they never block
+ */
+inline std::unique_lock<std::mutex> emergency_lock(std::mutex &mutex) {
+  constexpr int MX_TRIES = 1000;
+  std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+  for (int i = 0; i < MX_TRIES && !lock.owns_lock(); ++i) {
+    std::this_thread::yield();
+    lock.try_lock();
+  }
+  return lock;
+}
+
+// write all of data to fd; returns false if an error occurred
+inline bool write_fd(int fd, const char *data, size_t size) {
+  while (size > 0) {
+#ifdef _WIN32
+    int n = _write(fd, data, static_cast<unsigned>(
+      size < static_cast<size_t>(INT_MAX) ? size : INT_MAX));
+#else
+    ssize_t n = ::write(fd, data, size);
+#endif
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data += n;
+    size -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+#ifdef _WIN32
+struct iovec {
+  void *iov_base;
+  size_t iov_len;
+};
+#endif
+
+/*
+ * write all n_bufs buffers of bufs to fd (in as few system calls as
+ * possible, bufs is modified); returns false if an error occurred
+ */
+inline bool writev_fd(int fd, struct iovec *bufs, int n_bufs) {
+#ifdef _WIN32
+  for (int i = 0; i < n_bufs; ++i) {
+    if (!write_fd(fd, static_cast<const char *>(bufs[i].iov_base),
+                  bufs[i].iov_len)) {
+      return false;
+    }
+  }
+  return true;
+#else
+#ifdef IOV_MAX
+  constexpr int MX_BUFS = IOV_MAX;
+#else
+  constexpr int MX_BUFS = 16;
+#endif
+  while (n_bufs > 0) {
+    ssize_t n = ::writev(fd, bufs, n_bufs < MX_BUFS ? n_bufs : MX_BUFS);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+
+    size_t written = static_cast<size_t>(n);
+    while (n_bufs > 0 && written >= bufs->iov_len) {
+      written -= bufs->iov_len;
+      ++bufs;
+      --n_bufs;
+    }
+    if (n_bufs > 0) {
+      bufs->iov_base = static_cast<char *>(bufs->iov_base) + written;
+      bufs->iov_len -= written;
+    }
+  }
+  return true;
+#endif
+}
+
+// open a log file for writing (throws std::runtime_error on failure)
+inline int open_log_file(const std::string &path, bool truncate) {
+#ifdef _WIN32
+  int flags = _O_WRONLY | _O_CREAT | _O_BINARY |
+              (truncate ? _O_TRUNC : _O_APPEND);
+  int fd = _open(path.c_str(), flags, _S_IREAD | _S_IWRITE);
+#else
+  int flags = O_WRONLY | O_CREAT | O_CLOEXEC |
+              (truncate ? O_TRUNC : O_APPEND);
+  int fd = ::open(path.c_str(), flags, 0644);
+#endif
+  if (fd < 0) {
+    throw std::runtime_error("cpplog: could not open log file '" + path +
+                             "': " + std::strerror(errno));
+  }
+  return fd;
+}
+
+inline void close_fd(int fd) {
+#ifdef _WIN32
+  _close(fd);
+#else
+  ::close(fd);
+#endif
+}
+
+// current size of the file behind fd
+inline uint64_t fd_size(int fd) {
+#ifdef _WIN32
+  struct _stat64 st;
+  return _fstat64(fd, &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0;
+#else
+  struct stat st;
+  return ::fstat(fd, &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0;
+#endif
+}
+
+/*
+ * writes records into a std::ostream with a single write call per record
+ * (this is what a Logger uses by default, with std::cerr)
+ */
+class OStreamSink : public Sink {
+ private:
+  std::ostream &_stream;
+  std::mutex _mutex;
+  int _fd;
+  bool _terminal;
+
+  // descriptor of a standard stream (-1 for all other streams)
+  static int _std_fd(const std::ostream &stream) {
+    if (&stream == &std::cout) return 1;
+    if (&stream == &std::cerr || &stream == &std::clog) return 2;
+    return -1;
+  }
+
+ public:
+  explicit OStreamSink(std::ostream &stream) :
+    _stream(stream), _fd(_std_fd(stream)),
+    _terminal(_fd >= 0 && is_terminal_fd(_fd)) {}
+
+  bool is_terminal() const override {
+    return _terminal;
+  }
+
+  void write(const char *data, size_t size) override {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stream.write(data, static_cast<std::streamsize>(size));
+  }
+
+  void flush() override {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stream.flush();
+  }
+
+  /*
+   * (only the standard streams are written, directly into their file
+   * descriptor; whatever std::cout still buffers comes afterwards)
+   */
+  void emergency_write(const char *data, size_t size) override {
+    if (_fd < 0) return;
+    std::unique_lock<std::mutex> lock = emergency_lock(_mutex);
+    write_fd(_fd, data, size);
+  }
+};
+
+/*
+ * writes records directly into a file descriptor with write(2), without
+ * any buffering or iostream in between; the descriptor is only closed
+ * on destruction if the sink owns it
+ */
+class FdSink : public Sink {
+ private:
+  int _fd;
+  bool _owns_fd;
+  bool _terminal;
+
+ public:
+  explicit FdSink(int fd, bool owns_fd = false) :
+    _fd(fd), _owns_fd(owns_fd), _terminal(is_terminal_fd(fd)) {}
+
+  bool is_terminal() const override {
+    return _terminal;
+  }
+
+  ~FdSink() override {
+    if (_owns_fd) close_fd(_fd);
+  }
+
+  FdSink(const FdSink &) = delete;
+  FdSink &operator=(const FdSink &) = delete;
+
+  void write(const char *data, size_t size) override {
+    write_fd(_fd, data, size);
+  }
+
+  void emergency_write(const char *data, size_t size) override {
+    write_fd(_fd, data, size);
+  }
+
+  int fd() const {
+    return _fd;
+  }
+};
+
+// when a BatchingSink writes the records it has collected
+struct FlushPolicy {
+  // write once (at least) this many bytes are buffered (0 = no buffering)
+  size_t max_bytes = CPPLOG_BATCH_SIZE;
+
+  // write once this many writes (records or batches of records) are
+  // buffered (0 = no limit)
+  size_t max_records = 0;
+
+  /*
+   * write records at most this long after the first of them was buffered
+   * (by a background thread of the sink; 0 = no timer, an async Logger
+   * then writes the records whenever its queue runs dry)
+   */
+  std::chrono::microseconds max_latency = std::chrono::milliseconds(100);
+
+  // records of this severity (or above) are written right away
+  Severity flush_severity = Severity::ERROR;
+};
+
+/*
+ * collects records and writes them to a file descriptor in batches,
+ * with one write(2) per batch (see FlushPolicy for when a batch is
+ * written); a record that doesn't fit into the buffer anymore is written
+ * together with the buffered records in a single writev(2), without
+ * copying it first; the descriptor is only closed on destruction if the
+ * sink owns it
+ */
+class BatchingSink : public Sink {
+ private:
+  int _fd;
+  bool _owns_fd;
+  FlushPolicy _policy;
+  std::unique_ptr<char[]> _buffer;
+  size_t _size;
+  size_t _records;
+
+  // the buffered records have to be written by then (see max_latency)
+  std::chrono::steady_clock::time_point _deadline;
+
+  std::mutex _mutex;
+  std::condition_variable _wake_flusher;
+  bool _flusher_idle;
+  bool _stop;
+  std::thread _flusher;
+
+  bool _terminal;
+
+  void _flush_buffer() {
+    if (_size) write_fd(_fd, _buffer.get(), _size);
+    _size = 0;
+    _records = 0;
+  }
+
+  void _append(const char *data, size_t size) {
+    if (_size + size > _policy.max_bytes) {
+      iovec bufs[2] = {
+        {_buffer.get(), _size},
+        {const_cast<char *>(data), size}
+      };
+      writev_fd(_fd, bufs, 2);
+      _size = 0;
+      _records = 0;
+      return;
+    }
+
+    // (the clock is only read for the first record of a batch)
+    if (_size == 0 && _flusher.joinable()) {
+      _deadline = std::chrono::steady_clock::now() + _policy.max_latency;
+      if (_flusher_idle) _wake_flusher.notify_one();
+    }
+
+    std::memcpy(_buffer.get() + _size, data, size);
+    _size += size;
+    ++_records;
+    if (_size >= _policy.max_bytes ||
+        (_policy.max_records && _records >= _policy.max_records)) {
+      _flush_buffer();
+    }
+  }
+
+  // writes the buffered records once their deadline has passed
+  void _run() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_stop) {
+      if (_size == 0) {
+        _flusher_idle = true;
+        _wake_flusher.wait(lock);
+        _flusher_idle = false;
+      } else if (std::chrono::steady_clock::now() >= _deadline) {
+        _flush_buffer();
+      } else {
+        _wake_flusher.wait_until(lock, _deadline);
+      }
+    }
+  }
+
+ public:
+  explicit BatchingSink(int fd, const FlushPolicy &policy = FlushPolicy(),
+                        bool owns_fd = false) :
+    _fd(fd), _owns_fd(owns_fd), _policy(policy),
+    _buffer(policy.max_bytes ? new char[policy.max_bytes] : nullptr),
+    _size(0), _records(0), _flusher_idle(false), _stop(false),
+    _terminal(is_terminal_fd(fd)) {
+    if (_policy.max_latency.count() > 0 && _policy.max_bytes) {
+      _flusher = std::thread(&BatchingSink::_run, this);
+    }
+  }
+
+  ~BatchingSink() override {
+    if (_flusher.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+        _wake_flusher.notify_one();
+      }
+      _flusher.join();
+    }
+    _flush_buffer();
+    if (_owns_fd) close_fd(_fd);
+  }
+
+  BatchingSink(const BatchingSink &) = delete;
+  BatchingSink &operator=(const BatchingSink &) = delete;
+
+  void write(const char *data, size_t size) override {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _append(data, size);
+  }
+
+  void write_record(const char *data, size_t size,
+                    Severity severity) override {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _append(data, size);
+    if (severity >= _policy.flush_severity) _flush_buffer();
+  }
+
+  void flush() override {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _flush_buffer();
+  }
+
+  // (only without a timer, the timer bounds the latency otherwise)
+  void idle() override {
+    if (!_flusher.joinable()) flush();
+  }
+
+  Severity flush_severity() const override {
+    return _policy.flush_severity;
+  }
+
+  void emergency_write(const char *data, size_t size) override {
+    std::unique_lock<std::mutex> lock = emergency_lock(_mutex);
+    if (lock.owns_lock()) _flush_buffer();
+    write_fd(_fd, data, size);
+  }
+
+  void emergency_flush() override {
+    std::unique_lock<std::mutex> lock = emergency_lock(_mutex);
+    if (lock.owns_lock()) _flush_buffer();
+  }
+
+  bool is_terminal() const override {
+    return _terminal;
+  }
+
+  const FlushPolicy &policy() const {
+    return _policy;
+  }
+
+  int fd() const {
+    return _fd;
+  }
+};
+
+// codec of the frames a FileSink writes (see FileSink::set_compression)
+enum class Compression : uint8_t {
+  NONE,
+  LZ4,   // LZ4 frames (fast; needs lz4frame.h and liblz4)
+  ZSTD,  // zstd frames (better ratio; needs zstd.h and libzstd)
+};
+
+inline const char *compression_name(Compression codec) {
+  switch (codec) {
+    case Compression::LZ4:  return "lz4";
+    case Compression::ZSTD: return "zstd";
+    default:                return "none";
+  }
+}
+
+// how a FileSink compresses its records
+struct CompressionOptions {
+  Compression codec = Compression::NONE;
+
+  // 0 = the default of the codec (lz4: fast, zstd: 3)
+  int level = 0;
+
+  // uncompressed bytes per frame
+  size_t frame_size = CPPLOG_COMPRESSION_FRAME_SIZE;
+
+  /*
+   * compress on a thread of the sink; otherwise frames are compressed by
+   * whoever writes to the sink, which should then be the writer thread
+   * of an async Logger
+   */
+  bool own_thread = true;
+};
+
+// compresses a buffer into one complete, independently decodable frame
+class FrameCompressor {
+ public:
+  virtual ~FrameCompressor() = default;
+
+  // max size of the frame of size bytes
+  virtual size_t bound(size_t size) const = 0;
+
+  // returns the size of the frame written to dst (0 on error)
+  virtual size_t compress(const char *data, size_t size, char *dst,
+                          size_t capacity) = 0;
+};
+
+#ifdef CPPLOG_LZ4
+class Lz4FrameCompressor : public FrameCompressor {
+ private:
+  LZ4F_preferences_t _preferences;
+
+ public:
+  explicit Lz4FrameCompressor(int level) : _preferences() {
+    _preferences.compressionLevel = level;
+    _preferences.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+  }
+
+  size_t bound(size_t size) const override {
+    return LZ4F_compressFrameBound(size, &_preferences);
+  }
+
+  size_t compress(const char *data, size_t size, char *dst,
+                  size_t capacity) override {
+    _preferences.frameInfo.contentSize = size;
+    size_t n = LZ4F_compressFrame(dst, capacity, data, size, &_preferences);
+    return LZ4F_isError(n) ? 0 : n;
+  }
+};
+#endif
+
+#ifdef CPPLOG_ZSTD
+class ZstdFrameCompressor : public FrameCompressor {
+ private:
+  ZSTD_CCtx *_context;
+
+ public:
+  explicit ZstdFrameCompressor(int level) : _context(ZSTD_createCCtx()) {
+    if (!_context) throw std::bad_alloc();
+    ZSTD_CCtx_setParameter(_context, ZSTD_c_compressionLevel, level);
+    ZSTD_CCtx_setParameter(_context, ZSTD_c_checksumFlag, 1);
+  }
+
+  ~ZstdFrameCompressor() override {
+    ZSTD_freeCCtx(_context);
+  }
+
+  ZstdFrameCompressor(const ZstdFrameCompressor &) = delete;
+  ZstdFrameCompressor &operator=(const ZstdFrameCompressor &) = delete;
+
+  size_t bound(size_t size) const override {
+    return ZSTD_compressBound(size);
+  }
+
+  size_t compress(const char *data, size_t size, char *dst,
+                  size_t capacity) override {
+    size_t n = ZSTD_compress2(_context, dst, capacity, data, size);
+    return ZSTD_isError(n) ? 0 : n;
+  }
+};
+#endif
+
+// throws std::runtime_error if the codec isn't available
+inline std::unique_ptr<FrameCompressor> make_frame_compressor(
+    Compression codec, int level) {
+  switch (codec) {
+    case Compression::NONE:
+      return nullptr;
+#ifdef CPPLOG_LZ4
+    case Compression::LZ4:
+      return std::unique_ptr<FrameCompressor>(new Lz4FrameCompressor(level));
+#endif
+#ifdef CPPLOG_ZSTD
+    case Compression::ZSTD:
+      return std::unique_ptr<FrameCompressor>(new ZstdFrameCompressor(level));
+#endif
+    default:
+      (void)level;
+      throw std::runtime_error(std::string("cpplog: ") +
+                               compression_name(codec) +
+                               " compression is not available");
+  }
+}
+
+/*
+ * write data as a frame of the codec with uncompressed blocks, which
+ * needs neither the codec's library nor any allocation (so the crash
+ * handler can use it); returns false if an error occurred
+ */
+inline bool write_stored_frame(int fd, Compression codec, const char *data,
+                               size_t size) {
+  if (size == 0) return true;
+
+  if (codec == Compression::LZ4) {
+    // magic, FLG (version 1, independent blocks), BD (4 MiB blocks) and
+    // the header checksum (second byte of the xxHash32 of FLG + BD)
+    static const unsigned char HEADER[] = {
+      0x04, 0x22, 0x4d, 0x18, 0x60, 0x70, 0x73
+    };
+    constexpr size_t MX_BLOCK = 4 * 1024 * 1024;
+    if (!write_fd(fd, reinterpret_cast<const char *>(HEADER),
+                  sizeof(HEADER))) {
+      return false;
+    }
+    while (size > 0) {
+      size_t n = std::min(size, MX_BLOCK);
+      uint32_t block = static_cast<uint32_t>(n) | 0x80000000u;  // stored
+      unsigned char header[4] = {
+        static_cast<unsigned char>(block),
+        static_cast<unsigned char>(block >> 8),
+        static_cast<unsigned char>(block >> 16),
+        static_cast<unsigned char>(block >> 24)
+      };
+      if (!write_fd(fd, reinterpret_cast<const char *>(header), 4) ||
+          !write_fd(fd, data, n)) {
+        return false;
+      }
+      data += n;
+      size -= n;
+    }
+    return write_fd(fd, "\0\0\0\0", 4);  // end mark
+  }
+
+  if (codec == Compression::ZSTD) {
+    // magic, frame header descriptor (no size/checksum/dictionary) and a
+    // window of 128 KiB
+    static const unsigned char HEADER[] = {0x28, 0xb5, 0x2f, 0xfd, 0x00, 0x38};
+    constexpr size_t MX_BLOCK = 128 * 1024;
+    if (!write_fd(fd, reinterpret_cast<const char *>(HEADER),
+                  sizeof(HEADER))) {
+      return false;
+    }
+    while (size > 0) {
+      size_t n = std::min(size, MX_BLOCK);
+      // block size, type 0 (raw) and whether it is the last block
+      uint32_t block = static_cast<uint32_t>(n << 3) | (n == size ? 1 : 0);
+      unsigned char header[3] = {
+        static_cast<unsigned char>(block),
+        static_cast<unsigned char>(block >> 8),
+        static_cast<unsigned char>(block >> 16)
+      };
+      if (!write_fd(fd, reinterpret_cast<const char *>(header), 3) ||
+          !write_fd(fd, data, n)) {
+        return false;
+      }
+      data += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  return write_fd(fd, data, size);
+}
+
+// codec of the frame that starts at data (NONE if it isn't a frame)
+inline Compression frame_codec(const char *data, size_t size) {
+  static const unsigned char LZ4_MAGIC[] = {0x04, 0x22, 0x4d, 0x18};
+  static const unsigned char ZSTD_MAGIC[] = {0x28, 0xb5, 0x2f, 0xfd};
+  if (size < 4) return Compression::NONE;
+  if (std::memcmp(data, LZ4_MAGIC, 4) == 0) return Compression::LZ4;
+  if (std::memcmp(data, ZSTD_MAGIC, 4) == 0) return Compression::ZSTD;
+  return Compression::NONE;
+}
+
+/*
+ * append the contents of the (concatenated) frames in data to out; returns
+ * false if data is malformed or ends with an incomplete frame (out then
+ * has everything up to it); throws std::runtime_error if the codec of
+ * a frame isn't available
+ */
+inline bool decompress_frames(const char *data, size_t size,
+                              std::string &out) {
+  constexpr size_t CHUNK_SIZE = 256 * 1024;
+  std::unique_ptr<char[]> chunk(new char[CHUNK_SIZE]);
+
+  size_t pos = 0;
+  while (pos < size) {
+    Compression codec = frame_codec(data + pos, size - pos);
+#ifdef CPPLOG_LZ4
+    if (codec == Compression::LZ4) {
+      LZ4F_dctx *context;
+      if (LZ4F_isError(LZ4F_createDecompressionContext(&context,
+                                                       LZ4F_VERSION))) {
+        throw std::bad_alloc();
+      }
+      // (until the end of the frame, or no progress without more input)
+      size_t hint;
+      for (;;) {
+        size_t in_size = size - pos;
+        size_t out_size = CHUNK_SIZE;
+        hint = LZ4F_decompress(context, chunk.get(), &out_size, data + pos,
+                               &in_size, nullptr);
+        if (LZ4F_isError(hint)) break;
+        out.append(chunk.get(), out_size);
+        pos += in_size;
+        if (hint == 0 || (pos == size && out_size < CHUNK_SIZE)) break;
+      }
+      LZ4F_freeDecompressionContext(context);
+      if (hint != 0) return false;
+      continue;
+    }
+#endif
+#ifdef CPPLOG_ZSTD
+    if (codec == Compression::ZSTD) {
+      size_t frame_size = ZSTD_findFrameCompressedSize(data + pos, size - pos);
+      if (ZSTD_isError(frame_size)) return false;
+      ZSTD_DStream *stream = ZSTD_createDStream();
+      if (!stream) throw std::bad_alloc();
+      ZSTD_inBuffer in = {data + pos, frame_size, 0};
+      size_t hint;
+      for (;;) {
+        ZSTD_outBuffer chunk_out = {chunk.get(), CHUNK_SIZE, 0};
+        hint = ZSTD_decompressStream(stream, &chunk_out, &in);
+        if (ZSTD_isError(hint)) break;
+        out.append(chunk.get(), chunk_out.pos);
+        if (hint == 0 || (in.pos == in.size && chunk_out.pos < CHUNK_SIZE)) {
+          break;
+        }
+      }
+      ZSTD_freeDStream(stream);
+      if (hint != 0) return false;
+      pos += frame_size;
+      continue;
+    }
+#endif
+    (void)out;
+    if (codec == Compression::NONE) return false;
+    throw std::runtime_error(std::string("cpplog: ") +
+                             compression_name(codec) +
+                             " compression is not available");
+  }
+  return true;
+}
+
+/*
+ * layout of the index of a log file (see FileSink::set_index; all
+ * integers in host byte order):
+ *   header : CPPLOG_INDEX_MAGIC (8 bytes)
+ *   entry  : u8 IndexEntryType, u8 Compression, u8 levels (1 << severity
+ *            of its records), u8 0, u32 size (of the entry), payload
+ *     BLOCK  : u64 offset, u64 size (of the block in the log file),
+ *              u64 first timestamp, u64 last timestamp (ns since the
+ *              epoch), u64 names (name_bit of its Loggers or-ed together)
+ *     STRING : a record of a binary log that isn't a LOG record (string
+ *              definitions and CPPLOG_BINARY_MAGIC), in the order they
+ *              were written; the definitions of the records of a block
+ *              precede the block
+ * blocks are in the order of their offsets, compressed blocks are frames;
+ * the end of the log file may not be covered by a block yet
+ */
+static constexpr char CPPLOG_INDEX_MAGIC[8] = {
+  'C', 'P', 'P', 'L', 'O', 'G', 'X', '1'
+};
+static constexpr size_t CPPLOG_INDEX_ENTRY_HEADER_SIZE = 8;
+static constexpr size_t CPPLOG_INDEX_BLOCK_SIZE =
+  CPPLOG_INDEX_ENTRY_HEADER_SIZE + 5 * 8;
+
+enum class IndexEntryType : uint8_t {
+  BLOCK  = 1,
+  STRING = 2,
+};
+
+// a block of an indexed log file
+struct IndexBlock {
+  uint64_t offset = 0;
+  uint64_t size = 0;
+  Compression codec = Compression::NONE;
+
+  // severities, timestamps and names of its records (w/o the encoding)
+  RecordInfo records;
+};
+
+// file the index of the log file at log_path is written to
+inline std::string index_path(const std::string &log_path) {
+  return log_path + ".idx";
+}
+
+// out has to have room for CPPLOG_INDEX_BLOCK_SIZE bytes
+inline void encode_index_block(char *out, const IndexBlock &block) {
+  out[0] = static_cast<char>(IndexEntryType::BLOCK);
+  out[1] = static_cast<char>(block.codec);
+  out[2] = static_cast<char>(block.records.levels);
+  out[3] = 0;
+  uint32_t size = static_cast<uint32_t>(CPPLOG_INDEX_BLOCK_SIZE);
+  std::memcpy(out + 4, &size, sizeof(size));
+  const uint64_t values[5] = {
+    block.offset, block.size, block.records.first_timestamp,
+    block.records.last_timestamp, block.records.names
+  };
+  std::memcpy(out + CPPLOG_INDEX_ENTRY_HEADER_SIZE, values, sizeof(values));
+}
+
+inline void append_index_string(std::string &out, const char *record,
+                                size_t size) {
+  char header[CPPLOG_INDEX_ENTRY_HEADER_SIZE] = {
+    static_cast<char>(IndexEntryType::STRING)
+  };
+  uint32_t entry_size =
+    static_cast<uint32_t>(CPPLOG_INDEX_ENTRY_HEADER_SIZE + size);
+  std::memcpy(header + 4, &entry_size, sizeof(entry_size));
+  out.append(header, sizeof(header));
+  out.append(record, size);
+}
+
+// an entry of an index (see next_index_entry)
+struct IndexEntry {
+  IndexEntryType type;
+  IndexBlock block;          // (BLOCK)
+  std::string_view record;   // (STRING)
+};
+
+/*
+ * decode the entry at pos of an index (data starts with its header) and
+ * advance pos; returns false at its end or if the entry is truncated
+ */
+inline bool next_index_entry(const char *data, size_t size, size_t &pos,
+                             IndexEntry &entry) {
+  if (pos < sizeof(CPPLOG_INDEX_MAGIC)) pos = sizeof(CPPLOG_INDEX_MAGIC);
+  if (pos + CPPLOG_INDEX_ENTRY_HEADER_SIZE > size) return false;
+
+  const char *header = data + pos;
+  uint32_t entry_size = decode_binary_value<uint32_t>(header + 4);
+  if (entry_size < CPPLOG_INDEX_ENTRY_HEADER_SIZE ||
+      entry_size > size - pos) {
+    return false;
+  }
+
+  entry.type = static_cast<IndexEntryType>(header[0]);
+  const char *payload = header + CPPLOG_INDEX_ENTRY_HEADER_SIZE;
+  if (entry.type == IndexEntryType::BLOCK) {
+    if (entry_size < CPPLOG_INDEX_BLOCK_SIZE) return false;
+    entry.block.codec = static_cast<Compression>(header[1]);
+    entry.block.records = RecordInfo();
+    entry.block.records.levels = static_cast<uint8_t>(header[2]);
+    entry.block.offset = decode_binary_value<uint64_t>(payload);
+    entry.block.size = decode_binary_value<uint64_t>(payload + 8);
+    entry.block.records.first_timestamp =
+      decode_binary_value<uint64_t>(payload + 16);
+    entry.block.records.last_timestamp =
+      decode_binary_value<uint64_t>(payload + 24);
+    entry.block.records.names = decode_binary_value<uint64_t>(payload + 32);
+  } else {
+    entry.record = std::string_view(
+      payload, entry_size - CPPLOG_INDEX_ENTRY_HEADER_SIZE);
+  }
+  pos += entry_size;
+  return true;
+}
+
+/*
+ * compresses the buffers of a FileSink into frames and writes them to
+ * its file, on a thread of its own (see own_thread) or right away; at
+ * most MX_PENDING buffers wait for the thread, writing another one
+ * waits until one of them was written; every frame can be followed by
+ * its block in the index of the file
+ */
+class FrameWriter {
+ private:
+  static constexpr size_t MX_PENDING = 4;
+
+  struct Frame {
+    int fd;
+    std::string data;
+
+    // index of the file (-1 if none) and the block of the frame
+    int index_fd;
+    IndexBlock block;
+  };
+
+  CompressionOptions _options;
+  std::unique_ptr<FrameCompressor> _compressor;
+  std::unique_ptr<char[]> _out;
+  size_t _out_capacity;
+
+  std::mutex _mutex;
+  std::condition_variable _wake_thread;
+  std::condition_variable _written;
+
+  // ring of waiting frames, the first one is written while _writing
+  Frame _pending[MX_PENDING];
+  size_t _first;
+  size_t _n_pending;
+  bool _writing;
+
+  bool _stop;
+  std::thread _thread;
+
+  // (falls back to a stored frame if compressing fails)
+  void _write_frame(int fd, const char *data, size_t size, int index_fd,
+                    IndexBlock block) {
+    uint64_t offset = index_fd >= 0 ? fd_size(fd) : 0;
+    size_t bound = _compressor->bound(size);
+    if (bound > _out_capacity) {
+      _out.reset(new char[bound]);
+      _out_capacity = bound;
+    }
+    size_t n = _compressor->compress(data, size, _out.get(), _out_capacity);
+    if (n) {
+      write_fd(fd, _out.get(), n);
+    } else {
+      write_stored_frame(fd, _options.codec, data, size);
+    }
+
+    if (index_fd >= 0) {
+      block.offset = offset;
+      block.size = fd_size(fd) - offset;
+      block.codec = _options.codec;
+      char entry[CPPLOG_INDEX_BLOCK_SIZE];
+      encode_index_block(entry, block);
+      write_fd(index_fd, entry, sizeof(entry));
+    }
+  }
+
+  void _run() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;) {
+      if (_n_pending == 0) {
+        if (_stop) return;
+        _wake_thread.wait(lock);
+        continue;
+      }
+
+      Frame &frame = _pending[_first];
+      _writing = true;
+      lock.unlock();
+      _write_frame(frame.fd, frame.data.data(), frame.data.size(),
+                   frame.index_fd, frame.block);
+      lock.lock();
+      _writing = false;
+
+      _first = (_first + 1) % MX_PENDING;
+      --_n_pending;
+      _written.notify_all();
+    }
+  }
+
+ public:
+  explicit FrameWriter(const CompressionOptions &options) :
+    _options(options),
+    _compressor(make_frame_compressor(options.codec, options.level)),
+    _out_capacity(0), _first(0), _n_pending(0), _writing(false),
+    _stop(false) {
+    if (options.own_thread) _thread = std::thread(&FrameWriter::_run, this);
+  }
+
+  ~FrameWriter() {
+    if (_thread.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+        _wake_thread.notify_one();
+      }
+      _thread.join();
+    }
+  }
+
+  FrameWriter(const FrameWriter &) = delete;
+  FrameWriter &operator=(const FrameWriter &) = delete;
+
+  /*
+   * compress size bytes of data into one frame and write it to fd, followed
+   * by block (with the offset and size of the frame) to index_fd (if set)
+   */
+  void write(int fd, const char *data, size_t size, int index_fd = -1,
+             const IndexBlock &block = IndexBlock()) {
+    if (size == 0) return;
+    if (!_thread.joinable()) {
+      _write_frame(fd, data, size, index_fd, block);
+      return;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _written.wait(lock, [this] { return _n_pending < MX_PENDING; });
+    Frame &frame = _pending[(_first + _n_pending) % MX_PENDING];
+    frame.fd = fd;
+    frame.data.assign(data, size);  // (keeps its capacity)
+    frame.index_fd = index_fd;
+    frame.block = block;
+    ++_n_pending;
+    _wake_thread.notify_one();
+  }
+
+  // wait until all frames were written
+  void drain() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _written.wait(lock, [this] { return _n_pending == 0; });
+  }
+
+  /*
+   * crash handler: write the frames that wait for the thread as stored
+   * frames (see write_stored_frame; the thread finishes the frame it is
+   * writing right now, or it is cut off)
+   */
+  void emergency_write() {
+    std::unique_lock<std::mutex> lock = emergency_lock(_mutex);
+    if (!lock.owns_lock()) return;
+    for (size_t i = _writing ? 1 : 0; i < _n_pending; ++i) {
+      const Frame &frame = _pending[(_first + i) % MX_PENDING];
+      write_stored_frame(frame.fd, _options.codec, frame.data.data(),
+                         frame.data.size());
+    }
+  }
+
+  const CompressionOptions &options() const {
+    return _options;
+  }
+};
+
+/*
+ * appends records to a file; records are collected in a buffer of
+ * buffer_size bytes, which is written with a single write(2) whenever
+ * it is full or the sink gets flushed (records larger than the buffer
+ * are written directly); a buffer_size of 0 disables buffering; with
+ * set_compression, every buffer is written as a compressed frame; with
+ * set_index, a sparse index of the file is written next to it
+ */
+class FileSink : public Sink {
+ protected:
+  std::string _path;
+  int _fd;
+  std::unique_ptr<char[]> _buffer;
+  size_t _capacity;
+  size_t _size;
+
+  // bytes in the current file (including the buffered ones; before
+  // compression)
+  uint64_t _file_size;
+
+  // compresses the buffers (see set_compression)
+  Compression _compression = Compression::NONE;
+  std::unique_ptr<FrameWriter> _frames;
+
+  // index of the file (see set_index; -1 if none), the block the records
+  // are appended to (the buffer, if compressed) and the entries that can
+  // only be written once the data before them was written
+  int _index_fd = -1;
+  size_t _index_interval = 0;
+  IndexBlock _block;
+  std::string _index_pending;
+
+  std::mutex _mutex;
+
+  void _write_index_pending() {
+    if (_index_pending.empty()) return;
+    write_fd(_index_fd, _index_pending.data(), _index_pending.size());
+    _index_pending.clear();
+  }
+
+  // (a compressed block is the frame of data)
+  void _write_out(const char *data, size_t size) {
+    if (!_frames) {
+      write_fd(_fd, data, size);
+      _write_index_pending();
+    } else if (_index_fd >= 0) {
+      _write_index_pending();
+      _frames->write(_fd, data, size, _index_fd, _block);
+      _block = IndexBlock();
+    } else {
+      _frames->write(_fd, data, size);
+    }
+  }
+
+  void _flush_buffer() {
+    if (_size == 0) return;
+    _write_out(_buffer.get(), _size);
+    _size = 0;
+  }
+
+  // end the current (uncompressed) block
+  void _close_block() {
+    if (_index_fd < 0 || _frames || _block.size == 0) return;
+    char entry[CPPLOG_INDEX_BLOCK_SIZE];
+    encode_index_block(entry, _block);
+    _index_pending.append(entry, sizeof(entry));
+    _block = IndexBlock();
+  }
+
+  // add the records of a write to the current block (info may be null)
+  void _index(const char *data, size_t size, const RecordInfo *info) {
+    RecordInfo records;
+    if (info) {
+      records = *info;
+    } else {
+      records.levels = 0xff;
+      records.names = ~0ull;
+    }
+    if (!records.first_timestamp) {
+      records.first_timestamp = records.last_timestamp =
+        timestamp_now(TimestampPrecision::SECONDS);
+    }
+
+    // keep everything of a binary log but its LOG records
+    if (records.encoding == Encoding::BINARY) {
+      for (size_t pos = 0; pos < size;) {
+        size_t record_size;
+        if (size - pos >= sizeof(CPPLOG_BINARY_MAGIC) &&
+            std::memcmp(data + pos, CPPLOG_BINARY_MAGIC,
+                        sizeof(CPPLOG_BINARY_MAGIC)) == 0) {
+          record_size = sizeof(CPPLOG_BINARY_MAGIC);
+        } else if (size - pos >= CPPLOG_BINARY_RECORD_HEADER_SIZE) {
+          record_size = decode_binary_value<uint32_t>(data + pos + 1);
+          if (record_size < CPPLOG_BINARY_RECORD_HEADER_SIZE) break;
+          if (data[pos] == static_cast<char>(BinaryRecordType::LOG)) {
+            pos += record_size;
+            continue;
+          }
+        } else {
+          break;
+        }
+        append_index_string(_index_pending, data + pos,
+                            std::min(record_size, size - pos));
+        pos += record_size;
+      }
+    }
+
+    if (_block.size == 0) {
+      _block.offset = _file_size;
+      _block.records = RecordInfo();
+    }
+    _block.size += size;
+    RecordInfo &block = _block.records;
+    block.levels |= records.levels;
+    block.names |= records.names;
+    if (!block.first_timestamp ||
+        records.first_timestamp < block.first_timestamp) {
+      block.first_timestamp = records.first_timestamp;
+    }
+    block.last_timestamp =
+      std::max(block.last_timestamp, records.last_timestamp);
+  }
+
+  // open the index of the current file (a new one if the file is empty)
+  void _open_index() {
+    std::string path = index_path(_path);
+    if (_file_size == 0) std::remove(path.c_str());
+    _index_fd = open_log_file(path, false);
+    if (fd_size(_index_fd) == 0) {
+      write_fd(_index_fd, CPPLOG_INDEX_MAGIC, sizeof(CPPLOG_INDEX_MAGIC));
+    }
+    _block = IndexBlock();
+  }
+
+  // write the buffer and wait until its frames were written
+  void _flush_frames() {
+    _flush_buffer();
+    if (_frames) _frames->drain();
+    if (_index_fd >= 0) _write_index_pending();
+  }
+
+  // (crash handler; writes stored frames instead of compressing)
+  void _emergency_flush_buffer() {
+    if (_frames) _frames->emergency_write();
+    write_stored_frame(_fd, _compression, _buffer.get(), _size);
+    _size = 0;
+  }
+
+  void _append(const char *data, size_t size,
+               const RecordInfo *info = nullptr) {
+    if (_size + size > _capacity) _flush_buffer();
+    if (_index_fd >= 0) _index(data, size, info);
+    _file_size += size;
+    if (size >= _capacity) {
+      _write_out(data, size);
+    } else {
+      std::memcpy(_buffer.get() + _size, data, size);
+      _size += size;
+    }
+    if (_block.size >= _index_interval) _close_block();
+  }
+
+ public:
+  explicit FileSink(const std::string &path,
+                    size_t buffer_size = CPPLOG_FILE_BUFFER_SIZE,
+                    bool truncate = false) :
+    _path(path), _fd(open_log_file(path, truncate)),
+    _buffer(buffer_size ? new char[buffer_size] : nullptr),
+    _capacity(buffer_size), _size(0), _file_size(fd_size(_fd)) {}
+
+  ~FileSink() override {
+    _close_block();
+    _flush_buffer();
+    _frames.reset();
+    if (_index_fd >= 0) {
+      _write_index_pending();
+      close_fd(_index_fd);
+    }
+    close_fd(_fd);
+  }
+
+  FileSink(const FileSink &) = delete;
+  FileSink &operator=(const FileSink &) = delete;
+
+  /*
+   * write the records as independently decodable frames of options.codec
+   * (of frame_size bytes each before compression), so the file can be
+   * decoded up to its last complete frame after a crash, e.g. with
+   * "zstd -dc" or "lz4 -dc"; the file should be empty or use the same
+   * codec already; this should be called before the sink is added to a
+   * Logger; throws std::runtime_error if the codec isn't available
+   */
+  void set_compression(const CompressionOptions &options) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _close_block();
+    _flush_frames();
+    _frames.reset();
+    _compression = options.codec;
+    if (options.codec == Compression::NONE) return;
+
+    _frames.reset(new FrameWriter(options));
+    if (options.frame_size != _capacity) {
+      _buffer.reset(options.frame_size ? new char[options.frame_size]
+                                       : nullptr);
+      _capacity = options.frame_size;
+    }
+  }
+
+  Compression compression() const {
+    return _compression;
+  }
+
+  /*
+   * write a sparse index of the file to index_path(path): an entry per
+   * block of about interval bytes (per frame, if compressed) with its
+   * offset, the time range of its records and which severities and
+   * Loggers (see name_bit) they have; cpplog-query uses it to read only
+   * the blocks of a time range, severity or Logger; records that were
+   * written before are not indexed; this should be called before the
+   * sink is added to a Logger
+   */
+  void set_index(size_t interval = CPPLOG_INDEX_INTERVAL) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _flush_frames();
+    _index_interval = interval ? interval : 1;
+    if (_index_fd < 0) _open_index();
+  }
+
+  bool indexed() const {
+    return _index_fd >= 0;
+  }
+
+  void write(const char *data, size_t size) override {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _append(data, size);
+  }
+
+  void write_records(const char *data, size_t size,
+                     const RecordInfo &info) override {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _append(data, size, &info);
+  }
+
+  void flush() override {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _flush_frames();
+  }
+
+  // (compressed frames are only written once they are full, or on flush)
+  void idle() override {
+    if (!_frames) flush();
+  }
+
+  void emergency_write(const char *data, size_t size) override {
+    std::unique_lock<std::mutex> lock = emergency_lock(_mutex);
+    if (lock.owns_lock()) _emergency_flush_buffer();
+    write_stored_frame(_fd, _compression, data, size);
+  }
+
+  void emergency_flush() override {
+    std::unique_lock<std::mutex> lock = emergency_lock(_mutex);
+    if (lock.owns_lock()) _emergency_flush_buffer();
+  }
+
+  const std::string &path() const {
+    return _path;
+  }
+};
+
+/*
+ * buffered FileSink that starts a new file once the current one would
+ * grow beyond max_size bytes and/or once interval has passed since the
+ * file was opened (0 disables either check); old files are renamed to
+ * "<path>.1" ... "<path>.<max_files>", the oldest one is removed;
+ * with compression, max_size counts the bytes before compression
+ */
+class RotatingFileSink : public FileSink {
+ private:
+  uint64_t _max_size;
+  size_t _max_files;
+  std::chrono::seconds _interval;
+  std::chrono::steady_clock::time_point _next_rotation;
+
+  std::string _backup_path(size_t index) const {
+    return _path + "." + std::to_string(index);
+  }
+
+  bool _should_rotate(size_t size) const {
+    if (_max_size && _file_size > 0 && _file_size + size > _max_size) {
+      return true;
+    }
+    return _interval.count() > 0 &&
+           std::chrono::steady_clock::now() >= _next_rotation;
+  }
+
+  // (and the index of the file, if it has one)
+  void _rename(const std::string &from, const std::string &to) {
+    std::rename(from.c_str(), to.c_str());
+    if (_index_fd >= 0) {
+      std::rename(index_path(from).c_str(), index_path(to).c_str());
+    }
+  }
+
+  void _rotate() {
+    _close_block();
+    _flush_frames();
+    close_fd(_fd);
+    if (_index_fd >= 0) close_fd(_index_fd);
+
+    if (_max_files > 0) {
+      std::remove(_backup_path(_max_files).c_str());
+      std::remove(index_path(_backup_path(_max_files)).c_str());
+      for (size_t i = _max_files - 1; i >= 1; --i) {
+        _rename(_backup_path(i), _backup_path(i + 1));
+      }
+      _rename(_path, _backup_path(1));
+    }
+
+    _fd = open_log_file(_path, true);
+    _file_size = 0;
+    if (_index_fd >= 0) _open_index();
+    _next_rotation = std::chrono::steady_clock::now() + _interval;
+  }
+
+ public:
+  RotatingFileSink(const std::string &path, uint64_t max_size,
+                   size_t max_files = 5,
+                   std::chrono::seconds interval = std::chrono::seconds(0),
+                   size_t buffer_size = CPPLOG_FILE_BUFFER_SIZE) :
+    FileSink(path, buffer_size), _max_size(max_size),
+    _max_files(max_files), _interval(interval),
+    _next_rotation(std::chrono::steady_clock::now() + interval) {}
+
+  void write(const char *data, size_t size) override {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_should_rotate(size)) _rotate();
+    _append(data, size);
+  }
+
+  void write_records(const char *data, size_t size,
+                     const RecordInfo &info) override {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_should_rotate(size)) _rotate();
+    _append(data, size, &info);
+  }
+};
+
+#ifndef _WIN32
+/*
+ * layout of a MappedRingSink file:
+ *   header (CPPLOG_RING_HEADER_SIZE bytes):
+ *     CPPLOG_RING_MAGIC (8 bytes), u64 capacity, u64 head, u64 tail
+ *   data (capacity bytes): ring of frames, every frame is
+ *     u32 size + size bytes (the data of one Sink::write call)
+ * head and tail are logical offsets that only ever grow (the position
+ * in the data area is offset % capacity); tail always points to the
+ * oldest complete frame and head to the end of the newest one
+ */
+static constexpr char CPPLOG_RING_MAGIC[8] = {
+  'C', 'P', 'P', 'L', 'O', 'G', 'R', '1'
+};
+static constexpr size_t CPPLOG_RING_HEADER_SIZE = 64;
+static constexpr size_t CPPLOG_RING_FRAME_HEADER_SIZE = sizeof(uint32_t);
+
+/*
+ * keeps the newest records in a preallocated, memory-mapped file that is
+ * used as a ring buffer: records are copied straight into the mapping,
+ * so no system call is needed to log, and everything that was written
+ * survives a crash of the process (the kernel writes the pages back on
+ * its own; call sync() to also survive a crash of the machine);
+ * records that don't fit into the ring are dropped, the oldest records
+ * are overwritten once the ring is full; an existing ring file with the
+ * same capacity is continued, otherwise it is reinitialized;
+ * use cpplog-ring (or linearize) to turn the file back into a log
+ */
+class MappedRingSink : public Sink {
+ private:
+  std::string _path;
+  uint64_t _capacity;
+  char *_map;
+  size_t _map_size;
+  std::mutex _mutex;
+
+  uint64_t _header_value(size_t offset) const {
+    return decode_binary_value<uint64_t>(_map + offset);
+  }
+
+  void _set_header_value(size_t offset, uint64_t value) {
+    std::memcpy(_map + offset, &value, sizeof(value));
+  }
+
+  // copy into the data area at a logical offset (wrapping around)
+  void _copy_in(uint64_t offset, const char *data, size_t size) {
+    char *ring = _map + CPPLOG_RING_HEADER_SIZE;
+    size_t pos = static_cast<size_t>(offset % _capacity);
+    size_t first = std::min<size_t>(size, _capacity - pos);
+    std::memcpy(ring + pos, data, first);
+    std::memcpy(ring, data + first, size - first);
+  }
+
+  static uint32_t _frame_size(const char *ring, uint64_t capacity,
+                              uint64_t offset) {
+    char buf[CPPLOG_RING_FRAME_HEADER_SIZE];
+    for (size_t i = 0; i < sizeof(buf); ++i) {
+      buf[i] = ring[(offset + i) % capacity];
+    }
+    return decode_binary_value<uint32_t>(buf);
+  }
+
+  // (_mutex has to be held, apart from emergency writes)
+  void _write_frame(const char *data, size_t size) {
+    uint64_t frame = CPPLOG_RING_FRAME_HEADER_SIZE + size;
+    if (frame > _capacity || size > UINT32_MAX) return;
+
+    uint64_t head = _header_value(16);
+    uint64_t tail = _header_value(24);
+
+    // free the space of the oldest frames before overwriting them
+    const char *ring = _map + CPPLOG_RING_HEADER_SIZE;
+    while (head + frame - tail > _capacity) {
+      uint64_t oldest = CPPLOG_RING_FRAME_HEADER_SIZE +
+                        _frame_size(ring, _capacity, tail);
+      // a corrupted frame can't be skipped -> start over with an empty ring
+      tail = oldest <= head - tail ? tail + oldest : head;
+    }
+    _set_header_value(24, tail);
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+
+    uint32_t size32 = static_cast<uint32_t>(size);
+    _copy_in(head, reinterpret_cast<const char *>(&size32), sizeof(size32));
+    _copy_in(head + sizeof(size32), data, size);
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+
+    // the frame only becomes visible to readers once head covers it
+    _set_header_value(16, head + frame);
+  }
+
+ public:
+  MappedRingSink(const std::string &path, size_t capacity) :
+    _path(path), _capacity(capacity), _map(nullptr),
+    _map_size(CPPLOG_RING_HEADER_SIZE + capacity) {
+    if (capacity <= CPPLOG_RING_FRAME_HEADER_SIZE) {
+      throw std::runtime_error("cpplog: ring capacity is too small");
+    }
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      throw std::runtime_error("cpplog: could not open ring file '" + path +
+                               "': " + std::strerror(errno));
+    }
+
+    bool reuse = fd_size(fd) == _map_size;
+    if (!reuse && ::ftruncate(fd, static_cast<off_t>(_map_size)) != 0) {
+      int err = errno;
+      close_fd(fd);
+      throw std::runtime_error("cpplog: could not resize ring file '" +
+                               path + "': " + std::strerror(err));
+    }
+
+    void *map = ::mmap(nullptr, _map_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0);
+    int err = errno;
+    close_fd(fd);
+    if (map == MAP_FAILED) {
+      throw std::runtime_error("cpplog: could not map ring file '" + path +
+                               "': " + std::strerror(err));
+    }
+    _map = static_cast<char *>(map);
+
+    reuse = reuse &&
+            std::memcmp(_map, CPPLOG_RING_MAGIC, sizeof(CPPLOG_RING_MAGIC)) == 0 &&
+            _header_value(8) == _capacity &&
+            _header_value(24) <= _header_value(16) &&
+            _header_value(16) - _header_value(24) <= _capacity;
+    if (!reuse) {
+      std::memset(_map, 0, CPPLOG_RING_HEADER_SIZE);
+      _set_header_value(8, _capacity);
+      std::memcpy(_map, CPPLOG_RING_MAGIC, sizeof(CPPLOG_RING_MAGIC));
+    }
+  }
+
+  ~MappedRingSink() override {
+    ::munmap(_map, _map_size);
+  }
+
+  MappedRingSink(const MappedRingSink &) = delete;
+  MappedRingSink &operator=(const MappedRingSink &) = delete;
+
+  void write(const char *data, size_t size) override {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _write_frame(data, size);
+  }
+
+  // (frames in the mapping survive the crash, nothing has to be flushed;
+  // data is dropped if the ring is busy)
+  void emergency_write(const char *data, size_t size) override {
+    std::unique_lock<std::mutex> lock = emergency_lock(_mutex);
+    if (lock.owns_lock()) _write_frame(data, size);
+  }
+
+  // block until the mapped file has been written to disk
+  void sync() {
+    ::msync(_map, _map_size, MS_SYNC);
+  }
+
+  size_t capacity() const {
+    return static_cast<size_t>(_capacity);
+  }
+
+  const std::string &path() const {
+    return _path;
+  }
+
+  /*
+   * append the content of a ring file (size bytes at file) to out, from
+   * the oldest to the newest frame; returns false if the file isn't a
+   * valid ring (frames before a corrupted one are still appended)
+   */
+  static bool linearize(const char *file, size_t size, std::string &out) {
+    if (size < CPPLOG_RING_HEADER_SIZE ||
+        std::memcmp(file, CPPLOG_RING_MAGIC, sizeof(CPPLOG_RING_MAGIC)) != 0) {
+      return false;
+    }
+
+    uint64_t capacity = decode_binary_value<uint64_t>(file + 8);
+    uint64_t head = decode_binary_value<uint64_t>(file + 16);
+    uint64_t tail = decode_binary_value<uint64_t>(file + 24);
+    if (capacity <= CPPLOG_RING_FRAME_HEADER_SIZE ||
+        size - CPPLOG_RING_HEADER_SIZE < capacity ||
+        tail > head || head - tail > capacity) {
+      return false;
+    }
+
+    const char *ring = file + CPPLOG_RING_HEADER_SIZE;
+    while (tail < head) {
+      if (head - tail < CPPLOG_RING_FRAME_HEADER_SIZE) return false;
+      uint64_t frame_size = _frame_size(ring, capacity, tail);
+      tail += CPPLOG_RING_FRAME_HEADER_SIZE;
+      if (frame_size > head - tail) return false;
+
+      size_t pos = static_cast<size_t>(tail % capacity);
+      size_t first = static_cast<size_t>(
+        std::min<uint64_t>(frame_size, capacity - pos));
+      out.append(ring + pos, first);
+      out.append(ring, static_cast<size_t>(frame_size) - first);
+      tail += frame_size;
+    }
+    return true;
+  }
+};
+#endif
+
+#ifndef _WIN32
+// transport (and framing) of the records of a NetworkSink
+enum class NetworkProtocol : uint8_t {
+  UDP,  // one syslog message per datagram (RFC 5426)
+  TCP,  // syslog messages prefixed by their length (RFC 6587)
+};
+
+// where a NetworkSink sends its records to, and how
+struct NetworkSinkOptions {
+  NetworkProtocol protocol = NetworkProtocol::UDP;
+  std::string host = "127.0.0.1";
+  uint16_t port = 514;
+
+  // syslog facility and header fields (the host name / "-" if empty)
+  int facility = 1;  // user-level messages
+  std::string hostname;
+  std::string app_name;
+
+  /*
+   * bytes of records that wait to be sent at most; records that don't
+   * fit anymore (e.g. while the collector is unreachable) are dropped
+   * and counted (see Counter::DROPPED_SINK)
+   */
+  size_t max_backlog = CPPLOG_NETWORK_BACKLOG;
+
+  // bytes of messages handed to the socket at once (TCP: in one send,
+  // UDP: in one sendmmsg, with a datagram per message)
+  size_t max_batch = CPPLOG_NETWORK_BATCH;
+
+  // longer messages are truncated (RFC 5426 receivers only have to
+  // accept 480 bytes, but most accept at least 2048)
+  size_t max_message = 2048;
+
+  // records wait this long at most for a batch to fill up; records of
+  // flush_severity (or above) are sent right away
+  std::chrono::microseconds max_latency = std::chrono::milliseconds(100);
+  Severity flush_severity = Severity::ERROR;
+
+  // wait before connecting again, doubled after every failed attempt
+  std::chrono::milliseconds min_backoff = std::chrono::milliseconds(100);
+  std::chrono::milliseconds max_backoff = std::chrono::seconds(30);
+
+  // how long connecting (TCP) and flush() may take at most
+  std::chrono::milliseconds connect_timeout = std::chrono::seconds(5);
+  std::chrono::milliseconds flush_timeout = std::chrono::seconds(1);
+};
+
+/*
+ * sends records to a syslog collector, every line of a record as an
+ * RFC 5424 message (so text encoding only); the logging thread only
+ * copies records into a bounded backlog, a thread of the sink collects
+ * them into batches and sends them over a non-blocking socket; if the
+ * connection fails, it connects again with exponential backoff (the
+ * records of an interrupted batch are sent again, so they may arrive
+ * twice); dropped records and reconnects are counted in the metrics of
+ * the backend; the crash handler can't reach the collector, so records
+ * that weren't sent yet are lost on a crash
+ */
+class NetworkSink : public Sink {
+ private:
+  // header of every record in the backlog (followed by its bytes)
+  struct Entry {
+    uint32_t size;
+    Severity severity;
+    uint64_t time_us;  // since the epoch
+  };
+
+#ifdef MSG_NOSIGNAL
+  static constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+  static constexpr int SEND_FLAGS = 0;  // (SO_NOSIGPIPE is set instead)
+#endif
+
+  // messages per sendmmsg call
+  static constexpr size_t MX_DATAGRAMS = 64;
+
+  NetworkSinkOptions _options;
+
+  // " HOSTNAME APP-NAME PROCID MSGID STRUCTURED-DATA " of every message
+  std::string _header;
+
+  std::mutex _mutex;
+  std::condition_variable _wake_sender;
+  std::condition_variable _progress;
+
+  // records logged since the sender took the last ones
+  std::vector<char> _backlog;
+
+  // bytes of the records the sender took and is still busy with
+  size_t _in_flight;
+
+  // bytes of records ever added to the backlog / taken care of by the
+  // sender (sent or dropped; see flush)
+  uint64_t _queued;
+  uint64_t _done;
+
+  // send without waiting for the batch to fill up
+  bool _urgent;
+
+  // the records in the backlog have to be sent by then (see max_latency)
+  std::chrono::steady_clock::time_point _deadline;
+
+  std::atomic<bool> _stop;
+  std::atomic<uint64_t> _dropped;
+  std::atomic<uint64_t> _reconnects;
+
+  // only used by the sender thread:
+  int _fd;
+  bool _was_connected;
+  std::vector<char> _out;    // messages of the current batch
+  std::vector<size_t> _ends; // end of every message in _out
+  std::time_t _second;
+  char _date[sizeof("yyyy-mm-ddThh:mm:ss")];
+
+  std::thread _sender;
+
+  static int _syslog_severity(Severity severity) {
+    switch (severity) {
+      case Severity::TRACE:
+      case Severity::DEBUG: return 7;
+      case Severity::INFO:  return 6;
+      case Severity::WARN:  return 4;
+      case Severity::ERROR: return 3;
+      default:              return 2;
+    }
+  }
+
+  static size_t _count_records(const std::vector<char> &entries,
+                               size_t pos) {
+    size_t n = 0;
+    for (; pos < entries.size(); ++n) {
+      Entry entry;
+      std::memcpy(&entry, entries.data() + pos, sizeof(entry));
+      pos += sizeof(entry) + entry.size;
+    }
+    return n;
+  }
+
+  void _append(const char *data, size_t size) {
+    _out.insert(_out.end(), data, data + size);
+  }
+
+  void _append_message(const Entry &entry, const char *text, size_t len) {
+    std::time_t second = static_cast<std::time_t>(entry.time_us / 1000000);
+    if (second != _second) {
+      std::tm utc;
+      gmtime_r(&second, &utc);
+      std::strftime(_date, sizeof(_date), "%Y-%m-%dT%H:%M:%S", &utc);
+      _second = second;
+    }
+
+    char prefix[64];
+    size_t prefix_len = static_cast<size_t>(std::snprintf(
+      prefix, sizeof(prefix), "<%d>1 %s.%06uZ",
+      _options.facility * 8 + _syslog_severity(entry.severity), _date,
+      static_cast<unsigned>(entry.time_us % 1000000)));
+
+    size_t size = prefix_len + _header.size() + len;
+    if (size > _options.max_message) {
+      size_t excess = std::min(len, size - _options.max_message);
+      len -= excess;
+      size -= excess;
+    }
+
+    if (_options.protocol == NetworkProtocol::TCP) {
+      char octets[24];
+      _append(octets, static_cast<size_t>(
+        std::snprintf(octets, sizeof(octets), "%zu ", size)));
+    }
+    _append(prefix, prefix_len);
+    _append(_header.data(), _header.size());
+    _append(text, len);
+    _ends.push_back(_out.size());
+  }
+
+  /*
+   * format the messages of the records of entries from pos on, until the
+   * batch is full; returns the position of the first record left over
+   */
+  size_t _frame(const std::vector<char> &entries, size_t pos) {
+    _out.clear();
+    _ends.clear();
+    bool first = true;
+    while (pos < entries.size()) {
+      Entry entry;
+      std::memcpy(&entry, entries.data() + pos, sizeof(entry));
+      if (!first && _out.size() + entry.size > _options.max_batch) break;
+      first = false;
+
+      const char *text = entries.data() + pos + sizeof(entry);
+      const char *end = text + entry.size;
+      while (text < end) {
+        const char *eol = static_cast<const char *>(
+          std::memchr(text, '\n', static_cast<size_t>(end - text)));
+        if (!eol) eol = end;
+        if (eol > text) {
+          _append_message(entry, text, static_cast<size_t>(eol - text));
+        }
+        text = eol + 1;
+      }
+      pos += sizeof(entry) + entry.size;
+    }
+    return pos;
+  }
+
+  // wait until fd is writable (or timeout_ms passed)
+  static bool _poll_writable(int fd, int timeout_ms) {
+    pollfd poll_fd = {fd, POLLOUT, 0};
+    int n;
+    do {
+      n = ::poll(&poll_fd, 1, timeout_ms);
+    } while (n < 0 && errno == EINTR);
+    return n > 0;
+  }
+
+  // wait until a non-blocking connect finished; returns if it succeeded
+  bool _finish_connect(int fd) {
+    auto deadline = std::chrono::steady_clock::now() +
+                    _options.connect_timeout;
+    while (!_stop.load()) {
+      if (_poll_writable(fd, 100)) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        ::getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len);
+        return error == 0;
+      }
+      if (std::chrono::steady_clock::now() >= deadline) break;
+    }
+    return false;
+  }
+
+  bool _connect() {
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = _options.protocol == NetworkProtocol::UDP ?
+                          SOCK_DGRAM : SOCK_STREAM;
+    addrinfo *addrs = nullptr;
+    std::string port = std::to_string(_options.port);
+    if (::getaddrinfo(_options.host.c_str(), port.c_str(), &hints,
+                      &addrs) != 0) {
+      return false;
+    }
+
+    for (addrinfo *addr = addrs; addr && _fd < 0; addr = addr->ai_next) {
+      int fd = ::socket(addr->ai_family, addr->ai_socktype,
+                        addr->ai_protocol);
+      if (fd < 0) continue;
+      ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+      ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+#if defined(SO_NOSIGPIPE) && !defined(MSG_NOSIGNAL)
+      int on = 1;
+      ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+      if (::connect(fd, addr->ai_addr, addr->ai_addrlen) == 0 ||
+          (errno == EINPROGRESS && _finish_connect(fd))) {
+        _fd = fd;
+      } else {
+        close_fd(fd);
+      }
+    }
+    ::freeaddrinfo(addrs);
+
+    if (_fd < 0) return false;
+    if (_was_connected) _reconnects.fetch_add(1, std::memory_order_relaxed);
+    _was_connected = true;
+    return true;
+  }
+
+  void _disconnect() {
+    if (_fd >= 0) close_fd(_fd);
+    _fd = -1;
+  }
+
+  // whether the error of a send is only temporary (socket buffer full)
+  bool _retry(int error) {
+    if (error == EINTR) return true;
+    if ((error == EAGAIN || error == EWOULDBLOCK) && !_stop.load()) {
+      _poll_writable(_fd, 100);
+      return true;
+    }
+    return false;
+  }
+
+  bool _send_stream() {
+    const char *data = _out.data();
+    size_t size = _out.size();
+    while (size > 0) {
+      ssize_t n = ::send(_fd, data, size, SEND_FLAGS);
+      if (n >= 0) {
+        data += n;
+        size -= static_cast<size_t>(n);
+      } else if (!_retry(errno)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool _send_datagrams() {
+    size_t begin = 0;
+    for (size_t i = 0; i < _ends.size();) {
+#ifdef __linux__
+      mmsghdr msgs[MX_DATAGRAMS];
+      iovec bufs[MX_DATAGRAMS];
+      unsigned n_msgs = 0;
+      for (size_t start = begin; n_msgs < MX_DATAGRAMS &&
+           i + n_msgs < _ends.size(); ++n_msgs) {
+        bufs[n_msgs].iov_base = _out.data() + start;
+        bufs[n_msgs].iov_len = _ends[i + n_msgs] - start;
+        msgs[n_msgs] = mmsghdr();
+        msgs[n_msgs].msg_hdr.msg_iov = &bufs[n_msgs];
+        msgs[n_msgs].msg_hdr.msg_iovlen = 1;
+        start = _ends[i + n_msgs];
+      }
+      int sent = ::sendmmsg(_fd, msgs, n_msgs, SEND_FLAGS);
+#else
+      int sent = ::send(_fd, _out.data() + begin, _ends[i] - begin,
+                        SEND_FLAGS) < 0 ? -1 : 1;
+#endif
+      if (sent > 0) {
+        i += static_cast<size_t>(sent);
+        begin = _ends[i - 1];
+      } else if (errno == EMSGSIZE) {
+        // (a message the network can't carry)
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        begin = _ends[i++];
+      } else if (errno != ECONNREFUSED && !_retry(errno)) {
+        // (ECONNREFUSED belongs to an earlier datagram, nothing was sent)
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // wait before connecting again; returns false if the sink is stopped
+  bool _backoff(std::chrono::milliseconds delay) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    return !_wake_sender.wait_for(lock, delay,
+                                  [this] { return _stop.load(); });
+  }
+
+  // send all records of entries (connecting as often as it takes)
+  void _send(const std::vector<char> &entries) {
+    std::chrono::milliseconds delay = _options.min_backoff;
+    for (size_t pos = 0; pos < entries.size();) {
+      size_t next = _frame(entries, pos);
+      while (_fd < 0 || !(_options.protocol == NetworkProtocol::UDP ?
+                            _send_datagrams() : _send_stream())) {
+        if (_fd >= 0) {
+          _disconnect();
+        } else if (!_stop.load() && _connect()) {
+          continue;
+        }
+        if (_stop.load() || !_backoff(delay)) {
+          _dropped.fetch_add(_count_records(entries, pos),
+                             std::memory_order_relaxed);
+          return;
+        }
+        delay = std::min(delay * 2, _options.max_backoff);
+      }
+      delay = _options.min_backoff;
+      pos = next;
+    }
+  }
+
+  void _run() {
+    std::vector<char> entries;
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_stop.load()) {
+      if (_backlog.empty()) {
+        _wake_sender.wait(lock);
+      } else if (!_urgent && _backlog.size() < _options.max_batch &&
+                 std::chrono::steady_clock::now() < _deadline) {
+        _wake_sender.wait_until(lock, _deadline);
+      } else {
+        _urgent = false;
+        entries.swap(_backlog);
+        _in_flight = entries.size();
+        lock.unlock();
+
+        _send(entries);
+
+        lock.lock();
+        _done += entries.size();
+        _in_flight = 0;
+        entries.clear();
+        _progress.notify_all();
+      }
+    }
+    _dropped.fetch_add(_count_records(_backlog, 0),
+                       std::memory_order_relaxed);
+    _disconnect();
+  }
+
+  void _push(const char *data, size_t size, Severity severity) {
+    Entry entry = {static_cast<uint32_t>(size), severity,
+                   timestamp_now(TimestampPrecision::MICROSECONDS) / 1000};
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_backlog.size() + _in_flight + sizeof(entry) + size >
+        _options.max_backlog) {
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+
+    bool first = _backlog.empty();
+    const char *header = reinterpret_cast<const char *>(&entry);
+    _backlog.insert(_backlog.end(), header, header + sizeof(entry));
+    _backlog.insert(_backlog.end(), data, data + size);
+    _queued += sizeof(entry) + size;
+
+    if (first) {
+      _deadline = std::chrono::steady_clock::now() + _options.max_latency;
+    }
+    if (severity >= _options.flush_severity) _urgent = true;
+    if (first || _urgent) _wake_sender.notify_one();
+  }
+
+ public:
+  explicit NetworkSink(const NetworkSinkOptions &options) :
+    _options(options), _in_flight(0), _queued(0), _done(0),
+    _urgent(false), _stop(false), _dropped(0), _reconnects(0), _fd(-1),
+    _was_connected(false), _second(-1), _date() {
+    std::string hostname = options.hostname;
+    if (hostname.empty()) {
+      char name[256] = {};
+      if (::gethostname(name, sizeof(name) - 1) == 0) hostname = name;
+    }
+    _header = ' ' + (hostname.empty() ? "-" : hostname) + ' ' +
+              (options.app_name.empty() ? "-" : options.app_name) + ' ' +
+              std::to_string(::getpid()) + " - - ";
+    _sender = std::thread(&NetworkSink::_run, this);
+  }
+
+  NetworkSink(NetworkProtocol protocol, const std::string &host,
+              uint16_t port) :
+    NetworkSink([&] {
+      NetworkSinkOptions options;
+      options.protocol = protocol;
+      options.host = host;
+      options.port = port;
+      return options;
+    }()) {}
+
+  // (sends what is left for flush_timeout at most)
+  ~NetworkSink() override {
+    flush();
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+      _wake_sender.notify_one();
+    }
+    _sender.join();
+  }
+
+  NetworkSink(const NetworkSink &) = delete;
+  NetworkSink &operator=(const NetworkSink &) = delete;
+
+  void write(const char *data, size_t size) override {
+    _push(data, size, Severity::INFO);
+  }
+
+  void write_record(const char *data, size_t size,
+                    Severity severity) override {
+    _push(data, size, severity);
+  }
+
+  // (every message carries the severity of its own record)
+  bool wants_single_records() const override {
+    return true;
+  }
+
+  // wait until everything logged so far was sent (flush_timeout at most)
+  void flush() override {
+    std::unique_lock<std::mutex> lock(_mutex);
+    uint64_t queued = _queued;
+    if (_done >= queued) return;
+    _urgent = true;
+    _wake_sender.notify_one();
+    _progress.wait_for(lock, _options.flush_timeout,
+                       [this, queued] { return _done >= queued; });
+  }
+
+  // (the sender thread has a timer of its own, see max_latency)
+  void idle() override {}
+
+  Severity flush_severity() const override {
+    return _options.flush_severity;
+  }
+
+  void add_metrics(MetricsSnapshot &snapshot) const override {
+    snapshot.counters[static_cast<size_t>(Counter::DROPPED_SINK)] +=
+      dropped();
+    snapshot.counters[static_cast<size_t>(Counter::SINK_RECONNECTS)] +=
+      reconnects();
+  }
+
+  // records that were dropped so far (see max_backlog)
+  uint64_t dropped() const {
+    return _dropped.load(std::memory_order_relaxed);
+  }
+
+  // how often the sink had to connect again
+  uint64_t reconnects() const {
+    return _reconnects.load(std::memory_order_relaxed);
+  }
+
+  const NetworkSinkOptions &options() const {
+    return _options;
+  }
+};
+#endif
+
+// ##########################################################
+
+// ### record output ###
+
+/*
+ * append the text of a record to out (rendering its deferred timestamp);
+ * Record has to provide the same accessors as RecordStream
+ */
+template<typename Record>
+void append_record(FormatBuffer &out, const Record &record) {
+  uint32_t pos = record.timestamp_pos();
+  if (pos == CPPLOG_NO_TIMESTAMP) {
+    out.append(record.data(), record.size());
+    return;
+  }
+
+  out.append(record.data(), pos);
+  out.commit(TimestampCache::local().render(
+    record.timestamp(), record.timestamp_precision(),
+    out.reserve(CPPLOG_MX_TIMESTAMP_LEN)));
+  out.append(record.data() + pos, record.size() - pos);
+}
+
+/*
+ * pass the pieces of size bytes of data between the ANSI escape
+ * sequences ("\033[...m") in it to fn(piece, n); records can't contain
+ * ESC characters otherwise (logged strings are escaped, see
+ * sanitize_string)
+ */
+template<typename Fn>
+void for_each_without_colors(const char *data, size_t size, Fn &&fn) {
+  const char *end = data + size;
+  while (const char *esc = static_cast<const char *>(
+           std::memchr(data, '\033', static_cast<size_t>(end - data)))) {
+    if (esc != data) fn(data, static_cast<size_t>(esc - data));
+    data = esc + 1;
+    if (data < end && *data == '[') {
+      ++data;
+      while (data < end && !(*data >= 0x40 && *data <= 0x7e)) ++data;
+      if (data < end) ++data;
+    }
+  }
+  if (data != end) fn(data, static_cast<size_t>(end - data));
+}
+
+// append size bytes of data to out without their color codes
+inline void append_without_colors(FormatBuffer &out, const char *data,
+                                  size_t size) {
+  for_each_without_colors(data, size, [&out](const char *piece, size_t n) {
+    out.append(piece, n);
+  });
+}
+
+/*
+ * writes complete records into the sinks of a Logger (every sink gets
+ * every record, as a single contiguous write; sinks that don't want
+ * colors get the record without its color codes); for binary output, it
+ * also emits the header of the output and the definition of every
+ * string id before the id is used the first time in a sink
+ */
+class RecordWriter {
+ private:
+  struct Output {
+    std::shared_ptr<Sink> sink;
+    bool header_written;
+    bool colors;
+    bool single_records;  // see Sink::wants_single_records
+
+    // string ids that were already defined in this output
+    std::vector<bool> defined;
+
+    // string ids the crash handler defined (see _emergency_define)
+    static constexpr size_t MX_EMERGENCY_DEFINED = 8;
+    uint32_t emergency_defined[MX_EMERGENCY_DEFINED] = {};
+    size_t n_emergency_defined = 0;
+  };
+
+  std::vector<Output> _outputs;
+  Encoding _encoding;
+
+  // lowest flush severity of all sinks (the producers of thread-buffered
+  // Loggers read it without the lock)
+  std::atomic<Severity> _flush_severity{Severity::OFF};
+
+  // some sink wants colors
+  bool _colors = false;
+
+  // counts flushes and their latency (if set)
+  Metrics *_metrics = nullptr;
+
+  // the record currently written (if it isn't contiguous already)
+  FormatBuffer _out;
+
+  // the record currently written without its colors
+  FormatBuffer _plain;
+
+  // a single record of a batch without color codes (see _write_single)
+  FormatBuffer _single;
+
+  static bool _is_defined(const Output &output, uint32_t id) {
+    return id < output.defined.size() && output.defined[id];
+  }
+
+  void _define(Output &output, uint32_t id) {
+    if (_is_defined(output, id)) return;
+    if (id >= output.defined.size()) output.defined.resize(id + 1, false);
+    output.defined[id] = true;
+
+    const char *str = BinaryStringTable::global().get(id);
+    uint32_t len = str ? static_cast<uint32_t>(std::strlen(str)) : 0;
+    uint32_t size = static_cast<uint32_t>(
+      CPPLOG_BINARY_RECORD_HEADER_SIZE + sizeof(id) + len);
+
+    _out.push_back(static_cast<char>(BinaryRecordType::STRING));
+    _out.append(reinterpret_cast<const char *>(&size), sizeof(size));
+    _out.append(reinterpret_cast<const char *>(&id), sizeof(id));
+    _out.append(str, len);
+  }
+
+  /*
+   * collects the pieces of a record on the stack, so it can be handed to
+   * Sink::emergency_write in one piece (if it isn't too long)
+   */
+  class EmergencyRecord {
+   private:
+    Sink &_sink;
+    char _data[2048];
+    size_t _size;
+
+   public:
+    explicit EmergencyRecord(Sink &sink) : _sink(sink), _size(0) {}
+
+    ~EmergencyRecord() {
+      flush();
+    }
+
+    void append(const char *data, size_t size) {
+      if (!size) return;
+      if (_size + size > sizeof(_data)) {
+        flush();
+        if (size > sizeof(_data)) {
+          _sink.emergency_write(data, size);
+          return;
+        }
+      }
+      std::memcpy(_data + _size, data, size);
+      _size += size;
+    }
+
+    void flush() {
+      if (_size) _sink.emergency_write(_data, _size);
+      _size = 0;
+    }
+  };
+
+  static void _emergency_append(const Output &output, EmergencyRecord &out,
+                                const char *data, size_t size) {
+    if (output.colors) {
+      out.append(data, size);
+      return;
+    }
+    for_each_without_colors(data, size, [&out](const char *piece, size_t n) {
+      out.append(piece, n);
+    });
+  }
+
+  // define string id for the crash handler (output.defined can't grow)
+  void _emergency_define(Output &output, EmergencyRecord &out, uint32_t id) {
+    if (_is_defined(output, id)) return;
+    for (size_t i = 0; i < output.n_emergency_defined; ++i) {
+      if (output.emergency_defined[i] == id) return;
+    }
+    if (output.n_emergency_defined < Output::MX_EMERGENCY_DEFINED) {
+      output.emergency_defined[output.n_emergency_defined++] = id;
+    }
+
+    const char *str = BinaryStringTable::global().get(id);
+    uint32_t len = str ? static_cast<uint32_t>(std::strlen(str)) : 0;
+    uint32_t size = static_cast<uint32_t>(
+      CPPLOG_BINARY_RECORD_HEADER_SIZE + sizeof(id) + len);
+
+    char type = static_cast<char>(BinaryRecordType::STRING);
+    out.append(&type, sizeof(type));
+    out.append(reinterpret_cast<const char *>(&size), sizeof(size));
+    out.append(reinterpret_cast<const char *>(&id), sizeof(id));
+    out.append(str, len);
+  }
+
+  // hand a batch to output record by record (see wants_single_records)
+  void _write_single(Output &output, const char *data,
+                     const RecordInfo &batch, const RecordBound *bounds,
+                     size_t n_bounds) {
+    uint32_t start = 0;
+    for (size_t i = 0; i < n_bounds; ++i) {
+      const char *record = data + start;
+      size_t size = bounds[i].end - start;
+      start = bounds[i].end;
+
+      RecordInfo info;
+      info.add(bounds[i].severity, 0, batch.names);
+      if (output.colors || !std::memchr(record, '\033', size)) {
+        output.sink->write_records(record, size, info);
+        continue;
+      }
+      _single.clear();
+      append_without_colors(_single, record, size);
+      output.sink->write_records(_single.data(), _single.size(), info);
+    }
+  }
+
+  /*
+   * write one or more records to all sinks; bounds (if given) are the
+   * records of a batch, for the sinks that want them one by one
+   */
+  void _write_all(const char *data, size_t size, const RecordInfo &info,
+                  const RecordBound *bounds = nullptr, size_t n_bounds = 0) {
+    bool stripped = false;
+    for (Output &output : _outputs) {
+      if (output.single_records && n_bounds > 1) {
+        _write_single(output, data, info, bounds, n_bounds);
+        continue;
+      }
+      if (output.colors || !std::memchr(data, '\033', size)) {
+        output.sink->write_records(data, size, info);
+        continue;
+      }
+      if (!stripped) {
+        _plain.clear();
+        append_without_colors(_plain, data, size);
+        stripped = true;
+      }
+      output.sink->write_records(_plain.data(), _plain.size(), info);
+    }
+  }
+
+  // info about a single record of a severity
+  static RecordInfo _info(Severity severity, uint64_t timestamp = 0,
+                          uint32_t name_id = CPPLOG_NO_NAME_ID) {
+    RecordInfo info;
+    info.add(severity, timestamp,
+             BinaryStringTable::global().name_bit(name_id));
+    return info;
+  }
+
+ public:
+  explicit RecordWriter(std::shared_ptr<Sink> sink) :
+    _encoding(Encoding::TEXT) {
+    add_sink(std::move(sink));
+  }
+
+  void add_sink(std::shared_ptr<Sink> sink) {
+    if (!sink) return;
+    _flush_severity.store(std::min(flush_severity(), sink->flush_severity()),
+                          std::memory_order_relaxed);
+    bool colors = sink->colors();
+    _colors = _colors || colors;
+    bool single_records = sink->wants_single_records();
+    _outputs.push_back(Output{std::move(sink), false, colors,
+                              single_records, {}});
+  }
+
+  // remove all sinks (records are discarded until a sink is added)
+  void clear_sinks() {
+    _outputs.clear();
+    _flush_severity.store(Severity::OFF, std::memory_order_relaxed);
+    _colors = false;
+  }
+
+  // check if some sink wants highlighted records
+  bool colors() const {
+    return _colors;
+  }
+
+  // records of this severity (or above) are flushed by some sink
+  Severity flush_severity() const {
+    return _flush_severity.load(std::memory_order_relaxed);
+  }
+
+  size_t sink_count() const {
+    return _outputs.size();
+  }
+
+  void set_encoding(Encoding encoding) {
+    _encoding = encoding;
+  }
+
+  Encoding encoding() const {
+    return _encoding;
+  }
+
+  /*
+   * write one or more (concatenated) encoded binary LOG records (severity
+   * is the highest severity of them)
+   */
+  void write_binary(const char *data, size_t size,
+                    Severity severity = Severity::TRACE) {
+    write_binary(data, size, _info(severity));
+  }
+
+  // (the timestamps and names of info are taken from the records)
+  void write_binary(const char *data, size_t size, RecordInfo info) {
+    info.encoding = Encoding::BINARY;
+    BinaryStringTable &strings = BinaryStringTable::global();
+    for (size_t pos = 0; pos + CPPLOG_BINARY_LOG_HEADER_SIZE <= size;) {
+      uint32_t record_size = decode_binary_value<uint32_t>(data + pos + 1);
+      if (record_size < CPPLOG_BINARY_LOG_HEADER_SIZE) break;
+      uint64_t timestamp = decode_binary_value<uint64_t>(data + pos + 13);
+      if (!info.first_timestamp || timestamp < info.first_timestamp) {
+        info.first_timestamp = timestamp;
+      }
+      info.last_timestamp = std::max(info.last_timestamp, timestamp);
+      info.names |=
+        strings.name_bit(decode_binary_value<uint32_t>(data + pos + 9));
+      pos += record_size;
+    }
+
+    for (Output &output : _outputs) {
+      _out.clear();
+      if (!output.header_written) {
+        _out.append(CPPLOG_BINARY_MAGIC, sizeof(CPPLOG_BINARY_MAGIC));
+        output.header_written = true;
+      }
+
+      // string definitions have to precede the first record using them;
+      // the records in between are copied in one piece
+      size_t copied = 0;
+      size_t pos = 0;
+      while (pos + CPPLOG_BINARY_LOG_HEADER_SIZE <= size) {
+        uint32_t format_id = decode_binary_value<uint32_t>(data + pos + 5);
+        uint32_t name_id = decode_binary_value<uint32_t>(data + pos + 9);
+        if (!_is_defined(output, format_id) ||
+            !_is_defined(output, name_id)) {
+          _out.append(data + copied, pos - copied);
+          copied = pos;
+          _define(output, format_id);
+          _define(output, name_id);
+        }
+
+        uint32_t record_size = decode_binary_value<uint32_t>(data + pos + 1);
+        if (record_size < CPPLOG_BINARY_LOG_HEADER_SIZE) break;
+        pos += record_size;
+      }
+
+      if (_out.size() == 0) {
+        output.sink->write_records(data, size, info);
+      } else {
+        _out.append(data + copied, size - copied);
+        output.sink->write_records(_out.data(), _out.size(), info);
+      }
+    }
+  }
+
+  // write one or more complete text records
+  void write_text(const char *data, size_t size,
+                  Severity severity = Severity::TRACE) {
+    _write_all(data, size, _info(severity));
+  }
+
+  void write_text(const char *data, size_t size, const RecordInfo &info,
+                  const RecordBound *bounds = nullptr, size_t n_bounds = 0) {
+    _write_all(data, size, info, bounds, n_bounds);
+  }
+
+  /*
+   * write a record (see write_record) in the encoding of this output;
+   * name_id is the name of the Logger (for sinks that index records)
+   */
+  template<typename Record>
+  void write(const Record &record, Severity severity,
+             uint32_t name_id = CPPLOG_NO_NAME_ID) {
+    if (_encoding == Encoding::BINARY) {
+      write_binary(record.data(), record.size(), severity);
+      return;
+    }
+
+    uint32_t pos = record.timestamp_pos();
+    if (pos == CPPLOG_NO_TIMESTAMP) {
+      _write_all(record.data(), record.size(),
+                 _info(severity, 0, name_id));
+      return;
+    }
+
+    _out.clear();
+    append_record(_out, record);
+    _write_all(_out.data(), _out.size(),
+               _info(severity, record.timestamp(), name_id));
+  }
+
+  // write a record telling the reader how many records got lost
+  void write_dropped(uint64_t dropped) {
+    FormatBuffer buf;
+    if (_encoding == Encoding::BINARY) {
+      encode_binary_record(buf, CPPLOG_BINARY_DROPPED_FORMAT_ID,
+                           CPPLOG_BINARY_VALUE_FORMAT_ID,
+                           timestamp_now(TimestampPrecision::SECONDS),
+                           LogFmt::NEWLINE, Severity::WARN, dropped);
+      write_binary(buf.data(), buf.size(), Severity::WARN);
+    } else {
+      buf.append("[cpplog] dropped ");
+      format_integer(buf, dropped);
+      buf.append(" log record(s) (async queue full)\n");
+      _write_all(buf.data(), buf.size(), _info(Severity::WARN));
+    }
+  }
+
+  void flush() {
+    uint64_t start = _metrics ? steady_now() : 0;
+    for (Output &output : _outputs) {
+      output.sink->flush();
+    }
+    if (_metrics) {
+      _metrics->add(Counter::FLUSHES);
+      _metrics->record(Histogram::FLUSH_NS, steady_now() - start);
+    }
+  }
+
+  // add the counters of all sinks to snapshot (see Sink::add_metrics)
+  void add_sink_metrics(MetricsSnapshot &snapshot) const {
+    for (const Output &output : _outputs) {
+      output.sink->add_metrics(snapshot);
+    }
+  }
+
+  // the async queue ran dry (see Sink::idle)
+  void idle() {
+    for (Output &output : _outputs) {
+      output.sink->idle();
+    }
+  }
+
+  /*
+   * counterparts of write_text, write_binary and write for the crash
+   * handler: records go straight to the sinks (see Sink::emergency_write)
+   * without any lock or allocation
+   */
+  void emergency_write_text(const char *data, size_t size) {
+    for (Output &output : _outputs) {
+      EmergencyRecord out(*output.sink);
+      _emergency_append(output, out, data, size);
+    }
+  }
+
+  void emergency_write_binary(const char *data, size_t size) {
+    for (Output &output : _outputs) {
+      EmergencyRecord out(*output.sink);
+      if (!output.header_written) {
+        out.append(CPPLOG_BINARY_MAGIC, sizeof(CPPLOG_BINARY_MAGIC));
+        output.header_written = true;
+      }
+
+      size_t pos = 0;
+      while (pos + CPPLOG_BINARY_LOG_HEADER_SIZE <= size) {
+        uint32_t record_size = decode_binary_value<uint32_t>(data + pos + 1);
+        if (record_size < CPPLOG_BINARY_LOG_HEADER_SIZE ||
+            record_size > size - pos) {
+          break;
+        }
+        _emergency_define(output, out,
+                          decode_binary_value<uint32_t>(data + pos + 5));
+        _emergency_define(output, out,
+                          decode_binary_value<uint32_t>(data + pos + 9));
+        out.append(data + pos, record_size);
+        out.flush();
+        pos += record_size;
+      }
+    }
+  }
+
+  template<typename Record>
+  void emergency_write(const Record &record) {
+    if (_encoding == Encoding::BINARY) {
+      emergency_write_binary(record.data(), record.size());
+      return;
+    }
+
+    uint32_t pos = record.timestamp_pos();
+    if (pos == CPPLOG_NO_TIMESTAMP) {
+      emergency_write_text(record.data(), record.size());
+      return;
+    }
+
+    // (seconds since the epoch, local time can't be rendered safely here)
+    char timestamp[CPPLOG_MX_EPOCH_TIMESTAMP_LEN];
+    size_t len = TimestampCache::render_epoch(
+      record.timestamp(), record.timestamp_precision(), timestamp);
+    for (Output &output : _outputs) {
+      EmergencyRecord out(*output.sink);
+      _emergency_append(output, out, record.data(), pos);
+      _emergency_append(output, out, timestamp, len);
+      _emergency_append(output, out, record.data() + pos,
+                        record.size() - pos);
+    }
+  }
+
+  // write what the sinks buffer (see Sink::emergency_flush)
+  void emergency_flush() {
+    for (Output &output : _outputs) {
+      output.sink->emergency_flush();
+    }
+  }
+
+  void set_metrics(Metrics *metrics) {
+    _metrics = metrics;
+  }
+};
+
+// ##########################################################
+
+// ### binary decoding ###
+
+/*
+ * turns binary records (see Encoding::BINARY) back into the text
+ * a Logger would have written for them (used by cpplog-decode);
+ * the format strings are applied with the same formatting engine
+ * and LoggerImpl as on the logging side, so the output is identical
+ */
+class BinaryDecoder {
+ private:
+  std::unordered_map<uint32_t, std::string> _strings;
+  std::unordered_map<uint32_t, std::vector<FormatStringObject>> _fmt_objs;
+  LoggerImpl _impl;
+  RecordStream _record;
+  TimestampPrecision _timestamp_precision;
+
+  // decode deferred records of this process (see set_deferred)
+  bool _deferred;
+
+  // decode an argument at pos and format it into out
+  bool _format_arg(FormatBuffer &out, const char *&pos,
+                   const char *end, const FormatStringObject &obj) const {
+    if (pos >= end) return false;
+    BinaryArgType type = static_cast<BinaryArgType>(*pos++);
+    size_t size = (type == BinaryArgType::BOOL ||
+                   type == BinaryArgType::CHAR) ? 1 :
+                  type == BinaryArgType::STRING ? 4 :
+                  (type == BinaryArgType::CUSTOM ||
+                   type == BinaryArgType::STRING_REF) ? 12 : 8;
+    if (pos + size > end) return false;
+
+    switch (type) {
+      case BinaryArgType::INT:
+        format_arg(out, decode_binary_value<int64_t>(pos), obj);
+        break;
+      case BinaryArgType::UINT:
+        format_arg(out, decode_binary_value<uint64_t>(pos), obj);
+        break;
+      case BinaryArgType::DOUBLE:
+        format_arg(out, decode_binary_value<double>(pos), obj);
+        break;
+      case BinaryArgType::BOOL:
+        format_arg(out, *pos != 0, obj);
+        break;
+      case BinaryArgType::CHAR:
+        format_arg(out, *pos, obj);
+        break;
+      case BinaryArgType::STRING:
+      {
+        uint32_t len = decode_binary_value<uint32_t>(pos);
+        if (pos + size + len > end) return false;
+        format_arg(out, std::string_view(pos + size, len), obj);
+        size += len;
+        break;
+      }
+      case BinaryArgType::CUSTOM:
+      {
+        if (!_deferred) return false;
+        DeferredFormatFn fn = reinterpret_cast<DeferredFormatFn>(
+          decode_binary_value<uint64_t>(pos));
+        uint32_t len = decode_binary_value<uint32_t>(pos + 8);
+        if (pos + size + len > end) return false;
+        fn(out, pos + size, len, obj);
+        size += len;
+        break;
+      }
+      case BinaryArgType::STRING_REF:
+      {
+        if (!_deferred) return false;
+        const char *str = reinterpret_cast<const char *>(
+          decode_binary_value<uint64_t>(pos));
+        format_arg(out, std::string_view(
+          str, decode_binary_value<uint32_t>(pos + 8)), obj);
+        break;
+      }
+      default:
+        return false;
+    }
+
+    pos += size;
+    return true;
+  }
+
+  // string with the given id (data() is nullptr if it isn't defined)
+  std::string_view _string(uint32_t id) const {
+    if (_deferred) {
+      const char *str = BinaryStringTable::global().get(id);
+      return str ? std::string_view(str) : std::string_view();
+    }
+    auto it = _strings.find(id);
+    return it != _strings.end() ? std::string_view(it->second) :
+                                  std::string_view();
+  }
+
+  // decode a LOG record into _record
+  bool _decode_log(const char *data, size_t size) {
+    if (size < CPPLOG_BINARY_LOG_HEADER_SIZE) return false;
+
+    const char *pos = data + CPPLOG_BINARY_RECORD_HEADER_SIZE;
+    uint32_t format_id = decode_binary_value<uint32_t>(pos);
+    uint32_t name_id   = decode_binary_value<uint32_t>(pos + 4);
+    uint64_t timestamp = decode_binary_value<uint64_t>(pos + 8);
+    LogFormat fmt      = decode_binary_value<uint64_t>(pos + 16);
+    uint8_t n_args     = static_cast<uint8_t>(pos[25]);
+    pos += 26;
+
+    // (all strings are null-terminated)
+    std::string_view fmt_str = _string(format_id);
+    std::string_view name = _string(name_id);
+    if (!fmt_str.data()) return false;
+
+    // (format strings of a file may be corrupted, they must not end
+    // the process like a bad format string of a logging call)
+    auto objs_it = _fmt_objs.find(format_id);
+    if (objs_it == _fmt_objs.end()) {
+      std::vector<FormatStringObject> objs;
+      if (try_parse_format_string(fmt_str.data(), objs) !=
+          FormatError::NONE) {
+        return false;
+      }
+      objs_it = _fmt_objs.emplace(format_id, std::move(objs)).first;
+    }
+    const std::vector<FormatStringObject> &objs = objs_it->second;
+
+    // same output as format_string_args on the logging side
+    FormatBuffer msg;
+    const char *end = data + size;
+    int text_start = 0;
+    for (size_t i = 0; i < objs.size() && i < n_args; ++i) {
+      msg.append(fmt_str.data() + text_start,
+                 objs[i].start_idx - text_start);
+      if (!_format_arg(msg, pos, end, objs[i])) return false;
+      text_start = objs[i].end_idx;
+    }
+    msg.append(fmt_str.data() + text_start, fmt_str.size() - text_start);
+
+    if (name.data()) {
+      _impl.set_name(std::string(name));
+    } else {
+      _impl.set_name(std::string());
+    }
+    _record.reset();
+    _impl.parse_fmt_opts(_record, msg.view(), fmt, msg.size());
+    _record.set_timestamp(timestamp, _timestamp_precision);
+    return true;
+  }
+
+ public:
+  BinaryDecoder() :
+    _timestamp_precision(TimestampPrecision::SECONDS), _deferred(false) {
+    _impl.set_raw_timestamps(true);
+    _impl.set_timestamp_precision(_timestamp_precision);
+  }
+
+  /*
+   * decode the deferred records of this process instead of a binary log:
+   * strings are taken from the process-wide BinaryStringTable and the
+   * in-process argument types (CUSTOM, STRING_REF) are accepted
+   */
+  void set_deferred(bool deferred) {
+    _deferred = deferred;
+  }
+
+  // decode a LOG record (nullptr if it is malformed); the returned
+  // record is only valid until the next call
+  const RecordStream *decode_log(const char *data, size_t size) {
+    if (size < CPPLOG_BINARY_RECORD_HEADER_SIZE ||
+        static_cast<BinaryRecordType>(data[0]) != BinaryRecordType::LOG ||
+        !_decode_log(data, size)) {
+      return nullptr;
+    }
+    return &_record;
+  }
+
+  void set_timestamp_precision(TimestampPrecision precision) {
+    _timestamp_precision = precision;
+    _impl.set_timestamp_precision(precision);
+  }
+
+  // drop the highlighting options of all decoded records
+  void set_color(bool color) {
+    _impl.set_colors(color);
+  }
+
+  /*
+   * read the next complete record (or output header) from in;
+   * returns false at the end of the input or for a truncated record
+   */
+  static bool read_record(std::istream &in, std::string &record) {
+    record.resize(CPPLOG_BINARY_RECORD_HEADER_SIZE);
+    if (!in.read(&record[0], 1)) return false;
+
+    if (record[0] == CPPLOG_BINARY_MAGIC[0]) {
+      record.resize(sizeof(CPPLOG_BINARY_MAGIC));
+      return static_cast<bool>(in.read(&record[1], record.size() - 1));
+    }
+
+    if (!in.read(&record[1], CPPLOG_BINARY_RECORD_HEADER_SIZE - 1)) {
+      return false;
+    }
+    uint32_t size = decode_binary_value<uint32_t>(record.data() + 1);
+    if (size < CPPLOG_BINARY_RECORD_HEADER_SIZE) return false;
+
+    record.resize(size);
+    return static_cast<bool>(
+      in.read(&record[CPPLOG_BINARY_RECORD_HEADER_SIZE],
+              size - CPPLOG_BINARY_RECORD_HEADER_SIZE));
+  }
+
+  /*
+   * decode a single record into out (string definitions are only stored);
+   * returns false if the record is malformed or uses an undefined id
+   */
+  bool decode(const char *data, size_t size, std::ostream &out) {
+    if (size == sizeof(CPPLOG_BINARY_MAGIC) &&
+        std::memcmp(data, CPPLOG_BINARY_MAGIC, size) == 0) {
+      // start of a new output -> ids may be defined differently now
+      _strings.clear();
+      _fmt_objs.clear();
+      return true;
+    }
+
+    if (size < CPPLOG_BINARY_RECORD_HEADER_SIZE) return false;
+
+    switch (static_cast<BinaryRecordType>(data[0])) {
+      case BinaryRecordType::STRING:
+      {
+        if (size < CPPLOG_BINARY_RECORD_HEADER_SIZE + 4) return false;
+        uint32_t id = decode_binary_value<uint32_t>(data + 5);
+        _strings[id].assign(data + 9, size - 9);
+        _fmt_objs.erase(id);
+        return true;
+      }
+      case BinaryRecordType::LOG:
+        if (!_decode_log(data, size)) return false;
+        write_record(out, _record);
+        return true;
+      default:
+        return false;
+    }
+  }
+};
+
+// ##########################################################
+
+// ### asynchronous logging ###
+
+/*
+ * a single (already formatted) record inside of the async queue;
+ * short records are stored inline, longer ones spill to the heap
+ */
+class AsyncRecord {
+ private:
+  size_t _size;
+  uint64_t _timestamp;
+  uint32_t _timestamp_pos;
+  TimestampPrecision _timestamp_precision;
+  Severity _severity;
+
+  // name of the Logger (see RecordWriter::write)
+  uint32_t _name_id;
+
+  // binary LOG record that still has to be formatted by the writer
+  bool _deferred;
+
+  char _inline[CPPLOG_RECORD_INLINE_SIZE];
+  std::string _spill;
+
+ public:
+  AsyncRecord() :
+    _size(0), _timestamp(0), _timestamp_pos(CPPLOG_NO_TIMESTAMP),
+    _timestamp_precision(TimestampPrecision::SECONDS),
+    _severity(Severity::TRACE), _name_id(CPPLOG_NO_NAME_ID),
+    _deferred(false) {}
+
+  void assign(const char *data, size_t size, Severity severity,
+              bool deferred = false, uint32_t name_id = CPPLOG_NO_NAME_ID) {
+    _size = size;
+    _timestamp_pos = CPPLOG_NO_TIMESTAMP;
+    _severity = severity;
+    _name_id = name_id;
+    _deferred = deferred;
+    if (size <= CPPLOG_RECORD_INLINE_SIZE) {
+      std::memcpy(_inline, data, size);
+    } else {
+      _spill.assign(data, size);
+    }
+  }
+
+  // copy a formatted record (incl. its deferred timestamp)
+  void assign(const RecordStream &record, Severity severity,
+              uint32_t name_id = CPPLOG_NO_NAME_ID) {
+    assign(record.data(), record.size(), severity, false, name_id);
+    _timestamp = record.timestamp();
+    _timestamp_pos = record.timestamp_pos();
+    _timestamp_precision = record.timestamp_precision();
+  }
+
+  uint64_t timestamp() const {
+    return _timestamp;
+  }
+
+  uint32_t timestamp_pos() const {
+    return _timestamp_pos;
+  }
+
+  TimestampPrecision timestamp_precision() const {
+    return _timestamp_precision;
+  }
+
+  Severity severity() const {
+    return _severity;
+  }
+
+  uint32_t name_id() const {
+    return _name_id;
+  }
+
+  bool deferred() const {
+    return _deferred;
+  }
+
+  const char *data() const {
+    return _size <= CPPLOG_RECORD_INLINE_SIZE ? _inline : _spill.data();
+  }
+
+  size_t size() const {
+    return _size;
+  }
+};
+
+/*
+ * bounded lock-free queue of AsyncRecords (based on Dmitry Vyukov's
+ * bounded MPMC queue); any number of threads may push records while
+ * the writer thread pops them; producers are also allowed to pop
+ * records themselves, which is used to discard the oldest record
+ * if the queue is full and OverflowPolicy::DROP_OLDEST was chosen
+ */
+class AsyncQueue {
+ private:
+  struct Slot {
+    std::atomic<size_t> seq;
+    AsyncRecord record;
+  };
+
+  std::unique_ptr<Slot[]> _slots;
+  size_t _mask;
+
+  // keep producer and consumer positions on separate cache lines
+  alignas(64) std::atomic<size_t> _enqueue_pos;
+  alignas(64) std::atomic<size_t> _dequeue_pos;
+
+  static size_t _round_up_pow2(size_t n) {
+    size_t pow2 = 2;
+    while (pow2 < n) pow2 <<= 1;
+    return pow2;
+  }
+
+ public:
+  explicit AsyncQueue(size_t capacity) :
+    _slots(new Slot[_round_up_pow2(capacity)]),
+    _mask(_round_up_pow2(capacity) - 1),
+    _enqueue_pos(0), _dequeue_pos(0) {
+    for (size_t i = 0; i <= _mask; ++i) {
+      _slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  size_t capacity() const {
+    return _mask + 1;
+  }
+
+  /*
+   * let fill write a record into a free slot of the queue;
+   * returns false if the queue is full
+   */
+  template<typename Fn>
+  bool try_push(Fn &&fill) {
+    Slot *slot;
+    size_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+
+    for (;;) {
+      slot = &_slots[pos & _mask];
+      size_t seq = slot->seq.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+      if (diff == 0) {
+        if (_enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = _enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+
+    fill(slot->record);
+    slot->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /*
+   * pass the oldest record to fn and remove it from the queue;
+   * returns false if there was no (completely written) record
+   */
+  template<typename Fn>
+  bool try_pop(Fn &&fn) {
+    Slot *slot;
+    size_t pos = _dequeue_pos.load(std::memory_order_relaxed);
+
+    for (;;) {
+      slot = &_slots[pos & _mask];
+      size_t seq = slot->seq.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(seq) -
+                      static_cast<intptr_t>(pos + 1);
+
+      if (diff == 0) {
+        if (_dequeue_pos.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = _dequeue_pos.load(std::memory_order_relaxed);
+      }
+    }
+
+    fn(slot->record);
+    slot->seq.store(pos + _mask + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const {
+    return _dequeue_pos.load(std::memory_order_acquire) >=
+           _enqueue_pos.load(std::memory_order_acquire);
+  }
+
+  // number of queued records (approximate while records are pushed)
+  size_t size() const {
+    size_t dequeue_pos = _dequeue_pos.load(std::memory_order_relaxed);
+    size_t enqueue_pos = _enqueue_pos.load(std::memory_order_relaxed);
+    return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+  }
+};
+
+// CPUs a writer thread may run on (see WriterOptions)
+struct WriterAffinity {
+  // empty: all CPUs (unless numa_node is set)
+  std::vector<int> cpus;
+
+  // all CPUs of this NUMA node as well (-1 = none; Linux only)
+  int numa_node = -1;
+};
+
+// CPUs of a NUMA node (empty if it doesn't exist or isn't known)
+inline std::vector<int> numa_node_cpus(int node) {
+  std::vector<int> cpus;
+  std::ifstream list("/sys/devices/system/node/node" +
+                     std::to_string(node) + "/cpulist");
+
+  // e.g. "0-3,8-11"
+  int first;
+  while (list >> first) {
+    int last = first;
+    if (list.peek() == '-') {
+      list.get();
+      list >> last;
+    }
+    for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+    if (list.peek() == ',') list.get();
+  }
+  return cpus;
+}
+
+/*
+ * restrict the calling thread to the CPUs of affinity; returns false if
+ * that failed or isn't supported (only on Linux)
+ */
+inline bool set_thread_affinity(const WriterAffinity &affinity) {
+  std::vector<int> cpus = affinity.cpus;
+  if (affinity.numa_node >= 0) {
+    std::vector<int> node_cpus = numa_node_cpus(affinity.numa_node);
+    if (node_cpus.empty()) return false;
+    cpus.insert(cpus.end(), node_cpus.begin(), node_cpus.end());
+  }
+  if (cpus.empty()) return true;
+
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+  }
+  return ::sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+  return false;
+#endif
+}
+
+/*
+ * runs work of cpplog on the threads of an event loop instead of on
+ * threads of its own: the writer of async queues (see
+ * WriterOptions::executor) and coroutines that waited for a Logger
+ * (see Logger::info_async)
+ */
+class Executor {
+ public:
+  virtual ~Executor() = default;
+
+  /*
+   * run fn(context) soon on a thread of the executor, but not before this
+   * call returned; called by any thread (also by the producers of the
+   * queues, so it must not block)
+   */
+  virtual void post(void (*fn)(void *context), void *context) = 0;
+};
+
+// settings of an async writer thread and its queues
+struct WriterOptions {
+  // number of records all queues together can hold (every queue is
+  // rounded up to a power of 2)
+  size_t queue_capacity = CPPLOG_ASYNC_QUEUE_CAPACITY;
+
+  // what happens if the queue of a record is full
+  OverflowPolicy policy = OverflowPolicy::BLOCK;
+
+  /*
+   * number of queues the producers are spread over (fewer producers
+   * contend for each queue); records of one queue are written in the
+   * order they were logged in, see ShardPolicy for which queue that is
+   */
+  size_t shards = 1;
+  ShardPolicy shard_policy = ShardPolicy::THREAD;
+
+  WriterAffinity affinity;
+
+  /*
+   * run the writer as a task on this executor instead of on a thread of
+   * its own (affinity doesn't apply then); the executor has to keep
+   * running its tasks as long as the queues exist: flush(), set_sync()
+   * and the changes of the sinks wait for the task (see flush_async)
+   */
+  std::shared_ptr<Executor> executor;
+};
+
+// small number of the calling thread (0, 1, 2, ... by first call)
+inline size_t thread_index() {
+  static std::atomic<size_t> next_index{0};
+  static thread_local size_t index =
+    next_index.fetch_add(1, std::memory_order_relaxed);
+  return index;
+}
+
+// what a LatencyBudget does with the records it applies to
+enum class BudgetAction : uint8_t {
+  DROP,         // drop them
+  BEST_EFFORT   // queue them only if a slot is free (never wait)
+};
+
+/*
+ * how much a thread may be held up by a filling async queue (see
+ * set_thread_latency_budget): once the queue a record goes to is
+ * filled above high_water, records below keep are dropped or queued
+ * best-effort, so the thread never waits for them (whatever the
+ * OverflowPolicy is); records of at least keep are handled as usual
+ */
+struct LatencyBudget {
+  // fill level of the queue (0 ... 1)
+  double high_water = 0.75;
+
+  Severity keep = Severity::ERROR;
+  BudgetAction action = BudgetAction::DROP;
+};
+
+// what happened to the record of a try_ call (e.g. Logger::try_info)
+enum class LogStatus : uint8_t {
+  QUEUED,    // it was queued for the writer thread
+  DROPPED,   // no free slot (or no queue) or over the latency budget
+  FILTERED   // below the level of the Logger, rate-limited or collapsed
+};
+
+class AsyncBackend;
+
+// per-thread state of the producers of the async queues
+struct ProducerState {
+  std::optional<LatencyBudget> budget;
+
+  // inside a try_ call: push without waiting, and don't wake the writer
+  bool non_blocking = false;
+
+  // what happened to the last record pushed inside of a try_ call
+  LogStatus status = LogStatus::FILTERED;
+
+  // inside an awaited log call (see Logger::info_async): a record that
+  // would have to wait for room in a queue of spill_backend is copied
+  // into spill instead (and spilled is set)
+  const AsyncBackend *spill_backend = nullptr;
+  AsyncRecord *spill = nullptr;
+  bool spilled = false;
+};
+
+inline ProducerState &producer_state() {
+  static thread_local ProducerState state;
+  return state;
+}
+
+// apply budget to all records the calling thread logs (all Loggers)
+inline void set_thread_latency_budget(const LatencyBudget &budget) {
+  producer_state().budget = budget;
+}
+
+inline void clear_thread_latency_budget() {
+  producer_state().budget.reset();
+}
+
+/*
+ * a coroutine waiting for the writer of an AsyncBackend, until it wrote
+ * a record that didn't fit into the queues or completed a flush ticket
+ * (see Logger::info_async); the writer calls notify(context) once,
+ * without holding any of its locks
+ */
+struct WriterWaiter {
+  void (*notify)(void *context) = nullptr;
+  void *context = nullptr;
+  const AsyncRecord *record = nullptr;
+  uint64_t ticket = 0;
+};
+
+/*
+ * owns the async queues of a Logger and the background thread (or the
+ * Executor task) that drains them into the Logger's sinks; producers
+ * never take a lock (unless OverflowPolicy::BLOCK is used and the queue
+ * is full, in which case they yield until the writer has caught up); the
+ * ProducerState of the pushing thread may make a push non-blocking
+ */
+class AsyncBackend {
+ private:
+  RecordWriter &_writer;
+  WriterOptions _options;
+
+  // (AsyncQueues can't be moved)
+  std::vector<std::unique_ptr<AsyncQueue>> _queues;
+
+  // counts dropped records and the time spent waiting (if set)
+  Metrics *_metrics;
+
+  // formats deferred records (only used by the writer thread)
+  BinaryDecoder _decoder;
+
+  // number of records that were dropped since the last dropped-count record
+  std::atomic<uint64_t> _dropped;
+
+  // flush tickets requested by flush() and completed by the writer
+  std::atomic<uint64_t> _flush_requested;
+  uint64_t _flush_done;
+
+  // change of the RecordWriter the writer thread applies once it has
+  // completed _modify_ticket (see modify_writer; guarded by _mutex)
+  void (*_modify)(void *context, RecordWriter &writer) = nullptr;
+  void *_modify_context = nullptr;
+  uint64_t _modify_ticket = 0;
+
+  // coroutines waiting for their spilled records to be written and for
+  // flush tickets (guarded by _mutex), and the ones being notified
+  std::vector<WriterWaiter *> _spilled;
+  std::vector<WriterWaiter *> _flush_waiters;
+  std::vector<WriterWaiter *> _notified;
+  std::atomic<size_t> _n_spilled{0};
+
+  // records were written to the sinks since their last flush
+  bool _unflushed = false;
+
+  std::atomic<bool> _stop;
+  std::atomic<bool> _sleeping;
+  std::mutex _mutex;
+  std::condition_variable _wake_writer;
+  std::condition_variable _flushed;
+  std::thread _thread;
+
+  // the writer task is posted to the executor or running (executor
+  // mode), and it has stopped (guarded by _mutex)
+  std::atomic<bool> _scheduled{false};
+  bool _task_stopped = false;
+
+  void _wake() {
+    if (_options.executor) {
+      _schedule();
+    } else if (_sleeping.load(std::memory_order_relaxed)) {
+      _wake_writer.notify_one();
+    }
+  }
+
+  // wake the writer for a flush ticket or a stop (with _mutex held)
+  void _wake_locked() {
+    if (_options.executor) {
+      _schedule();
+    } else {
+      _wake_writer.notify_one();
+    }
+  }
+
+  // post the writer task unless it is posted or running already
+  void _schedule() {
+    // (pairs with the fence of _run_task: either the task sees what was
+    // queued before, or this sees that the task is done)
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!_scheduled.load(std::memory_order_relaxed) &&
+        !_scheduled.exchange(true, std::memory_order_acq_rel)) {
+      _options.executor->post(&AsyncBackend::_task, this);
+    }
+  }
+
+  // write a record telling the reader how many records got lost
+  void _log_dropped() {
+    uint64_t dropped = _dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped) _writer.write_dropped(dropped);
+  }
+
+  // the queue of a record of the Logger with name id key
+  AsyncQueue &_queue(uint32_t key) {
+    if (_queues.size() == 1) return *_queues[0];
+    size_t shard =
+      _options.shard_policy == ShardPolicy::NAME ? key : thread_index();
+    return *_queues[shard % _queues.size()];
+  }
+
+  bool _empty() const {
+    for (const std::unique_ptr<AsyncQueue> &queue : _queues) {
+      if (!queue->empty()) return false;
+    }
+    return true;
+  }
+
+  // hand a record to the sinks (deferred ones are formatted first)
+  void _write_record(const AsyncRecord &record) {
+    if (!record.deferred()) {
+      _writer.write(record, record.severity(), record.name_id());
+    } else if (const RecordStream *text =
+                 _decoder.decode_log(record.data(), record.size())) {
+      _writer.write(*text, record.severity(), record.name_id());
+    }
+  }
+
+  // (takes turns between the queues, so no queue has to wait for long)
+  bool _drain() {
+    constexpr int BATCH_SIZE = 64;
+    auto write = [this](const AsyncRecord &record) { _write_record(record); };
+
+    bool wrote = false;
+    for (bool popped = true; popped;) {
+      popped = false;
+      for (const std::unique_ptr<AsyncQueue> &queue : _queues) {
+        for (int i = 0; i < BATCH_SIZE && queue->try_pop(write); ++i) {
+          popped = true;
+        }
+      }
+      wrote = wrote || popped;
+    }
+    _log_dropped();
+    return wrote;
+  }
+
+  // notify the waiters in _notified (without holding _mutex)
+  void _notify_waiters() {
+    for (WriterWaiter *waiter : _notified) waiter->notify(waiter->context);
+    _notified.clear();
+  }
+
+  // write the spilled records (see write_spilled), then resume their
+  // coroutines; returns if there were any
+  bool _write_spilled() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _notified.swap(_spilled);
+      _n_spilled.store(0, std::memory_order_relaxed);
+    }
+    for (WriterWaiter *waiter : _notified) _write_record(*waiter->record);
+    bool wrote = !_notified.empty();
+    _notify_waiters();
+    return wrote;
+  }
+
+  /*
+   * one round of the writer: drain the queues and write the spilled
+   * records, then complete the flush tickets requested before; wrote tells
+   * if any record was written, returns if the writer has stopped
+   */
+  bool _round(bool &wrote) {
+    uint64_t flush_ticket = _flush_requested.load(std::memory_order_acquire);
+    bool stop = _stop.load(std::memory_order_acquire);
+
+    wrote = _drain();
+    if (_n_spilled.load(std::memory_order_relaxed)) {
+      wrote = _write_spilled() || wrote;
+    }
+    if (wrote) {
+      _unflushed = true;
+    } else if (_unflushed) {
+      // the queue ran dry -> hand the whole batch to the sinks' outputs
+      _writer.idle();
+      _unflushed = false;
+    }
+
+    if (flush_ticket != _flush_done || stop) {
+      _writer.flush();
+      _unflushed = false;
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_modify && (flush_ticket >= _modify_ticket || stop)) {
+          _modify(_modify_context, _writer);
+          _modify = nullptr;
+          _modify_context = nullptr;
+        }
+        _flush_done = flush_ticket;
+        _flushed.notify_all();
+
+        for (size_t i = 0; i < _flush_waiters.size();) {
+          if (_flush_waiters[i]->ticket <= flush_ticket || stop) {
+            _notified.push_back(_flush_waiters[i]);
+            _flush_waiters[i] = _flush_waiters.back();
+            _flush_waiters.pop_back();
+          } else {
+            ++i;
+          }
+        }
+      }
+      _notify_waiters();
+    }
+    return stop;
+  }
+
+  static void _task(void *context) {
+    static_cast<AsyncBackend *>(context)->_run_task();
+  }
+
+  /*
+   * the writer as a task of an Executor (see WriterOptions::executor):
+   * writes until the queues ran dry, then ends until the next push posts
+   * it again (and posts itself again after a while of writing, so other
+   * tasks get their turn)
+   */
+  void _run_task() {
+    constexpr int MX_ROUNDS = 16;
+    for (;;) {
+      bool wrote = true;
+      for (int round = 0; wrote; ++round) {
+        if (_round(wrote)) {
+          std::lock_guard<std::mutex> lock(_mutex);
+          _task_stopped = true;
+          _flushed.notify_all();
+          return;
+        }
+        if (wrote && round + 1 == MX_ROUNDS) {
+          _options.executor->post(&AsyncBackend::_task, this);
+          return;
+        }
+      }
+
+      // (once _scheduled is cleared, the next task may run already)
+      uint64_t flush_done = _flush_done;
+      _scheduled.store(false, std::memory_order_release);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (_empty() && !_n_spilled.load(std::memory_order_relaxed) &&
+          !_stop.load(std::memory_order_relaxed) &&
+          _flush_requested.load(std::memory_order_relaxed) == flush_done) {
+        return;
+      }
+      // (something came in meanwhile, unless another thread posted the
+      // task for it already)
+      if (_scheduled.exchange(true, std::memory_order_acq_rel)) return;
+    }
+  }
+
+  void _run() {
+    set_thread_affinity(_options.affinity);
+
+    constexpr int SPIN_ROUNDS = 64;
+    int idle_rounds = 0;
+
+    for (;;) {
+      bool wrote;
+      if (_round(wrote)) return;
+      if (wrote) idle_rounds = 0;
+
+      if (++idle_rounds < SPIN_ROUNDS) {
+        std::this_thread::yield();
+        continue;
+      }
+
+      // nothing to do for a while -> sleep until a producer wakes us up
+      // (the timeout covers the rare case of a missed notification)
+      std::unique_lock<std::mutex> lock(_mutex);
+      _sleeping.store(true, std::memory_order_relaxed);
+      _wake_writer.wait_for(lock, std::chrono::milliseconds(10), [this]() {
+        return !_empty() || _n_spilled.load(std::memory_order_relaxed) ||
+               _stop.load(std::memory_order_relaxed) ||
+               _flush_requested.load(std::memory_order_relaxed) != _flush_done;
+      });
+      _sleeping.store(false, std::memory_order_relaxed);
+      idle_rounds = 0;
+    }
+  }
+
+ public:
+  AsyncBackend(RecordWriter &writer, const WriterOptions &options,
+               Metrics *metrics = nullptr,
+               TimestampPrecision precision = TimestampPrecision::SECONDS) :
+    _writer(writer), _options(options), _metrics(metrics), _dropped(0),
+    _flush_requested(0), _flush_done(0), _stop(false), _sleeping(false) {
+    size_t shards = options.shards ? options.shards : 1;
+    size_t shard_capacity = (options.queue_capacity + shards - 1) / shards;
+    for (size_t i = 0; i < shards; ++i) {
+      _queues.emplace_back(new AsyncQueue(shard_capacity));
+    }
+
+    _decoder.set_deferred(true);
+    _decoder.set_color(writer.colors());
+    _decoder.set_timestamp_precision(precision);
+    if (!options.executor) _thread = std::thread(&AsyncBackend::_run, this);
+  }
+
+  ~AsyncBackend() {
+    shutdown();
+  }
+
+  /*
+   * enqueue a formatted record (handles a full queue based on the
+   * policy); key is the name id of the Logger (see ShardPolicy::NAME)
+   */
+  void push(const RecordStream &record, Severity severity,
+            uint32_t key = CPPLOG_NO_NAME_ID) {
+    _push(_queue(key), severity,
+          [&record, severity, key](AsyncRecord &slot) {
+      slot.assign(record, severity, key);
+    });
+  }
+
+  /*
+   * enqueue an already encoded (binary) record; deferred records are
+   * formatted into text by the writer thread
+   */
+  void push(const char *data, size_t size, Severity severity,
+            bool deferred = false, uint32_t key = CPPLOG_NO_NAME_ID) {
+    _push(_queue(key), severity,
+          [data, size, severity, deferred, key](AsyncRecord &slot) {
+      slot.assign(data, size, severity, deferred, key);
+    });
+  }
+
+  // precision of the timestamps of deferred records
+  // (applied by the writer thread, which the decoder belongs to)
+  void set_timestamp_precision(TimestampPrecision precision) {
+    auto apply = [this, precision](RecordWriter &) {
+      _decoder.set_timestamp_precision(precision);
+    };
+    modify_writer(apply);
+  }
+
+ private:
+  void _count_dropped(Counter counter = Counter::DROPPED_QUEUE) {
+    _dropped.fetch_add(1, std::memory_order_relaxed);
+    if (_metrics) _metrics->add(counter);
+  }
+
+  // the latency budget of the thread applies to a record
+  static bool _over_budget(const AsyncQueue &queue, Severity severity,
+                           const LatencyBudget &budget) {
+    return severity < budget.keep &&
+           static_cast<double>(queue.size()) >=
+             budget.high_water * static_cast<double>(queue.capacity());
+  }
+
+  template<typename Fn>
+  void _push(AsyncQueue &queue, Severity severity, Fn &&fill) {
+    ProducerState &producer = producer_state();
+    bool non_blocking = producer.non_blocking;
+    if (producer.budget && _over_budget(queue, severity, *producer.budget)) {
+      if (producer.budget->action == BudgetAction::DROP) {
+        _count_dropped(Counter::DROPPED_BUDGET);
+        producer.status = LogStatus::DROPPED;
+        return;
+      }
+      if (_metrics) _metrics->add(Counter::BEST_EFFORT);
+      non_blocking = true;
+    }
+
+    if (queue.try_push(fill)) {
+      // (a sleeping writer thread wakes up on its own within 10 ms, a
+      // writer task has to be posted)
+      if (!producer.non_blocking || _options.executor) _wake();
+      producer.status = LogStatus::QUEUED;
+      return;
+    }
+
+    if (producer.spill_backend == this &&
+        _options.policy == OverflowPolicy::BLOCK) {
+      fill(*producer.spill);
+      producer.spilled = true;
+      return;
+    }
+
+    if (non_blocking) {
+      // DROP_OLDEST gets a single retry, the record is dropped otherwise
+      if (_options.policy == OverflowPolicy::DROP_OLDEST &&
+          queue.try_pop([](const AsyncRecord &) {})) {
+        _count_dropped();
+        if (queue.try_push(fill)) {
+          if (_options.executor) _wake();
+          producer.status = LogStatus::QUEUED;
+          return;
+        }
+      }
+      _count_dropped(Counter::DROPPED_NONBLOCKING);
+      producer.status = LogStatus::DROPPED;
+      return;
+    }
+
+    // (the clock is only read if the queue is full)
+    uint64_t wait_start = _metrics ? steady_now() : 0;
+    do {
+      switch (_options.policy) {
+        case OverflowPolicy::DROP_NEWEST:
+          _count_dropped();
+          _wake();
+          return;
+        case OverflowPolicy::DROP_OLDEST:
+          if (queue.try_pop([](const AsyncRecord &) {})) _count_dropped();
+          break;
+        case OverflowPolicy::BLOCK:
+          _wake();
+          std::this_thread::yield();
+          break;
+      }
+    } while (!queue.try_push(fill));
+
+    if (_metrics && _options.policy == OverflowPolicy::BLOCK) {
+      _metrics->add(Counter::QUEUE_WAIT_NS, steady_now() - wait_start);
+    }
+    _wake();
+  }
+
+ public:
+  // block until all records queued before this call have been written
+  void flush() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    uint64_t ticket = _flush_requested.fetch_add(1) + 1;
+    _wake_locked();
+    _flushed.wait(lock, [this, ticket]() { return _flush_done >= ticket; });
+  }
+
+  /*
+   * the same as flush(), but without blocking: returns false if there is
+   * nothing to wait for (the writer has stopped), otherwise the writer
+   * notifies waiter once the records queued before were written
+   */
+  bool flush_async(WriterWaiter &waiter) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_stop.load(std::memory_order_relaxed)) return false;
+    waiter.ticket = _flush_requested.fetch_add(1) + 1;
+    _flush_waiters.push_back(&waiter);
+    _wake_locked();
+    return true;
+  }
+
+  /*
+   * let the writer write a record that was spilled since its queue was
+   * full (see ProducerState::spill) right after the queued records, and
+   * notify waiter then (record has to stay valid until then); returns
+   * false if the writer has stopped (the record is dropped)
+   */
+  bool write_spilled(WriterWaiter &waiter, const AsyncRecord &record) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_stop.load(std::memory_order_relaxed)) {
+      _count_dropped();
+      return false;
+    }
+    waiter.record = &record;
+    _spilled.push_back(&waiter);
+    _n_spilled.store(_spilled.size(), std::memory_order_relaxed);
+    _wake_locked();
+    return true;
+  }
+
+  // the executor the writer runs on (if any, see WriterOptions::executor)
+  Executor *executor() const {
+    return _options.executor.get();
+  }
+
+  /*
+   * let the writer thread apply fn to the RecordWriter once it has
+   * written the records queued before this call (the producers keep
+   * going meanwhile); blocks until fn was applied; the decoder of
+   * deferred records picks up the colors of the sinks afterwards
+   */
+  template<typename Fn>
+  void modify_writer(Fn &fn) {
+    auto apply = [this, &fn](RecordWriter &writer) {
+      fn(writer);
+      _decoder.set_color(writer.colors());
+    };
+    using Apply = decltype(apply);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _flushed.wait(lock, [this]() { return !_modify; });
+    _modify = [](void *context, RecordWriter &writer) {
+      (*static_cast<Apply *>(context))(writer);
+    };
+    _modify_context = &apply;
+    _modify_ticket = _flush_requested.fetch_add(1) + 1;
+    _wake_locked();
+    _flushed.wait(lock, [this, &apply]() {
+      return _modify_context != &apply;
+    });
+  }
+
+  // drain the queue and stop the writer thread (or task)
+  void shutdown() {
+    if (_options.executor) {
+      std::unique_lock<std::mutex> lock(_mutex);
+      if (_task_stopped) return;
+      _stop.store(true, std::memory_order_release);
+      _schedule();
+      _flushed.wait(lock, [this]() { return _task_stopped; });
+      return;
+    }
+    if (!_thread.joinable()) return;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop.store(true, std::memory_order_release);
+      _wake_writer.notify_one();
+    }
+    _thread.join();
+  }
+
+  /*
+   * crash handler: write the queued records straight to the sinks (see
+   * RecordWriter::emergency_write); deferred records can't be formatted
+   * without allocating, they are only counted; returns their number
+   */
+  uint64_t emergency_drain() {
+    uint64_t unformatted = 0;
+    for (const std::unique_ptr<AsyncQueue> &queue : _queues) {
+      while (queue->try_pop([this, &unformatted](const AsyncRecord &record) {
+        if (record.deferred()) {
+          ++unformatted;
+        } else {
+          _writer.emergency_write(record);
+        }
+      })) {}
+    }
+    return unformatted;
+  }
+
+  // number of records dropped and not yet reported by the writer thread
+  uint64_t dropped() const {
+    return _dropped.load(std::memory_order_relaxed);
+  }
+
+  size_t capacity() const {
+    size_t capacity = 0;
+    for (const std::unique_ptr<AsyncQueue> &queue : _queues) {
+      capacity += queue->capacity();
+    }
+    return capacity;
+  }
+
+  // number of records in all queues (approximate)
+  size_t size() const {
+    size_t size = 0;
+    for (const std::unique_ptr<AsyncQueue> &queue : _queues) {
+      size += queue->size();
+    }
+    return size;
+  }
+
+  OverflowPolicy policy() const {
+    return _options.policy;
+  }
+
+  const WriterOptions &options() const {
+    return _options;
+  }
+};
+
+// ##########################################################
+
+// ### thread buffers ###
+
+// default number of bytes a thread collects before committing them
+static constexpr size_t CPPLOG_THREAD_BUFFER_SIZE = 16 * 1024;
+
+/*
+ * per-thread record batches of a Logger (see Logger::set_thread_buffered):
+ * every thread appends its records to its own buffer and only takes the
+ * Logger's lock to commit a full batch of complete records to the sinks;
+ * buffers are committed on flush, when their thread exits, and when the
+ * ThreadBuffers are closed (records of different threads may therefore
+ * be reordered, records themselves are never split)
+ */
+class ThreadBuffers : public std::enable_shared_from_this<ThreadBuffers> {
+ private:
+  struct Buffer {
+    // only contended while the buffer is committed by another thread
+    std::mutex mutex;
+    FormatBuffer data;
+
+    // severities, timestamps and names of the records in data
+    RecordInfo info;
+
+    // where each record in data ends (see Sink::wants_single_records)
+    std::vector<RecordBound> bounds;
+  };
+
+  // buffers of the calling thread (for all ThreadBuffers it logged to)
+  struct ThreadState {
+    struct Entry {
+      uint64_t id;
+      std::weak_ptr<ThreadBuffers> owner;
+      std::shared_ptr<Buffer> buffer;
+    };
+    std::vector<Entry> entries;
+
+    ~ThreadState() {
+      for (Entry &entry : entries) {
+        if (auto owner = entry.owner.lock()) owner->_release(entry.buffer);
+      }
+    }
+
+    Buffer *find(uint64_t id) {
+      for (Entry &entry : entries) {
+        if (entry.id == id) return entry.buffer.get();
+      }
+      return nullptr;
+    }
+  };
+
+  static uint64_t _next_id() {
+    static std::atomic<uint64_t> next_id{1};
+    return next_id.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  const uint64_t _id;
+  const size_t _batch_size;
+  RecordWriter *_writer;
+  std::mutex &_writer_mutex;
+
+  // guards _buffers and _writer (only used to register/commit buffers)
+  std::mutex _mutex;
+  std::vector<std::shared_ptr<Buffer>> _buffers;
+
+  // commit the buffer of a thread (buffer.mutex has to be held)
+  void _commit(Buffer &buffer) {
+    if (buffer.data.size() == 0) return;
+    {
+      std::lock_guard<std::mutex> lock(_writer_mutex);
+      if (_writer->encoding() == Encoding::BINARY) {
+        _writer->write_binary(buffer.data.data(), buffer.data.size(),
+                              buffer.info);
+      } else {
+        _writer->write_text(buffer.data.data(), buffer.data.size(),
+                            buffer.info, buffer.bounds.data(),
+                            buffer.bounds.size());
+      }
+    }
+    buffer.data.clear();
+    buffer.info = RecordInfo();
+    buffer.bounds.clear();
+  }
+
+  Buffer &_local() {
+    static thread_local ThreadState state;
+    if (Buffer *buffer = state.find(_id)) return *buffer;
+
+    // forget the buffers of ThreadBuffers that are gone already
+    for (size_t i = state.entries.size(); i-- > 0;) {
+      if (state.entries[i].owner.expired()) {
+        state.entries.erase(state.entries.begin() +
+                            static_cast<std::ptrdiff_t>(i));
+      }
+    }
+
+    auto buffer = std::make_shared<Buffer>();
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _buffers.push_back(buffer);
+    }
+    state.entries.push_back({_id, weak_from_this(), buffer});
+    return *buffer;
+  }
+
+  // commit the buffer if it is full or the record has to be flushed
+  void _pushed(Buffer &buffer, Severity severity, uint64_t timestamp = 0,
+               uint32_t name_id = CPPLOG_NO_NAME_ID) {
+    buffer.info.add(severity, timestamp,
+                    BinaryStringTable::global().name_bit(name_id));
+    buffer.bounds.push_back(
+      RecordBound{static_cast<uint32_t>(buffer.data.size()), severity});
+    if (buffer.data.size() >= _batch_size ||
+        severity >= _writer->flush_severity()) {
+      _commit(buffer);
+    }
+  }
+
+  // called when the thread of a buffer exits
+  void _release(const std::shared_ptr<Buffer> &buffer) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_writer) {
+      std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+      _commit(*buffer);
+    }
+    for (size_t i = 0; i < _buffers.size(); ++i) {
+      if (_buffers[i] == buffer) {
+        _buffers.erase(_buffers.begin() + static_cast<std::ptrdiff_t>(i));
+        break;
+      }
+    }
+  }
+
+ public:
+  // records get committed to writer while holding writer_mutex
+  ThreadBuffers(RecordWriter &writer, std::mutex &writer_mutex,
+                size_t batch_size) :
+    _id(_next_id()), _batch_size(batch_size),
+    _writer(&writer), _writer_mutex(writer_mutex) {}
+
+  ~ThreadBuffers() {
+    close();
+  }
+
+  ThreadBuffers(const ThreadBuffers &) = delete;
+  ThreadBuffers &operator=(const ThreadBuffers &) = delete;
+
+  /*
+   * append a formatted record to the buffer of the calling thread (records
+   * that some sink flushes right away commit the buffer right away)
+   */
+  void push(const RecordStream &record, Severity severity,
+            uint32_t name_id = CPPLOG_NO_NAME_ID) {
+    Buffer &buffer = _local();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    append_record(buffer.data, record);
+    _pushed(buffer, severity,
+            record.timestamp_pos() != CPPLOG_NO_TIMESTAMP ?
+              record.timestamp() : 0, name_id);
+  }
+
+  /*
+   * append an encoded binary record to the buffer of the calling thread
+   * (its timestamp and name are read from the record when it's written)
+   */
+  void push(const char *data, size_t size, Severity severity) {
+    Buffer &buffer = _local();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.data.append(data, size);
+    _pushed(buffer, severity);
+  }
+
+  // commit the buffers of all threads
+  void flush() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_writer) return;
+    for (const std::shared_ptr<Buffer> &buffer : _buffers) {
+      std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+      _commit(*buffer);
+    }
+  }
+
+  /*
+   * crash handler: write the buffers of all threads without locking them
+   * (see RecordWriter::emergency_write)
+   */
+  void emergency_write() {
+    if (!_writer) return;
+    for (const std::shared_ptr<Buffer> &buffer : _buffers) {
+      const FormatBuffer &data = buffer->data;
+      if (_writer->encoding() == Encoding::BINARY) {
+        _writer->emergency_write_binary(data.data(), data.size());
+      } else {
+        _writer->emergency_write_text(data.data(), data.size());
+      }
+    }
+  }
+
+  // commit all buffers and detach from the RecordWriter
+  void close() {
+    flush();
+    std::lock_guard<std::mutex> lock(_mutex);
+    _writer = nullptr;
+    _buffers.clear();
+  }
+
+  size_t batch_size() const {
+    return _batch_size;
+  }
+};
+
+// ##########################################################
+
+// ### logger backends ###
+
+// max number of live LoggerBackends the crash handler can flush
+static constexpr size_t CPPLOG_MX_CRASH_BACKENDS = 64;
+
+/*
+ * the part of a Logger that several Loggers can share: the sinks
+ * (RecordWriter), the lock around them and the async queue or the
+ * thread buffers; Loggers that share a backend write through the same
+ * lock/queue, so their records never interleave (see the registry);
+ * sinks added with add_writer have a writer thread of their own, which
+ * gets a copy of every record in every mode
+ */
+class LoggerBackend {
+ private:
+  // queue drops, waiting times and flushes
+  Metrics _metrics;
+
+  std::mutex _mutex;
+
+  // writes complete records into the sinks (in the backend's encoding)
+  RecordWriter _writer{std::make_shared<OStreamSink>(std::cerr)};
+
+  // queue + writer thread (only set if the backend runs in async mode)
+  std::unique_ptr<AsyncBackend> _async;
+
+  // shards and affinity of _async (see set_async)
+  WriterOptions _async_options;
+
+  // sinks with a writer thread of their own (see add_writer)
+  struct Writer {
+    RecordWriter writer;
+    std::unique_ptr<AsyncBackend> async;
+
+    explicit Writer(std::shared_ptr<Sink> sink) : writer(std::move(sink)) {}
+  };
+  std::vector<std::unique_ptr<Writer>> _writers;
+
+  // per-thread record batches (only set if the backend is thread-buffered)
+  std::shared_ptr<ThreadBuffers> _thread_buffers;
+
+  TimestampPrecision _timestamp_precision = TimestampPrecision::SECONDS;
+
+  // slot of this backend in _crash_slots (CPPLOG_MX_CRASH_BACKENDS if none)
+  size_t _crash_slot = CPPLOG_MX_CRASH_BACKENDS;
+
+  // all live backends (constant-initialized, so the crash handler can
+  // read them without any guard)
+  static std::atomic<LoggerBackend *> *_crash_slots() {
+    static std::atomic<LoggerBackend *> slots[CPPLOG_MX_CRASH_BACKENDS];
+    return slots;
+  }
+
+  void _set_thread_buffers(std::shared_ptr<ThreadBuffers> buffers) {
+    if (_thread_buffers) _thread_buffers->close();
+    _thread_buffers = std::move(buffers);
+  }
+
+  // (thread buffers are only written by the first writer)
+  void _emergency_flush(RecordWriter &writer, AsyncBackend *async,
+                        const char *note) {
+    writer.emergency_flush();
+    uint64_t unformatted = async ? async->emergency_drain() : 0;
+    if (_thread_buffers && &writer == &_writer) {
+      _thread_buffers->emergency_write();
+    }
+    if (writer.encoding() == Encoding::TEXT) {
+      if (unformatted) {
+        char buf[96] = "[cpplog] ";
+        char *end = std::to_chars(buf + 9, buf + 32, unformatted).ptr;
+        const char msg[] = " deferred record(s) lost (not formatted)\n";
+        std::memcpy(end, msg, sizeof(msg) - 1);
+        writer.emergency_write_text(
+          buf, static_cast<size_t>(end - buf) + sizeof(msg) - 1);
+      }
+      if (note) writer.emergency_write_text(note, std::strlen(note));
+    }
+    writer.emergency_flush();
+  }
+
+  // take the lock of the sinks (the clock is only read if it is taken)
+  std::unique_lock<std::mutex> _lock() {
+    std::unique_lock<std::mutex> lock(_mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+      uint64_t start = steady_now();
+      lock.lock();
+      _metrics.add(Counter::LOCK_WAIT_NS, steady_now() - start);
+    }
+    return lock;
+  }
+
+ public:
+  LoggerBackend() {
+    _writer.set_metrics(&_metrics);
+    for (size_t i = 0; i < CPPLOG_MX_CRASH_BACKENDS; ++i) {
+      LoggerBackend *empty = nullptr;
+      if (_crash_slots()[i].compare_exchange_strong(empty, this)) {
+        _crash_slot = i;
         break;
       }
-      case FormatStringObject::STRING :
-        _pad_fmt_arg(fmt_arg, arg, fmt_obj);
-        break;
-      case FormatStringObject::OBJECT :
-        _pad_fmt_arg(fmt_arg, arg, fmt_obj);
-        break;
-      case FormatStringObject::CHAR :
-        _pad_fmt_arg(fmt_arg, arg, fmt_obj);
+    }
+  }
+
+  LoggerBackend(const LoggerBackend &) = delete;
+  LoggerBackend &operator=(const LoggerBackend &) = delete;
+
+  ~LoggerBackend() {
+    if (_crash_slot < CPPLOG_MX_CRASH_BACKENDS) {
+      _crash_slots()[_crash_slot].store(nullptr);
+    }
+    // write all pending records before the sinks are gone
+    set_sync();
+  }
+
+  /*
+   * write a complete text record (see Logger::_write); key is the name id
+   * of the Logger, which the queues may be sharded by
+   */
+  void write(const RecordStream &record, Severity severity,
+             uint32_t key = CPPLOG_NO_NAME_ID) {
+    for (const std::unique_ptr<Writer> &writer : _writers) {
+      writer->async->push(record, severity, key);
+    }
+    if (_async) {
+      _async->push(record, severity, key);
+    } else if (_thread_buffers) {
+      _thread_buffers->push(record, severity, key);
+    } else {
+      std::unique_lock<std::mutex> lock = _lock();
+      _writer.write(record, severity, key);
+    }
+  }
+
+  // write an encoded binary record
+  void write_binary(const char *data, size_t size, Severity severity,
+                    uint32_t key = CPPLOG_NO_NAME_ID) {
+    for (const std::unique_ptr<Writer> &writer : _writers) {
+      writer->async->push(data, size, severity, false, key);
+    }
+    if (_async) {
+      _async->push(data, size, severity, false, key);
+    } else if (_thread_buffers) {
+      _thread_buffers->push(data, size, severity);
+    } else {
+      std::unique_lock<std::mutex> lock = _lock();
+      _writer.write_binary(data, size, severity);
+    }
+  }
+
+  // enqueue a record with deferred formatting (async backends only)
+  void push_deferred(const char *data, size_t size, Severity severity,
+                     uint32_t key = CPPLOG_NO_NAME_ID) {
+    for (const std::unique_ptr<Writer> &writer : _writers) {
+      writer->async->push(data, size, severity, true, key);
+    }
+    _async->push(data, size, severity, true, key);
+  }
+
+  /*
+   * apply fn to the RecordWriter while no record is being written (by
+   * the writer thread in async mode, so the producers aren't held up;
+   * under the lock otherwise), once the records so far were written;
+   * returns if some sink wants colors afterwards
+   */
+  template<typename Fn>
+  bool modify_writer(Fn &&fn) {
+    bool colors = false;
+    auto modify = [this, &fn, &colors](RecordWriter &writer) {
+      writer.flush();
+      fn(writer);
+      colors = this->colors();
+    };
+
+    if (_async) {
+      _async->modify_writer(modify);
+    } else {
+      if (_thread_buffers) _thread_buffers->flush();
+      std::lock_guard<std::mutex> lock(_mutex);
+      modify(_writer);
+    }
+    return colors;
+  }
+
+  // see Logger::set_async
+  void set_async(size_t queue_capacity, OverflowPolicy policy) {
+    WriterOptions options = _async_options;
+    options.queue_capacity = queue_capacity;
+    options.policy = policy;
+    set_async(options);
+  }
+
+  void set_async(const WriterOptions &options) {
+    set_sync();
+    _async_options = options;
+    _async.reset(new AsyncBackend(_writer, options, &_metrics,
+                                  _timestamp_precision));
+  }
+
+  // see Logger::add_writer
+  void add_writer(const std::vector<std::shared_ptr<Sink>> &sinks,
+                  const WriterOptions &options) {
+    if (sinks.empty()) return;
+    flush();
+
+    std::unique_ptr<Writer> writer(new Writer(sinks[0]));
+    for (size_t i = 1; i < sinks.size(); ++i) writer->writer.add_sink(sinks[i]);
+    writer->writer.set_encoding(_writer.encoding());
+    writer->writer.set_metrics(&_metrics);
+    writer->async.reset(new AsyncBackend(writer->writer, options, &_metrics,
+                                         _timestamp_precision));
+    _writers.push_back(std::move(writer));
+  }
+
+  // remove the sinks of add_writer (after writing their queued records)
+  void clear_writers() {
+    if (!_writers.empty()) _writers.clear();
+  }
+
+  size_t writer_count() const {
+    return _writers.size();
+  }
+
+  // see Logger::set_thread_buffered
+  void set_thread_buffered(size_t batch_size) {
+    set_sync();
+    _set_thread_buffers(
+      std::make_shared<ThreadBuffers>(_writer, _mutex, batch_size));
+  }
+
+  // commit all buffered/queued records and write synchronously
+  void set_sync() {
+    _async.reset();
+    _set_thread_buffers(nullptr);
+  }
+
+  bool is_async() const {
+    return _async != nullptr;
+  }
+
+  bool is_thread_buffered() const {
+    return _thread_buffers != nullptr;
+  }
+
+  // precision of the timestamps the writer threads render
+  void set_timestamp_precision(TimestampPrecision precision) {
+    _timestamp_precision = precision;
+    if (_async) _async->set_timestamp_precision(precision);
+    for (const std::unique_ptr<Writer> &writer : _writers) {
+      writer->async->set_timestamp_precision(precision);
+    }
+  }
+
+  void set_encoding(Encoding encoding) {
+    flush();
+    _writer.set_encoding(encoding);
+    for (const std::unique_ptr<Writer> &writer : _writers) {
+      writer->writer.set_encoding(encoding);
+    }
+  }
+
+  Encoding encoding() const {
+    return _writer.encoding();
+  }
+
+  // check if some sink wants highlighted records
+  bool colors() const {
+    for (const std::unique_ptr<Writer> &writer : _writers) {
+      if (writer->writer.colors()) return true;
+    }
+    return _writer.colors();
+  }
+
+  // current counters of the backend and its sinks (see write_prometheus)
+  MetricsSnapshot metrics() const {
+    MetricsSnapshot snapshot = _metrics.snapshot();
+    uint64_t &depth =
+      snapshot.counters[static_cast<size_t>(Counter::QUEUE_DEPTH)];
+    _writer.add_sink_metrics(snapshot);
+    if (_async) depth += _async->size();
+    for (const std::unique_ptr<Writer> &writer : _writers) {
+      writer->writer.add_sink_metrics(snapshot);
+      depth += writer->async->size();
+    }
+    return snapshot;
+  }
+
+  /*
+   * check if records can be queued without blocking (see Logger::try_info),
+   * which needs the async queue; counts the record as dropped otherwise
+   */
+  bool admits_nonblocking() {
+    if (_async) return true;
+    _metrics.add(Counter::DROPPED_NONBLOCKING);
+    return false;
+  }
+
+  /*
+   * crash handler: write everything pending (buffered by the sinks,
+   * queued, in thread buffers) with async-signal-safe calls only,
+   * followed by the text note (text encoding only); no lock is taken,
+   * so records that are written at the same time may interleave
+   */
+  void emergency_flush(const char *note) {
+    _emergency_flush(_writer, _async.get(), note);
+    for (const std::unique_ptr<Writer> &writer : _writers) {
+      _emergency_flush(writer->writer, writer->async.get(), note);
+    }
+  }
+
+  // emergency_flush every live backend
+  static void emergency_flush_all(const char *note) {
+    for (size_t i = 0; i < CPPLOG_MX_CRASH_BACKENDS; ++i) {
+      if (LoggerBackend *backend = _crash_slots()[i].load()) {
+        backend->emergency_flush(note);
+      }
+    }
+  }
+
+  // block until all records written so far have reached the sinks
+  void flush() {
+    for (const std::unique_ptr<Writer> &writer : _writers) {
+      writer->async->flush();
+    }
+    if (_async) {
+      _async->flush();
+    } else {
+      flush_unqueued();
+    }
+  }
+
+  // flush what no writer thread takes care of (nothing in async mode)
+  void flush_unqueued() {
+    if (_async) return;
+    if (_thread_buffers) _thread_buffers->flush();
+    std::lock_guard<std::mutex> lock(_mutex);
+    _writer.flush();
+  }
+
+  // number of async queues of the backend (its own and add_writer's)
+  size_t async_count() const {
+    return _writers.size() + (_async ? 1 : 0);
+  }
+
+  template<typename Fn>
+  void for_each_async(Fn &&fn) {
+    for (const std::unique_ptr<Writer> &writer : _writers) fn(*writer->async);
+    if (_async) fn(*_async);
+  }
+
+  // the queues + writer of async mode (nullptr otherwise)
+  AsyncBackend *async() const {
+    return _async.get();
+  }
+
+  // the executor of the writer of the async queue (if any)
+  Executor *executor() const {
+    return _async ? _async->executor() : nullptr;
+  }
+};
+
+// ##########################################################
+
+// ### crash handling ###
+
+// what install_crash_handler writes
+struct CrashHandlerOptions {
+  // also flush when std::terminate is called
+  bool terminate = true;
+
+  // write a backtrace of the crashing thread into this file descriptor
+  // (if the platform has <execinfo.h>; -1 = no backtrace)
+  int backtrace_fd = 2;
+};
+
+/*
+ * signal handler (SIGSEGV, SIGABRT, SIGBUS, SIGFPE) and std::terminate
+ * handler that write all pending records of all Loggers before the
+ * process dies (see LoggerBackend::emergency_flush), followed by a
+ * backtrace; afterwards the handler that was installed before runs
+ * (by re-raising the signal)
+ */
+class CrashHandler {
+ private:
+  static constexpr int SIGNALS[] = {
+    SIGSEGV, SIGABRT, SIGFPE,
+#ifdef SIGBUS
+    SIGBUS,
+#endif
+  };
+  static constexpr size_t N_SIGNALS = sizeof(SIGNALS) / sizeof(SIGNALS[0]);
+
+  struct State {
+    CrashHandlerOptions options;
+    bool installed = false;
+
+    // only the first crashing thread writes anything
+    std::atomic<bool> crashed{false};
+
+#ifdef _WIN32
+    void (*previous[N_SIGNALS])(int) = {};
+#else
+    struct sigaction previous[N_SIGNALS] = {};
+#endif
+    std::terminate_handler previous_terminate = nullptr;
+  };
+
+  static State &_state() {
+    static State state;
+    return state;
+  }
+
+  static const char *_note(int sig) {
+    switch (sig) {
+      case SIGSEGV: return "[cpplog] caught SIGSEGV\n";
+      case SIGABRT: return "[cpplog] caught SIGABRT\n";
+      case SIGFPE:  return "[cpplog] caught SIGFPE\n";
+#ifdef SIGBUS
+      case SIGBUS:  return "[cpplog] caught SIGBUS\n";
+#endif
+      default:      return "[cpplog] caught a signal\n";
+    }
+  }
+
+  static void _write_pending(const char *note) {
+    LoggerBackend::emergency_flush_all(note);
+
+#ifdef CPPLOG_BACKTRACE
+    int fd = _state().options.backtrace_fd;
+    if (fd >= 0) {
+      constexpr int MX_FRAMES = 64;
+      void *frames[MX_FRAMES];
+      int n_frames = ::backtrace(frames, MX_FRAMES);
+      const char header[] = "[cpplog] backtrace:\n";
+      write_fd(fd, header, sizeof(header) - 1);
+      ::backtrace_symbols_fd(frames, n_frames, fd);
+    }
+#endif
+  }
+
+  // put back the previous handler of sig
+  static void _restore(int sig) {
+    State &state = _state();
+    for (size_t i = 0; i < N_SIGNALS; ++i) {
+      if (SIGNALS[i] != sig) continue;
+#ifdef _WIN32
+      std::signal(sig, state.previous[i]);
+#else
+      ::sigaction(sig, &state.previous[i], nullptr);
+#endif
+    }
+  }
+
+  static void _on_signal(int sig) {
+    if (!_state().crashed.exchange(true)) _write_pending(_note(sig));
+
+    // (with the default handler, this terminates the process)
+    _restore(sig);
+    std::raise(sig);
+  }
+
+  // (abort leads to _on_signal, which only re-raises by then)
+  static void _on_terminate() {
+    State &state = _state();
+    if (!state.crashed.exchange(true)) {
+      _write_pending("[cpplog] std::terminate called\n");
+    }
+    if (state.previous_terminate) state.previous_terminate();
+    std::abort();
+  }
+
+ public:
+  // see install_crash_handler
+  static void install(const CrashHandlerOptions &options) {
+    State &state = _state();
+    state.options = options;
+    if (state.installed) return;
+    state.installed = true;
+
+#ifdef CPPLOG_BACKTRACE
+    // the first call might allocate (loads the unwinder), not in a handler
+    void *frame;
+    ::backtrace(&frame, 1);
+#endif
+
+    for (size_t i = 0; i < N_SIGNALS; ++i) {
+#ifdef _WIN32
+      state.previous[i] = std::signal(SIGNALS[i], &CrashHandler::_on_signal);
+#else
+      struct sigaction action = {};
+      action.sa_handler = &CrashHandler::_on_signal;
+      sigemptyset(&action.sa_mask);
+      action.sa_flags = SA_ONSTACK;
+      ::sigaction(SIGNALS[i], &action, &state.previous[i]);
+#endif
+    }
+    if (options.terminate) {
+      state.previous_terminate =
+        std::set_terminate(&CrashHandler::_on_terminate);
+    }
+  }
+};
+
+/*
+ * write the pending records of all Loggers (queued, thread-buffered or
+ * buffered by a sink) when the process crashes or std::terminate gets
+ * called, using only async-signal-safe calls (raw write(2)s of records
+ * that are formatted already); deferred records can't be formatted in
+ * a signal handler, they are only counted; only sinks that implement
+ * Sink::emergency_write are written; a stack overflow can only be
+ * reported by threads that set up an alternate signal stack
+ * (sigaltstack); call this once, early in main
+ */
+inline void install_crash_handler(
+    const CrashHandlerOptions &options = CrashHandlerOptions()) {
+  CrashHandler::install(options);
+}
+
+// ##########################################################
+
+// ### rate limiting ###
+
+/*
+ * identity of a call site for rate limiting and repeated records: the
+ * address of a compile-time format string, but the content of a runtime
+ * one (a reused buffer may hold a different format string); never 0
+ */
+inline uint64_t call_site(const char *fmt_str) {
+  return std::hash<std::string_view>()(fmt_str) | 1;
+}
+
+template<class Str>
+uint64_t call_site(CompiledFormat<Str>) {
+  return reinterpret_cast<uintptr_t>(Str::value());
+}
+
+// text of the format string of a call site
+inline const char *call_site_format(const char *fmt_str) {
+  return fmt_str;
+}
+
+template<class Str>
+const char *call_site_format(CompiledFormat<Str>) {
+  return Str::value();
+}
+
+/*
+ * per-call-site token buckets of a Logger (see Logger::set_rate_limit);
+ * call sites are identified by call_site and live in a fixed-size
+ * lock-free table; every call site may
+ * log a burst of records and then one record per interval (implemented
+ * as a generic cell rate algorithm, so a bucket is a single atomic);
+ * call sites that don't fit into the table anymore are never limited
+ */
+class RateLimiter {
+ private:
+  static constexpr size_t N_SITES = 1024;
+  static constexpr size_t MX_PROBES = 16;
+
+  struct Site {
+    std::atomic<uint64_t> key{0};
+
+    // theoretical arrival time of the next record (ns)
+    std::atomic<uint64_t> next{0};
+
+    // records suppressed since the last record that got through
+    std::atomic<uint64_t> suppressed{0};
+  };
+
+  std::unique_ptr<Site[]> _sites;
+  uint64_t _interval;
+  uint64_t _tolerance;
+
+  Site *_find(uint64_t key) {
+    size_t idx = static_cast<size_t>((key >> 3) * 0x9e3779b97f4a7c15ull);
+
+    for (size_t i = 0; i < MX_PROBES; ++i) {
+      Site &slot = _sites[(idx + i) % N_SITES];
+      uint64_t slot_key = slot.key.load(std::memory_order_relaxed);
+      if (slot_key == key) return &slot;
+      if (slot_key == 0 &&
+          (slot.key.compare_exchange_strong(slot_key, key,
+                                            std::memory_order_relaxed) ||
+           slot_key == key)) {
+        return &slot;
+      }
+    }
+    return nullptr;
+  }
+
+ public:
+  // allow records_per_second records (after an initial burst) per site
+  RateLimiter(double records_per_second, uint32_t burst) :
+    _sites(new Site[N_SITES]),
+    _interval(static_cast<uint64_t>(1e9 / records_per_second)),
+    _tolerance(_interval * (burst ? burst - 1 : 0)) {}
+
+  /*
+   * check if a record of site may be logged at now (ns of a monotonic
+   * clock, see steady_now; a coarse or wall clock would distort the rate
+   * or silence the site when it steps back); if so, suppressed
+   * is set to the number of records of site that were suppressed since
+   * its last record
+   */
+  bool admit(uint64_t site, uint64_t now, uint64_t &suppressed) {
+    Site *slot = _find(site);
+    if (!slot) return true;
+
+    uint64_t next = slot->next.load(std::memory_order_relaxed);
+    for (;;) {
+      uint64_t start = next > now ? next : now;
+      if (start - now > _tolerance) {
+        slot->suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      if (slot->next.compare_exchange_weak(next, start + _interval,
+                                           std::memory_order_relaxed)) {
         break;
-      case FormatStringObject::BOOL :
+      }
+    }
+
+    suppressed = slot->suppressed.load(std::memory_order_relaxed) ?
+      slot->suppressed.exchange(0, std::memory_order_relaxed) : 0;
+    return true;
+  }
+};
+
+// mix a value into the hash of a record
+inline uint64_t hash_mix(uint64_t hash, uint64_t value) {
+  hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+  return hash;
+}
+
+/*
+ * add an argument to the hash of a record (only integers, floating-point
+ * numbers, strings and fields with such values); returns false for all
+ * other types, since their value can't be compared without formatting them
+ */
+template<typename T>
+bool hash_arg(uint64_t &hash, const T &arg) {
+  using U = typename std::decay<const T &>::type;
+
+  if constexpr (std::is_integral<U>::value || std::is_enum<U>::value) {
+    hash = hash_mix(hash, static_cast<uint64_t>(arg));
+  } else if constexpr (std::is_floating_point<U>::value) {
+    double value = arg;
+    hash = hash_mix(hash, decode_binary_value<uint64_t>(
+      reinterpret_cast<const char *>(&value)));
+  } else if constexpr (std::is_same<U, const char *>::value ||
+                       std::is_same<U, char *>::value) {
+    const char *str = arg;  // (char arrays decay here)
+    hash = hash_mix(hash, std::hash<std::string_view>()(
+      str ? std::string_view(str) : std::string_view()));
+  } else if constexpr (std::is_convertible<const U &,
+                                           std::string_view>::value) {
+    hash = hash_mix(hash, std::hash<std::string_view>()(
+      std::string_view(arg)));
+  } else if constexpr (is_key_value<U>::value) {
+    hash = hash_mix(hash, std::hash<std::string_view>()(arg.key));
+    return hash_arg(hash, arg.value);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/*
+ * key of a record for the detection of repeated records (call site +
+ * all arguments); returns false if the arguments can't be hashed
+ */
+template<typename ...T>
+bool record_key(uint64_t &key, uint64_t site, LogFormat fmt,
+                const T &...args) {
+  key = hash_mix(site, fmt);
+  return (hash_arg(key, args) && ...);
+}
+
+// ##########################################################
+
+// ### spans ###
+
+/*
+ * clock of spans: the cycle counter on x86 (unless CPPLOG_NO_TSC is
+ * defined), nanoseconds of a monotonic clock everywhere else
+ */
+inline uint64_t span_ticks() {
+#ifdef CPPLOG_TSC
+  return __rdtsc();
+#else
+  return steady_now();
+#endif
+}
+
+/*
+ * nanoseconds per span tick; the cycle counter is calibrated against the
+ * monotonic clock once (spinning for 1ms the first time this is called)
+ */
+inline double span_ns_per_tick() {
+#ifdef CPPLOG_TSC
+  static const double ns_per_tick = [] {
+    uint64_t start_ns = steady_now();
+    uint64_t start_ticks = span_ticks();
+    uint64_t ns;
+    do {
+      ns = steady_now();
+    } while (ns - start_ns < 1000000);
+    uint64_t ticks = span_ticks() - start_ticks;
+    return ticks ? static_cast<double>(ns - start_ns) / ticks : 1.0;
+  }();
+  return ns_per_tick;
+#else
+  return 1.0;
+#endif
+}
+
+inline uint64_t span_ticks_to_ns(uint64_t ticks) {
+  return static_cast<uint64_t>(static_cast<double>(ticks) *
+                               span_ns_per_tick());
+}
+
+inline uint64_t span_ns_to_ticks(uint64_t ns) {
+  return static_cast<uint64_t>(static_cast<double>(ns) / span_ns_per_tick());
+}
+
+// unique id of a span (> 0); every thread reserves blocks of 1024 ids
+inline uint64_t next_span_id() {
+  static constexpr uint64_t BLOCK = 1024;
+  static std::atomic<uint64_t> next_block{0};
+  static thread_local uint64_t next = 0;
+  static thread_local uint64_t end = 0;
+  if (next == end) {
+    next = next_block.fetch_add(BLOCK, std::memory_order_relaxed);
+    end = next + BLOCK;
+  }
+  return ++next;
+}
+
+// id of the innermost span of the calling thread (0 = none)
+inline uint64_t &current_span_id() {
+  static thread_local uint64_t id = 0;
+  return id;
+}
+
+/*
+ * count, sum, min, max and a histogram of the durations of spans per
+ * span name (see Logger::set_span_aggregation); names are identified by
+ * their address (so they should be string literals) and live in a
+ * fixed-size lock-free table, names that don't fit into it anymore are
+ * not aggregated; the histogram has 4 buckets per power of 2, so the
+ * reported percentiles are at most 25% too high
+ */
+class SpanStats {
+ private:
+  static constexpr size_t N_SITES = 128;
+  static constexpr size_t MX_PROBES = 16;
+  static constexpr size_t N_BUCKETS = 128;
+
+  struct Site {
+    std::atomic<uintptr_t> key{0};
+    std::atomic<uint8_t> severity{0};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> min{UINT64_MAX};
+    std::atomic<uint64_t> max{0};
+    std::atomic<uint64_t> buckets[N_BUCKETS] = {};
+  };
+
+  std::unique_ptr<Site[]> _sites;
+
+  Site *_find(const char *name) {
+    uintptr_t key = reinterpret_cast<uintptr_t>(name);
+    size_t idx = static_cast<size_t>((key >> 3) * 0x9e3779b97f4a7c15ull);
+
+    for (size_t i = 0; i < MX_PROBES; ++i) {
+      Site &slot = _sites[(idx + i) % N_SITES];
+      uintptr_t slot_key = slot.key.load(std::memory_order_relaxed);
+      if (slot_key == key) return &slot;
+      if (slot_key == 0 &&
+          (slot.key.compare_exchange_strong(slot_key, key,
+                                            std::memory_order_relaxed) ||
+           slot_key == key)) {
+        return &slot;
+      }
+    }
+    return nullptr;
+  }
+
+  // 0..3: exact, then 4 buckets per power of 2 (everything >= 2^32 ticks
+  // ends up in the last bucket)
+  static size_t _bucket(uint64_t ticks) {
+    if (ticks < 4) return static_cast<size_t>(ticks);
+    size_t exp = highest_bit(ticks);
+    size_t bucket = 4 * (exp - 1) + ((ticks >> (exp - 2)) & 3);
+    return bucket < N_BUCKETS ? bucket : N_BUCKETS - 1;
+  }
+
+  // first value (in ticks) that is not part of bucket anymore
+  static uint64_t _bucket_end(size_t bucket) {
+    if (bucket < 4) return bucket + 1;
+    size_t exp = bucket / 4 + 1;
+    return (5 + bucket % 4) << (exp - 2);
+  }
+
+  static void _update_min(std::atomic<uint64_t> &min, uint64_t value) {
+    uint64_t cur = min.load(std::memory_order_relaxed);
+    while (value < cur &&
+           !min.compare_exchange_weak(cur, value,
+                                      std::memory_order_relaxed)) {}
+  }
+
+  static void _update_max(std::atomic<uint64_t> &max, uint64_t value) {
+    uint64_t cur = max.load(std::memory_order_relaxed);
+    while (value > cur &&
+           !max.compare_exchange_weak(cur, value,
+                                      std::memory_order_relaxed)) {}
+  }
+
+ public:
+  // aggregated durations of one span name (all in nanoseconds)
+  struct Summary {
+    const char *name;
+    Severity severity;
+    uint64_t count;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t mean_ns;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+  };
+
+  SpanStats() : _sites(new Site[N_SITES]) {}
+
+  // add a span of name that took ticks
+  void add(const char *name, Severity severity, uint64_t ticks) {
+    Site *site = _find(name);
+    if (!site) return;
+    site->severity.store(static_cast<uint8_t>(severity),
+                         std::memory_order_relaxed);
+    site->count.fetch_add(1, std::memory_order_relaxed);
+    site->sum.fetch_add(ticks, std::memory_order_relaxed);
+    _update_min(site->min, ticks);
+    _update_max(site->max, ticks);
+    site->buckets[_bucket(ticks)].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /*
+   * hand the summary of every name with spans since the last call to fn
+   * and reset the stats (spans that end during the call might only be
+   * counted partially)
+   */
+  template<typename Fn>
+  void drain(Fn &&fn) {
+    for (size_t i = 0; i < N_SITES; ++i) {
+      Site &site = _sites[i];
+      uintptr_t key = site.key.load(std::memory_order_relaxed);
+      if (!key || !site.count.load(std::memory_order_relaxed)) continue;
+
+      uint64_t count = site.count.exchange(0, std::memory_order_relaxed);
+      uint64_t sum = site.sum.exchange(0, std::memory_order_relaxed);
+      uint64_t min = site.min.exchange(UINT64_MAX, std::memory_order_relaxed);
+      uint64_t max = site.max.exchange(0, std::memory_order_relaxed);
+      uint64_t buckets[N_BUCKETS];
+      uint64_t total = 0;
+      for (size_t j = 0; j < N_BUCKETS; ++j) {
+        buckets[j] = site.buckets[j].exchange(0, std::memory_order_relaxed);
+        total += buckets[j];
+      }
+      if (!count || !total) continue;
+
+      // upper end of the bucket of the given rank (at most max)
+      auto percentile = [&](double p) {
+        uint64_t rank = static_cast<uint64_t>(std::ceil(p * total));
+        uint64_t seen = 0;
+        for (size_t j = 0; j < N_BUCKETS; ++j) {
+          seen += buckets[j];
+          if (seen >= rank) {
+            return span_ticks_to_ns(std::min(_bucket_end(j) - 1, max));
+          }
+        }
+        return span_ticks_to_ns(max);
+      };
+
+      fn(Summary{
+        reinterpret_cast<const char *>(key),
+        static_cast<Severity>(site.severity.load(std::memory_order_relaxed)),
+        count, span_ticks_to_ns(min), span_ticks_to_ns(max),
+        span_ticks_to_ns(sum / count), percentile(0.5), percentile(0.99)
+      });
+    }
+  }
+};
+
+/*
+ * times the scope it lives in and reports its duration to a Logger when
+ * it ends (see Logger::span); spans of the same thread that are alive at
+ * the same time form a tree: every span records the id of the span it was
+ * started in as its parent; spans whose severity is disabled never read
+ * the clock
+ */
+template<class Log>
+class Span {
+ private:
+  Log *_logger;
+  const char *_name;
+  Severity _severity;
+  uint64_t _id;
+  uint64_t _parent;
+  uint64_t _start;
+
+ public:
+  // name has to outlive the span (and should be a string literal)
+  Span(Log &logger, const char *name, Severity severity = Severity::INFO) :
+    _logger(is_active_level(static_cast<int>(severity)) &&
+            logger.is_enabled(severity) ? &logger : nullptr),
+    _name(name), _severity(severity), _id(0), _parent(0), _start(0) {
+    if (!_logger) return;
+    _id = next_span_id();
+    _parent = current_span_id();
+    current_span_id() = _id;
+    _start = span_ticks();
+  }
+
+  Span(const Span &) = delete;
+  Span &operator=(const Span &) = delete;
+
+  ~Span() {
+    end();
+  }
+
+  // end the span before the end of its scope
+  void end() {
+    if (!_logger) return;
+    uint64_t end = span_ticks();
+    current_span_id() = _parent;
+    _logger->_end_span(_name, _severity, _id, _parent, _start, end);
+    _logger = nullptr;
+  }
+
+  uint64_t id() const { return _id; }
+  uint64_t parent() const { return _parent; }
+};
+
+// a Span is just a scoped timer that knows where it has been started
+template<class Log>
+using ScopedTimer = Span<Log>;
+
+// ##########################################################
+
+// ### configuration snapshots ###
+
+/*
+ * epoch-based reclamation of objects that readers only reach through an
+ * atomic pointer (the LogImpl of a Logger, see Logger::set_log_impl): a
+ * reader announces the epoch it started in for as long as it may use
+ * such an object (see EpochGuard); an object that was replaced in epoch
+ * e can be deleted once every thread is outside of its guards or has
+ * entered them in epoch e or later
+ */
+class EpochDomain {
+ private:
+  // one per thread (reused once the thread exits, never deleted)
+  struct Slot {
+    std::atomic<uint64_t> epoch{0};  // 0 = outside of all guards
+    std::atomic<bool> used{true};
+    Slot *next = nullptr;
+  };
+
+  std::atomic<uint64_t> _epoch{1};
+  std::atomic<Slot *> _slots{nullptr};
+
+  Slot *_acquire_slot() {
+    Slot *head = _slots.load(std::memory_order_acquire);
+    for (Slot *slot = head; slot; slot = slot->next) {
+      bool used = false;
+      if (!slot->used.load(std::memory_order_relaxed) &&
+          slot->used.compare_exchange_strong(used, true,
+                                             std::memory_order_acquire)) {
+        return slot;
+      }
+    }
+
+    Slot *slot = new Slot();
+    slot->next = head;
+    while (!_slots.compare_exchange_weak(slot->next, slot,
+                                         std::memory_order_release,
+                                         std::memory_order_acquire)) {}
+    return slot;
+  }
+
+  // the slot of the calling thread and the depth of its guards
+  struct ThreadState {
+    Slot *slot = global()._acquire_slot();
+    unsigned depth = 0;
+
+    ~ThreadState() {
+      slot->epoch.store(0, std::memory_order_release);
+      slot->used.store(false, std::memory_order_release);
+    }
+  };
+
+  static ThreadState &_thread_state() {
+    static thread_local ThreadState state;
+    return state;
+  }
+
+ public:
+  // (never destroyed, threads may still exit after the end of main)
+  static EpochDomain &global() {
+    static EpochDomain *domain = new EpochDomain();
+    return *domain;
+  }
+
+  // announce the current epoch (nested: only the outermost call does)
+  void enter() {
+    ThreadState &state = _thread_state();
+    if (state.depth++) return;
+    state.slot->epoch.store(_epoch.load(std::memory_order_acquire),
+                            std::memory_order_relaxed);
+    // (the pointers the reader loads next are read after the store)
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+
+  void leave() {
+    ThreadState &state = _thread_state();
+    if (--state.depth) return;
+    state.slot->epoch.store(0, std::memory_order_release);
+  }
+
+  // start a new epoch after an object was replaced; returns it
+  uint64_t advance() {
+    return _epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+  }
+
+  // check if no reader can still use an object replaced in epoch
+  bool quiescent(uint64_t epoch) const {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (Slot *slot = _slots.load(std::memory_order_acquire); slot;
+         slot = slot->next) {
+      uint64_t entered = slot->epoch.load(std::memory_order_acquire);
+      if (entered && entered < epoch) return false;
+    }
+    return true;
+  }
+};
+
+// scope in which the calling thread reads objects of EpochDomain::global()
+class EpochGuard {
+ public:
+  EpochGuard() {
+    EpochDomain::global().enter();
+  }
+
+  ~EpochGuard() {
+    EpochDomain::global().leave();
+  }
+
+  EpochGuard(const EpochGuard &) = delete;
+  EpochGuard &operator=(const EpochGuard &) = delete;
+};
+
+// ##########################################################
+
+/*
+ * The Logger class writes all logged messages into its sinks
+ * (an OStreamSink on std::cerr by default, see add_sink);
+ * you can specify the log level and log format of the
+ * to-be-logged messages using the set_log_level and
+ * set_log_format methods; this class contains methods that
+ * support the logging of all primitive and most std library types;
+ * if you wish to log your own custom types, please extend the
+ * "LoggerImpl" class and add your own
+ * "void log(std::ostream &stream, YourCustomType t, LogFormat fmt)"
+ * definitions that specify how your custom types should be logged
+ * and provide your extension of the LoggerImpl class as the template
+ * class for the Logger class;
+ * the Logger class will take ownership of the LoggerImpl object,
+ * so be aware that it will be deleted whenever the Logger class
+ * get deleted;
+ * by default every record is written synchronously (guarded by a mutex);
+ * set_async switches the Logger to a lock-free queue that is drained
+ * by a background writer thread, set_thread_buffered lets every thread
+ * collect its records and write them in batches
+ */
+template<class LogImpl = LoggerImpl>
+class Logger {
+ private:
+  std::string _name;
+
+  // (see set_log_format; read by every record, may change at any time)
+  std::atomic<LogFormat> _log_format{0};
+
+  /*
+   * formats the records; it is never modified once it is published, but
+   * replaced by a modified copy (see _modify_impl), so threads that log
+   * keep using the one they loaded (inside an EpochGuard, see _impl)
+   */
+  std::atomic<LogImpl *> _log_impl{nullptr};
+
+  // replaced LogImpls and the epoch they were replaced in
+  std::vector<std::pair<LogImpl *, uint64_t>> _retired_impls;
+
+  // serializes the changes of the configuration
+  std::mutex _config_mutex;
+
+  // sinks, lock, queue and thread buffers (possibly shared)
+  std::shared_ptr<LoggerBackend> _backend =
+    std::make_shared<LoggerBackend>();
+
+  // string id of the name of this Logger (for binary records)
+  uint32_t _name_id = BinaryStringTable::global().add(_name.c_str());
+
+  // async text records only capture their arguments (see
+  // set_deferred_formatting)
+  bool _deferred_formatting = false;
+
+  // how records of fields (see kv) are written
+  StructuredFormat _structured_format = StructuredFormat::TEXT;
+
+  // records, bytes and (if _timing_metrics is set) formatting times
+  Metrics _metrics;
+  bool _timing_metrics = false;
+
+  // timestamp settings (applied to every LogImpl this Logger owns)
+  std::atomic<TimestampPrecision> _timestamp_precision{
+    TimestampPrecision::SECONDS};
+  bool _raw_timestamps = false;
+
+  // truncation limits (applied to every LogImpl this Logger owns)
+  size_t _max_string_length = CPPLOG_MX_STR_LEN;
+  size_t _max_elements = CPPLOG_MX_ELS;
+
+  // records below this severity are discarded before any formatting
+  std::atomic<uint8_t> _min_severity{CPPLOG_LEVEL_TRACE};
+
+  // memory of long messages and format strings (see set_allocator),
+  // default_allocator() if not set
+  std::shared_ptr<Allocator> _allocator;
+
+  // per-call-site token buckets (only set if rate limiting is enabled)
+  std::unique_ptr<RateLimiter> _rate_limiter;
+
+  // collapse repeated records into "last message repeated N time(s)"
+  bool _collapse_repeats = false;
+  std::atomic<uint64_t> _last_record_key{0};
+  std::atomic<LogFormat> _last_record_fmt{0};
+  std::atomic<uint64_t> _repeats{0};
+
+  // spans shorter than _span_threshold (ticks) aren't logged, every
+  // _span_sampling-th span is logged anyway (0 = none)
+  uint64_t _span_threshold = 0;
+  uint32_t _span_sampling = 0;
+
+  // aggregated spans (only set if aggregation is enabled), logged every
+  // _span_interval ticks
+  std::unique_ptr<SpanStats> _span_stats;
+  uint64_t _span_interval = 0;
+  std::atomic<uint64_t> _next_span_stats{0};
+
+#ifdef CPPLOG_COROUTINES
+  // where coroutines that waited for this Logger resume (see set_executor)
+  std::shared_ptr<Executor> _executor;
+#endif
+
+  // default log formats for all severities
+  const LogFormat _default_trace_fmt =
+    LogFmt::HIGHLIGHT_DEF | LogFmt::TIMESTAMP | LogFmt::NEWLINE;
+  const LogFormat _default_debug_fmt =
+    LogFmt::HIGHLIGHT_DEF | LogFmt::TIMESTAMP | LogFmt::NEWLINE;
+  const LogFormat _default_info_fmt =
+    LogFmt::HIGHLIGHT_GREEN | LogFmt::TIMESTAMP | LogFmt::NEWLINE;
+  const LogFormat _default_warn_fmt =
+    LogFmt::HIGHLIGHT_YELLOW | LogFmt::TIMESTAMP | LogFmt::NEWLINE;
+  const LogFormat _default_err_fmt =
+    LogFmt::HIGHLIGHT_RED | LogFmt::TIMESTAMP | LogFmt::NEWLINE;
+  const LogFormat _default_fatal_fmt =
+    LogFmt::HIGHLIGHT_RED | LogFmt::TIMESTAMP | LogFmt::NEWLINE;
+
+  template<class> friend class Span;
+
+  // log format of records of a severity (w/o the LogImpl of a value)
+  LogFormat _default_fmt(Severity severity) const {
+    switch (severity) {
+      case Severity::TRACE: return log_format() | _default_trace_fmt;
+      case Severity::DEBUG: return log_format() | _default_debug_fmt;
+      case Severity::INFO:  return log_format() | _default_info_fmt;
+      case Severity::WARN:  return log_format() | _default_warn_fmt;
+      case Severity::ERROR: return log_format() | _default_err_fmt;
+      default:              return log_format() | _default_fatal_fmt;
+    }
+  }
+
+  TimestampPrecision _precision() const {
+    return _timestamp_precision.load(std::memory_order_relaxed);
+  }
+
+  // the current LogImpl (only valid inside of an EpochGuard)
+  LogImpl &_impl() const {
+    return *_log_impl.load(std::memory_order_acquire);
+  }
+
+  /*
+   * replace the LogImpl by impl and delete the replaced LogImpls that no
+   * thread can still use (the caller holds _config_mutex)
+   */
+  void _publish_impl(LogImpl *impl) {
+    LogImpl *old = _log_impl.exchange(impl, std::memory_order_seq_cst);
+    if (!old) return;
+
+    EpochDomain &epochs = EpochDomain::global();
+    _retired_impls.emplace_back(old, epochs.advance());
+    auto end = std::remove_if(
+      _retired_impls.begin(), _retired_impls.end(),
+      [&epochs](const std::pair<LogImpl *, uint64_t> &retired) {
+        if (!epochs.quiescent(retired.second)) return false;
+        delete retired.first;
+        return true;
+      });
+    _retired_impls.erase(end, _retired_impls.end());
+  }
+
+  /*
+   * apply fn to a copy of the LogImpl and publish it (a LogImpl that
+   * can't be copied is modified in place, which is only safe as long as
+   * no other thread uses the Logger)
+   */
+  template<typename Fn>
+  void _modify_impl(Fn &&fn) {
+    std::lock_guard<std::mutex> lock(_config_mutex);
+    LogImpl &impl = *_log_impl.load(std::memory_order_relaxed);
+    if constexpr (std::is_copy_constructible<LogImpl>::value) {
+      LogImpl *copy = new LogImpl(impl);
+      fn(*copy);
+      _publish_impl(copy);
+    } else {
+      fn(impl);
+    }
+  }
+
+  void _set_colors(bool colors) {
+    _modify_impl([colors](LogImpl &impl) { impl.set_colors(colors); });
+  }
+
+  /*
+   * called by a Span that ran from start to end (ticks): log it if it
+   * took long enough or is sampled, aggregate it otherwise
+   */
+  void _end_span(const char *name, Severity severity, uint64_t id,
+                 uint64_t parent, uint64_t start, uint64_t end) {
+    uint64_t ticks = end - start;
+    bool log = _span_stats ? _span_threshold && ticks >= _span_threshold :
+                             ticks >= _span_threshold;
+    if (_span_sampling && id % _span_sampling == 0) log = true;
+
+    if (log) {
+      _metrics.add(static_cast<Counter>(severity));
+      _log_structured(severity, "span", _default_fmt(severity),
+                      kv("name", name), kv("id", id), kv("parent", parent),
+                      kv("duration_ns", span_ticks_to_ns(ticks)));
+    }
+
+    if (_span_stats) {
+      _span_stats->add(name, severity, ticks);
+      uint64_t next = _next_span_stats.load(std::memory_order_relaxed);
+      if (end >= next &&
+          _next_span_stats.compare_exchange_strong(
+            next, end + _span_interval, std::memory_order_relaxed)) {
+        _log_span_stats();
+      }
+    }
+  }
+
+  // log (and reset) the stats of all aggregated spans
+  void _log_span_stats() {
+    _span_stats->drain([this](const SpanStats::Summary &stats) {
+      if (!is_enabled(stats.severity)) return;
+      _metrics.add(static_cast<Counter>(stats.severity));
+      _log_structured(stats.severity, "span stats",
+                      _default_fmt(stats.severity),
+                      kv("name", stats.name), kv("count", stats.count),
+                      kv("min_ns", stats.min_ns),
+                      kv("mean_ns", stats.mean_ns),
+                      kv("p50_ns", stats.p50_ns),
+                      kv("p99_ns", stats.p99_ns),
+                      kv("max_ns", stats.max_ns));
+    });
+  }
+
+  /*
+   * hand a stream to fn that fn should write one complete record of
+   * severity into (start is the _format_start of the record);
+   * the record is collected in a thread-local RecordStream (without
+   * holding any lock) and then either written to the sinks in one piece,
+   * appended to the batch of the thread or enqueued for the writer thread;
+   * fn runs inside an EpochGuard, so it may use _impl()
+   */
+  template<typename Fn>
+  void _write(Severity severity, uint64_t start, Fn &&fn) {
+    RecordStream &record = thread_record_stream();
+    {
+      EpochGuard guard;
+      fn(record);
+    }
+    _count(start, record.size());
+    _backend->write(record, severity, _name_id);
+  }
+
+  // start of the formatting of a record (0 if it isn't measured)
+  uint64_t _format_start() const {
+    return _timing_metrics ? steady_now() : 0;
+  }
+
+  // count the bytes (and formatting time) of a record
+  void _count(uint64_t start, size_t size) {
+    _metrics.add(Counter::BYTES, size);
+    if (start) _metrics.record(Histogram::FORMAT_NS, steady_now() - start);
+  }
+
+  // log how often the last record was repeated (if it was)
+  void _log_repeats() {
+    if (!_repeats.load(std::memory_order_relaxed)) return;
+    uint64_t repeats = _repeats.exchange(0, std::memory_order_relaxed);
+    if (!repeats) return;
+    _log_format_string(Severity::INFO,
+                       "[cpplog] last message repeated {d} time(s)",
+                       _last_record_fmt.load(std::memory_order_relaxed),
+                       repeats);
+  }
+
+  /*
+   * check if a record of the call site fmt_str (a runtime or
+   * CompiledFormat format string) should be logged (rate limit +
+   * repeated records) and count it; runs before anything is formatted
+   */
+  template<typename Fmt, typename ...T>
+  bool _admit(Severity severity, Fmt fmt_str, LogFormat fmt,
+              const T &...args) {
+    if (_collapse_repeats) {
+      uint64_t key = 0;
+      if (!record_key(key, call_site(fmt_str), fmt, args...)) key = 0;
+      if (key && _last_record_key.exchange(
+            key, std::memory_order_relaxed) == key) {
+        _repeats.fetch_add(1, std::memory_order_relaxed);
+        _metrics.add(Counter::COLLAPSED);
+        return false;
+      }
+      if (!key) _last_record_key.store(0, std::memory_order_relaxed);
+      _log_repeats();
+      _last_record_fmt.store(fmt, std::memory_order_relaxed);
+    }
+
+    if (_rate_limiter) {
+      uint64_t suppressed = 0;
+      if (!_rate_limiter->admit(call_site(fmt_str), steady_now(),
+                                suppressed)) {
+        _metrics.add(Counter::DROPPED_RATE_LIMIT);
+        return false;
+      }
+      if (suppressed) {
+        _log_format_string(severity, "[cpplog] suppressed {d} record(s) "
+                           "of \"{s}\" (rate limit)", fmt, suppressed,
+                           call_site_format(fmt_str));
+      }
+    }
+
+    _metrics.add(static_cast<Counter>(severity));
+    return true;
+  }
+
+  Allocator &_memory() const {
+    return _allocator ? *_allocator : default_allocator();
+  }
+
+  // let log write one record without blocking (see try_info)
+  template<typename Fn>
+  LogStatus _try_log(Severity severity, Fn &&log) {
+    if (!is_enabled(severity)) return LogStatus::FILTERED;
+    if (!_backend->admits_nonblocking()) return LogStatus::DROPPED;
+
+    ProducerState &producer = producer_state();
+    bool non_blocking = producer.non_blocking;
+    producer.non_blocking = true;
+    producer.status = LogStatus::FILTERED;
+    log();
+    producer.non_blocking = non_blocking;
+    return producer.status;
+  }
+
+  // encode format string id + arguments (nothing is formatted here)
+  template<typename ...T>
+  void _log_binary(Severity severity, uint32_t format_id, LogFormat fmt,
+                   const T &...args) {
+    uint64_t start = _format_start();
+    FormatBuffer buf(_memory());
+    encode_binary_record(buf, format_id, _name_id,
+                         timestamp_now(_precision()), fmt, severity,
+                         args...);
+    _count(start, buf.size());
+    _backend->write_binary(buf.data(), buf.size(), severity, _name_id);
+  }
+
+  // format strings are applied by the writer thread
+  bool _defers_formatting() const {
+    return _deferred_formatting && _backend->is_async() &&
+           _backend->encoding() == Encoding::TEXT;
+  }
+
+  // capture the arguments of a text record for the writer thread
+  template<typename ...T>
+  void _log_deferred(Severity severity, uint32_t format_id, LogFormat fmt,
+                     const T &...args) {
+    uint64_t start = _format_start();
+    FormatBuffer buf(_memory());
+    encode_binary_record<true>(buf, format_id, _name_id,
+                               timestamp_now(_precision()),
+                               fmt, severity, args...);
+    _count(start, buf.size());
+    _backend->push_deferred(buf.data(), buf.size(), severity, _name_id);
+  }
+
+  // log a single value via the log method of the LogImpl
+  template<typename T>
+  void _log_value(Severity severity, const T &t, LogFormat fmt) {
+    if (_backend->encoding() == Encoding::BINARY) {
+      // the text of the value itself is produced by the LogImpl,
+      // the decoder adds color, name, timestamp and newline again
+      constexpr LogFormat BODY_FMT = LogFmt::VERBOSE | LogFmt::TYPE_SIZE;
+      RecordStream &text = thread_record_stream();
       {
-        std::string bool_val = (arg == "1") ? "true" : "false";
-        _pad_fmt_arg(fmt_arg, bool_val, fmt_obj);
-        break;
+        EpochGuard guard;
+        _impl().log(text, t, fmt & BODY_FMT);
       }
-      default:
-       fmt_arg << "Unknown type";
+
+      std::string_view body(text.data(), text.size());
+      _log_binary(severity, CPPLOG_BINARY_VALUE_FORMAT_ID, fmt & ~BODY_FMT,
+                  body);
+      return;
+    }
+
+    _write(severity, _format_start(), [&](std::ostream &stream) {
+      _impl().log(stream, t, fmt);
+    });
+  }
+
+  template<typename T, typename ...Tr>
+  void _log_format_string(Severity severity, const char *fmt_str,
+                          LogFormat fmt, T &&first, Tr&&... args) {
+    if (_backend->encoding() == Encoding::BINARY) {
+      _log_binary(severity, binary_format_id(fmt_str), fmt, first, args...);
+      return;
+    }
+    if (_defers_formatting()) {
+      _log_deferred(severity, binary_format_id(fmt_str), fmt, first,
+                    args...);
+      return;
+    }
+
+    uint64_t start = _format_start();
+    FormatObjects objs{StdAllocator<FormatStringObject>(_memory())};
+    parse_format_string(fmt_str, objs);
+    FormatBuffer msg(_memory());
+    format_string_args(msg, objs.data(), objs.size(), fmt_str,
+                       std::strlen(fmt_str), 0, objs.front().start_idx,
+                       0, std::forward<T>(first), std::forward<Tr>(args)...);
+    _write(severity, start, [&](std::ostream &stream) {
+      _impl().parse_fmt_opts(stream, msg.view(), fmt, msg.size());
+    });
+  }
+
+  /*
+   * write a structured record (message + fields); the fields are encoded
+   * right into the record, binary records only carry the text version
+   */
+  template<typename ...T>
+  void _log_structured(Severity severity, const char *msg, LogFormat fmt,
+                       const KeyValue<T> &...fields) {
+    uint64_t start = _format_start();
+    FormatBuffer body(_memory());
+    if (_structured_format == StructuredFormat::TEXT ||
+        _backend->encoding() == Encoding::BINARY) {
+      body.append(msg, std::strlen(msg));
+      encode_fields(body, StructuredFormat::LOGFMT, fields...);
+      if (_backend->encoding() == Encoding::BINARY) {
+        _log_binary(severity, CPPLOG_BINARY_VALUE_FORMAT_ID, fmt,
+                    body.view());
+        return;
+      }
+      _write(severity, start, [&](std::ostream &stream) {
+        _impl().parse_fmt_opts(stream, body.view(), fmt, body.size());
+      });
+      return;
+    }
+
+    // everything after the timestamp
+    bool json = _structured_format == StructuredFormat::JSON;
+    if (json) {
+      body.append(fmt & LogFmt::TIMESTAMP ? "\",\"level\":\"" :
+                                            "{\"level\":\"");
+      body.append(severity_name(severity));
+      body.push_back('"');
+      if (fmt & LogFmt::NAME) {
+        body.append(",\"logger\":", 10);
+        append_json_string(body, _name);
+      }
+      body.append(",\"msg\":", 7);
+      append_json_string(body, msg);
+    } else {
+      body.append(fmt & LogFmt::TIMESTAMP ? " level=" : "level=");
+      body.append(severity_name(severity));
+      if (fmt & LogFmt::NAME) {
+        body.append(" logger=", 8);
+        append_logfmt_string(body, _name);
+      }
+      body.append(" msg=", 5);
+      append_logfmt_string(body, msg);
+    }
+    encode_fields(body, _structured_format, fields...);
+    if (json) body.push_back('}');
+    if (fmt & LogFmt::NEWLINE) body.push_back('\n');
+
+    _write(severity, start, [&](std::ostream &stream) {
+      if (fmt & LogFmt::TIMESTAMP) {
+        stream << (json ? "{\"time\":\"" : "time=");
+        _impl().log_timestamp(stream);
+      }
+      stream.write(body.data(), static_cast<std::streamsize>(body.size()));
+    });
+  }
+
+  // log a format string or (if all arguments are fields) a structured record
+  template<typename T, typename ...Tr>
+  void _log_message(Severity severity, const char *fmt_str, LogFormat fmt,
+                    T &&first, Tr&&... args) {
+    if constexpr (are_key_values<T, Tr...>::value) {
+      _log_structured(severity, fmt_str, fmt, first, args...);
+    } else {
+      _log_format_string(severity, fmt_str, fmt, std::forward<T>(first),
+                         std::forward<Tr>(args)...);
+    }
+  }
+
+  // same as _log_format_string, but all specifiers were parsed already
+  template<class Str, typename ...T>
+  void _log_compiled_format(Severity severity, CompiledFormat<Str> fmt_str,
+                            LogFormat default_fmt, T&&... args) {
+    if constexpr (sizeof...(T) == CompiledFormat<Str>::count + 1) {
+      _log_compiled_format_with_fmt(severity, fmt_str, default_fmt,
+                                    std::forward<T>(args)...);
+    } else {
+      _log_compiled_format_args(severity, fmt_str, log_format() | default_fmt,
+                                std::forward<T>(args)...);
+    }
+  }
+
+  template<class Str, typename F, typename ...T>
+  void _log_compiled_format_with_fmt(Severity severity,
+                                     CompiledFormat<Str> fmt_str,
+                                     LogFormat default_fmt,
+                                     F &&fmt, T&&... args) {
+    static_assert(std::is_convertible<F, LogFormat>::value,
+                  "cpplog: number of arguments doesn't match the number "
+                  "of format specifiers");
+    _log_compiled_format_args(severity, fmt_str, fmt | default_fmt,
+                              std::forward<T>(args)...);
+  }
+
+  template<class Str, typename ...T>
+  void _log_compiled_format_args(Severity severity, CompiledFormat<Str>,
+                                 LogFormat fmt, T&&... args) {
+    using Format = CompiledFormat<Str>;
+    Format::template check_args<T...>();
+
+    if (_backend->encoding() == Encoding::BINARY) {
+      _log_binary(severity, binary_format_id(Format()), fmt, args...);
+      return;
+    }
+    if (_defers_formatting()) {
+      _log_deferred(severity, binary_format_id(Format()), fmt, args...);
+      return;
+    }
+
+    uint64_t start = _format_start();
+    FormatBuffer msg(_memory());
+    if constexpr (Format::count == 0) {
+      msg.append(Format::str, Format::length);
+    } else {
+      format_string_args(msg, Format::objs.data(), Format::count,
+                         Format::str, Format::length, 0,
+                         Format::objs[0].start_idx, 0,
+                         std::forward<T>(args)...);
+    }
+    _write(severity, start, [&](std::ostream &stream) {
+      _impl().parse_fmt_opts(stream, msg.view(), fmt, msg.size());
+    });
+  }
+
+ public:
+  Logger() :
+    _name("LOG") {
+    set_log_level(Level::STANDARD);
+    set_log_format(Level::STANDARD);
+    set_log_impl(nullptr);
+  }
+
+  Logger(const char *name, LogImpl *log_impl = nullptr) :
+    _name(name) {
+    set_log_level(Level::STANDARD);
+    set_log_format(Level::STANDARD);
+    set_log_impl(log_impl);
+  }
+
+  Logger(const char *name, Level lvl,
+         LogFormat fmt, LogImpl *log_impl = nullptr) :
+    _name(name) {
+    set_log_level(lvl);
+    set_log_format(fmt);
+    set_log_impl(log_impl);
+  }
+
+  /*
+   * Logger that shares the sinks, lock and queue of backend with other
+   * Loggers (e.g. from another_logger.backend()); switching one of them
+   * to async mode, adding sinks, ... affects all of them
+   */
+  Logger(const char *name, std::shared_ptr<LoggerBackend> backend,
+         LogImpl *log_impl = nullptr) :
+    _name(name), _backend(std::move(backend)) {
+    set_log_level(Level::STANDARD);
+    set_log_format(Level::STANDARD);
+    set_log_impl(log_impl);
+  }
+
+  ~Logger() {
+    // (the backend might be shared and outlive this Logger; queued
+    // records are already formatted, so the LogImpl isn't needed anymore)
+    flush();
+    delete _log_impl.load(std::memory_order_relaxed);
+    for (const auto &retired : _retired_impls) delete retired.first;
+  }
+
+  // set log level (may be called while other threads log)
+  void set_log_level(Level lvl) {
+    set_log_format(lvl);
+  }
+
+  /*
+   * specify log format (see LogFmt enum for available options; may be
+   * called while other threads log)
+   */
+  void set_log_format(LogFormat fmt) {
+    _log_format.store(fmt, std::memory_order_relaxed);
+  }
+
+  LogFormat log_format() const {
+    return _log_format.load(std::memory_order_relaxed);
+  }
+
+  const std::string &name() const {
+    return _name;
+  }
+
+  /*
+   * set the log implementation object;
+   * the Logger class will take ownership of the LogImpl object,
+   * so be aware that it will be deleted whenever the Logger class
+   * get deleted (the replaced one is deleted once no thread that
+   * logs can still use it, so this may be called at any time)
+   */
+  void set_log_impl(LogImpl *log_impl) {
+    // if a valid ptr was passed, simply take ownership;
+    // else, create a new log implementation object
+    LogImpl *impl = log_impl ? log_impl : new LogImpl();
+
+    std::lock_guard<std::mutex> lock(_config_mutex);
+    impl->set_name(_name);
+    impl->set_timestamp_precision(_precision());
+    impl->set_raw_timestamps(_raw_timestamps);
+    impl->set_max_string_length(_max_string_length);
+    impl->set_max_elements(_max_elements);
+    impl->set_colors(_backend->colors());
+    _publish_impl(impl);
+  }
+
+  // log timestamps with seconds, milliseconds or microseconds
+  void set_timestamp_precision(TimestampPrecision precision) {
+    _modify_impl([this, precision](LogImpl &impl) {
+      _timestamp_precision.store(precision, std::memory_order_relaxed);
+      impl.set_timestamp_precision(precision);
+    });
+    _backend->set_timestamp_precision(precision);
+  }
+
+  /*
+   * strings with length or more characters are shortened to their first
+   * and last characters (unless LogFmt::VERBOSE is set; 0 = no limit)
+   */
+  void set_max_string_length(size_t length) {
+    _modify_impl([this, length](LogImpl &impl) {
+      _max_string_length = length;
+      impl.set_max_string_length(length);
+    });
+  }
+
+  /*
+   * containers only log their first and last n_elements / 2 elements if
+   * that leaves some out (unless LogFmt::VERBOSE is set; 0 = no limit)
+   */
+  void set_max_elements(size_t n_elements) {
+    _modify_impl([this, n_elements](LogImpl &impl) {
+      _max_elements = n_elements;
+      impl.set_max_elements(n_elements);
+    });
+  }
+
+  /*
+   * if enabled, async records only carry the raw clock ticks and the
+   * timestamp is rendered by the writer thread (sync Loggers render it
+   * while writing the record, so the output is the same)
+   */
+  void set_raw_timestamps(bool raw) {
+    _modify_impl([this, raw](LogImpl &impl) {
+      _raw_timestamps = raw;
+      impl.set_raw_timestamps(raw);
+    });
+  }
+
+  /*
+   * switch to asynchronous logging: records get formatted on the calling
+   * thread and are then pushed into a lock-free queue with room for
+   * queue_capacity records (rounded up to a power of 2), which a
+   * background thread drains into the output stream; policy specifies
+   * what happens if the queue is full (dropped records are reported
+   * by the writer thread with a single dropped-count record);
+   * this should be called before any other thread uses the Logger
+   */
+  void set_async(size_t queue_capacity = CPPLOG_ASYNC_QUEUE_CAPACITY,
+                 OverflowPolicy policy = OverflowPolicy::BLOCK) {
+    _backend->set_timestamp_precision(_precision());
+    _backend->set_async(queue_capacity, policy);
+  }
+
+  /*
+   * same as set_async(queue_capacity, policy), but the producers can be
+   * spread over several queues (records of one queue are written in
+   * order, see ShardPolicy) and the writer thread can be pinned to CPUs
+   */
+  void set_async(const WriterOptions &options) {
+    _backend->set_timestamp_precision(_precision());
+    _backend->set_async(options);
+  }
+
+  /*
+   * write all records to sinks as well, with a writer thread (and queues,
+   * see WriterOptions) of their own, so slow sinks don't hold up the
+   * others; the writer gets every record in every mode (also if the
+   * Logger itself is synchronous), records of one of its queues are
+   * written in order; this should be called before any other thread
+   * uses the Logger
+   */
+  void add_writer(const std::vector<std::shared_ptr<Sink>> &sinks,
+                  const WriterOptions &options = WriterOptions()) {
+    _backend->add_writer(sinks, options);
+    _set_colors(_backend->colors());
+  }
+
+  /*
+   * if enabled, async Loggers with text encoding don't format their
+   * format strings on the calling thread anymore: records only capture
+   * the argument values and the writer thread formats them; strings are
+   * copied (pass a cpplog::string_ref to only reference them), trivially
+   * copyable types are copied as they are and other types are captured
+   * via their cpplog::serializer specialization (types without one are
+   * still formatted right away); single values (e.g. info(vec)) are
+   * always formatted right away;
+   * this should be called before any other thread uses the Logger
+   */
+  void set_deferred_formatting(bool deferred) {
+    flush();
+    _deferred_formatting = deferred;
+  }
+
+  /*
+   * take the memory of messages longer than CPPLOG_FORMAT_BUFFER_SIZE and
+   * of parsed runtime format strings from allocator (nullptr: the
+   * per-thread BlockPool, the default; see PoolAllocator);
+   * this should be called before any other thread uses the Logger
+   */
+  void set_allocator(std::shared_ptr<Allocator> allocator) {
+    _allocator = std::move(allocator);
+  }
+
+  /*
+   * switch to thread-buffered logging: every thread collects its records
+   * in its own buffer and only takes the Logger's lock to write a batch
+   * of batch_size bytes (or more) to the sinks; flush() (and the exit of
+   * a thread) commits the buffered records; records are never split,
+   * but records of different threads may not be written in the order
+   * they were logged in;
+   * this should be called before any other thread uses the Logger
+   */
+  void set_thread_buffered(size_t batch_size = CPPLOG_THREAD_BUFFER_SIZE) {
+    _backend->set_thread_buffered(batch_size);
+  }
+
+  // commit all buffered/queued records and log synchronously
+  void set_sync() {
+    _backend->set_sync();
+  }
+
+  bool is_async() const {
+    return _backend->is_async();
+  }
+
+  bool is_thread_buffered() const {
+    return _backend->is_thread_buffered();
+  }
+
+  // sinks, lock and queue of this Logger (see Logger(name, backend))
+  const std::shared_ptr<LoggerBackend> &backend() const {
+    return _backend;
+  }
+
+  /*
+   * write all records to sink (in addition to the sinks the Logger
+   * already has; by default, a Logger writes to std::cerr); records
+   * logged before this call still go to the old sinks only; this may be
+   * called while other threads log (they aren't held up in async mode,
+   * see LoggerBackend::modify_writer)
+   */
+  void add_sink(std::shared_ptr<Sink> sink) {
+    _set_colors(_backend->modify_writer([&sink](RecordWriter &writer) {
+      writer.add_sink(std::move(sink));
+    }));
+  }
+
+  /*
+   * write all records to sink only (like add_sink; removing the sinks of
+   * add_writer is only safe before any other thread uses the Logger)
+   */
+  void set_sink(std::shared_ptr<Sink> sink) {
+    _backend->clear_writers();
+    _set_colors(_backend->modify_writer([&sink](RecordWriter &writer) {
+      writer.clear_sinks();
+      writer.add_sink(std::move(sink));
+    }));
+  }
+
+  // remove all sinks (records are discarded until a sink is added)
+  void clear_sinks() {
+    _backend->clear_writers();
+    _set_colors(_backend->modify_writer([](RecordWriter &writer) {
+      writer.clear_sinks();
+    }));
+  }
+
+  /*
+   * limit every call site (identified by its format string) to a burst of
+   * records followed by records_per_second records; suppressed records
+   * cost no formatting and are reported with the next record of the call
+   * site that gets through; records_per_second <= 0 disables the limit
+   * (fatal records and single values are never limited);
+   * this should be called before any other thread uses the Logger
+   */
+  void set_rate_limit(double records_per_second, uint32_t burst = 1) {
+    if (records_per_second > 0) {
+      _rate_limiter.reset(new RateLimiter(records_per_second, burst));
+    } else {
+      _rate_limiter.reset();
+    }
+  }
+
+  /*
+   * collapse records that are identical to the previous record (same
+   * call site and argument values) into a single "last message repeated
+   * N time(s)" record; only records whose arguments are numbers and
+   * strings are compared;
+   * this should be called before any other thread uses the Logger
+   */
+  void set_collapse_repeats(bool collapse) {
+    if (!collapse) _log_repeats();
+    _collapse_repeats = collapse;
+    _last_record_key.store(0, std::memory_order_relaxed);
+  }
+
+  /*
+   * write records that only consist of a message and fields (see kv) as
+   * part of a regular record (TEXT), as logfmt lines or as JSON objects;
+   * LogFmt::TIMESTAMP, NAME and NEWLINE still apply, colors are only
+   * used by TEXT records (binary Loggers always write TEXT records)
+   */
+  void set_structured_format(StructuredFormat format) {
+    _structured_format = format;
+  }
+
+  /*
+   * also measure how long formatting/encoding each record takes (costs
+   * two reads of the clock per record; all counters are always kept)
+   */
+  void set_timing_metrics(bool timing) {
+    _timing_metrics = timing;
+  }
+
+  // current counters of this Logger (records, bytes, formatting times)
+  MetricsSnapshot metrics() const {
+    return _metrics.snapshot();
+  }
+
+  // write the metrics of this Logger and its backend for Prometheus
+  void write_metrics(std::ostream &out) const {
+    std::string label = prometheus_label("logger", _name);
+    write_prometheus(out, {MetricsSource{label, metrics()}},
+                     {MetricsSource{label, _backend->metrics()}});
+  }
+
+  /*
+   * start a span that logs a "span" record with its name, id, the id of
+   * its parent span and its duration once it goes out of scope (or end is
+   * called), e.g.
+   *   auto span = logger.span("db.query");
+   */
+  Span<Logger> span(const char *name, Severity severity = Severity::INFO) {
+    return Span<Logger>(*this, name, severity);
+  }
+
+  /*
+   * only log spans that take at least threshold (with aggregation: only
+   * log spans individually that take at least threshold; 0 = none);
+   * this should be called before any other thread uses the Logger
+   */
+  void set_span_threshold(std::chrono::nanoseconds threshold) {
+    _span_threshold = threshold.count() > 0 ?
+      span_ns_to_ticks(static_cast<uint64_t>(threshold.count())) : 0;
+  }
+
+  /*
+   * also log every n-th span, no matter how long it took (0 = none);
+   * this should be called before any other thread uses the Logger
+   */
+  void set_span_sampling(uint32_t n) {
+    _span_sampling = n;
+  }
+
+  /*
+   * aggregate spans per name instead of logging every single one: count,
+   * min, mean, p50, p99 and max of every name are logged as a "span stats"
+   * record every interval (checked whenever a span ends) and by flush();
+   * an interval of 0 disables the aggregation again;
+   * this should be called before any other thread uses the Logger
+   */
+  void set_span_aggregation(std::chrono::nanoseconds interval) {
+    if (_span_stats) _log_span_stats();
+    if (interval.count() <= 0) {
+      _span_stats.reset();
+      return;
+    }
+    if (!_span_stats) _span_stats.reset(new SpanStats());
+    _span_interval =
+      span_ns_to_ticks(static_cast<uint64_t>(interval.count()));
+    _next_span_stats.store(span_ticks() + _span_interval,
+                           std::memory_order_relaxed);
+  }
+
+  // block until all records logged so far have been written to the sinks
+  void flush() {
+    if (_collapse_repeats) _log_repeats();
+    if (_span_stats) _log_span_stats();
+    _backend->flush();
+  }
+
+  /*
+   * switch between text and binary records; binary records only contain
+   * the id of the format string and the raw argument values and can be
+   * turned back into text with the cpplog-decode tool (applies to all
+   * Loggers that share the backend);
+   * this should be called before any other thread uses the Logger
+   */
+  void set_encoding(Encoding encoding) {
+    flush();
+    _backend->set_encoding(encoding);
+  }
+
+  // set the minimum severity of logged records (single atomic store)
+  void set_severity(Severity severity) {
+    _min_severity.store(static_cast<uint8_t>(severity),
+                        std::memory_order_relaxed);
+  }
+
+  Severity severity() const {
+    return static_cast<Severity>(
+      _min_severity.load(std::memory_order_relaxed));
+  }
+
+  // check if records of a severity would currently be logged
+  bool is_enabled(Severity severity) const {
+    return static_cast<uint8_t>(severity) >=
+           _min_severity.load(std::memory_order_relaxed);
+  }
+
+  template<typename T>
+  void trace(const T &t, LogFormat fmt) {
+    if constexpr (CPPLOG_LEVEL_TRACE >= CPPLOG_ACTIVE_LEVEL) {
+      if (!is_enabled(Severity::TRACE)) return;
+      _metrics.add(Counter::RECORDS_TRACE);
+      _log_value(Severity::TRACE, t, fmt | _default_trace_fmt);
     }
   }
 
-  // terminate the variadic argument recursion and print the rest of
-  // the text in the format string after the last format specifier
-  void _log_format_string_args(std::stringstream &fmt_stream,
-                               const std::vector<FormatStringObject> &fmt_objs,
-                               const char *fmt_str,
-                               int start_idx, int end_idx, int obj_idx) {
-    for (int i = start_idx; i < end_idx; ++i) fmt_stream << fmt_str[i];
+  template<typename T>
+  void trace(const T &t) {
+    trace(t, log_format());
+  }
+
+  /*
+   * print args accoring to format specified by fmt_str;
+   * the format string can parse decimal numbers, floating point numbers,
+   * strings, objects and characters. Formatting can be specified in curly
+   * brackets with Python/printf-like syntax:
+   *   {_>10.2f} -> left-padded w/ '_', 10 chars, 2 decimal place float
+   *   {0>8d< }   -> left-padded w/ '0, 8 chars, decimal, right-padded w/ ' '
+   */
+  template<typename ...T>
+  void trace(const char *fmt_str, T&&... args) {
+    trace(fmt_str, log_format(), std::forward<T>(args)...);
+  }
+
+  template<typename T, typename ...Tr>
+  void trace(const char *fmt_str, LogFormat fmt, T &&first, Tr&&... args) {
+    if constexpr (CPPLOG_LEVEL_TRACE >= CPPLOG_ACTIVE_LEVEL) {
+      if (!is_enabled(Severity::TRACE) ||
+          !_admit(Severity::TRACE, fmt_str, fmt | _default_trace_fmt,
+                  first, args...)) {
+        return;
+      }
+      _log_message(Severity::TRACE, fmt_str, fmt | _default_trace_fmt,
+                   std::forward<T>(first), std::forward<Tr>(args)...);
+    }
+  }
+
+  /*
+   * print args according to a format string that was parsed at compile
+   * time (see CPPLOG_FMT / cpplog::fmt); a mismatch between the format
+   * specifiers and the passed arguments is a compile error; if there is
+   * one more argument than format specifiers, the first argument is
+   * used as the LogFormat of the message
+   */
+  template<class Str, typename ...T>
+  void trace(CompiledFormat<Str> fmt_str, T&&... args) {
+    if constexpr (CPPLOG_LEVEL_TRACE >= CPPLOG_ACTIVE_LEVEL) {
+      if (!is_enabled(Severity::TRACE) ||
+          !_admit(Severity::TRACE, fmt_str,
+                  log_format() | _default_trace_fmt, args...)) {
+        return;
+      }
+      _log_compiled_format(Severity::TRACE, fmt_str, _default_trace_fmt,
+                           std::forward<T>(args)...);
+    }
+  }
+
+  template<typename T>
+  void debug(const T &t, LogFormat fmt) {
+    if constexpr (CPPLOG_LEVEL_DEBUG >= CPPLOG_ACTIVE_LEVEL) {
+      if (!is_enabled(Severity::DEBUG)) return;
+      _metrics.add(Counter::RECORDS_DEBUG);
+      _log_value(Severity::DEBUG, t, fmt | _default_debug_fmt);
+    }
+  }
+
+  template<typename T>
+  void debug(const T &t) {
+    debug(t, log_format());
+  }
+
+  /*
+   * print args accoring to format specified by fmt_str;
+   * the format string can parse decimal numbers, floating point numbers,
+   * strings, objects and characters. Formatting can be specified in curly
+   * brackets with Python/printf-like syntax:
+   *   {_>10.2f} -> left-padded w/ '_', 10 chars, 2 decimal place float
+   *   {0>8d< }   -> left-padded w/ '0, 8 chars, decimal, right-padded w/ ' '
+   */
+  template<typename ...T>
+  void debug(const char *fmt_str, T&&... args) {
+    debug(fmt_str, log_format(), std::forward<T>(args)...);
   }
 
   template<typename T, typename ...Tr>
-  void _log_format_string_args(std::stringstream &fmt_stream,
-                               const std::vector<FormatStringObject> &fmt_objs,
-                               const char *fmt_str, int start_idx, int end_idx,
-                               int obj_idx, T &&first, Tr &&...rest) {
-    _log_fmt_arg(fmt_stream, std::move(first), fmt_str,
-                 start_idx, end_idx, fmt_objs[obj_idx]);
-
-    // case where recursion anchor is called
-    if (obj_idx + 1 >= fmt_objs.size()) {
-      _log_format_string_args(fmt_stream, fmt_objs, fmt_str,
-                              fmt_objs[obj_idx].end_idx,
-                              std::strlen(fmt_str), obj_idx,
-                              std::forward<Tr>(rest)...);
-    } else {
-      _log_format_string_args(fmt_stream, fmt_objs, fmt_str,
-                              fmt_objs[obj_idx].end_idx,
-                              fmt_objs[obj_idx + 1].start_idx, obj_idx + 1,
-                              std::forward<Tr>(rest)...);
+  void debug(const char *fmt_str, LogFormat fmt, T &&first, Tr&&... args) {
+    if constexpr (CPPLOG_LEVEL_DEBUG >= CPPLOG_ACTIVE_LEVEL) {
+      if (!is_enabled(Severity::DEBUG) ||
+          !_admit(Severity::DEBUG, fmt_str, fmt | _default_debug_fmt,
+                  first, args...)) {
+        return;
+      }
+      _log_message(Severity::DEBUG, fmt_str, fmt | _default_debug_fmt,
+                   std::forward<T>(first), std::forward<Tr>(args)...);
     }
   }
 
- public:
-  Logger() :
-    _stream(std::cerr), _name("LOG") {
-    set_log_level(Level::STANDARD);
-    set_log_format(Level::STANDARD);
-    set_log_impl(nullptr);
-  }
-
-  Logger(const char *name, LogImpl *log_impl = nullptr) :
-    _stream(std::cerr), _name(name) {
-    set_log_level(Level::STANDARD);
-    set_log_format(Level::STANDARD);
-    set_log_impl(log_impl);
+  /*
+   * print args according to a format string that was parsed at compile
+   * time (see CPPLOG_FMT / cpplog::fmt); a mismatch between the format
+   * specifiers and the passed arguments is a compile error; if there is
+   * one more argument than format specifiers, the first argument is
+   * used as the LogFormat of the message
+   */
+  template<class Str, typename ...T>
+  void debug(CompiledFormat<Str> fmt_str, T&&... args) {
+    if constexpr (CPPLOG_LEVEL_DEBUG >= CPPLOG_ACTIVE_LEVEL) {
+      if (!is_enabled(Severity::DEBUG) ||
+          !_admit(Severity::DEBUG, fmt_str,
+                  log_format() | _default_debug_fmt, args...)) {
+        return;
+      }
+      _log_compiled_format(Severity::DEBUG, fmt_str, _default_debug_fmt,
+                           std::forward<T>(args)...);
+    }
   }
 
-  Logger(const char *name, Level lvl,
-         LogFormat fmt, LogImpl *log_impl = nullptr) :
-    _log_lvl(lvl), _stream(std::cerr), _name(name), _log_format(fmt) {
-    set_log_level(lvl);
-    set_log_format(fmt);
-    set_log_impl(log_impl);
+  template<typename T>
+  void info(const T &t, LogFormat fmt) {
+    if constexpr (CPPLOG_LEVEL_INFO >= CPPLOG_ACTIVE_LEVEL) {
+      if (!is_enabled(Severity::INFO)) return;
+      _metrics.add(Counter::RECORDS_INFO);
+      _log_value(Severity::INFO, t, fmt | _default_info_fmt);
+    }
   }
 
-  ~Logger() {
-    delete _log_impl;
+  template<typename T>
+  void info(const T &t) {
+    info(t, log_format());
   }
 
-  // set log level
-  void set_log_level(Level lvl) {
-    _log_lvl = lvl;
-    _log_format = _log_lvl;
+  /*
+   * print args accoring to format specified by fmt_str;
+   * the format string can parse decimal numbers, floating point numbers,
+   * strings, objects and characters. Formatting can be specified in curly
+   * brackets with Python/printf-like syntax:
+   *   {_>10.2f} -> left-padded w/ '_', 10 chars, 2 decimal place float
+   *   {0>8d< }   -> left-padded w/ '0, 8 chars, decimal, right-padded w/ ' '
+   */
+  template<typename ...T>
+  void info(const char *fmt_str, T&&... args) {
+    info(fmt_str, log_format(), std::forward<T>(args)...);
   }
 
-  // specify log format (see LogFmt enum for available options)
-  void set_log_format(LogFormat fmt) {
-    _log_format = fmt;
+  template<typename T, typename ...Tr>
+  void info(const char *fmt_str, LogFormat fmt, T &&first, Tr&&... args) {
+    if constexpr (CPPLOG_LEVEL_INFO >= CPPLOG_ACTIVE_LEVEL) {
+      if (!is_enabled(Severity::INFO) ||
+          !_admit(Severity::INFO, fmt_str, fmt | _default_info_fmt,
+                  first, args...)) {
+        return;
+      }
+      _log_message(Severity::INFO, fmt_str, fmt | _default_info_fmt,
+                   std::forward<T>(first), std::forward<Tr>(args)...);
+    }
   }
 
   /*
-   * set the log implementation object;
-   * the Logger class will take ownership of the LogImpl object,
-   * so be aware that it will be deleted whenever the Logger class
-   * get deleted
+   * print args according to a format string that was parsed at compile
+   * time (see CPPLOG_FMT / cpplog::fmt); a mismatch between the format
+   * specifiers and the passed arguments is a compile error; if there is
+   * one more argument than format specifiers, the first argument is
+   * used as the LogFormat of the message
    */
-  void set_log_impl(LogImpl *log_impl) {
-    // if log implementation already exists, delete it first
-    if (_log_impl) {
-      delete _log_impl;
-    }
-
-    // if a valid ptr was passed, simply take ownership;
-    // else, create a new log implementation object
-    if (log_impl) {
-      _log_impl = log_impl;
-    } else {
-      _log_impl = new LogImpl();
+  template<class Str, typename ...T>
+  void info(CompiledFormat<Str> fmt_str, T&&... args) {
+    if constexpr (CPPLOG_LEVEL_INFO >= CPPLOG_ACTIVE_LEVEL) {
+      if (!is_enabled(Severity::INFO) ||
+          !_admit(Severity::INFO, fmt_str,
+                  log_format() | _default_info_fmt, args...)) {
+        return;
+      }
+      _log_compiled_format(Severity::INFO, fmt_str, _default_info_fmt,
+                           std::forward<T>(args)...);
     }
-
-    _log_impl->set_name(_name);
   }
 
   template<typename T>
-  void error(const T &t, LogFormat fmt) {
-    std::lock_guard<std::mutex> lock(_mutex);
-    _log_impl->log(_stream, t, fmt | _default_err_fmt);
+  void warn(const T &t, LogFormat fmt) {
+    if constexpr (CPPLOG_LEVEL_WARN >= CPPLOG_ACTIVE_LEVEL) {
+      if (!is_enabled(Severity::WARN)) return;
+      _metrics.add(Counter::RECORDS_WARN);
+      _log_value(Severity::WARN, t, fmt | _default_warn_fmt);
+    }
   }
 
   template<typename T>
-  void error(const T &t) {
-    error(t, _log_format);
+  void warn(const T &t) {
+    warn(t, log_format());
   }
 
   /*
@@ -881,31 +9685,55 @@ class Logger {
    *   {0>8d< }   -> left-padded w/ '0, 8 chars, decimal, right-padded w/ ' '
    */
   template<typename ...T>
-  void error(const char *fmt_str, T&&... args) {
-    error(fmt_str, _log_format, std::forward<T>(args)...);
+  void warn(const char *fmt_str, T&&... args) {
+    warn(fmt_str, log_format(), std::forward<T>(args)...);
   }
 
   template<typename T, typename ...Tr>
-  void error(const char *fmt_str, LogFormat fmt, T &&first, Tr&&... args) {
-    std::vector<FormatStringObject> objs = _parse_format_string(fmt_str);
-    std::stringstream fmt_stream;
-    _log_format_string_args(fmt_stream, objs, fmt_str, 0,
-                            objs.front().start_idx, 0, std::move(first),
-                            std::forward<Tr>(args)...);
-    std::lock_guard<std::mutex> lock(_mutex);
-    _log_impl->parse_fmt_opts(_stream, fmt_stream.rdbuf(),
-                              fmt | _default_err_fmt);
+  void warn(const char *fmt_str, LogFormat fmt, T &&first, Tr&&... args) {
+    if constexpr (CPPLOG_LEVEL_WARN >= CPPLOG_ACTIVE_LEVEL) {
+      if (!is_enabled(Severity::WARN) ||
+          !_admit(Severity::WARN, fmt_str, fmt | _default_warn_fmt,
+                  first, args...)) {
+        return;
+      }
+      _log_message(Severity::WARN, fmt_str, fmt | _default_warn_fmt,
+                   std::forward<T>(first), std::forward<Tr>(args)...);
+    }
+  }
+
+  /*
+   * print args according to a format string that was parsed at compile
+   * time (see CPPLOG_FMT / cpplog::fmt); a mismatch between the format
+   * specifiers and the passed arguments is a compile error; if there is
+   * one more argument than format specifiers, the first argument is
+   * used as the LogFormat of the message
+   */
+  template<class Str, typename ...T>
+  void warn(CompiledFormat<Str> fmt_str, T&&... args) {
+    if constexpr (CPPLOG_LEVEL_WARN >= CPPLOG_ACTIVE_LEVEL) {
+      if (!is_enabled(Severity::WARN) ||
+          !_admit(Severity::WARN, fmt_str,
+                  log_format() | _default_warn_fmt, args...)) {
+        return;
+      }
+      _log_compiled_format(Severity::WARN, fmt_str, _default_warn_fmt,
+                           std::forward<T>(args)...);
+    }
   }
 
   template<typename T>
-  void warn(const T &t, LogFormat fmt) {
-    warn(t, _log_format);
+  void error(const T &t, LogFormat fmt) {
+    if constexpr (CPPLOG_LEVEL_ERROR >= CPPLOG_ACTIVE_LEVEL) {
+      if (!is_enabled(Severity::ERROR)) return;
+      _metrics.add(Counter::RECORDS_ERROR);
+      _log_value(Severity::ERROR, t, fmt | _default_err_fmt);
+    }
   }
 
   template<typename T>
-  void warn(const T &t) {
-    std::lock_guard<std::mutex> lock(_mutex);
-    _log_impl->log(_stream, t, _log_format | _default_warn_fmt);
+  void error(const T &t) {
+    error(t, log_format());
   }
 
   /*
@@ -917,31 +9745,295 @@ class Logger {
    *   {0>8d< }   -> left-padded w/ '0, 8 chars, decimal, right-padded w/ ' '
    */
   template<typename ...T>
-  void warn(const char *fmt_str, T&&... args) {
-    warn(fmt_str, _log_format, std::forward<T>(args)...);
+  void error(const char *fmt_str, T&&... args) {
+    error(fmt_str, log_format(), std::forward<T>(args)...);
   }
 
   template<typename T, typename ...Tr>
-  void warn(const char *fmt_str, LogFormat fmt, T &&first, Tr&&... args) {
-    std::vector<FormatStringObject> objs = _parse_format_string(fmt_str);
-    std::stringstream fmt_stream;
-    _log_format_string_args(fmt_stream, objs, fmt_str, 0,
-                            objs.front().start_idx, 0, std::move(first),
-                            std::forward<Tr>(args)...);
-    std::lock_guard<std::mutex> lock(_mutex);
-    _log_impl->parse_fmt_opts(_stream, fmt_stream.rdbuf(),
-                              fmt | _default_warn_fmt);
+  void error(const char *fmt_str, LogFormat fmt, T &&first, Tr&&... args) {
+    if constexpr (CPPLOG_LEVEL_ERROR >= CPPLOG_ACTIVE_LEVEL) {
+      if (!is_enabled(Severity::ERROR) ||
+          !_admit(Severity::ERROR, fmt_str, fmt | _default_err_fmt,
+                  first, args...)) {
+        return;
+      }
+      _log_message(Severity::ERROR, fmt_str, fmt | _default_err_fmt,
+                   std::forward<T>(first), std::forward<Tr>(args)...);
+    }
+  }
+
+  /*
+   * print args according to a format string that was parsed at compile
+   * time (see CPPLOG_FMT / cpplog::fmt); a mismatch between the format
+   * specifiers and the passed arguments is a compile error; if there is
+   * one more argument than format specifiers, the first argument is
+   * used as the LogFormat of the message
+   */
+  template<class Str, typename ...T>
+  void error(CompiledFormat<Str> fmt_str, T&&... args) {
+    if constexpr (CPPLOG_LEVEL_ERROR >= CPPLOG_ACTIVE_LEVEL) {
+      if (!is_enabled(Severity::ERROR) ||
+          !_admit(Severity::ERROR, fmt_str,
+                  log_format() | _default_err_fmt, args...)) {
+        return;
+      }
+      _log_compiled_format(Severity::ERROR, fmt_str, _default_err_fmt,
+                           std::forward<T>(args)...);
+    }
+  }
+
+  /*
+   * the same as trace/debug/info/warn/error, but the calling thread never
+   * waits: no lock is taken and queueing makes no system call, the record
+   * is dropped unless the Logger is async and the queue has a free slot
+   * right now (a sleeping writer thread isn't woken up, it picks the
+   * record up within 10 ms; a writer task is posted to its Executor);
+   * returns what happened to the record
+   */
+  template<typename ...T>
+  LogStatus try_trace(T&&... args) {
+    return _try_log(Severity::TRACE, [&]() {
+      trace(std::forward<T>(args)...);
+    });
+  }
+
+  template<typename ...T>
+  LogStatus try_debug(T&&... args) {
+    return _try_log(Severity::DEBUG, [&]() {
+      debug(std::forward<T>(args)...);
+    });
+  }
+
+  template<typename ...T>
+  LogStatus try_info(T&&... args) {
+    return _try_log(Severity::INFO, [&]() {
+      info(std::forward<T>(args)...);
+    });
+  }
+
+  template<typename ...T>
+  LogStatus try_warn(T&&... args) {
+    return _try_log(Severity::WARN, [&]() {
+      warn(std::forward<T>(args)...);
+    });
+  }
+
+  template<typename ...T>
+  LogStatus try_error(T&&... args) {
+    return _try_log(Severity::ERROR, [&]() {
+      error(std::forward<T>(args)...);
+    });
+  }
+
+#ifdef CPPLOG_COROUTINES
+ private:
+  // resume a coroutine that waited for a writer (see set_executor)
+  void _resume(std::coroutine_handle<> handle) {
+    Executor *executor = _executor ? _executor.get() : _backend->executor();
+    if (!executor) return handle.resume();
+    executor->post([](void *address) {
+      std::coroutine_handle<>::from_address(address).resume();
+    }, handle.address());
+  }
+
+  /*
+   * let log copy its record into spill instead of waiting for room in the
+   * queue of async (see ProducerState::spill); returns if it did
+   */
+  template<typename Fn>
+  bool _log_or_spill(AsyncBackend *async, AsyncRecord &spill, Fn &&log) {
+    ProducerState &producer = producer_state();
+    const AsyncBackend *spill_backend = producer.spill_backend;
+    AsyncRecord *previous_spill = producer.spill;
+    producer.spill_backend = async;
+    producer.spill = &spill;
+    producer.spilled = false;
+    log();
+    bool spilled = producer.spilled;
+    producer.spill_backend = spill_backend;
+    producer.spill = previous_spill;
+    producer.spilled = false;
+    return spilled;
   }
 
+  template<Severity S, typename ...T>
+  void _log_at(T&&... args) {
+    if constexpr (S == Severity::TRACE) {
+      trace(std::forward<T>(args)...);
+    } else if constexpr (S == Severity::DEBUG) {
+      debug(std::forward<T>(args)...);
+    } else if constexpr (S == Severity::INFO) {
+      info(std::forward<T>(args)...);
+    } else if constexpr (S == Severity::WARN) {
+      warn(std::forward<T>(args)...);
+    } else {
+      error(std::forward<T>(args)...);
+    }
+  }
+
+ public:
+  /*
+   * what info_async & co return: logs the record right away, but if it
+   * doesn't fit into its queue, the awaiting coroutine is suspended until
+   * the writer has written it
+   */
+  template<Severity S, typename ...T>
+  class [[nodiscard]] LogAwaiter {
+   private:
+    Logger &_logger;
+    std::tuple<T&&...> _args;
+    std::coroutine_handle<> _handle;
+    AsyncBackend *_async = nullptr;
+    WriterWaiter _waiter;
+    AsyncRecord _spill;
+
+   public:
+    explicit LogAwaiter(Logger &logger, T&&... args) :
+      _logger(logger), _args(std::forward<T>(args)...) {}
+
+    bool await_ready() {
+      _async = _logger._backend->async();
+      return !_logger._log_or_spill(_async, _spill, [this]() {
+        std::apply([this](auto &&...args) {
+          _logger.template _log_at<S>(std::forward<decltype(args)>(args)...);
+        }, std::move(_args));
+      });
+    }
+
+    // (doesn't suspend if the writer has stopped, the record is dropped)
+    bool await_suspend(std::coroutine_handle<> handle) {
+      _handle = handle;
+      _waiter.notify = [](void *context) {
+        LogAwaiter *awaiter = static_cast<LogAwaiter *>(context);
+        awaiter->_logger._resume(awaiter->_handle);
+      };
+      _waiter.context = this;
+      return _async->write_spilled(_waiter, _spill);
+    }
+
+    void await_resume() {}
+  };
+
+  // what flush_async returns
+  class [[nodiscard]] FlushAwaiter {
+   private:
+    Logger &_logger;
+    std::coroutine_handle<> _handle;
+
+    // one per async queue, and the number of them not notified yet
+    // (+ 1 while await_suspend registers them)
+    std::vector<WriterWaiter> _waiters;
+    std::atomic<size_t> _pending{0};
+
+    static void _notify(void *context) {
+      FlushAwaiter *awaiter = static_cast<FlushAwaiter *>(context);
+      if (awaiter->_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        awaiter->_logger._resume(awaiter->_handle);
+      }
+    }
+
+   public:
+    explicit FlushAwaiter(Logger &logger) : _logger(logger) {}
+
+    // (flushes right away what no writer takes care of)
+    bool await_ready() {
+      if (_logger._collapse_repeats) _logger._log_repeats();
+      if (_logger._span_stats) _logger._log_span_stats();
+      _logger._backend->flush_unqueued();
+      return _logger._backend->async_count() == 0;
+    }
+
+    // (doesn't suspend if all writers were done meanwhile)
+    bool await_suspend(std::coroutine_handle<> handle) {
+      _handle = handle;
+      _waiters.resize(_logger._backend->async_count());
+      _pending.store(_waiters.size() + 1, std::memory_order_relaxed);
+      size_t i = 0;
+      _logger._backend->for_each_async([this, &i](AsyncBackend &async) {
+        WriterWaiter &waiter = _waiters[i++];
+        waiter.notify = &FlushAwaiter::_notify;
+        waiter.context = this;
+        if (!async.flush_async(waiter)) {
+          _pending.fetch_sub(1, std::memory_order_relaxed);
+        }
+      });
+      // (the coroutine may be resumed right after this, so nothing of
+      // the awaiter is touched afterwards)
+      return _pending.fetch_sub(1, std::memory_order_acq_rel) != 1;
+    }
+
+    void await_resume() {}
+  };
+
+  /*
+   * co_await logger.info_async(...) logs the record of info(...) (with
+   * the same formatting), but if the async queue of the record is full
+   * (OverflowPolicy::BLOCK), the coroutine is suspended until the writer
+   * has written it instead of blocking its thread (and resumed as
+   * set_executor says); other modes and the queues of add_writer handle
+   * the record as info(...) does; the arguments are only referenced, so
+   * the result has to be awaited right away
+   */
+  template<typename ...T>
+  LogAwaiter<Severity::TRACE, T...> trace_async(T&&... args) {
+    return LogAwaiter<Severity::TRACE, T...>(*this, std::forward<T>(args)...);
+  }
+
+  template<typename ...T>
+  LogAwaiter<Severity::DEBUG, T...> debug_async(T&&... args) {
+    return LogAwaiter<Severity::DEBUG, T...>(*this, std::forward<T>(args)...);
+  }
+
+  template<typename ...T>
+  LogAwaiter<Severity::INFO, T...> info_async(T&&... args) {
+    return LogAwaiter<Severity::INFO, T...>(*this, std::forward<T>(args)...);
+  }
+
+  template<typename ...T>
+  LogAwaiter<Severity::WARN, T...> warn_async(T&&... args) {
+    return LogAwaiter<Severity::WARN, T...>(*this, std::forward<T>(args)...);
+  }
+
+  template<typename ...T>
+  LogAwaiter<Severity::ERROR, T...> error_async(T&&... args) {
+    return LogAwaiter<Severity::ERROR, T...>(*this, std::forward<T>(args)...);
+  }
+
+  /*
+   * co_await logger.flush_async() suspends the coroutine until all
+   * records logged so far have been written to the sinks, like flush()
+   * blocks until then (the sync and thread-buffered parts are flushed
+   * right away, under the lock as usual)
+   */
+  FlushAwaiter flush_async() {
+    return FlushAwaiter(*this);
+  }
+
+  /*
+   * where coroutines that waited for this Logger (see info_async and
+   * flush_async) are resumed: by default on the executor the writer runs
+   * on (see WriterOptions::executor), or else right on the writer thread
+   * (which then must not block, e.g. by calling flush());
+   * this should be called before any other thread uses the Logger
+   */
+  void set_executor(std::shared_ptr<Executor> executor) {
+    _executor = std::move(executor);
+  }
+#endif
+
   template<typename T>
-  void info(const T &t, LogFormat fmt) {
-    std::lock_guard<std::mutex> lock(_mutex);
-    _log_impl->log(_stream, t, fmt | _default_info_fmt);
+  void fatal(const T &t, LogFormat fmt) {
+    if constexpr (CPPLOG_LEVEL_FATAL >= CPPLOG_ACTIVE_LEVEL) {
+      if (!is_enabled(Severity::FATAL)) return;
+      _metrics.add(Counter::RECORDS_FATAL);
+      _log_value(Severity::FATAL, t, fmt | _default_fatal_fmt);
+      flush();
+    }
   }
 
   template<typename T>
-  void info(const T &t) {
-    info(t, _log_format);
+  void fatal(const T &t) {
+    fatal(t, log_format());
   }
 
   /*
@@ -953,23 +10045,177 @@ class Logger {
    *   {0>8d< }   -> left-padded w/ '0, 8 chars, decimal, right-padded w/ ' '
    */
   template<typename ...T>
-  void info(const char *fmt_str, T&&... args) {
-    info(fmt_str, _log_format, std::forward<T>(args)...);
+  void fatal(const char *fmt_str, T&&... args) {
+    fatal(fmt_str, log_format(), std::forward<T>(args)...);
   }
 
   template<typename T, typename ...Tr>
-  void info(const char *fmt_str, LogFormat fmt, T &&first, Tr&&... args) {
-    std::vector<FormatStringObject> objs = _parse_format_string(fmt_str);
-    std::stringstream fmt_stream;
-    _log_format_string_args(fmt_stream, objs, fmt_str, 0,
-                            objs.front().start_idx, 0, std::move(first),
-                            std::forward<Tr>(args)...);
+  void fatal(const char *fmt_str, LogFormat fmt, T &&first, Tr&&... args) {
+    if constexpr (CPPLOG_LEVEL_FATAL >= CPPLOG_ACTIVE_LEVEL) {
+      if (!is_enabled(Severity::FATAL)) return;
+      _metrics.add(Counter::RECORDS_FATAL);
+      _log_message(Severity::FATAL, fmt_str, fmt | _default_fatal_fmt,
+                   std::forward<T>(first), std::forward<Tr>(args)...);
+      flush();
+    }
+  }
+
+  /*
+   * print args according to a format string that was parsed at compile
+   * time (see CPPLOG_FMT / cpplog::fmt); a mismatch between the format
+   * specifiers and the passed arguments is a compile error; if there is
+   * one more argument than format specifiers, the first argument is
+   * used as the LogFormat of the message
+   */
+  template<class Str, typename ...T>
+  void fatal(CompiledFormat<Str> fmt_str, T&&... args) {
+    if constexpr (CPPLOG_LEVEL_FATAL >= CPPLOG_ACTIVE_LEVEL) {
+      if (!is_enabled(Severity::FATAL)) return;
+      _metrics.add(Counter::RECORDS_FATAL);
+      _log_compiled_format(Severity::FATAL, fmt_str, _default_fatal_fmt,
+                           std::forward<T>(args)...);
+      flush();
+    }
+  }
+};
+
+// ### logger registry ###
+
+/*
+ * named Loggers that all share one backend, so the records of all
+ * subsystems go through the same lock/queue into the same sinks (use
+ * cpplog::get to look one up); every Logger keeps its own name,
+ * severity and log format; Loggers are created on their first lookup
+ * and live as long as the registry
+ */
+class Registry {
+ private:
+  std::mutex _mutex;
+  std::shared_ptr<LoggerBackend> _backend;
+  std::unordered_map<std::string, std::unique_ptr<Logger<>>> _loggers;
+
+  // applied to all Loggers (incl. the ones created later on)
+  LogFormat _log_format = Level::STANDARD;
+  Severity _severity = Severity::TRACE;
+
+ public:
+  Registry() : _backend(std::make_shared<LoggerBackend>()) {
+    // the string table has to outlive the writer thread of the backend
+    BinaryStringTable::global();
+  }
+
+  Registry(const Registry &) = delete;
+  Registry &operator=(const Registry &) = delete;
+
+  // the registry used by cpplog::get
+  static Registry &global() {
+    static Registry registry;
+    return registry;
+  }
+
+  // sinks, lock and queue that all Loggers of the registry share
+  const std::shared_ptr<LoggerBackend> &backend() const {
+    return _backend;
+  }
+
+  // Logger with the given name (created on the first call)
+  Logger<> &get(std::string_view name) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    std::string key(name);
+    auto it = _loggers.find(key);
+    if (it == _loggers.end()) {
+      std::unique_ptr<Logger<>> logger(new Logger<>(key.c_str(), _backend));
+      logger->set_log_format(_log_format);
+      logger->set_severity(_severity);
+      it = _loggers.emplace(std::move(key), std::move(logger)).first;
+    }
+    return *it->second;
+  }
+
+  // set the log format of all Loggers
+  void set_log_format(LogFormat fmt) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _log_format = fmt;
+    for (auto &logger : _loggers) logger.second->set_log_format(fmt);
+  }
+
+  // set the minimum severity of all Loggers
+  void set_severity(Severity severity) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _severity = severity;
+    for (auto &logger : _loggers) logger.second->set_severity(severity);
+  }
+
+  // call fn(Logger<> &) for every Logger of the registry
+  template<typename Fn>
+  void for_each(Fn &&fn) {
     std::lock_guard<std::mutex> lock(_mutex);
-    _log_impl->parse_fmt_opts(_stream, fmt_stream.rdbuf(),
-                              fmt | _default_info_fmt);
+    for (auto &logger : _loggers) fn(*logger.second);
+  }
+
+  // counters of all Loggers of the registry added up
+  MetricsSnapshot metrics() {
+    MetricsSnapshot total;
+    for_each([&total](Logger<> &logger) { total += logger.metrics(); });
+    return total;
+  }
+
+  // write the metrics of all Loggers and the backend for Prometheus
+  void write_metrics(std::ostream &out) {
+    std::vector<MetricsSource> loggers;
+    for_each([&loggers](Logger<> &logger) {
+      loggers.push_back(MetricsSource{
+        prometheus_label("logger", logger.name()), logger.metrics()});
+    });
+    std::sort(loggers.begin(), loggers.end(),
+              [](const MetricsSource &a, const MetricsSource &b) {
+      return a.labels < b.labels;
+    });
+    write_prometheus(out, loggers, {MetricsSource{"", _backend->metrics()}});
   }
 };
 
+/*
+ * copyable reference to a Logger of the registry (a single pointer,
+ * valid as long as the registry exists)
+ */
+class LogHandle {
+ private:
+  Logger<> *_logger;
+
+ public:
+  LogHandle() : _logger(nullptr) {}
+
+  explicit LogHandle(Logger<> &logger) : _logger(&logger) {}
+
+  Logger<> *operator->() const {
+    return _logger;
+  }
+
+  Logger<> &operator*() const {
+    return *_logger;
+  }
+
+  Logger<> *get() const {
+    return _logger;
+  }
+
+  explicit operator bool() const {
+    return _logger != nullptr;
+  }
+};
+
+/*
+ * handle of the Logger with the given name in the global registry;
+ * the lookup takes a lock, so keep the handle (or use CPPLOG_GET)
+ */
+inline LogHandle get(std::string_view name) {
+  return LogHandle(Registry::global().get(name));
+}
+
+// ##########################################################
+
 // create a new Logger object and transfer ownership
 // of the Logger to the binding variable
 template<class LogImpl = LoggerImpl>
@@ -990,4 +10236,85 @@ inline Logger<LogImpl>* create_log(const char *name, Level lvl,
 
 }  // namespace cpplog
 
+/*
+ * handle of a Logger of the global registry that is only looked up on
+ * the first call of each call site (name has to be a string literal), e.g.
+ *   CPPLOG_GET("db")->info("connected to {s}", host);
+ */
+#define CPPLOG_GET(name)                                           \
+  ([]() -> ::cpplog::LogHandle {                                   \
+    static const ::cpplog::LogHandle _cpplog_handle =              \
+      ::cpplog::get(name);                                         \
+    return _cpplog_handle;                                         \
+  }())
+
+#define CPPLOG_CONCAT_(a, b) a##b
+#define CPPLOG_CONCAT(a, b) CPPLOG_CONCAT_(a, b)
+
+/*
+ * span that lasts until the end of the enclosing scope; logger has to be
+ * a pointer to a Logger (or a LogHandle), e.g.
+ *   CPPLOG_SPAN(logger, "db.query");
+ */
+#define CPPLOG_SPAN(logger, ...)                                   \
+  auto CPPLOG_CONCAT(_cpplog_span_, __LINE__) =                    \
+    (&*(logger))->span(__VA_ARGS__)
+
+/*
+ * logging macros that check the severity before anything else happens:
+ * calls below CPPLOG_ACTIVE_LEVEL expand to nothing, all other calls only
+ * evaluate their arguments if the Logger's runtime severity allows it;
+ * logger has to be a pointer to a Logger, e.g.
+ *   CPPLOG_INFO(logger, "request {d} done", compute_id());
+ */
+#define CPPLOG_LOG_AT_(logger, method, severity, ...)              \
+  do {                                                               \
+    auto *_cpplog_logger = &*(logger);                               \
+    if (_cpplog_logger->is_enabled(severity)) {                      \
+      _cpplog_logger->method(__VA_ARGS__);                           \
+    }                                                                \
+  } while (0)
+
+#if CPPLOG_ACTIVE_LEVEL <= CPPLOG_LEVEL_TRACE
+#define CPPLOG_TRACE(logger, ...) \
+  CPPLOG_LOG_AT_(logger, trace, ::cpplog::Severity::TRACE, __VA_ARGS__)
+#else
+#define CPPLOG_TRACE(logger, ...) ((void)0)
+#endif
+
+#if CPPLOG_ACTIVE_LEVEL <= CPPLOG_LEVEL_DEBUG
+#define CPPLOG_DEBUG(logger, ...) \
+  CPPLOG_LOG_AT_(logger, debug, ::cpplog::Severity::DEBUG, __VA_ARGS__)
+#else
+#define CPPLOG_DEBUG(logger, ...) ((void)0)
+#endif
+
+#if CPPLOG_ACTIVE_LEVEL <= CPPLOG_LEVEL_INFO
+#define CPPLOG_INFO(logger, ...) \
+  CPPLOG_LOG_AT_(logger, info, ::cpplog::Severity::INFO, __VA_ARGS__)
+#else
+#define CPPLOG_INFO(logger, ...) ((void)0)
+#endif
+
+#if CPPLOG_ACTIVE_LEVEL <= CPPLOG_LEVEL_WARN
+#define CPPLOG_WARN(logger, ...) \
+  CPPLOG_LOG_AT_(logger, warn, ::cpplog::Severity::WARN, __VA_ARGS__)
+#else
+#define CPPLOG_WARN(logger, ...) ((void)0)
+#endif
+
+#if CPPLOG_ACTIVE_LEVEL <= CPPLOG_LEVEL_ERROR
+#define CPPLOG_ERROR(logger, ...) \
+  CPPLOG_LOG_AT_(logger, error, ::cpplog::Severity::ERROR, __VA_ARGS__)
+#else
+#define CPPLOG_ERROR(logger, ...) ((void)0)
+#endif
+
+#if CPPLOG_ACTIVE_LEVEL <= CPPLOG_LEVEL_FATAL
+#define CPPLOG_FATAL(logger, ...) \
+  CPPLOG_LOG_AT_(logger, fatal, ::cpplog::Severity::FATAL, __VA_ARGS__)
+#else
+#define CPPLOG_FATAL(logger, ...) ((void)0)
+#endif
+
 #endif  // CPPLOG_H_
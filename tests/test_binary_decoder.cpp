@@ -0,0 +1,70 @@
+/*
+ * BinaryDecoder has to reject corrupted binary logs instead of ending the
+ * process: a format string with an unknown specifier makes decode return
+ * false (the ctest cpplog-binary-decoder runs this)
+ */
+
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "cpplog.h"
+
+// binary output of a Logger that logs a single record
+static std::string binary_log() {
+  std::ostringstream stream;
+  std::unique_ptr<cpplog::Logger<>> logger(cpplog::create_log("test"));
+  logger->set_sink(std::make_shared<cpplog::OStreamSink>(stream));
+  logger->set_encoding(cpplog::Encoding::BINARY);
+  logger->error("err {d}", 42);
+  logger->flush();
+  logger.reset();
+  return stream.str();
+}
+
+// decode all records of data; returns false at the first malformed one
+static bool decode_all(const std::string &data, std::string &text) {
+  cpplog::BinaryDecoder decoder;
+  decoder.set_color(false);
+  std::istringstream in(data);
+  std::ostringstream out;
+  std::string record;
+  while (cpplog::BinaryDecoder::read_record(in, record)) {
+    if (!decoder.decode(record.data(), record.size(), out)) return false;
+  }
+  text = out.str();
+  return true;
+}
+
+int main() {
+  int failures = 0;
+  std::string data = binary_log();
+  std::string text;
+
+  if (!decode_all(data, text) || text.find("err 42") == std::string::npos) {
+    std::cerr << "FAILED: intact log doesn't decode to \"err 42\": "
+              << text << "\n";
+    ++failures;
+  }
+
+  size_t pos = data.find("err {d}");
+  if (pos == std::string::npos) {
+    std::cerr << "FAILED: format string not found in the binary log\n";
+    return 1;
+  }
+  data[pos + 5] = 'z';
+  if (decode_all(data, text)) {
+    std::cerr << "FAILED: unknown specifier '{z}' was decoded: " << text;
+    ++failures;
+  }
+
+  data[pos + 5] = 'd';
+  data[pos + 6] = ' ';
+  if (decode_all(data, text)) {
+    std::cerr << "FAILED: unclosed specifier '{d ' was decoded: " << text;
+    ++failures;
+  }
+
+  return failures ? 1 : 0;
+}
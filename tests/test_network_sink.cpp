@@ -0,0 +1,95 @@
+/*
+ * a NetworkSink tags every syslog message with the severity of its own
+ * record, also when the records reach it in batches (thread-buffered
+ * Loggers commit several records at once; the ctest cpplog-network-sink
+ * runs this)
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cpplog.h"
+
+// UDP socket on a free port of 127.0.0.1 (-1 on failure)
+static int bind_listener(uint16_t &port) {
+  int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) return -1;
+
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      ::getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) != 0) {
+    ::close(fd);
+    return -1;
+  }
+  port = ntohs(addr.sin_port);
+  return fd;
+}
+
+// receive up to n datagrams (waits for 2s at most for each of them)
+static std::vector<std::string> receive(int fd, size_t n) {
+  std::vector<std::string> messages;
+  char buf[4096];
+  while (messages.size() < n) {
+    pollfd pfd = {fd, POLLIN, 0};
+    if (::poll(&pfd, 1, 2000) <= 0) break;
+    ssize_t size = ::recv(fd, buf, sizeof(buf), 0);
+    if (size < 0) break;
+    messages.emplace_back(buf, static_cast<size_t>(size));
+  }
+  return messages;
+}
+
+int main() {
+  uint16_t port = 0;
+  int fd = bind_listener(port);
+  if (fd < 0) {
+    std::cerr << "FAILED: couldn't bind a UDP socket\n";
+    return 1;
+  }
+
+  cpplog::NetworkSinkOptions options;
+  options.port = port;
+  options.app_name = "test";
+
+  std::unique_ptr<cpplog::Logger<>> logger(cpplog::create_log("test"));
+  logger->set_sink(std::make_shared<cpplog::NetworkSink>(options));
+  logger->set_thread_buffered();
+  logger->info("first info");
+  logger->info("second info");
+  logger->error("an error");
+  logger->flush();
+
+  // (facility user = 1: info = <14>, error = <11>)
+  const char *expected[][2] = {
+    {"<14>", "first info"}, {"<14>", "second info"}, {"<11>", "an error"}
+  };
+  std::vector<std::string> messages = receive(fd, 3);
+  ::close(fd);
+
+  int failures = 0;
+  if (messages.size() != 3) {
+    std::cerr << "FAILED: received " << messages.size()
+              << " messages instead of 3\n";
+    ++failures;
+  }
+  for (size_t i = 0; i < messages.size() && i < 3; ++i) {
+    if (messages[i].compare(0, 4, expected[i][0]) != 0 ||
+        messages[i].find(expected[i][1]) == std::string::npos) {
+      std::cerr << "FAILED: expected " << expected[i][0] << " ... "
+                << expected[i][1] << ", got " << messages[i] << "\n";
+      ++failures;
+    }
+  }
+  return failures ? 1 : 0;
+}
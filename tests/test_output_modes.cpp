@@ -0,0 +1,155 @@
+/*
+ * every output mode has to write the same text: the same calls are logged
+ * synchronously, with deferred formatting (the writer thread formats the
+ * captured arguments through BinaryDecoder) and in binary encoding (decoded
+ * afterwards like cpplog-decode does), and the three outputs are compared
+ * (the ctest cpplog-output-modes runs this); the sync output also has to
+ * contain a few records that were lost before
+ */
+
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "cpplog.h"
+
+enum class Mode { SYNC, DEFERRED, BINARY };
+
+static const char *mode_name(Mode mode) {
+  switch (mode) {
+    case Mode::SYNC:     return "sync";
+    case Mode::DEFERRED: return "deferred";
+    case Mode::BINARY:   return "binary";
+  }
+  return "";
+}
+
+// the same calls in every mode
+static void log_records(cpplog::Logger<> &logger) {
+  std::string text = "some text";
+  std::vector<int> values = {1, 2, 3};
+
+  logger.info("int {d} negative {d} padded {0>8d< }", 42, -7, 123);
+  logger.info("unsigned {d} bool {b} char {c}", 42u, true, 'x');
+  logger.info("signed char {c} unsigned char {c}",
+              static_cast<signed char>('y'), static_cast<unsigned char>('z'));
+  logger.info(static_cast<unsigned char>('v'));
+  logger.info("float {f} {.2f} {.0f} {_>10.3f}", 3.14159, 2.5, 3.14159,
+              -1.0);
+  logger.info("string {s} {4s} {_>12s}", text, "literal", text);
+  logger.info("object {o}", values);
+  logger.warn(CPPLOG_FMT("compiled {d} {s}"), 1, text);
+  logger.error("no arguments");
+  logger.info(12345);
+  logger.info(text);
+
+  // a reused buffer holds a different runtime format string every time
+  char buf[32];
+  const char *fmt_str = buf;
+  std::snprintf(buf, sizeof(buf), "first {d}");
+  logger.info(fmt_str, 1);
+  std::snprintf(buf, sizeof(buf), "second {d}");
+  logger.info(fmt_str, 2);
+
+  // only the second record is a repeat of the one before
+  std::snprintf(buf, sizeof(buf), "disk {s} full");
+  logger.info(fmt_str, "sda");
+  std::snprintf(buf, sizeof(buf), "disk {s} ok");
+  logger.info(fmt_str, "sda");
+  logger.info(fmt_str, "sda");
+  logger.info("done");
+}
+
+// records the sync output has to contain
+static const char *EXPECTED_RECORDS[] = {
+  "[test] second 2",
+  "[test] disk sda full",
+  "[test] disk sda ok",
+  "[test] [cpplog] last message repeated 1 time(s)",
+};
+
+/*
+ * drop the timestamp of every record ("[test, 12:34:56] msg" becomes
+ * "[test] msg", colors stay), the modes may log in different seconds
+ */
+static std::string strip_timestamps(const std::string &output) {
+  std::istringstream in(output);
+  std::string stripped;
+  std::string line;
+  while (std::getline(in, line)) {
+    size_t start = line.find(", ");
+    size_t end = line.find("] ");
+    if (start != std::string::npos && end != std::string::npos &&
+        start < end) {
+      line.erase(start, end - start);
+    }
+    stripped += line + '\n';
+  }
+  return stripped;
+}
+
+// output of log_records in the given mode (as text w/o timestamps)
+static std::string log_output(Mode mode) {
+  std::ostringstream stream;
+  std::unique_ptr<cpplog::Logger<>> logger(cpplog::create_log("test"));
+  logger->set_log_format(cpplog::LogFmt::NEWLINE | cpplog::LogFmt::NAME);
+  logger->set_collapse_repeats(true);
+
+  if (mode == Mode::DEFERRED) {
+    logger->set_async();
+    logger->set_deferred_formatting(true);
+  } else if (mode == Mode::BINARY) {
+    logger->set_encoding(cpplog::Encoding::BINARY);
+  }
+
+  // (after the mode, so the writer thread has to pick up the colors)
+  auto sink = std::make_shared<cpplog::OStreamSink>(stream);
+  sink->set_color_mode(cpplog::ColorMode::ALWAYS);
+  logger->set_sink(sink);
+
+  log_records(*logger);
+  logger->flush();
+  logger.reset();
+  if (mode != Mode::BINARY) return strip_timestamps(stream.str());
+
+  cpplog::BinaryDecoder decoder;
+  decoder.set_color(true);
+  std::istringstream in(stream.str());
+  std::ostringstream out;
+  std::string record;
+  while (cpplog::BinaryDecoder::read_record(in, record)) {
+    if (!decoder.decode(record.data(), record.size(), out)) {
+      return "malformed record";
+    }
+  }
+  return strip_timestamps(out.str());
+}
+
+int main() {
+  std::string expected = log_output(Mode::SYNC);
+  int failures = 0;
+
+  for (const char *record : EXPECTED_RECORDS) {
+    if (expected.find(record) == std::string::npos) {
+      std::cerr << "FAILED: sync output doesn't contain " << record
+                << "\n--- sync\n" << expected;
+      ++failures;
+    }
+  }
+
+  for (Mode mode : {Mode::DEFERRED, Mode::BINARY}) {
+    std::string output = log_output(mode);
+    if (output != expected) {
+      std::cerr << "FAILED: " << mode_name(mode)
+                << " output differs from sync output\n--- sync\n"
+                << expected << "--- " << mode_name(mode) << "\n"
+                << output;
+      ++failures;
+    }
+  }
+
+  return failures ? 1 : 0;
+}
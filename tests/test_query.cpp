@@ -0,0 +1,102 @@
+/*
+ * cpplog-query has to filter binary records one by one: a record is only
+ * printed if its own time, severity and Logger match, not just the block
+ * it is in (the ctest cpplog-query runs this with the path of the tool)
+ */
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "cpplog.h"
+
+// run cpplog-query with args on path and return its output
+static std::string query(const std::string &tool, const std::string &args,
+                         const std::string &path) {
+  std::string command =
+    "\"" + tool + "\" --no-color " + args + " \"" + path + "\"";
+  std::string out;
+  FILE *pipe = popen(command.c_str(), "r");
+  if (!pipe) return out;
+  char buf[256];
+  size_t n;
+  while ((n = std::fread(buf, 1, sizeof(buf), pipe)) > 0) out.append(buf, n);
+  pclose(pipe);
+  return out;
+}
+
+// the markers ("db-info", ...) of the records in out, in order
+static std::string records(const std::string &out) {
+  static const char *const markers[] = {
+    "db-info", "db-error", "net-warn", "net-error"
+  };
+  std::string found;
+  for (size_t pos = 0; (pos = out.find('<', pos)) != std::string::npos;) {
+    for (const char *marker : markers) {
+      if (out.compare(pos + 1, std::strlen(marker), marker) == 0) {
+        if (!found.empty()) found += ' ';
+        found += marker;
+      }
+    }
+    ++pos;
+  }
+  return found;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    std::cerr << "usage: " << argv[0] << " CPPLOG_QUERY\n";
+    return 1;
+  }
+
+  std::string path = (std::filesystem::temp_directory_path() /
+                      ("cpplog-test-query-" + std::to_string(getpid()) +
+                       ".bin")).string();
+  {
+    // (a single block, so only the records themselves tell them apart)
+    auto sink = std::make_shared<cpplog::FileSink>(path);
+    sink->set_index();
+    std::unique_ptr<cpplog::Logger<>> db(cpplog::create_log("db"));
+    std::unique_ptr<cpplog::Logger<>> net(cpplog::create_log("net"));
+    for (cpplog::Logger<> *logger : {db.get(), net.get()}) {
+      logger->set_sink(sink);
+      logger->set_encoding(cpplog::Encoding::BINARY);
+    }
+    db->info("<db-info>");
+    db->error("<db-error>");
+    net->warn("<net-warn>");
+    net->error("<net-error>");
+  }
+
+  struct {
+    const char *args;
+    const char *expected;
+  } cases[] = {
+    {"", "db-info db-error net-warn net-error"},
+    {"--level error", "db-error net-error"},
+    {"--level warn --logger net", "net-warn net-error"},
+    {"--logger db", "db-info db-error"},
+    {"--level fatal", ""},
+    {"--to @1", ""},
+  };
+
+  int failures = 0;
+  for (const auto &test : cases) {
+    std::string out = query(argv[1], test.args, path);
+    std::string found = records(out);
+    if (found != test.expected) {
+      std::cerr << "FAILED: cpplog-query " << test.args << ": expected \""
+                << test.expected << "\", got \"" << found << "\":\n" << out;
+      ++failures;
+    }
+  }
+
+  std::remove(path.c_str());
+  std::remove(cpplog::index_path(path).c_str());
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * shortened ranges (see Logger::set_max_elements) only leave out elements
+ * if there are more than they show, and never repeat an element (the
+ * ctest cpplog-ranges runs this)
+ */
+
+#include <forward_list>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "cpplog.h"
+
+static int failures = 0;
+
+// log value with the given limit and check that the record contains expected
+template<typename T>
+static void check(const T &value, size_t max_elements,
+                  const std::string &expected) {
+  std::ostringstream stream;
+  std::unique_ptr<cpplog::Logger<>> logger(cpplog::create_log("test"));
+  logger->set_sink(std::make_shared<cpplog::OStreamSink>(stream));
+  logger->set_max_elements(max_elements);
+  logger->info(value);
+  logger->flush();
+
+  if (stream.str().find("] " + expected + " \n") == std::string::npos) {
+    std::cerr << "FAILED: max_elements " << max_elements << ": expected "
+              << expected << ", got " << stream.str();
+    ++failures;
+  }
+}
+
+int main() {
+  check(std::vector<int>{7}, 1, "vector: [7]");
+  check(std::vector<int>{1, 2}, 1, "vector: [1, 2]");
+  check(std::vector<int>{1, 2, 3}, 1, "vector: [1 ... 3]");
+  check(std::vector<int>{1, 2}, 2, "vector: [1, 2]");
+  check(std::vector<int>{1, 2, 3}, 2, "vector: [1 ... 3]");
+  check(std::vector<int>{1, 2, 3, 4}, 4, "vector: [1, 2, 3, 4]");
+  check(std::vector<int>{1, 2, 3, 4, 5}, 4, "vector: [1, 2 ... 4, 5]");
+  check(std::vector<int>{1, 2, 3, 4, 5}, 0, "vector: [1, 2, 3, 4, 5]");
+  check(std::list<int>{1, 2, 3}, 2, "list: [1 ... 3]");
+
+  // (forward-only ranges only show their head)
+  check(std::forward_list<int>{7}, 2, "forward_list: [7]");
+  check(std::forward_list<int>{1, 2}, 2, "forward_list: [1 ... (1 more)]");
+  check(std::forward_list<int>{1, 2, 3}, 4,
+        "forward_list: [1, 2 ... (1 more)]");
+
+  return failures ? 1 : 0;
+}
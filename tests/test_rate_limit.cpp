@@ -0,0 +1,87 @@
+/*
+ * rate-limited call sites (see Logger::set_rate_limit) get through their
+ * burst at once and then records_per_second records per second (the
+ * ctest cpplog-rate-limit runs this)
+ */
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "cpplog.h"
+
+static int failures = 0;
+
+// a Logger writing into stream, limited to rate records/s after burst
+static std::unique_ptr<cpplog::Logger<>> limited_log(std::ostream &stream,
+                                                     double rate,
+                                                     uint32_t burst) {
+  std::unique_ptr<cpplog::Logger<>> logger(cpplog::create_log("test"));
+  logger->set_sink(std::make_shared<cpplog::OStreamSink>(stream));
+  logger->set_rate_limit(rate, burst);
+  return logger;
+}
+
+// number of admitted records (lines with "tick") in output
+static size_t admitted(const std::string &output) {
+  size_t n = 0;
+  for (size_t pos = 0;
+       (pos = output.find("] tick", pos)) != std::string::npos; ++pos) {
+    ++n;
+  }
+  return n;
+}
+
+// a burst of records logged at once gets through, nothing beyond it
+static void check_burst() {
+  std::ostringstream stream;
+  auto logger = limited_log(stream, 1.0, 5);
+  for (int i = 0; i < 100; ++i) logger->info("tick {d}", i);
+  logger->flush();
+
+  size_t n = admitted(stream.str());
+  if (n != 5) {
+    std::cerr << "FAILED: burst of 5 admitted " << n << " records\n";
+    ++failures;
+  }
+}
+
+/*
+ * logging every 100us for 300ms at 1000 records/s admits about 300
+ * records (a clock that only advances every few ms admits far fewer)
+ */
+static void check_rate() {
+  using Clock = std::chrono::steady_clock;
+  constexpr double RATE = 1000.0;
+  constexpr auto DURATION = std::chrono::milliseconds(300);
+
+  std::ostringstream stream;
+  auto logger = limited_log(stream, RATE, 1);
+  Clock::time_point start = Clock::now();
+  Clock::time_point next = start;
+  int i = 0;
+  while (Clock::now() - start < DURATION) {
+    logger->info("tick {d}", i++);
+    next += std::chrono::microseconds(100);
+    while (Clock::now() < next) {}
+  }
+  logger->flush();
+
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  double expected = RATE * seconds;
+  size_t n = admitted(stream.str());
+  if (n < expected * 0.8 || n > expected * 1.1 + 1) {
+    std::cerr << "FAILED: " << RATE << " records/s admitted " << n
+              << " records in " << seconds << "s (expected ~" << expected
+              << ")\n";
+    ++failures;
+  }
+}
+
+int main() {
+  check_burst();
+  check_rate();
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,83 @@
+/*
+ * cpplog-decode: turn binary cpplog output (see cpplog::Encoding::BINARY)
+ * back into the text the Logger would have written
+ *
+ * usage: cpplog-decode [-p s|ms|us] [--color|--no-color] [FILE]
+ *   -p          precision of the decoded timestamps (default: s)
+ *   --color     highlight the decoded records (default: if stdout is a
+ *               terminal)
+ *   --no-color  don't highlight the decoded records
+ *   FILE        binary log file (default: stdin)
+ */
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "cpplog.h"
+
+static void print_usage(const char *prog) {
+  std::cerr << "usage: " << prog
+            << " [-p s|ms|us] [--color|--no-color] [FILE]\n";
+}
+
+int main(int argc, char **argv) {
+  cpplog::BinaryDecoder decoder;
+  decoder.set_color(cpplog::is_terminal_fd(1));
+  const char *path = nullptr;
+
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      const char *precision = argv[++i];
+      if (std::strcmp(precision, "s") == 0) {
+        decoder.set_timestamp_precision(cpplog::TimestampPrecision::SECONDS);
+      } else if (std::strcmp(precision, "ms") == 0) {
+        decoder.set_timestamp_precision(
+          cpplog::TimestampPrecision::MILLISECONDS);
+      } else if (std::strcmp(precision, "us") == 0) {
+        decoder.set_timestamp_precision(
+          cpplog::TimestampPrecision::MICROSECONDS);
+      } else {
+        print_usage(argv[0]);
+        return 1;
+      }
+    } else if (std::strcmp(argv[i], "--color") == 0) {
+      decoder.set_color(true);
+    } else if (std::strcmp(argv[i], "--no-color") == 0) {
+      decoder.set_color(false);
+    } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+      print_usage(argv[0]);
+      return 1;
+    } else {
+      path = argv[i];
+    }
+  }
+
+  std::ifstream file;
+  if (path) {
+    file.open(path, std::ios::binary);
+    if (!file) {
+      std::cerr << "Error: Couldn't open '" << path << "'\n";
+      return 1;
+    }
+  }
+  std::istream &in = path ? file : std::cin;
+
+  std::string record;
+  size_t n_records = 0;
+  while (cpplog::BinaryDecoder::read_record(in, record)) {
+    if (!decoder.decode(record.data(), record.size(), std::cout)) {
+      std::cerr << "Error: Malformed record #" << n_records << "\n";
+      return 1;
+    }
+    ++n_records;
+  }
+
+  if (!in.eof()) {
+    std::cerr << "Error: Truncated record #" << n_records << "\n";
+    return 1;
+  }
+
+  return 0;
+}
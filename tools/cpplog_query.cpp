@@ -0,0 +1,423 @@
+/*
+ * cpplog-query: print the records of a log file in a time range and/or of
+ * some severities or Loggers, reading only the blocks its index (see
+ * cpplog::FileSink::set_index) says could contain them
+ *
+ * usage: cpplog-query [--from TIME] [--to TIME] [--level LEVEL]
+ *                     [--logger NAME]... [--blocks] [-p s|ms|us]
+ *                     [--color|--no-color] FILE
+ *   --from/--to  time range ("YYYY-MM-DD[ HH:MM[:SS]]" in local time, or
+ *                "@SECONDS" since the epoch)
+ *   --level      only records of this severity or higher (trace, debug,
+ *                info, warn, error, fatal)
+ *   --logger     only records of this Logger (may be repeated)
+ *   --blocks     list the matching blocks instead of printing them
+ *   -p           precision of decoded timestamps (binary logs, default: s)
+ *   --color      highlight decoded records (default: if stdout is a
+ *                terminal)
+ *   --no-color   don't highlight decoded records
+ *   FILE         log file (its index is FILE.idx)
+ *
+ * compressed files are decompressed block by block; binary records are
+ * decoded and filtered one by one (by timestamp, severity and Logger),
+ * text is printed block by block (so it may contain a few records around
+ * the matches); the part of the file that isn't covered by the index
+ * (yet) is always read
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cpplog.h"
+
+// read-only mapping of a whole file
+class MappedFile {
+ private:
+  const char *_data = nullptr;
+  size_t _size = 0;
+
+ public:
+  explicit MappedFile(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+      void *map = ::mmap(nullptr, static_cast<size_t>(st.st_size),
+                         PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map != MAP_FAILED) {
+        _data = static_cast<const char *>(map);
+        _size = static_cast<size_t>(st.st_size);
+        ::madvise(map, _size, MADV_RANDOM);
+      }
+    }
+    ::close(fd);
+  }
+
+  ~MappedFile() {
+    if (_data) ::munmap(const_cast<char *>(_data), _size);
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const char *data() const {
+    return _data;
+  }
+
+  size_t size() const {
+    return _size;
+  }
+};
+
+struct Query {
+  uint64_t from = 0;  // ns since the epoch (0 = open)
+  uint64_t to = 0;
+  uint8_t levels = 0xff;
+
+  // names of the Loggers (empty = all) and their name_bits
+  std::vector<std::string> loggers;
+  uint64_t names = ~0ull;
+
+  bool list_blocks = false;
+
+  bool matches(const cpplog::IndexBlock &block) const {
+    const cpplog::RecordInfo &records = block.records;
+    return (!from || records.last_timestamp >= from) &&
+           (!to || records.first_timestamp <= to) &&
+           (records.levels & levels) && (records.names & names);
+  }
+};
+
+// parse "YYYY-MM-DD[ HH:MM[:SS]]" (local time) or "@SECONDS"
+static bool parse_time(const char *str, uint64_t &ns) {
+  if (str[0] == '@') {
+    char *end;
+    double seconds = std::strtod(str + 1, &end);
+    if (*end || seconds < 0) return false;
+    ns = static_cast<uint64_t>(seconds * 1e9);
+    return true;
+  }
+
+  std::tm time = {};
+  int n = 0;
+  int fields = std::sscanf(str, "%d-%d-%d%*1[ T]%d:%d:%d%n", &time.tm_year,
+                           &time.tm_mon, &time.tm_mday, &time.tm_hour,
+                           &time.tm_min, &time.tm_sec, &n);
+  if (fields < 3) return false;
+  if (fields == 3) {
+    n = 0;
+    std::sscanf(str, "%*d-%*d-%*d%n", &n);
+  } else if (fields == 5) {
+    n = 0;
+    std::sscanf(str, "%*d-%*d-%*d%*1[ T]%*d:%*d%n", &n);
+  }
+  if (str[n] != '\0') return false;
+
+  time.tm_year -= 1900;
+  time.tm_mon -= 1;
+  time.tm_isdst = -1;
+  std::time_t seconds = std::mktime(&time);
+  if (seconds < 0) return false;
+  ns = static_cast<uint64_t>(seconds) * 1000000000ull;
+  return true;
+}
+
+static bool parse_level(const char *str, uint8_t &levels) {
+  for (int level = CPPLOG_LEVEL_TRACE; level < CPPLOG_LEVEL_OFF; ++level) {
+    if (std::strcmp(str, cpplog::severity_name(
+                           static_cast<cpplog::Severity>(level))) == 0) {
+      levels = static_cast<uint8_t>(0xff << level);
+      return true;
+    }
+  }
+  return false;
+}
+
+// prints the records of the matching parts of a log file
+class Printer {
+ private:
+  const Query &_query;
+  cpplog::BinaryDecoder &_decoder;
+  bool _binary;
+
+  // strings (Logger names) of the binary log
+  std::unordered_map<uint32_t, std::string> _strings;
+
+  std::string _decompressed;
+
+  bool _matches_record(const char *record, size_t size) const {
+    if (size < cpplog::CPPLOG_BINARY_LOG_HEADER_SIZE) return true;
+    uint64_t timestamp =
+      cpplog::decode_binary_value<uint64_t>(record + 13);
+    if ((_query.from && timestamp < _query.from) ||
+        (_query.to && timestamp > _query.to)) {
+      return false;
+    }
+    uint8_t severity = static_cast<uint8_t>(
+      record[cpplog::CPPLOG_BINARY_LOG_SEVERITY_OFFSET]);
+    if (severity >= 8 || !(_query.levels & (1 << severity))) return false;
+    if (_query.loggers.empty()) return true;
+
+    auto it = _strings.find(
+      cpplog::decode_binary_value<uint32_t>(record + 9));
+    if (it == _strings.end()) return false;
+    for (const std::string &logger : _query.loggers) {
+      if (logger == it->second) return true;
+    }
+    return false;
+  }
+
+ public:
+  Printer(const Query &query, cpplog::BinaryDecoder &decoder, bool binary) :
+    _query(query), _decoder(decoder), _binary(binary) {}
+
+  /*
+   * a string definition (or output header) of the binary log; the
+   * definitions of a block precede it, so the headers (every Logger
+   * writes its own) must not reset them: ids are process-wide, and an id
+   * that is defined again is replaced
+   */
+  void define(const char *record, size_t size) {
+    if (size >= cpplog::CPPLOG_BINARY_RECORD_HEADER_SIZE + 4 &&
+        record[0] == static_cast<char>(cpplog::BinaryRecordType::STRING)) {
+      _decoder.decode(record, size, std::cout);
+      _strings[cpplog::decode_binary_value<uint32_t>(record + 5)].assign(
+        record + 9, size - 9);
+    }
+  }
+
+  /*
+   * print the records of data (size bytes at offset of the log file);
+   * defines is set if data isn't indexed, so its string definitions
+   * aren't in the index; returns false if data is malformed
+   */
+  bool print(const char *data, size_t size, bool defines) {
+    bool valid = true;
+    if (cpplog::frame_codec(data, size) != cpplog::Compression::NONE) {
+      _decompressed.clear();
+      valid = cpplog::decompress_frames(data, size, _decompressed);
+      data = _decompressed.data();
+      size = _decompressed.size();
+    }
+
+    if (!_binary) {
+      std::cout.write(data, static_cast<std::streamsize>(size));
+      return valid;
+    }
+
+    for (size_t pos = 0; pos < size;) {
+      size_t record_size;
+      bool header = size - pos >= sizeof(cpplog::CPPLOG_BINARY_MAGIC) &&
+                    std::memcmp(data + pos, cpplog::CPPLOG_BINARY_MAGIC,
+                                sizeof(cpplog::CPPLOG_BINARY_MAGIC)) == 0;
+      if (header) {
+        record_size = sizeof(cpplog::CPPLOG_BINARY_MAGIC);
+      } else if (size - pos >= cpplog::CPPLOG_BINARY_RECORD_HEADER_SIZE) {
+        record_size = cpplog::decode_binary_value<uint32_t>(data + pos + 1);
+        if (record_size < cpplog::CPPLOG_BINARY_RECORD_HEADER_SIZE ||
+            record_size > size - pos) {
+          return false;
+        }
+      } else {
+        return false;
+      }
+
+      const char *record = data + pos;
+      pos += record_size;
+      if (header || record[0] != static_cast<char>(
+                                   cpplog::BinaryRecordType::LOG)) {
+        if (defines) define(record, record_size);
+      } else if (_matches_record(record, record_size) &&
+                 !_decoder.decode(record, record_size, std::cout)) {
+        return false;
+      }
+    }
+    return valid;
+  }
+};
+
+static void print_usage(const char *prog) {
+  std::cerr << "usage: " << prog
+            << " [--from TIME] [--to TIME] [--level LEVEL]"
+               " [--logger NAME]... [--blocks] [-p s|ms|us]"
+               " [--color|--no-color] FILE\n";
+}
+
+static void print_block(const char *kind, uint64_t offset, uint64_t size,
+                        const cpplog::RecordInfo *records) {
+  std::cout << kind << " offset=" << offset << " size=" << size;
+  if (records) {
+    std::cout << " first=" << records->first_timestamp
+              << " last=" << records->last_timestamp << " levels=";
+    for (int level = CPPLOG_LEVEL_TRACE; level < CPPLOG_LEVEL_OFF; ++level) {
+      if (records->levels & (1 << level)) {
+        std::cout << cpplog::severity_name(
+          static_cast<cpplog::Severity>(level))[0];
+      }
+    }
+  }
+  std::cout << '\n';
+}
+
+int main(int argc, char **argv) {
+  Query query;
+  cpplog::BinaryDecoder decoder;
+  decoder.set_color(cpplog::is_terminal_fd(1));
+  const char *path = nullptr;
+
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (std::strcmp(arg, "--from") == 0 && has_value) {
+      if (!parse_time(argv[++i], query.from)) {
+        std::cerr << "Error: Invalid time '" << argv[i] << "'\n";
+        return 1;
+      }
+    } else if (std::strcmp(arg, "--to") == 0 && has_value) {
+      if (!parse_time(argv[++i], query.to)) {
+        std::cerr << "Error: Invalid time '" << argv[i] << "'\n";
+        return 1;
+      }
+    } else if (std::strcmp(arg, "--level") == 0 && has_value) {
+      if (!parse_level(argv[++i], query.levels)) {
+        std::cerr << "Error: Invalid level '" << argv[i] << "'\n";
+        return 1;
+      }
+    } else if (std::strcmp(arg, "--logger") == 0 && has_value) {
+      if (query.loggers.empty()) query.names = 0;
+      query.loggers.push_back(argv[++i]);
+      query.names |= cpplog::name_bit(query.loggers.back());
+    } else if (std::strcmp(arg, "--blocks") == 0) {
+      query.list_blocks = true;
+    } else if (std::strcmp(arg, "-p") == 0 && has_value) {
+      const char *precision = argv[++i];
+      if (std::strcmp(precision, "s") == 0) {
+        decoder.set_timestamp_precision(cpplog::TimestampPrecision::SECONDS);
+      } else if (std::strcmp(precision, "ms") == 0) {
+        decoder.set_timestamp_precision(
+          cpplog::TimestampPrecision::MILLISECONDS);
+      } else if (std::strcmp(precision, "us") == 0) {
+        decoder.set_timestamp_precision(
+          cpplog::TimestampPrecision::MICROSECONDS);
+      } else {
+        print_usage(argv[0]);
+        return 1;
+      }
+    } else if (std::strcmp(arg, "--color") == 0) {
+      decoder.set_color(true);
+    } else if (std::strcmp(arg, "--no-color") == 0) {
+      decoder.set_color(false);
+    } else if (arg[0] == '-' || path) {
+      print_usage(argv[0]);
+      return 1;
+    } else {
+      path = arg;
+    }
+  }
+  if (!path) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  MappedFile log(path);
+  if (!log.data()) {
+    std::cerr << "Error: Couldn't read '" << path << "'\n";
+    return 1;
+  }
+  MappedFile index(cpplog::index_path(path));
+  if (!index.data() || index.size() < sizeof(cpplog::CPPLOG_INDEX_MAGIC) ||
+      std::memcmp(index.data(), cpplog::CPPLOG_INDEX_MAGIC,
+                  sizeof(cpplog::CPPLOG_INDEX_MAGIC)) != 0) {
+    std::cerr << "Warning: '" << cpplog::index_path(path)
+              << "' is missing or not an index, reading the whole file\n";
+  }
+
+  // binary logs start with their header (compressed ones in a frame)
+  std::string start;
+  const char *head = log.data();
+  if (cpplog::frame_codec(log.data(), log.size()) !=
+      cpplog::Compression::NONE) {
+    size_t n = std::min(log.size(), size_t(64 * 1024));
+    try {
+      cpplog::decompress_frames(log.data(), n, start);
+    } catch (const std::exception &e) {
+      std::cerr << "Error: " << e.what() << "\n";
+      return 1;
+    }
+    head = start.data();
+  }
+  bool binary = (head == log.data() ? log.size() : start.size()) >=
+                  sizeof(cpplog::CPPLOG_BINARY_MAGIC) &&
+                std::memcmp(head, cpplog::CPPLOG_BINARY_MAGIC,
+                            sizeof(cpplog::CPPLOG_BINARY_MAGIC)) == 0;
+
+  Printer printer(query, decoder, binary);
+  uint64_t covered = 0;  // end of the last block
+  bool first_block = true;
+  bool valid = true;
+
+  // (the part before the first block and after the last one isn't indexed)
+  auto print_unindexed = [&](uint64_t end) {
+    if (end <= covered) return;
+    if (query.list_blocks) {
+      print_block("unindexed", covered, end - covered, nullptr);
+    } else {
+      valid = printer.print(log.data() + covered,
+                            static_cast<size_t>(end - covered), true) &&
+              valid;
+    }
+    covered = end;
+  };
+
+  try {
+    cpplog::IndexEntry entry;
+    size_t pos = 0;
+    while (index.data() &&
+           cpplog::next_index_entry(index.data(), index.size(), pos, entry)) {
+      if (entry.type == cpplog::IndexEntryType::STRING) {
+        printer.define(entry.record.data(), entry.record.size());
+        continue;
+      }
+      if (entry.type != cpplog::IndexEntryType::BLOCK) continue;
+
+      const cpplog::IndexBlock &block = entry.block;
+      if (block.offset >= log.size()) break;  // (not written yet)
+      uint64_t size = std::min<uint64_t>(block.size,
+                                         log.size() - block.offset);
+      if (first_block) {
+        print_unindexed(block.offset);
+        first_block = false;
+      }
+      covered = std::max(covered, block.offset + size);
+
+      if (!query.matches(block)) continue;
+      if (query.list_blocks) {
+        print_block("block", block.offset, size, &block.records);
+      } else {
+        valid = printer.print(log.data() + block.offset,
+                              static_cast<size_t>(size), false) && valid;
+      }
+    }
+    print_unindexed(log.size());
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+
+  std::cout.flush();
+  if (!valid) {
+    std::cerr << "Error: '" << path << "' is truncated or malformed "
+              << "(the output may be incomplete)\n";
+    return 1;
+  }
+  return 0;
+}
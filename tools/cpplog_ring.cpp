@@ -0,0 +1,45 @@
+/*
+ * cpplog-ring: print the records stored in a memory-mapped ring file
+ * (see cpplog::MappedRingSink) from the oldest to the newest one
+ *
+ * usage: cpplog-ring FILE
+ *   FILE  ring file written by a MappedRingSink
+ *
+ * the output has the encoding of the Logger that wrote the records,
+ * so binary records can be piped into cpplog-decode
+ */
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+#include "cpplog.h"
+
+int main(int argc, char **argv) {
+  if (argc != 2 || argv[1][0] == '-') {
+    std::cerr << "usage: " << argv[0] << " FILE\n";
+    return 1;
+  }
+
+  std::ifstream file(argv[1], std::ios::binary);
+  if (!file) {
+    std::cerr << "Error: Couldn't open '" << argv[1] << "'\n";
+    return 1;
+  }
+  std::string data((std::istreambuf_iterator<char>(file)),
+                   std::istreambuf_iterator<char>());
+
+  std::string records;
+  bool valid = cpplog::MappedRingSink::linearize(data.data(), data.size(),
+                                                 records);
+  std::cout.write(records.data(), static_cast<std::streamsize>(records.size()));
+
+  if (!valid) {
+    std::cerr << "Error: '" << argv[1] << "' is not a valid ring file"
+              << (records.empty() ? "" : " (output is incomplete)") << "\n";
+    return 1;
+  }
+
+  return 0;
+}